@@ -0,0 +1,133 @@
+
+#include "CpuFeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+
+bool ParseSimdLevel(const std::string& name, SimdLevel& level)
+{
+	for (int l = SimdScalar; l < cSimdLevelCount; ++l)
+	{
+		if (name == SimdLevelName((SimdLevel)l))
+		{
+			level = (SimdLevel)l;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+const char* SimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdScalar: return "scalar";
+	case SimdSSE41: return "sse4.1";
+	case SimdAVX2: return "avx2";
+	case SimdAVX512: return "avx512";
+	}
+	return "unknown";
+}
+
+
+#ifdef CPU_FEATURES_X86
+/// <summary>
+/// eax, ebx, ecx, edx of cpuid leaf / subleaf
+/// </summary>
+static void CpuId(unsigned int leaf, unsigned int subleaf, unsigned int registers[4])
+{
+#ifdef _MSC_VER
+	int values[4];
+	__cpuidex(values, (int)leaf, (int)subleaf);
+	for (int i = 0; i < 4; ++i)
+	{
+		registers[i] = (unsigned int)values[i];
+	}
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+/// <summary>
+/// The register state the OS saves on a context switch (XCR0)
+/// </summary>
+static unsigned long long EnabledRegisterState()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int low, high;
+	__asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return ((unsigned long long)high << 32) | low;
+#endif
+}
+
+static SimdLevel QuerySimdLevel()
+{
+	unsigned int r[4];
+	CpuId(0, 0, r);
+	const unsigned int maxLeaf = r[0];
+	if (maxLeaf < 1)
+	{
+		return SimdScalar;
+	}
+
+	CpuId(1, 0, r);
+	const bool ssse3 = 0 != (r[2] & (1u << 9));
+	const bool sse41 = 0 != (r[2] & (1u << 19));
+	const bool osxsave = 0 != (r[2] & (1u << 27));
+	const bool avx = 0 != (r[2] & (1u << 28));
+	const bool fma = 0 != (r[2] & (1u << 12));
+	if (!ssse3 || !sse41)
+	{
+		return SimdScalar;
+	}
+	if (!osxsave || !avx || !fma || maxLeaf < 7)
+	{
+		return SimdSSE41;
+	}
+
+	// XMM and YMM state, then opmask and both halves of ZMM0-31
+	const unsigned long long state = EnabledRegisterState();
+	if (0x6 != (state & 0x6))
+	{
+		return SimdSSE41;
+	}
+
+	CpuId(7, 0, r);
+	const bool avx2 = 0 != (r[1] & (1u << 5));
+	const bool avx512f = 0 != (r[1] & (1u << 16));
+	const bool avx512dq = 0 != (r[1] & (1u << 17));
+	const bool avx512bw = 0 != (r[1] & (1u << 30));
+	const bool avx512vl = 0 != (r[1] & (1u << 31));
+	if (!avx2)
+	{
+		return SimdSSE41;
+	}
+	if (!avx512f || !avx512dq || !avx512bw || !avx512vl || 0xE6 != (state & 0xE6))
+	{
+		return SimdAVX2;
+	}
+	return SimdAVX512;
+}
+#endif
+
+
+SimdLevel DetectSimdLevel()
+{
+#ifdef CPU_FEATURES_X86
+	static const SimdLevel detected = QuerySimdLevel();
+	return detected;
+#else
+	return SimdScalar;
+#endif
+}
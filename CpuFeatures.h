@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+/// <summary>
+/// Instruction set levels the vectorized kernels are compiled for, in increasing order; a level
+/// implies the ones below it
+/// </summary>
+enum SimdLevel
+{
+	SimdScalar = 0,				// portable C++, no intrinsics
+	SimdSSE41 = 1,				// SSE4.1 (with SSSE3), 4 floats per register
+	SimdAVX2 = 2,				// AVX2, 8 floats per register
+	SimdAVX512 = 3				// AVX-512 F, BW, DQ and VL, 16 floats per register
+};
+
+static const int cSimdLevelCount = 4;
+
+/// <summary>
+/// Parse "scalar", "sse4.1", "avx2" or "avx512"
+/// </summary>
+/// <returns>false if the name is unknown</returns>
+bool ParseSimdLevel(const std::string& name, SimdLevel& level);
+const char* SimdLevelName(SimdLevel level);
+
+/// <summary>
+/// Highest level both the CPU and the operating system support (the OS must save the AVX and
+/// AVX-512 registers), detected with cpuid on the first call. SimdScalar on other architectures.
+/// </summary>
+SimdLevel DetectSimdLevel();
@@ -0,0 +1,188 @@
+
+#include "DepthFilter.h"
+#include "ThreadPool.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+/// <summary>
+/// Rows per range of the thread pool: enough to amortize the hand-off, few enough to balance
+/// </summary>
+static const int cRowsPerRange = 16;
+
+/// <summary>
+/// Range differences past this many standard deviations weigh nothing
+/// </summary>
+static const float cRangeSigmas = 3.0f;
+
+
+DepthFilterSettings::DepthFilterSettings()
+	: bilateral(false)
+	, radius(2)
+	, sigmaSpace(1.5f)
+	, sigmaDepth(0.008f)
+	, minSupport(0.2f)
+	, temporalFrames(1)
+	, temporalGate(0.01f)
+{
+}
+
+
+DepthFilter::DepthFilter()
+	: m_width(0)
+	, m_height(0)
+	, m_historyFrames(0)
+	, m_historyNext(0)
+{
+	memset(&m_bilateral, 0, sizeof(m_bilateral));
+	memset(m_rangeLut, 0, sizeof(m_rangeLut));
+}
+
+
+void DepthFilter::Initialize(const DepthFilterSettings& settings, int width, int height)
+{
+	m_settings = settings;
+	m_settings.radius = std::max(1, std::min(settings.radius, (int)cMaxRadius));
+	m_settings.temporalFrames = std::max(1, std::min(settings.temporalFrames, cMaxTemporalFrames)) | 1;
+	m_width = width;
+	m_height = height;
+
+	// entry i of the table covers (difference / sigma)^2 in [i, i + 1) * cRangeSigmas^2 / size
+	const float sigmas2 = cRangeSigmas * cRangeSigmas;
+	for (int i = 0; i < cBilateralLutSize; ++i)
+	{
+		m_rangeLut[i] = (i + 1 < cBilateralLutSize) ? expf(-0.5f * i * sigmas2 / cBilateralLutSize) : 0.0f;
+	}
+
+	const int radius = m_settings.radius;
+	const float sigmaSpace = std::max(m_settings.sigmaSpace, 0.1f);
+	const float sigmaDepth = std::max(m_settings.sigmaDepth, 1e-5f);
+	float neighbours = 0.0f;
+	m_bilateral.taps = 2 * radius + 1;
+	for (int k = 0; k < m_bilateral.taps; ++k)
+	{
+		const float offset = (float)(k - radius);
+		m_bilateral.spatial[k] = expf(-0.5f * offset * offset / (sigmaSpace * sigmaSpace));
+		neighbours += (k == radius) ? 0.0f : m_bilateral.spatial[k];
+	}
+	m_bilateral.pRangeLut = m_rangeLut;
+	m_bilateral.lutScale = cBilateralLutSize / sigmas2 / (sigmaDepth * sigmaDepth);
+	m_bilateral.minSupport = std::max(m_settings.minSupport, 0.0f) * neighbours;
+
+	// the padding and the border rows stay 0 (invalid), so the passes need no edge cases
+	const size_t pixels = (size_t)width * height;
+	m_padded.assign(m_settings.Enabled() ? (size_t)(width + 2 * cMaxRadius) * height : 0, 0.0f);
+	m_horizontal.assign(m_settings.bilateral ? (size_t)width * (height + 2 * cMaxRadius) : 0, 0.0f);
+	m_history.assign(pixels * (m_settings.temporalFrames - 1), 0.0f);
+	Reset();
+}
+
+
+void DepthFilter::Reset()
+{
+	m_historyFrames = 0;
+	m_historyNext = 0;
+}
+
+
+void DepthFilter::Apply(float* pDepth)
+{
+	Apply(pDepth, ThreadPool::Instance());
+}
+
+
+void DepthFilter::Apply(float* pDepth, ThreadPool& pool)
+{
+	if (!m_settings.Enabled() || nullptr == pDepth || 0 == m_width)
+	{
+		return;
+	}
+
+	const SimdKernels& kernels = ActiveSimdKernels();
+	const int width = m_width;
+	const int height = m_height;
+	const int paddedWidth = width + 2 * cMaxRadius;
+	const int offset = cMaxRadius - m_settings.radius;
+	const size_t pixels = (size_t)width * height;
+	const int capacity = m_settings.temporalFrames - 1;
+
+	// the median runs over the odd number of frames available, so it starts with the stream
+	const int frames = 1 + (m_historyFrames & ~1);
+
+	// temporal median into the padded rows, the raw frame into the history (over the oldest
+	// frame, once the median has read it) and the horizontal pass: every step reads its own row
+	pool.ParallelFor(0, height, [&](int yBegin, int yEnd)
+	{
+		for (int y = yBegin; y < yEnd; ++y)
+		{
+			float* pRow = pDepth + (size_t)y * width;
+			float* pMedian = &m_padded[(size_t)y * paddedWidth + cMaxRadius];
+
+			if (frames > 1)
+			{
+				const float* ppFrames[cMaxTemporalFrames];
+				ppFrames[0] = pRow;
+				for (int f = 1; f < frames; ++f)
+				{
+					const int slot = (m_historyNext - f + capacity) % capacity;
+					ppFrames[f] = &m_history[slot * pixels + (size_t)y * width];
+				}
+				kernels.temporalMedianRow(ppFrames, frames, width, m_settings.temporalGate, pMedian);
+			}
+			else
+			{
+				memcpy(pMedian, pRow, width * sizeof(float));
+			}
+
+			if (capacity > 0)
+			{
+				memcpy(&m_history[m_historyNext * pixels + (size_t)y * width], pRow, width * sizeof(float));
+			}
+
+			if (m_settings.bilateral)
+			{
+				const float* ppTaps[cMaxBilateralTaps];
+				const float* pPadded = &m_padded[(size_t)y * paddedWidth + offset];
+				for (int k = 0; k < m_bilateral.taps; ++k)
+				{
+					ppTaps[k] = pPadded + k;
+				}
+				kernels.bilateralRow(m_bilateral, ppTaps, width, &m_horizontal[(size_t)(y + cMaxRadius) * width]);
+			}
+			else
+			{
+				memcpy(pRow, pMedian, width * sizeof(float));
+			}
+		}
+	}, cRowsPerRange);
+
+	if (capacity > 0)
+	{
+		m_historyNext = (m_historyNext + 1) % capacity;
+		m_historyFrames = std::min(m_historyFrames + 1, capacity);
+	}
+
+	if (m_settings.bilateral)
+	{
+		// vertical pass back into the frame, over the rows of the horizontal pass
+		pool.ParallelFor(0, height, [&](int yBegin, int yEnd)
+		{
+			for (int y = yBegin; y < yEnd; ++y)
+			{
+				const float* ppTaps[cMaxBilateralTaps];
+				for (int k = 0; k < m_bilateral.taps; ++k)
+				{
+					ppTaps[k] = &m_horizontal[(size_t)(y + offset + k) * width];
+				}
+				kernels.bilateralRow(m_bilateral, ppTaps, width, pDepth + (size_t)y * width);
+			}
+		}, cRowsPerRange);
+	}
+}
+
+
+size_t DepthFilter::MemoryBytes() const
+{
+	return (m_padded.capacity() + m_horizontal.capacity() + m_history.capacity()) * sizeof(float);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "MemoryAccounting.h"
+#include "SimdKernels.h"
+
+#include <vector>
+
+class ThreadPool;
+
+/// <summary>
+/// Settings of the depth filter that runs between the depth conversion and tracking
+/// </summary>
+struct DepthFilterSettings
+{
+	/// <summary>
+	/// Edge-preserving bilateral filter, as a horizontal and a vertical pass
+	/// </summary>
+	bool                        bilateral;
+	int                         radius;				// pixels on each side of the centre, 1 to 4
+	float                       sigmaSpace;			// pixels
+
+	/// <summary>
+	/// Range standard deviation at 1 m, in m; it grows with the square of the depth, like the
+	/// sensor noise, so that far surfaces are smoothed as much as near ones
+	/// </summary>
+	float                       sigmaDepth;
+
+	/// <summary>
+	/// Fraction of the weight of its neighbours along a pass that must lie within 3 range standard
+	/// deviations of a pixel, or it is dropped as a flying pixel between two surfaces; 0 keeps all
+	/// </summary>
+	float                       minSupport;
+
+	/// <summary>
+	/// Median over this many frames, the current one included: 1 (off), 3 or 5. An earlier depth
+	/// further than temporalGate * z^2 (in m) from the current one is replaced by the current
+	/// one, so that the camera or the scene can move.
+	/// </summary>
+	int                         temporalFrames;
+	float                       temporalGate;
+
+	DepthFilterSettings();
+
+	bool Enabled() const { return bilateral || temporalFrames > 1; }
+};
+
+/// <summary>
+/// Denoises depth images in place before tracking and integration: an optional temporal median
+/// over the last frames, then a separable bilateral filter whose range weights come from a
+/// table. Less noise at depth edges and no flying pixels take fewer ICP iterations and give a
+/// smooth surface at a lower integration weight. The rows run on the vectorized kernels (see
+/// SimdKernels), spread over the thread pool. The buffers are sized by Initialize, so Apply does
+/// not allocate.
+/// </summary>
+class DepthFilter
+{
+public:
+	static const int            cMaxRadius = cMaxBilateralTaps / 2;
+
+	DepthFilter();
+
+	void Initialize(const DepthFilterSettings& settings, int width, int height);
+	const DepthFilterSettings& Settings() const { return m_settings; }
+
+	/// <summary>
+	/// Forget the earlier frames; call whenever the depth stream restarts
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Filter one frame, of the size given to Initialize
+	/// </summary>
+	/// <param name="pDepth">width * height depths in m, 0 = invalid; replaced by the filtered ones</param>
+	void Apply(float* pDepth);
+
+	/// <summary>
+	/// Filter one frame on the threads of a pool of its own, for a thread that runs beside the
+	/// loops of the shared pool
+	/// </summary>
+	void Apply(float* pDepth, ThreadPool& pool);
+
+	size_t MemoryBytes() const;
+
+private:
+	typedef std::vector<float, TaggedAllocator<float, MemoryFrames> > FrameBuffer;
+
+	DepthFilterSettings         m_settings;
+	int                         m_width;
+	int                         m_height;
+	BilateralRowParameters      m_bilateral;
+	float                       m_rangeLut[cBilateralLutSize];
+
+	/// <summary>
+	/// Input of the horizontal pass, rows padded with cMaxRadius invalid pixels on each side
+	/// </summary>
+	FrameBuffer                 m_padded;
+
+	/// <summary>
+	/// Output of the horizontal pass, with cMaxRadius invalid rows above and below
+	/// </summary>
+	FrameBuffer                 m_horizontal;
+
+	/// <summary>
+	/// The last temporalFrames - 1 unfiltered frames, oldest overwritten first
+	/// </summary>
+	FrameBuffer                 m_history;
+	int                         m_historyFrames;
+	int                         m_historyNext;
+};
@@ -0,0 +1,90 @@
+
+#include "DepthImageIO.h"
+
+#include <stdio.h>
+#include <ctype.h>
+
+
+/// <summary>
+/// Next integer of a PGM header, skipping white space and # comments
+/// </summary>
+static bool ReadHeaderInt(FILE* file, int& value)
+{
+	int c = fgetc(file);
+	for (;;)
+	{
+		while (c != EOF && isspace(c))
+		{
+			c = fgetc(file);
+		}
+		if (c != '#')
+		{
+			break;
+		}
+		while (c != EOF && c != '\n')
+		{
+			c = fgetc(file);
+		}
+	}
+	if (c == EOF || !isdigit(c))
+	{
+		return false;
+	}
+	value = 0;
+	while (c != EOF && isdigit(c))
+	{
+		value = value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+	// the single white space after the header ends here too
+	return true;
+}
+
+
+bool ReadDepthPgm(const char* filename, std::vector<unsigned short>& depthMm, int& width, int& height)
+{
+	FILE* file = fopen(filename, "rb");
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	int maxValue = 0;
+	bool ok = fgetc(file) == 'P' && fgetc(file) == '5'
+		&& ReadHeaderInt(file, width) && ReadHeaderInt(file, height) && ReadHeaderInt(file, maxValue)
+		&& width > 0 && height > 0 && maxValue > 255 && maxValue < 65536;
+
+	if (ok)
+	{
+		std::vector<unsigned char> bytes((size_t)width * height * 2);
+		ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+		depthMm.resize((size_t)width * height);
+		for (size_t i = 0; ok && i < depthMm.size(); ++i)
+		{
+			depthMm[i] = (unsigned short)((bytes[i * 2] << 8) | bytes[i * 2 + 1]);
+		}
+	}
+	fclose(file);
+	return ok;
+}
+
+
+bool WriteDepthPgm(const char* filename, const unsigned short* pDepthMm, int width, int height)
+{
+	FILE* file = fopen(filename, "wb");
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	fprintf(file, "P5\n%d %d\n65535\n", width, height);
+	std::vector<unsigned char> bytes((size_t)width * height * 2);
+	for (size_t i = 0; i < (size_t)width * height; ++i)
+	{
+		bytes[i * 2] = (unsigned char)(pDepthMm[i] >> 8);
+		bytes[i * 2 + 1] = (unsigned char)(pDepthMm[i] & 0xFF);
+	}
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	ok = (0 == fclose(file)) && ok;
+	return ok;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+
+/// <summary>
+/// Read a 16 bit binary PGM (P5, maxval above 255) holding one depth image in mm
+/// </summary>
+/// <returns>false if the file cannot be read or is not a 16 bit PGM</returns>
+bool ReadDepthPgm(const char* filename, std::vector<unsigned short>& depthMm, int& width, int& height);
+
+/// <summary>
+/// Write a depth image in mm as a 16 bit binary PGM (big endian samples, maxval 65535)
+/// </summary>
+bool WriteDepthPgm(const char* filename, const unsigned short* pDepthMm, int width, int height);
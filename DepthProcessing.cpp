@@ -0,0 +1,274 @@
+
+#include "DepthProcessing.h"
+#include "SimdKernels.h"
+#include "Telemetry.h"
+#include "ThreadPool.h"
+
+#include <math.h>
+#include <string.h>
+
+static const CounterId s_counterVertexNormalLevels = Telemetry::Instance().RegisterCounter("vertex-normal-levels");
+
+
+void ConvertDepthToFloat(const unsigned short* pDepthMm, int width, int height, float minDepth, float maxDepth,
+	bool mirror, float* pDepth)
+{
+	// compare in mm so the row kernel is a select without a table
+	const float minMm = minDepth * 1000.0f;
+	const float maxMm = maxDepth * 1000.0f;
+	const SimdKernels& simd = ActiveSimdKernels();
+
+	ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			simd.depthToFloatRow(pDepthMm + (size_t)y * width, width, minMm, maxMm, mirror, pDepth + (size_t)y * width);
+		}
+	}, 16);
+}
+
+
+void ComputeVertexNormalMap(const float* pDepth, int width, int height, const CameraIntrinsics& intrinsics,
+	float* pPoints)
+{
+	const float invFx = 1.0f / (intrinsics.focalLengthX * width);
+	const float invFy = 1.0f / (intrinsics.focalLengthY * height);
+	const float cx = intrinsics.principalPointX * width - 0.5f;
+	const float cy = intrinsics.principalPointY * height - 0.5f;
+
+	// back-project first, then take normals from the right and lower neighbours
+	ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			const float* pRow = pDepth + (size_t)y * width;
+			float* pOut = pPoints + (size_t)y * width * 6;
+			float ry = (y - cy) * invFy;
+			for (int x = 0; x < width; ++x)
+			{
+				float z = pRow[x];
+				pOut[x * 6 + 0] = (x - cx) * invFx * z;
+				pOut[x * 6 + 1] = ry * z;
+				pOut[x * 6 + 2] = z;
+			}
+		}
+	}, 16);
+
+	ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			float* pRow = pPoints + (size_t)y * width * 6;
+			for (int x = 0; x < width; ++x)
+			{
+				float* p = pRow + x * 6;
+				p[3] = p[4] = p[5] = 0.0f;
+				if (x + 1 >= width || y + 1 >= height || p[2] <= 0.0f)
+				{
+					continue;
+				}
+				const float* pRight = p + 6;
+				const float* pDown = p + (size_t)width * 6;
+				if (pRight[2] <= 0.0f || pDown[2] <= 0.0f)
+				{
+					continue;
+				}
+
+				float ax = pRight[0] - p[0], ay = pRight[1] - p[1], az = pRight[2] - p[2];
+				float bx = pDown[0] - p[0], by = pDown[1] - p[1], bz = pDown[2] - p[2];
+
+				// right x down points away from the camera in a y-down frame; flip it towards the camera
+				float nx = az * by - ay * bz;
+				float ny = ax * bz - az * bx;
+				float nz = ay * bx - ax * by;
+				float length2 = nx * nx + ny * ny + nz * nz;
+				if (length2 <= 0.0f)
+				{
+					continue;
+				}
+				float inv = 1.0f / sqrtf(length2);
+				p[3] = nx * inv;
+				p[4] = ny * inv;
+				p[5] = nz * inv;
+			}
+		}
+	}, 16);
+}
+
+
+DepthPyramid::DepthPyramid()
+	: m_width(0)
+	, m_height(0)
+{
+}
+
+
+void DepthPyramid::Resize(int width, int height, int levels)
+{
+	m_width = width;
+	m_height = height;
+	m_levels.resize(levels);
+	for (int level = 0; level < levels; ++level)
+	{
+		m_levels[level].assign((size_t)Width(level) * Height(level), 0.0f);
+	}
+}
+
+
+void DepthPyramid::Build(const float* pDepth, float maxDifference)
+{
+	if (m_levels.empty())
+	{
+		return;
+	}
+	memcpy(m_levels[0].data(), pDepth, m_levels[0].size() * sizeof(float));
+
+	for (int level = 1; level < Levels(); ++level)
+	{
+		const float* pSrc = m_levels[level - 1].data();
+		float* pDst = m_levels[level].data();
+		const int srcWidth = Width(level - 1);
+		const int width = Width(level);
+
+		ThreadPool::Instance().ParallelFor(0, Height(level), [&](int rowBegin, int rowEnd)
+		{
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				const float* pTop = pSrc + (size_t)(2 * y) * srcWidth;
+				const float* pBottom = pTop + srcWidth;
+				for (int x = 0; x < width; ++x)
+				{
+					const float block[4] = { pTop[2 * x], pTop[2 * x + 1], pBottom[2 * x], pBottom[2 * x + 1] };
+
+					// the first valid pixel of the block is the reference
+					float reference = 0.0f;
+					for (int i = 0; i < 4 && reference <= 0.0f; ++i)
+					{
+						reference = block[i];
+					}
+
+					float sum = 0.0f;
+					int count = 0;
+					for (int i = 0; i < 4; ++i)
+					{
+						if (block[i] > 0.0f && fabsf(block[i] - reference) <= maxDifference)
+						{
+							sum += block[i];
+							count++;
+						}
+					}
+					pDst[(size_t)y * width + x] = (count > 0) ? sum / count : 0.0f;
+				}
+			}
+		}, 8);
+	}
+}
+
+
+size_t DepthPyramid::MemoryBytes() const
+{
+	size_t bytes = 0;
+	for (size_t level = 0; level < m_levels.size(); ++level)
+	{
+		bytes += m_levels[level].capacity() * sizeof(float);
+	}
+	return bytes;
+}
+
+
+VertexNormalMaps::VertexNormalMaps()
+	: m_pPyramid(nullptr)
+	, m_intrinsics(KinectDepthIntrinsics())
+	, m_levels(0)
+{
+	for (int level = 0; level < cMaxLevels; ++level)
+	{
+		m_computed[level] = false;
+		m_level[level].width = 0;
+		m_level[level].height = 0;
+		for (int i = 0; i < 6; ++i)
+		{
+			m_level[level].pPlanes[i] = nullptr;
+		}
+	}
+}
+
+
+void VertexNormalMaps::Resize(int width, int height, int levels)
+{
+	m_levels = (levels < cMaxLevels) ? levels : cMaxLevels;
+	m_pPyramid = nullptr;
+	for (int level = 0; level < cMaxLevels; ++level)
+	{
+		VertexNormalLevel& maps = m_level[level];
+		maps.width = (level < m_levels) ? width >> level : 0;
+		maps.height = (level < m_levels) ? height >> level : 0;
+		const size_t pixels = (size_t)maps.width * maps.height;
+		m_planes[level].assign(pixels * 6, 0.0f);
+		for (int i = 0; i < 6; ++i)
+		{
+			maps.pPlanes[i] = m_planes[level].data() + i * pixels;
+		}
+		m_computed[level] = false;
+	}
+}
+
+
+void VertexNormalMaps::SetFrame(const DepthPyramid& pyramid, const CameraIntrinsics& intrinsics)
+{
+	m_pPyramid = &pyramid;
+	m_intrinsics = intrinsics;
+	for (int level = 0; level < cMaxLevels; ++level)
+	{
+		m_computed[level] = false;
+	}
+}
+
+
+const VertexNormalLevel& VertexNormalMaps::Level(int level)
+{
+	VertexNormalLevel& maps = m_level[level];
+	if (m_computed[level] || nullptr == m_pPyramid || level >= m_pPyramid->Levels())
+	{
+		return maps;
+	}
+
+	VertexNormalRowParameters parameters;
+	parameters.invFx = 1.0f / (m_intrinsics.focalLengthX * maps.width);
+	parameters.invFy = 1.0f / (m_intrinsics.focalLengthY * maps.height);
+	parameters.cx = m_intrinsics.principalPointX * maps.width - 0.5f;
+	parameters.cy = m_intrinsics.principalPointY * maps.height - 0.5f;
+
+	const SimdKernels& simd = ActiveSimdKernels();
+	const float* pDepth = m_pPyramid->Level(level);
+	float* pPlanes = m_planes[level].data();
+	const size_t pixels = (size_t)maps.width * maps.height;
+	ThreadPool::Instance().ParallelFor(0, maps.height, [&](int rowBegin, int rowEnd)
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			float* ppOut[6];
+			for (int i = 0; i < 6; ++i)
+			{
+				ppOut[i] = pPlanes + i * pixels + (size_t)y * maps.width;
+			}
+			const float* pRow = pDepth + (size_t)y * maps.width;
+			simd.vertexNormalRow(parameters, pRow, (y + 1 < maps.height) ? pRow + maps.width : nullptr, y, maps.width, ppOut);
+		}
+	}, 16);
+
+	m_computed[level] = true;
+	Telemetry::Instance().Add(s_counterVertexNormalLevels);
+	return maps;
+}
+
+
+size_t VertexNormalMaps::MemoryBytes() const
+{
+	size_t bytes = 0;
+	for (int level = 0; level < cMaxLevels; ++level)
+	{
+		bytes += m_planes[level].capacity() * sizeof(float);
+	}
+	return bytes;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "MemoryAccounting.h"
+
+#include <vector>
+
+/// <summary>
+/// Native replacement of INuiFusionReconstruction::DepthToDepthFloatFrame: depth in millimeters
+/// to depth in meters. Pixels outside [minDepth, maxDepth] become 0 (invalid).
+/// </summary>
+/// <param name="pDepthMm">width * height depths in mm, 0 = no reading</param>
+/// <param name="mirror">flip every row horizontally</param>
+/// <param name="pDepth">receives width * height depths in m</param>
+void ConvertDepthToFloat(const unsigned short* pDepthMm, int width, int height, float minDepth, float maxDepth,
+	bool mirror, float* pDepth);
+
+/// <summary>
+/// Camera space position (3 floats) and normal (3 floats) per pixel, the layout of a raycast
+/// point cloud. Pixel (x, y) looks through ((x + 0.5) / width, (y + 0.5) / height), so every
+/// pyramid level shares the same normalized intrinsics. Pixels without depth, or whose
+/// neighbours lack depth, get a zero normal.
+/// </summary>
+void ComputeVertexNormalMap(const float* pDepth, int width, int height, const CameraIntrinsics& intrinsics,
+	float* pPoints);
+
+/// <summary>
+/// Depth image pyramid for coarse-to-fine tracking. Level 0 is the input at full resolution,
+/// each further level halves both dimensions. Storage is allocated by Resize and reused by Build.
+/// </summary>
+class DepthPyramid
+{
+public:
+	DepthPyramid();
+
+	void Resize(int width, int height, int levels);
+
+	/// <summary>
+	/// Copy the depth image into level 0 and downsample the others: each coarse pixel averages
+	/// the valid pixels of its 2x2 block that lie within maxDifference (in m) of the first one,
+	/// so averaging never blurs across a depth edge.
+	/// </summary>
+	void Build(const float* pDepth, float maxDifference = 0.03f);
+
+	int Levels() const { return (int)m_levels.size(); }
+	int Width(int level) const { return m_width >> level; }
+	int Height(int level) const { return m_height >> level; }
+	const float* Level(int level) const { return m_levels[level].data(); }
+
+	/// <summary>
+	/// Bytes held by the pyramid
+	/// </summary>
+	size_t MemoryBytes() const;
+
+private:
+	int                         m_width;
+	int                         m_height;
+	std::vector<std::vector<float, TaggedAllocator<float, MemoryPyramid> > > m_levels;
+};
+
+/// <summary>
+/// One level of VertexNormalMaps: camera space positions and normals in six planes of
+/// width * height floats (structure of arrays), so that the row kernels load whole registers
+/// </summary>
+struct VertexNormalLevel
+{
+	int                         width;
+	int                         height;
+	const float*                pPlanes[6];			// x, y, z, nx, ny, nz
+
+	/// <summary>
+	/// Row y of every plane, in the order SimdKernels::icpRow takes them
+	/// </summary>
+	void Row(int y, const float* ppRow[6]) const
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			ppRow[i] = pPlanes[i] + (size_t)y * width;
+		}
+	}
+};
+
+/// <summary>
+/// The vertex and normal maps of every level of a frame's depth pyramid, computed once per frame
+/// and shared by everything that reads them: tracking, and the export of the frame's points.
+/// A level is computed the first time it is asked for after SetFrame, so the levels no one reads,
+/// such as the fine levels the quality governor stops tracking on, cost nothing. Positions and
+/// normals are those of ComputeVertexNormalMap, from the vectorized SimdKernels::vertexNormalRow.
+/// </summary>
+class VertexNormalMaps
+{
+public:
+	static const int            cMaxLevels = 4;
+
+	VertexNormalMaps();
+
+	void Resize(int width, int height, int levels);
+
+	/// <summary>
+	/// Take the levels of a new frame. The pyramid must outlive the frame's use of the maps.
+	/// </summary>
+	void SetFrame(const DepthPyramid& pyramid, const CameraIntrinsics& intrinsics);
+
+	/// <summary>
+	/// The maps of a level of the current frame, computed on the first call. Call from the thread
+	/// that runs the frame; the level is then read-only until the next SetFrame.
+	/// </summary>
+	const VertexNormalLevel& Level(int level);
+
+	bool IsComputed(int level) const { return m_computed[level]; }
+	int Levels() const { return m_levels; }
+
+	/// <summary>
+	/// Bytes held by the maps
+	/// </summary>
+	size_t MemoryBytes() const;
+
+private:
+	const DepthPyramid*         m_pPyramid;
+	CameraIntrinsics            m_intrinsics;
+	int                         m_levels;
+	bool                        m_computed[cMaxLevels];
+	VertexNormalLevel           m_level[cMaxLevels];
+	std::vector<float, TaggedAllocator<float, MemoryPyramid> > m_planes[cMaxLevels];
+};
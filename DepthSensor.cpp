@@ -1,220 +1,195 @@
 
 #include "DepthSensor.h"
+#include "NativeReconstruction.h"
+#include "SimdKernels.h"
+#ifdef FUSION_KINECT_SDK
+#include "KinectDepthSource.h"
+#include "KinectReconstruction.h"
+#endif
 #include <functional>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+
+// Pipeline stages and events reported by the telemetry snapshots; the reconstruction reports its own
+static const StageId s_stageShading = Telemetry::Instance().RegisterStage("shading");
+static const StageId s_stagePresent = Telemetry::Instance().RegisterStage("present");
+static const StageId s_stageRender = Telemetry::Instance().RegisterStage("render");
+static const StageId s_stageSaveMesh = Telemetry::Instance().RegisterStage("save-mesh");
+static const CounterId s_counterPresentedFrames = Telemetry::Instance().RegisterCounter("presented-frames");
+static const CounterId s_counterDroppedFrames = Telemetry::Instance().RegisterCounter("dropped-frames");
+static const CounterId s_counterResets = Telemetry::Instance().RegisterCounter("resets");
+
+// Set by Ctrl+C in headless mode
+static std::atomic<bool> s_bStopRequested(false);
+
+static void RequestStop(int)
+{
+    s_bStopRequested = true;
+}
 
 
 // add  Properties->Debugging ->environment  PATH = %PATH%; D:\VTK_bin\bin\Debug
-DepthSensor::DepthSensor()
-    : mNuiSensor(NULL)
-    , mNextDepthFrameEvent(INVALID_HANDLE_VALUE)
-    , mDepthStreamHandle(INVALID_HANDLE_VALUE)
+DepthSensor::DepthSensor(std::unique_ptr<DepthSource> source, std::unique_ptr<Reconstruction> reconstruction,
+    const FusionConfig& config)
+    : cDepthWidth(0)
+    , cDepthHeight(0)
+    , m_pSource(std::move(source))
+    , m_pReconstruction(std::move(reconstruction))
     , mDrawDepth(NULL)
-    , mdepthImageResolution(NUI_IMAGE_RESOLUTION_640x480)
-    , m_pVolume(NULL)
-    , cDepthImagePixels(0)
-    , m_pDepthImagePixelBuffer(NULL)
-    , m_pDepthFloatImage(NULL)
-    , m_pPointCloud(NULL)
-    , m_pShadedSurface(NULL)
-    , m_bMirrorDepthFrame(false)
-    , m_bTranslateResetPoseByMinDepthThreshold(true)
+    , m_fLastDepthFrameTime(0)
     , m_cLostFrameCounter(0)
     , m_bTrackingFailed(false)
     , m_bAutoResetReconstructionWhenLost(false)
     , m_bAutoResetReconstructionOnTimeout(true)
+    , m_cFrameCounter(0)
     , m_fStartTime(0)
-    , m_isInit(false)
-    , m_saveMeshFormat(Stl)
     , filename()
+    , m_config(config)
+    , m_bFusionRunning(false)
+    , m_cFusedFrames(0)
+    , m_cPresentedInInterval(0)
+    , m_fLatencySumMs(0)
+    , m_fLatencyMaxMs(0)
+    , m_fPresentIntervalStart(0)
+    , m_bReviewLoading(false)
+    , m_fNextThumbnailTime(0)
+    , m_bPointExportPending(false)
+    , m_cFusedAtIntervalStart(0)
+    , m_bTelemetryOverlay(config.telemetryOverlay)
+    , m_fNextTelemetryWrite(0)
+    , m_fNextOverlayUpdate(0)
 {
-    // Get the depth frame size from the NUI_IMAGE_RESOLUTION enum
-    DWORD WIDTH = 0, HEIGHT = 0;
-    NuiImageResolutionToSize(mdepthImageResolution, WIDTH, HEIGHT);
-    cDepthWidth = WIDTH;
-    cDepthHeight = HEIGHT;
-    cDepthImagePixels = cDepthWidth*cDepthHeight;
-
-    //create heap storage for depth pixel data in RGBX format
-    m_depthRGBX = new BYTE[cDepthWidth*cDepthHeight*cBytesPerPixel];
-
-    // Define a cubic Kinect Fusion reconstruction volume,
-    // with the Kinect at the center of the front face and the volume directly in front of Kinect.
-    reconstructionParams.voxelsPerMeter = 256;	// 1000mm / 256vpm = ~3.9mm/voxel
-    reconstructionParams.voxelCountX = 512;		// 512 / 256vpm = 2m wide reconstruction
-    reconstructionParams.voxelCountY = 384;		// Memory = 512*384*512 * 4bytes per voxel
-    reconstructionParams.voxelCountZ = 512;		// Require 512MB GPU memory
-
-    // These parameters are for optionally clipping the input depth image 
-    m_fMinDepthThreshold = NUI_FUSION_DEFAULT_MINIMUM_DEPTH;   // min depth in meters
-    m_fMaxDepthThreshold = NUI_FUSION_DEFAULT_MAXIMUM_DEPTH;    // max depth in meters
-
-    // This parameter is the temporal averaging parameter for depth integration into the reconstruction
-    m_cMaxIntegrationWeight = NUI_FUSION_DEFAULT_INTEGRATION_WEIGHT;	// Reasonable for static scenes   
-
-    SetIdentityMatrix(m_worldToCameraTransform);
-    SetIdentityMatrix(m_defaultWorldToVolumeTransform);
-
-    m_cLastDepthFrameTimeStamp.QuadPart = 0;
-
-    // Initialize synchronization objects
-    InitializeCriticalSection(&m_lockVolume);
+    MemoryAccounting::Instance().SetBudget((long long)(m_config.memoryBudgetMb * 1024.0 * 1024.0));
+
+    // The depth clipping range (0.35m to 8m) and the integration weight are the Kinect Fusion
+    // defaults; the volume is sized in initReconstruction, for the reconstruction's memory layout.
+    m_reconstructionParameters.volume = m_config.volume;
+    m_reconstructionParameters.depthFilter = m_config.depthFilter;
+    m_reconstructionParameters.integration = m_config.integration;
+
+    // Resets after lost frames are the viewer's, see m_bAutoResetReconstructionWhenLost
+    m_reconstructionParameters.resetOnLostFrames = 0;
+
+    // The depth colour ramp spans the clipping range
+    ShadingParameters shading = m_config.shading;
+    shading.minDepth = m_reconstructionParameters.minDepth;
+    shading.maxDepth = m_reconstructionParameters.maxDepth;
+    m_shader.SetParameters(shading);
+
+    m_presentStats.presentedFps = 0;
+    m_presentStats.presentedFrames = 0;
+    m_presentStats.droppedPresentations = 0;
+    m_presentStats.meanLatencyMs = 0;
+    m_presentStats.maxLatencyMs = 0;
 }
 
 
 
-void DepthSensor::createInstance()
+void DepthSensor::init()
 {
-    int count = 0;
-    NuiGetSensorCount(&count);
-    if (count == 0)
-    {
-        throw std::runtime_error("no valid Kinect is connected");
-    }
-    // creat kinect
-    NuiCreateSensorByIndex(0, &mNuiSensor);
-    // get kinect status
-    HRESULT status = mNuiSensor->NuiStatus();
-    if (status != S_OK)
+    if (!m_pSource || !m_pSource->Open())
     {
-        throw std::runtime_error("Kinect is not ready to work");
+        throw std::runtime_error(m_pSource ? "Cannot open the depth source: " + m_pSource->Error() : std::string("No depth source"));
     }
+    cDepthWidth = m_pSource->Width();
+    cDepthHeight = m_pSource->Height();
+    std::cout << "Depth source " << m_pSource->Name() << ": " << cDepthWidth << "x" << cDepthHeight << std::endl;
 
     // Create and initialize a new vtk image renderer 
-    // We'll use this to draw the data we receive from the Kinect to the screen
+    // We'll use this to draw the data we receive from the depth source to the screen
     mDrawDepth = new vtkImageRender();
     
-    if (!mDrawDepth->Initialize(cDepthWidth, cDepthHeight, cDepthWidth * sizeof(long)))
+    if (!mDrawDepth->Initialize(cDepthWidth, cDepthHeight, cDepthWidth * cBytesPerPixel, m_config.headless))
     {
         throw std::runtime_error("Failed to initialize the vtk draw device.");
     }
-}
-
-void DepthSensor::init()
-{
-    HRESULT hr;
-    createInstance();
-
-    hr=mNuiSensor->NuiInitialize(NUI_INITIALIZE_FLAG_USES_DEPTH);
-    //NUI_INITIALIZE_FLAG_USES_COLOR |
-    if (SUCCEEDED(hr))
-    {
-        // Create an event that will be signaled when depth data  is available
-        mNextDepthFrameEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-
-        // Open a depth image stream to receive depth frames
-        hr = mNuiSensor->NuiImageStreamOpen(
-            NUI_IMAGE_TYPE_DEPTH,
-            NUI_IMAGE_RESOLUTION_640x480,
-            0,
-            2, 
-            mNextDepthFrameEvent,
-            &mDepthStreamHandle);
-        if (FAILED(hr))
-        {
-            throw std::runtime_error("NuiImageStreamOpen failed");
-        }
-    }
-    else 
-    {
-        throw std::runtime_error("Initial failed");
-    }
-    std::cout << "Intial Kinect Finish" << std::endl;
+    m_frameSlot.Initialize(cDepthWidth, cDepthHeight, cBytesPerPixel);
 
-    //Initialize Kinect Fusion 
-    initKinectFusion();
+    //Initialize the reconstruction
+    initReconstruction();
 }
 
 
-//Initialize Kinect Fusion volume and images for processing
-void DepthSensor::initKinectFusion()
+//Initialize the reconstruction volume and the outputs of every frame
+void DepthSensor::initReconstruction()
 {
-    HRESULT hr = S_OK;
-
-    
-    // Create the Kinect Fusion Reconstruction Volume
-    hr = NuiFusionCreateReconstruction(
-        &reconstructionParams,
-        NUI_FUSION_RECONSTRUCTION_PROCESSOR_TYPE_AMP,
-        -1, 
-        &m_worldToCameraTransform,
-        &m_pVolume);
-    if (FAILED(hr))
-    {
-        throw std::runtime_error("NuiFusionCreateReconstruction failed.");
-    }
-
-
-
-    // Save the default world to volume transformation to be optionally used in ResetReconstruction
-    hr = m_pVolume->GetCurrentWorldToVolumeTransform(&m_defaultWorldToVolumeTransform);
-    if (FAILED(hr))
+    if (!m_pReconstruction)
     {
-        throw std::runtime_error("Failed in call to GetCurrentWorldToVolumeTransform.");
+        throw std::runtime_error("No reconstruction");
     }
 
-
-
-    if (m_bTranslateResetPoseByMinDepthThreshold)
+    // Define the reconstruction volume,
+    // with the camera at the center of the front face and the volume directly in front of it.
+    // The default is 512x384x512 voxels at 256 voxels/m: ~3.9mm voxels, 2m wide, 384MB of GPU memory with the SDK.
+    const VolumeBackend backend = m_pReconstruction->Backend();
+    if (m_config.volumeAuto)
     {
-        // This call will set the world-volume transformation
-        hr = ResetReconstruction();
-        if (FAILED(hr))
+        // leave a quarter of an overall budget to the frames, meshes and caches
+        VolumeSizingRequest request = m_config.volumeSizing;
+        double budgetShare = m_config.memoryBudgetMb * 1024.0 * 1024.0 * 0.75;
+        if (budgetShare > 0 && budgetShare < request.budgetBytes)
         {
-            return ;
+            request.budgetBytes = budgetShare;
+        }
+        VolumeSizing sizing = ChooseVolume(request, backend);
+        m_reconstructionParameters.volume = sizing.volume;
+        if (!sizing.coversExtent)
+        {
+            cout << "The volume budget does not cover the requested extent at " << request.minVoxelsPerMeter
+                << " voxels/m; the volume is smaller" << endl;
         }
     }
 
+    // Create the volume, smaller than asked for when the device cannot hold it
+    if (!m_pReconstruction->Initialize(m_reconstructionParameters, cDepthWidth, cDepthHeight))
+    {
+        throw std::runtime_error(m_pReconstruction->Error());
+    }
+    cout << "Reconstruction " << m_pReconstruction->Name() << ", volume: "
+        << DescribeVolume(m_pReconstruction->Volume(), backend) << endl;
+    if (MemoryAccounting::Instance().Budget() > 0 && MemoryAccounting::Instance().Available() == 0)
+    {
+        cout << "Warning: the reconstruction volume alone exceeds the memory budget" << endl;
+    }
 
+    // Full quality until the governor finds the frames over budget. The raycast lever is left out
+    // when the reconstruction raycasts at the full depth resolution only: it would cost a step
+    // without saving any time
+    QualityGovernorSettings governor = m_config.governor;
+    governor.raycastLever = governor.raycastLever && m_pReconstruction->ScalesRaycast();
+    m_governor.Initialize(governor);
 
-    // DepthFloatImage  Frames generated from the depth input
-    hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_FLOAT, cDepthWidth, cDepthHeight, nullptr, &m_pDepthFloatImage);
-    if (FAILED(hr))
-        throw std::runtime_error("NuiFusionCreateImageFrame failed (Float).");
-
-    // PointCloud   Create images to raycast the Reconstruction Volume
-    hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_POINT_CLOUD, cDepthWidth, cDepthHeight, nullptr, &m_pPointCloud);
-    if (FAILED(hr))
-        throw std::runtime_error("NuiFusionCreateImageFrame failed (PointCloud).");
-
-    // ShadedSurface  Create images to raycast the Reconstruction Volume(color)
-    hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_COLOR, cDepthWidth, cDepthHeight, nullptr, &m_pShadedSurface);
-    if (FAILED(hr))
-        throw std::runtime_error("NuiFusionCreateImageFrame failed (Color).");
-
-    m_pDepthImagePixelBuffer = new(std::nothrow) NUI_DEPTH_IMAGE_PIXEL[cDepthImagePixels];
-
-
-    /////////////////////
-    if (nullptr == m_pDepthImagePixelBuffer)
+    if (m_config.pointExport.Enabled() && !m_pointExporter.Start(m_config.pointExport, cDepthWidth, cDepthHeight))
+    {
+        throw std::runtime_error("Cannot create the point export directory " + m_config.pointExport.directory);
+    }
+    if (!m_config.poseLogPath.empty() && !m_poseLog.Open(m_config.poseLogPath))
     {
-        throw std::runtime_error("Failed to initialize Kinect Fusion depth image pixel buffer.");
+        throw std::runtime_error("Cannot create the pose log " + m_config.poseLogPath);
     }
 
     m_fStartTime = m_timer.AbsoluteTime();
 
+    InitMeshPreview();
+
     std::cout << "Intial Finish"<<std::endl;
 }
 
 
-void DepthSensor::processDepth()
+void DepthSensor::processDepth(const DepthFrame& frame)
 {    
-    HRESULT hr;	
-    NUI_IMAGE_FRAME imageFrame;
-    //get the depth frame 
-    
-    hr = mNuiSensor->NuiImageStreamGetNextFrame(mDepthStreamHandle, 500, &imageFrame);
-    if (FAILED(hr))
+    TraceRecorder::SetFrame(m_cFusedFrames);
+    if (frame.width != cDepthWidth || frame.height != cDepthHeight)
     {
-        throw std::runtime_error("NuiImageStreamGetNextFrame failed");
+        throw std::runtime_error("The depth source changed its frame size");
     }
 
-    hr = CopyExtendedDepth(imageFrame);
-
-
-    LARGE_INTEGER currentDepthFrameTime = imageFrame.liTimeStamp;
-
-    // Release the Kinect camera frame
-    mNuiSensor->NuiImageStreamReleaseFrame(mDepthStreamHandle, &imageFrame);
+    // The frame budget of the quality governor starts once the frame is in
+    Timing::Clock::time_point frameStart = Timing::Clock::now();
+    QualitySample sample = {};
     
 
     // To enable playback of a .xed file through Kinect Studio and reset of the reconstruction
@@ -222,74 +197,76 @@ void DepthSensor::processDepth()
     // Note: this will potentially continually reset live reconstructions on slow machines which
     // cannot process a live frame in less time than the reset threshold. Increase the number of
     // milliseconds in cResetOnTimeStampSkippedMilliseconds if this is a problem.
+    // With the quality governor a slow machine sheds quality instead, so only a jump back in time
+    // (the .xed looping) resets; falling behind is logged.
+    long long timeStampStep = (long long)((frame.timestamp - m_fLastDepthFrameTime) * 1000.0);
     if (m_bAutoResetReconstructionOnTimeout && m_cFrameCounter != 0
-        && abs(currentDepthFrameTime.QuadPart - m_cLastDepthFrameTimeStamp.QuadPart) > cResetOnTimeStampSkippedMilliseconds)
+        && llabs(timeStampStep) > cResetOnTimeStampSkippedMilliseconds)
     {
-        ResetReconstruction();
-
-        if (FAILED(hr))
+        if (m_governor.Settings().enabled && timeStampStep > 0)
         {
-            return;
+            char text[sizeof(TelemetryEvent::text)];
+            snprintf(text, sizeof(text), "fell %lld ms behind the sensor at %d steps below full quality",
+                timeStampStep, m_governor.StepsDown());
+            Telemetry::Instance().LogEvent(text);
+        }
+        else
+        {
+            ResetReconstruction();
         }
     }
 
-    m_cLastDepthFrameTimeStamp = currentDepthFrameTime;
+    m_fLastDepthFrameTime = frame.timestamp;
 
-    // Return if the volume is not initialized
-    if (nullptr == m_pVolume)
-    {
-        throw std::runtime_error("Kinect Fusion reconstruction volume not initialized. Please try reducing volume size or restarting.");
-        return;
-    }
+    // The UI thread may reset or mesh the volume between two frames
+    std::lock_guard<std::recursive_mutex> lock(m_lockVolume);
 
 
     ////////////////////////////////////////////////////////
-    // Depth to DepthFloat
+    // ProcessFrame
 
-    // Convert the pixels describing extended depth as unsigned short type in millimeters to depth
-    // as floating point type in meters.
-    hr = m_pVolume->DepthToDepthFloatFrame(m_pDepthImagePixelBuffer, cDepthImagePixels * sizeof(NUI_DEPTH_IMAGE_PIXEL), m_pDepthFloatImage, m_fMinDepthThreshold, m_fMaxDepthThreshold, m_bMirrorDepthFrame);
-    if (FAILED(hr))
+    // Perform the camera tracking and update the reconstruction volume, on the depth clipped to
+    // the depth thresholds and denoised. The first frame after a reset defines the model and is
+    // not tracked. With lazy integration still frames are integrated at a reduced rate.
+    ReconstructionFrame result;
+    if (!m_pReconstruction->ProcessFrame(frame.pDepthMm, result))
     {
-        throw std::runtime_error("Kinect Fusion NuiFusionDepthToDepthFloatFrame call failed.");
-        return;
+        throw std::runtime_error(m_pReconstruction->Error());
     }
+    sample.leverMs[QualityTracking] = result.trackingMs;
+    sample.leverMs[QualityIntegration] = result.integrationMs;
+    sample.leverMs[QualityRaycast] = result.raycastMs;
 
-
-    ////////////////////////////////////////////////////////
-    // ProcessFrame
-
-    // Perform the camera tracking and update the Kinect Fusion Volume
-    // This will create memory on the GPU, upload the image, run camera tracking and integrate the
-    // data into the Reconstruction Volume if successful. Note that passing nullptr as the final 
-    // parameter will use and update the internal camera pose.
-    hr = m_pVolume->ProcessFrame(m_pDepthFloatImage, NUI_FUSION_DEFAULT_ALIGN_ITERATION_COUNT, m_cMaxIntegrationWeight, &m_worldToCameraTransform);
-    if (SUCCEEDED(hr))
+    if (result.tracked)
     {
-        Matrix4 calculatedCameraPose;
-        hr = m_pVolume->GetCurrentWorldToCameraTransform(&calculatedCameraPose);
+        m_cLostFrameCounter = 0;
+        m_bTrackingFailed = false;
 
-        if (SUCCEEDED(hr))
+        // The frame was integrated: the blocks in view need re-meshing
+        if (result.integrated && m_preview.IsRunning())
         {
-            // Set the pose
-            m_worldToCameraTransform = calculatedCameraPose;
-            m_cLostFrameCounter = 0;
-            m_bTrackingFailed = false;
+            m_preview.MarkVisibleBlocksDirty(m_pReconstruction->WorldToCamera(), m_pReconstruction->Intrinsics(),
+                m_reconstructionParameters.minDepth, m_reconstructionParameters.maxDepth);
         }
     }
     else
     {
-        if (hr == E_NUI_FUSION_TRACKING_ERROR)
-        {
-            m_cLostFrameCounter++;
-            m_bTrackingFailed = true;
-            std::cout << "Kinect Fusion camera tracking failed! Align the camera to the last tracked position. " << std::endl;
-        }
-        else
-        {
-            throw std::runtime_error("Kinect Fusion ProcessFrame call failed!");
-            return;
-        }
+        m_cLostFrameCounter++;
+        m_bTrackingFailed = true;
+        std::cout << "Camera tracking failed! Align the camera to the last tracked position. " << std::endl;
+    }
+
+    // Log the frame's pose before a reset replaces it; appending never waits for the disk
+    if (m_poseLog.IsOpen())
+    {
+        PoseLogRecord record;
+        record.timestamp = frame.timestamp;
+        record.frame = frame.index;
+        record.worldToCamera = m_pReconstruction->WorldToCamera();
+        record.status = m_bTrackingFailed ? PoseLost : ((0 == m_cFrameCounter) ? PoseReset : PoseTracked);
+        record.lostFrames = m_cLostFrameCounter;
+        record.residual = result.residual;
+        m_poseLog.Append(record);
     }
 
 
@@ -297,226 +274,590 @@ void DepthSensor::processDepth()
     if (m_bAutoResetReconstructionWhenLost && m_bTrackingFailed && m_cLostFrameCounter >= cResetOnNumberOfLostFrames)
     {
         // Automatically clear volume and reset tracking if tracking fails
-        hr = ResetReconstruction();
-
-        if (FAILED(hr))
-        {
-            return;
-        }
+        ResetReconstruction();
 
         // Set bad tracking message
-        std::cout << "Kinect Fusion camera tracking failed, automatically reset volume" << std::endl; 
+        std::cout << "Camera tracking failed, automatically reset volume" << std::endl; 
     
     }
 
+    // Export the points of a due frame once they can be placed with its pose
+    if (m_pointExporter.IsDue(m_cFrameCounter) && !m_bTrackingFailed)
+    {
+        if (PointExportDepth == m_pointExporter.Settings().source)
+        {
+            // Only the copy into the exporter's buffer runs here; when the writer is behind, the frame is dropped
+            m_pReconstruction->ExportPoints(m_pointExporter, m_cFrameCounter, PointExportDepth);
+        }
+        else
+        {
+            m_bPointExportPending = true;
+        }
+    }
+
 
     ////////////////////////////////////////////////////////
     // CalculatePointCloud
-    // Raycast all the time, even if we camera tracking failed, to enable us to visualize what is happening with the system
-    hr = m_pVolume->CalculatePointCloud(m_pPointCloud, &m_worldToCameraTransform);
-
-    if (FAILED(hr))
+    // Raycast all the time, even if we camera tracking failed, to enable us to visualize what is happening with the system.
+    // With the SDK this raycast only feeds the display, the native pipeline has raycast the volume
+    // for tracking the next frame already: at a lowered quality level only every n-th frame is
+    // raycast and shown.
+    const QualityLevel& quality = m_governor.Level();
+    if (0 != m_cFrameCounter % quality.displayInterval)
     {
-        throw std::runtime_error("Kinect Fusion CalculatePointCloud call failed.");
+        FinishFrame(sample, frameStart);
         return;
     }
 
+    Timing::Clock::time_point raycastStart = Timing::Clock::now();
+    if (!m_pReconstruction->CalculatePointCloud())
+    {
+        throw std::runtime_error(m_pReconstruction->Error());
+    }
+    // skipped along with the display, so that lever is charged for it
+    const double raycastMs = std::chrono::duration<double, std::milli>(Timing::Clock::now() - raycastStart).count();
+
+    if (m_bPointExportPending)
+    {
+        m_pReconstruction->ExportPoints(m_pointExporter, m_cFrameCounter, PointExportRaycast);
+        m_bPointExportPending = false;
+    }
+
 
     ////////////////////////////////////////////////////////
     // ShadePointCloud and render
 
-    hr = NuiFusionShadePointCloud(m_pPointCloud, &m_worldToCameraTransform, nullptr, m_pShadedSurface, nullptr);
+    ScopedStageTimer shadingTimer(s_stageShading);
+    Timing::Clock::time_point displayStart = Timing::Clock::now();
 
-    if (FAILED(hr))
+    // The point cloud is shaded straight into the presented frame; the render loop is handed the
+    // frame without waiting for presentation
+    unsigned char * pDst = m_frameSlot.BeginWrite();
+    if (!m_pReconstruction->Shade(m_shader, pDst, cDepthWidth * cBytesPerPixel))
     {
-        throw std::runtime_error("Kinect Fusion NuiFusionShadePointCloud call failed.");
-        return;
+        throw std::runtime_error(m_pReconstruction->Error());
     }
+    m_frameSlot.EndWrite(m_cFusedFrames++, m_timer.AbsoluteTime());
+    sample.leverMs[QualityDisplay] = raycastMs + std::chrono::duration<double, std::milli>(Timing::Clock::now() - displayStart).count();
+
+    FinishFrame(sample, frameStart);
+}
 
-    // Draw the shaded raycast volume image
-    INuiFrameTexture * pShadedImageTexture = m_pShadedSurface->pFrameTexture;
-    NUI_LOCKED_RECT ShadedLockedRect;
 
-    // Lock the frame data so the Kinect knows not to modify it while we're reading it
-    hr = pShadedImageTexture->LockRect(0, &ShadedLockedRect, nullptr, 0);
-    if (FAILED(hr))
+void DepthSensor::FinishFrame(QualitySample& sample, Timing::Clock::time_point start)
+{
+    // Frames since the last reset; the reconstruction counts the fused frames, and the fused
+    // frame rate is reported by the render loop
+    m_cFrameCounter++;
+
+    sample.frameMs = std::chrono::duration<double, std::milli>(Timing::Clock::now() - start).count();
+    if (!m_governor.Update(sample))
     {
         return;
     }
 
+    const QualityLevel& quality = m_governor.Level();
+    m_pReconstruction->SetQuality(quality);
+
+    cout << "Quality " << m_governor.StepsDown() << " steps below full: " << quality.iterationScale << " of the align iterations, "
+        << quality.skippedTrackingLevels << " tracking level(s) skipped, raycast step " << quality.raycastStep
+        << ", integrating every " << quality.integrationInterval << ", showing every " << quality.displayInterval << " frame(s)" << endl;
+}
+
 
-    // Make sure we've received valid data
-    if (ShadedLockedRect.Pitch != 0)
+void DepthSensor::ResetReconstruction()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lockVolume);
+
+    // Clears the volume and puts the camera back at the world origin, the volume in front of it
+    if (!m_pReconstruction->Reset())
     {
-        BYTE * pBuffer = (BYTE *)ShadedLockedRect.pBits;
+        throw std::runtime_error("Failed to reset reconstruction: " + m_pReconstruction->Error());
+    }
+
+    m_cLostFrameCounter = 0;
+    m_cFrameCounter = 0;
+    m_fStartTime = m_timer.AbsoluteTime();
+    m_bTrackingFailed = false;
+    m_preview.Reset(m_pReconstruction->VolumeToWorld());
+    Telemetry::Instance().Add(s_counterResets);
+
+    cout << "Reconstruction has been reset.\n" << endl;
+}
 
-        // Draw the data with vtk
-        mDrawDepth->Draw(pBuffer, cDepthWidth , cDepthHeight , cBytesPerPixel);
-        if (!m_isInit)
+
+//void DepthSensor::KeypressCallbackFunction(vtkObject* caller, long unsigned int eventId, void* clientData)
+//{
+//
+//	// Get the keypress
+//	vtkRenderWindowInteractor *iren = static_cast<vtkRenderWindowInteractor*>(caller);
+//
+//	std::string key = iren->GetKeySym();
+//
+//	// Output the key that was pressed
+//	std::cout << "Pressed " << key << std::endl;
+//
+//	// Handle an arrow key
+//	if (key == "s")
+//	{
+//		if (this->SaveMesh())
+//		{
+//			std::cout << "save Mesh successed." << std::endl;
+//		}
+//	}
+//
+//
+//}
+
+void DepthSensor::FusionLoop()
+{
+    TraceRecorder::Instance().SetThreadName("fusion");
+    while (m_bFusionRunning)
+    {
+        // Wait with a timeout so that a stop request is noticed even without frames
+        DepthFrame frame;
+        DepthFrameStatus status = m_pSource->NextFrame(frame, 100);
+        if (DepthFrameTimeout == status)
         {
-            mDrawDepth->Actor->GetMapper()->SetInputData(mDrawDepth->image);
-            mDrawDepth->renderer->AddActor(mDrawDepth->Actor);
-            m_isInit = true;
+            continue;
+        }
+        if (DepthFrameEnd == status)
+        {
+            cout << "The depth source " << m_pSource->Name() << " ended" << endl;
+            m_bFusionRunning = false;
+            break;
         }
-        mDrawDepth->renWin->Render();
-    }
 
-    // We're done with the texture so unlock it
-    pShadedImageTexture->UnlockRect(0);
-
-
-    //////////////////////////////////////////////////////////
-    //// Periodically Display Fps
-    //// Update frame counter
-    //m_cFrameCounter++;
-    //// Display fps count approximately every cTimeDisplayInterval seconds
-    //double elapsed = m_timer.AbsoluteTime() - m_fStartTime;
-    //if ((int)elapsed >= cTimeDisplayInterval)
-    //{
-    //	double fps = (double)m_cFrameCounter / elapsed;
-    //	// Update status display
-    //	if (!m_bTrackingFailed)
-    //	{
-    //		WCHAR str[MAX_PATH];
-    //		swprintf_s(str, ARRAYSIZE(str), L"Fps: %5.2f", fps);
-    //		
-    //		cout<<str<<endl;
-    //	}
-    //	m_cFrameCounter = 0;
-    //	m_fStartTime = m_timer.AbsoluteTime();
-    //}
+        try
+        {
+            if (DepthFrameError == status)
+            {
+                throw std::runtime_error(m_pSource->Error());
+            }
+            processDepth(frame);
+        }
+        catch (const std::exception& e)
+        {
+            cout << "Fusion stopped: " << e.what() << endl;
+            m_bFusionRunning = false;
+        }
+    }
 }
 
 
-HRESULT DepthSensor::ResetReconstruction()
+void DepthSensor::StartFusionThread()
 {
-    if (nullptr == m_pVolume)
+    cout << "Telemetry scope overhead: " << Telemetry::Instance().MeasureScopeOverhead() << " ns" << endl;
+
+    TraceRecorder::Instance().SetThreadName("render");
+    if (!m_config.tracePath.empty())
     {
-        return E_FAIL;
+        SetTracing(true);
     }
 
-    HRESULT hr = S_OK;
-    SetIdentityMatrix(m_worldToCameraTransform);
-    // Translate the reconstruction volume location away from the world origin by an amount equal
-    // to the minimum depth threshold. This ensures that some depth signal falls inside the volume.
-    // If set false, the default world origin is set to the center of the front face of the 
-    // volume, which has the effect of locating the volume directly in front of the initial camera
-    // positionto the with the +Z axis in volume along the initial camera direction of view.
-    if (m_bTranslateResetPoseByMinDepthThreshold)
+    m_bFusionRunning = true;
+    m_fPresentIntervalStart = m_timer.AbsoluteTime();
+    m_fusionThread = std::thread(&DepthSensor::FusionLoop, this);
+}
+
+
+void DepthSensor::StopFusionThread()
+{
+    m_bFusionRunning = false;
+    if (m_fusionThread.joinable())
     {
-        Matrix4 worldToVolumeTransform = m_defaultWorldToVolumeTransform;
+        m_fusionThread.join();
+
+        if (!m_config.telemetryPath.empty())
+        {
+            Telemetry::Instance().WriteSnapshot(m_config.telemetryPath);
+        }
+        if (TraceRecorder::IsEnabled())
+        {
+            SetTracing(false);
+        }
+    }
+}
 
-        // Translate the volume in the Z axis by the minDepthThreshold distance
-        float minDist = (m_fMinDepthThreshold < m_fMaxDepthThreshold) ? m_fMinDepthThreshold : m_fMaxDepthThreshold;
-        worldToVolumeTransform.M43 -= (minDist * reconstructionParams.voxelsPerMeter);
 
-        hr = m_pVolume->ResetReconstruction(&m_worldToCameraTransform, &worldToVolumeTransform);
+void DepthSensor::SetTracing(bool enabled)
+{
+    const std::string path = m_config.tracePath.empty() ? std::string("trace.json") : m_config.tracePath;
+    if (enabled)
+    {
+        TraceRecorder::Instance().Start(m_config.traceEvents);
+        cout << "Tracing, the timeline is written to " << path << " when tracing stops" << endl;
     }
     else
     {
-        hr = m_pVolume->ResetReconstruction(&m_worldToCameraTransform, nullptr);
+        TraceRecorder::Instance().Stop();
+        if (TraceRecorder::Instance().WriteJson(path))
+        {
+            cout << "Trace written to " << path << " (open in chrome://tracing or ui.perfetto.dev)" << endl;
+        }
+        else
+        {
+            cout << "Failed to write the trace to " << path << endl;
+        }
     }
+}
 
-    m_cLostFrameCounter = 0;
-    m_cFrameCounter = 0;
-    m_fStartTime = m_timer.AbsoluteTime();
 
-    if (SUCCEEDED(hr))
+void DepthSensor::PrintMemoryReport()
+{
+    MemoryReport report = MemoryAccounting::Instance().Report();
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    cout << "Memory: " << report.liveBytes * mb << " MB live, " << report.peakBytes * mb << " MB peak";
+    if (report.budgetBytes > 0)
     {
-        m_bTrackingFailed = false;
+        cout << ", budget " << report.budgetBytes * mb << " MB";
+    }
+    cout << endl;
+    for (size_t i = 0; i < report.tags.size(); ++i)
+    {
+        const MemoryTagUsage& tag = report.tags[i];
+        cout << "  " << tag.name << ": " << tag.liveBytes * mb << " MB live, " << tag.peakBytes * mb
+            << " MB peak, " << tag.refused << " refused" << endl;
+    }
+}
 
-        cout << "Reconstruction has been reset.\n" << endl;
+
+void DepthSensor::Present()
+{
+    if (!m_bFusionRunning)
+    {
+        // the fusion thread hit an error, close the viewer
+        if (mDrawDepth->interactor)
+        {
+            mDrawDepth->interactor->TerminateApp();
         }
-    else
+        return;
+    }
+
+    // Pick up a review mesh that finished loading
+    vtkSmartPointer<vtkPolyData> reviewMesh;
+    {
+        std::lock_guard<std::mutex> lock(m_reviewLock);
+        reviewMesh = m_pendingReviewMesh;
+        m_pendingReviewMesh = nullptr;
+    }
+    if (reviewMesh)
+    {
+        mDrawDepth->ShowReviewMesh(reviewMesh);
+    }
+
+    // Patch re-meshed blocks into the live preview
+    bool previewChanged = false;
+    if (m_preview.IsRunning() && m_preview.ApplyPendingUpdates())
+    {
+        mDrawDepth->PreviewMeshModified();
+        previewChanged = true;
+    }
+
+    // Skip the tick if nothing new was fused since the last presentation
+    const LatestFrameSlot::Frame* frame = m_frameSlot.AcquireLatest();
+    TraceRecorder::SetFrame((nullptr != frame) ? frame->frameId : -1);
+    if (nullptr == frame && (reviewMesh || previewChanged) && !m_config.headless)
     {
-        throw std::runtime_error("Failed to reset reconstruction.");
+        ScopedStageTimer renderTimer(s_stageRender);
+        mDrawDepth->renWin->Render();
+    }
+    if (nullptr != frame)
+    {
+        ScopedStageTimer presentTimer(s_stagePresent);
+        if (m_config.headless)
+        {
+            WriteThumbnails(*frame);
+        }
+        else
+        {
+            mDrawDepth->Draw(frame->pixels.data(), frame->width, frame->height, cBytesPerPixel);
+            ScopedStageTimer renderTimer(s_stageRender);
+            mDrawDepth->renWin->Render();
+        }
+        Telemetry::Instance().Add(s_counterPresentedFrames);
+
+        double latencyMs = (m_timer.AbsoluteTime() - frame->publishTime) * 1000.0;
+        m_fLatencySumMs += latencyMs;
+        m_fLatencyMaxMs = (latencyMs > m_fLatencyMaxMs) ? latencyMs : m_fLatencyMaxMs;
+        m_cPresentedInInterval++;
+        m_presentStats.presentedFrames++;
+    }
+
+    UpdateTelemetry();
+
+    // Refresh the statistics approximately every cTimeDisplayInterval seconds
+    double elapsed = m_timer.AbsoluteTime() - m_fPresentIntervalStart;
+    if (elapsed >= cTimeDisplayInterval)
+    {
+        m_presentStats.presentedFps = m_cPresentedInInterval / elapsed;
+        m_presentStats.droppedPresentations = m_frameSlot.DroppedCount();
+        m_presentStats.meanLatencyMs = (m_cPresentedInInterval > 0) ? m_fLatencySumMs / m_cPresentedInInterval : 0;
+        m_presentStats.maxLatencyMs = m_fLatencyMaxMs;
+
+        long long fusedFrames = Telemetry::Instance().Snapshot().Counter("fused-frames");
+        cout << "Fused: " << (fusedFrames - m_cFusedAtIntervalStart) / elapsed << " fps" << endl;
+        m_cFusedAtIntervalStart = fusedFrames;
+
+        cout << "Presented: " << m_presentStats.presentedFps << " fps, dropped: "
+            << m_presentStats.droppedPresentations << ", latency: "
+            << m_presentStats.meanLatencyMs << " ms (max " << m_presentStats.maxLatencyMs << " ms)" << endl;
+
+        if (!m_config.sdkShading)
+        {
+            ShadingStats shading = m_shader.GetStats();
+            cout << "Shading (" << ShadingModeName(m_shader.Parameters().mode) << "): "
+                << shading.lastNsPerPixel << " ns/pixel (mean " << shading.meanNsPerPixel << ")" << endl;
+        }
+
+        if (m_thumbnails.IsRunning())
+        {
+            ThumbnailWriterStats thumbnails = m_thumbnails.GetStats();
+            cout << "Thumbnails: " << thumbnails.written << " written, " << thumbnails.dropped << " dropped, "
+                << thumbnails.failed << " failed, " << thumbnails.meanEncodeMs << " ms per image" << endl;
+        }
+
+        if (m_pointExporter.IsRunning())
+        {
+            PointCloudExportStats points = m_pointExporter.GetStats();
+            cout << "Point export: " << points.written << " written, " << points.dropped << " dropped, "
+                << points.failed << " failed, " << points.points << " points, " << points.meanWriteMs << " ms per file" << endl;
+        }
+
+        if (m_poseLog.IsOpen())
+        {
+            PoseLogStats poses = m_poseLog.GetStats();
+            cout << "Pose log: " << poses.written << " written, " << poses.dropped << " dropped"
+                << (poses.failed ? ", write failed" : "") << endl;
+        }
+
+        if (m_preview.IsRunning())
+        {
+            MeshPreviewStats preview = m_preview.GetStats();
+            cout << "Preview: " << preview.liveTriangles << "/" << preview.capacityTriangles << " triangles, "
+                << preview.blocksMeshed << " blocks meshed, " << preview.dirtyBlocks << " pending, "
+                << preview.blocksOverBudget << " over budget, last update " << preview.lastUpdateMs << " ms" << endl;
+        }
+
+        cout << MemoryAccounting::Instance().Report().ToText() << endl;
+
+        m_cPresentedInInterval = 0;
+        m_fLatencySumMs = 0;
+        m_fLatencyMaxMs = 0;
+        m_fPresentIntervalStart = m_timer.AbsoluteTime();
     }
-    return hr;
 }
 
 
-HRESULT DepthSensor::CopyExtendedDepth(NUI_IMAGE_FRAME &imageFrame)
+void DepthSensor::UpdateTelemetry()
 {
-    HRESULT hr = S_OK;
+    double now = m_timer.AbsoluteTime();
+    Telemetry::Instance().Set(s_counterDroppedFrames, m_frameSlot.DroppedCount());
+
+    if (!m_config.telemetryPath.empty() && now >= m_fNextTelemetryWrite)
+    {
+        m_fNextTelemetryWrite = now + m_config.telemetryInterval;
+        if (!Telemetry::Instance().WriteSnapshot(m_config.telemetryPath))
+        {
+            cout << "Failed to write telemetry to " << m_config.telemetryPath << endl;
+        }
+    }
 
-    if (nullptr == m_pDepthImagePixelBuffer)
+    if (m_bTelemetryOverlay && !m_config.headless && now >= m_fNextOverlayUpdate)
     {
-        throw std::runtime_error("Error depth image pixel buffer is nullptr.");
-        return E_FAIL;
+        m_fNextOverlayUpdate = now + 1.0;
+        mDrawDepth->SetOverlayText(Telemetry::Instance().Snapshot().ToText());
     }
+}
 
-    INuiFrameTexture *extendedDepthTex = nullptr;
-    // Extract the extended depth in NUI_DEPTH_IMAGE_PIXEL format from the frame
-    BOOL nearModeOperational = FALSE;
 
-    hr = mNuiSensor->NuiImageFrameGetDepthImagePixelFrameTexture(mDepthStreamHandle, &imageFrame, &nearModeOperational, &extendedDepthTex);
-    if (FAILED(hr))
+void DepthSensor::SetTelemetryOverlay(bool enabled)
+{
+    m_bTelemetryOverlay = enabled;
+    m_fNextOverlayUpdate = 0;
+    if (!enabled)
     {
-        throw std::runtime_error("Error getting extended depth texture.");
-        return hr;
+        mDrawDepth->SetOverlayText(std::string());
     }
+}
+
 
+void DepthSensor::WriteThumbnails(const LatestFrameSlot::Frame& frame)
+{
+    if (!m_thumbnails.IsRunning() || m_timer.AbsoluteTime() < m_fNextThumbnailTime)
+    {
+        return;
+    }
+    m_fNextThumbnailTime += 1.0 / m_config.thumbnailHz;
+    if (m_fNextThumbnailTime < m_timer.AbsoluteTime())
+    {
+        // do not try to catch up after a stall
+        m_fNextThumbnailTime = m_timer.AbsoluteTime() + 1.0 / m_config.thumbnailHz;
+    }
 
-    NUI_LOCKED_RECT extendedDepthLockedRect;
+    char name[64];
+    snprintf(name, sizeof(name), "frame_%06lld", frame.frameId);
+    m_thumbnails.Submit(name, frame.pixels.data(), frame.width, frame.height, frame.stride, ThumbnailBGRX, false);
 
-    // Lock the frame data to access the un-clamped NUI_DEPTH_IMAGE_PIXELs
-    hr = extendedDepthTex->LockRect(0, &extendedDepthLockedRect, nullptr, 0);
-    if (FAILED(hr) || extendedDepthLockedRect.Pitch == 0)
+    if (m_preview.IsRunning())
     {
-        throw std::runtime_error("Error getting extended depth texture pixels.");
-        return hr;
+        int width = 0, height = 0;
+        const unsigned char* pPixels = mDrawDepth->RenderModelView(width, height);
+        if (nullptr != pPixels)
+        {
+            snprintf(name, sizeof(name), "preview_%06lld", frame.frameId);
+            m_thumbnails.Submit(name, pPixels, width, height, width * cBytesPerPixel, ThumbnailRGBA, true);
+        }
     }
+}
 
-    /////////////////////////////////////////////////////////////////memcpy
-    // Copy the depth pixels so we can return the image frame
-    errno_t err = memcpy_s(m_pDepthImagePixelBuffer, cDepthImagePixels * sizeof(NUI_DEPTH_IMAGE_PIXEL), extendedDepthLockedRect.pBits, extendedDepthTex->BufferLen());
 
-    extendedDepthTex->UnlockRect(0);
+void DepthSensor::RunHeadless()
+{
+    s_bStopRequested = false;
+    signal(SIGINT, RequestStop);
 
-    if (0 != err)
+    if (m_config.thumbnailHz > 0)
     {
-        throw std::runtime_error("Error copying extended depth texture pixels.");
-        return hr;
+        if (!m_thumbnails.Start(m_config.thumbnailDirectory, m_config.thumbnailScale))
+        {
+            throw std::runtime_error("Cannot create the thumbnail directory " + m_config.thumbnailDirectory);
+        }
+        m_fNextThumbnailTime = m_timer.AbsoluteTime();
+    }
+    if (m_config.previewEnabled)
+    {
+        SetPreviewEnabled(true);
+    }
+
+    // Same pacing as the viewer timer, without a window: present-hz = 0 runs at 60 Hz
+    double presentHz = (m_config.presentHz > 0) ? m_config.presentHz : 60.0;
+    std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / presentHz));
+    std::chrono::steady_clock::time_point nextTick = std::chrono::steady_clock::now();
+
+    cout << "Running headless, press Ctrl+C to stop" << endl;
+    StartFusionThread();
+    while (m_bFusionRunning && !s_bStopRequested)
+    {
+        nextTick += period;
+        std::this_thread::sleep_until(nextTick);
+        Present();
     }
-    return hr;
+    StopFusionThread();
+    m_preview.Stop();
+    m_thumbnails.Stop();
+
+    ThumbnailWriterStats thumbnails = m_thumbnails.GetStats();
+    cout << "Wrote " << thumbnails.written << " thumbnails to " << m_config.thumbnailDirectory << endl;
+    signal(SIGINT, SIG_DFL);
 }
 
 
+void DepthSensor::LoadReviewMesh(const string& meshFile)
+{
+    if (m_bReviewLoading)
+    {
+        cout << "A mesh is already being loaded" << endl;
+        return;
+    }
+    if (m_reviewLoader.joinable())
+    {
+        m_reviewLoader.join();
+    }
 
+    cout << "Reading the mesh in the background..." << endl;
+    m_bReviewLoading = true;
+    m_reviewLoader = std::thread([this, meshFile]()
+    {
+        LoadedMesh mesh;
+        MeshLoadStats stats;
+        if (LoadMeshFile(meshFile.c_str(), mesh, &stats))
+        {
+            PrintMeshLoadStats(meshFile.c_str(), stats);
 
+            // VTK copies the mesh into its own arrays, so the display needs as much again
+            if (MemoryAccounting::Instance().Admit(MemoryDisplay, (long long)mesh.MemoryBytes()))
+            {
+                vtkSmartPointer<vtkPolyData> polyData = CreatePolyData(mesh);
 
+                std::lock_guard<std::mutex> lock(m_reviewLock);
+                m_pendingReviewMesh = polyData;
+            }
+            else
+            {
+                cout << "Not enough memory left in the budget to display the mesh" << endl;
+            }
+        }
+        else
+        {
+            cout << "Read model file failed" << endl;
+        }
+        m_bReviewLoading = false;
+    });
+}
+
+
+void DepthSensor::InitMeshPreview()
+{
+    // The preview reads the volume in blocks; it holds the volume lock only for one block at a time
+    TsdfBlockExporter exporter = [this](int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step, std::vector<short>& samples)
+    {
+        samples.resize((size_t)samplesX * samplesY * samplesZ);
+        std::lock_guard<std::recursive_mutex> lock(m_lockVolume);
+        return m_pReconstruction->ExportBlock(x, y, z, samplesX, samplesY, samplesZ, step, samples);
+    };
+
+    const VolumeParameters volume = m_pReconstruction->Volume();
+    m_preview.Initialize(m_config.preview, volume.voxelCountX, volume.voxelCountY, volume.voxelCountZ,
+        m_pReconstruction->VolumeToWorld(), exporter);
+}
+
+
+void DepthSensor::SetPreviewEnabled(bool enabled)
+{
+    if (enabled)
+    {
+        if (!mDrawDepth->preview->GetPoints())
+        {
+            mDrawDepth->ShowPreviewMesh(m_preview.Points(), m_preview.CapacityTriangles());
+        }
+        // blocks integrated while the preview was off are picked up on the next frames in view
+        m_preview.Start();
+    }
+    else
+    {
+        m_preview.Stop();
+    }
+    mDrawDepth->SetPreviewVisible(enabled);
+    cout << "Live mesh preview " << (enabled ? "on" : "off") << endl;
+}
 
-//void DepthSensor::KeypressCallbackFunction(vtkObject* caller, long unsigned int eventId, void* clientData)
-//{
-//
-//	// Get the keypress
-//	vtkRenderWindowInteractor *iren = static_cast<vtkRenderWindowInteractor*>(caller);
-//
-//	std::string key = iren->GetKeySym();
-//
-//	// Output the key that was pressed
-//	std::cout << "Pressed " << key << std::endl;
-//
-//	// Handle an arrow key
-//	if (key == "s")
-//	{
-//		if (this->SaveMesh())
-//		{
-//			std::cout << "save Mesh successed." << std::endl;
-//		}
-//	}
-//
-//
-//}
 
 void DepthSensor::Update()
 {
+    if (m_config.headless)
+    {
+        RunHeadless();
+        return;
+    }
+
+
     // Initialize must be called prior to creating timer events.
     mDrawDepth->interactor->Initialize();
     // Sign up to receive TimerEvent
     vtkTimerCallback* timer = new vtkTimerCallback(this);
     mDrawDepth->interactor->AddObserver(vtkCommand::TimerEvent, timer);
-    int timerId = mDrawDepth->interactor->CreateRepeatingTimer(100);
+
+    // The timer only paces presentation; fusion runs on its own thread at the sensor rate.
+    // With present-hz = 0 every tick presents, so the buffer swap (vsync) sets the pace.
+    unsigned long presentPeriodMs = 1;
+    if (m_config.presentHz > 0)
+    {
+        presentPeriodMs = (unsigned long)(1000.0 / m_config.presentHz + 0.5);
+        presentPeriodMs = (presentPeriodMs > 0) ? presentPeriodMs : 1;
+    }
+    int timerId = mDrawDepth->interactor->CreateRepeatingTimer(presentPeriodMs);
 
     vtkSmartPointer<vtkLambdaCommand> keypressCallback = vtkSmartPointer<vtkLambdaCommand>::New();
     
@@ -544,160 +885,149 @@ void DepthSensor::Update()
                 ResetReconstruction();
             }
 
-            //press t and read STL File just have created
+            //press c to start a trace capture, and again to write it
+            if (key == "c")
+            {
+                SetTracing(!TraceRecorder::IsEnabled());
+            }
+
+            //press o to toggle the telemetry overlay
+            if (key == "o")
+            {
+                SetTelemetryOverlay(!m_bTelemetryOverlay);
+            }
+
+            //press p to toggle the live mesh preview
+            if (key == "p")
+            {
+                SetPreviewEnabled(!m_preview.IsRunning());
+            }
+
+            //press m to print the memory used by every buffer
+            if (key == "m")
+            {
+                PrintMemoryReport();
+            }
+
+            //press t to review the file just created next to the live view
             if (key == "t")
             {
-                if (m_saveMeshFormat == Stl || m_saveMeshFormat == Obj)
+                if (filename.empty())
                 {
-                    cout << "Reading the mesh , waiting...... " << endl;
-                    ReadModelFile((char*)filename.c_str(), m_saveMeshFormat);
+                    cout << "No mesh has been saved yet" << endl;
                 }
                 else
                 {
-                    cout << "Read model file failed" << endl;
+                    LoadReviewMesh(filename);
                 }
             }
         }
     );
     mDrawDepth->interactor->AddObserver(vtkCommand::KeyPressEvent, keypressCallback);
-    mDrawDepth->interactor->Start();
 
-    
-}
-
-
-
-/// <summary>
-/// Calculate a mesh for the current volume
-/// </summary>
-/// <param name="ppMesh">returns the new mesh</param>
-HRESULT DepthSensor::CalculateMesh(INuiFusionMesh** ppMesh)
-{
-    EnterCriticalSection(&m_lockVolume);
-    HRESULT hr = E_FAIL;
-    if (m_pVolume != nullptr)
+    if (m_config.previewEnabled)
     {
-        hr = m_pVolume->CalculateMesh(1, ppMesh);
-
-        // Set the frame counter to 0 to prevent a reset reconstruction call due to large frame 
-        // timestamp change after meshing. Also reset frame time for fps counter.
-        m_cFrameCounter = 0;
-        m_fStartTime = m_timer.AbsoluteTime();
+        SetPreviewEnabled(true);
     }
-    LeaveCriticalSection(&m_lockVolume);
-    return hr;
-}
-
-// save the mesh 
-bool DepthSensor::SaveMesh()
-{
-    INuiFusionMesh *mesh = nullptr;
-    HRESULT hr = this->CalculateMesh(&mesh);
-    if (SUCCEEDED(hr))
-    {
-        // Save mesh
-        hr = SaveFile(mesh, &m_saveMeshFormat);
-
-        if (SUCCEEDED(hr))
-        {
-            return true;
-        }
-        else
-        {
-            throw std::runtime_error("Error saving Kinect Fusion mesh!");
-        }
-
-        // Release the mesh
-        SafeRelease(mesh);
-    }
-    
-    return false;
-    
 
+    StartFusionThread();
+    mDrawDepth->interactor->Start();
+    StopFusionThread();
+    m_preview.Stop();
 }
 
 
 
-/// <summary>
-/// Save Mesh to disk.
-/// </summary>
-/// <param name="mesh">The mesh to save.</param>
-/// <returns>indicates success or failure</returns>
-HRESULT DepthSensor::SaveFile(INuiFusionMesh* pMesh, KinectFusionMeshTypes *saveMeshType)
+// save the mesh 
+bool DepthSensor::SaveMesh()
 {
-    HRESULT hr = S_OK;
-
-    if (nullptr == pMesh)
-    {
-        return E_INVALIDARG;
-    }
+    ScopedStageTimer saveTimer(s_stageSaveMesh);
 
     //string filename;
     cout << "Please enter a file name to write: ";
     getline(cin, filename);
-    
 
-    if (filename.substr(filename.find_last_of(".") + 1) == "stl")
+    //with no .stl or .obj extension name ,set default  type ***a.stl
+    const string extension = filename.substr(filename.find_last_of(".") + 1);
+    if (extension != "stl" && extension != "obj")
     {
-        *saveMeshType = Stl;
-    }
-    else if (filename.substr(filename.find_last_of(".") + 1) == "obj")
-    {
-        *saveMeshType = Obj;
-    }
-    //with no extension name ,set default  type ***a.stl
-    else
-    {
-        filename = filename +"a"+".stl";		
+        filename = filename +"a"+".stl";
     }
 
-    //change file name from string to char*
-    char *cfilename = (char*)filename.c_str();
+    std::lock_guard<std::recursive_mutex> lock(m_lockVolume);
+    bool saved = m_pReconstruction->SaveMesh(filename);
 
-    
-    if (Stl == *saveMeshType)
-    {
-        cout << "Creating and saving mesh in format stl,please waiting...... " << endl;
-        hr = WriteBinarySTLMeshFile(pMesh, cfilename);
-    }
-    else if (Obj == *saveMeshType)
-    {
-        cout << "Creating and saving mesh in format obj,please waiting...... " << endl;
-        hr = WriteAsciiObjMeshFile(pMesh, cfilename);
-    }
-    else
+    // Set the frame counter to 0 to prevent a reset reconstruction call due to large frame 
+    // timestamp change after meshing. Also reset frame time for fps counter.
+    m_cFrameCounter = 0;
+    m_fStartTime = m_timer.AbsoluteTime();
+
+    if (!saved)
     {
-        hr = E_FAIL;
+        throw std::runtime_error("Error saving the mesh: " + m_pReconstruction->Error());
     }
-    return hr;
+    return true;
 }
 
 
 DepthSensor::~DepthSensor()
 {
-    if (mNuiSensor != 0)
-    {
-        mNuiSensor->NuiShutdown();
-        mNuiSensor->Release();
-    }
-
-    if (mNextDepthFrameEvent != INVALID_HANDLE_VALUE)
+    m_preview.Stop();
+    StopFusionThread();
+    m_thumbnails.Stop();
+    m_pointExporter.Stop();
+    m_poseLog.Close();
+    if (m_reviewLoader.joinable())
     {
-        CloseHandle(mNextDepthFrameEvent);
+        m_reviewLoader.join();
     }
-    delete[] m_depthRGBX;
 
     // clean up vtk renderer
     delete mDrawDepth;
     mDrawDepth = NULL;
-
-    DeleteCriticalSection(&m_lockVolume);
 }
 
 
-int main()
+int main(int argc, char* argv[])
 {
-    DepthSensor Fusion;
+    FusionConfig config;
+    config.ParseCommandLine(argc, argv);
+    config.Print();
+
+    if (!config.simdAuto && !SetSimdLevel(config.simd))
+    {
+        std::cerr << "The CPU or this build does not support " << SimdLevelName(config.simd) << " (up to "
+            << SimdLevelName(DetectSimdLevel()) << ")" << std::endl;
+        return 1;
+    }
+    std::cout << "SIMD kernels: " << SimdLevelName(ActiveSimdLevel()) << std::endl;
+
+    // The Kinect into the Kinect Fusion SDK volume, or a source without a sensor for development
+    // and replays into the native pipeline, which runs on any platform
+    std::unique_ptr<DepthSource> source;
+    std::unique_ptr<Reconstruction> reconstruction;
+    if (config.source == "kinect")
+    {
+#ifdef FUSION_KINECT_SDK
+        source.reset(new KinectDepthSource(config.sourceSettings.width, config.sourceSettings.height));
+        reconstruction.reset(new KinectReconstruction(config.sdkShading, config.governor.enabled));
+#else
+        std::cerr << "This build has no Kinect SDK: use --source=synthetic or a recorded sequence directory" << std::endl;
+        return 1;
+#endif
+    }
+    else
+    {
+        source = CreateDepthSource(config.source, config.sourceSettings);
+        reconstruction.reset(new NativeReconstruction());
+        if (config.sdkShading)
+        {
+            std::cout << "--shading=sdk needs the Kinect Fusion SDK volume, shading natively" << std::endl;
+            config.sdkShading = false;
+        }
+    }
+
+    DepthSensor Fusion(std::move(source), std::move(reconstruction), config);
     Fusion.init();
     Fusion.Update();
     return 0;
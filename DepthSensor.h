@@ -2,14 +2,14 @@
 #define DEPTH_SENSOR_H
 
 // System includes
-#include <windows.h>
 #include <stdexcept>
 #include <iostream>
 #include <functional>
-
-
-#include <NuiApi.h>
-#include <NuiKinectFusionApi.h>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
 
 #include "vtkImageRender.h"
 //#include "vtkTimeCallBack.h"
@@ -18,10 +18,43 @@
 #include "Timer.h"
 
 #include "KeyPressInteractorStyle.h"
-#include "FusionHelper.h"
+#include "DepthSource.h"
+#include "Reconstruction.h"
+#include "FusionConfig.h"
+#include "QualityGovernor.h"
+#include "LatestFrameSlot.h"
+#include "MeshPreview.h"
+#include "ThumbnailWriter.h"
+#include "PointCloudExporter.h"
+#include "Trajectory.h"
+#include "PointCloudShader.h"
+#include "Telemetry.h"
+#include "TraceRecorder.h"
+#include "MemoryAccounting.h"
 
 using namespace std;
 
+
+/// <summary>
+/// Statistics of the render loop, refreshed every cTimeDisplayInterval seconds
+/// </summary>
+struct PresentStats
+{
+	double                      presentedFps;
+	long long                   presentedFrames;
+
+	/// <summary>
+	/// Fused frames replaced by a newer one before they could be presented
+	/// </summary>
+	long long                   droppedPresentations;
+
+	/// <summary>
+	/// Time from the fusion thread publishing a frame to Render() returning, in ms
+	/// </summary>
+	double                      meanLatencyMs;
+	double                      maxLatencyMs;
+};
+
 class DepthSensor
 {
 
@@ -36,42 +69,31 @@ private:
 
 	int							cDepthWidth;
     int							cDepthHeight;
-	int							cDepthImagePixels;
-	//Kinect 
-	INuiSensor*					mNuiSensor;
 
-	//INuiFusionColorReconstruction * m_pVolume;
-	INuiFusionReconstruction*	m_pVolume;
-	CRITICAL_SECTION            m_lockVolume;
+	/// <summary>
+	/// Where the depth frames come from: the Kinect, a recorded sequence or the synthetic scene
+	/// </summary>
+	std::unique_ptr<DepthSource> m_pSource;
 
+	/// <summary>
+	/// The volume the frames are fused into: the Kinect Fusion SDK one for the Kinect, the native
+	/// pipeline for every other source. The UI thread may reset or mesh it between two frames, and
+	/// the live preview reads it, under m_lockVolume.
+	/// </summary>
+	std::unique_ptr<Reconstruction> m_pReconstruction;
+	std::recursive_mutex        m_lockVolume;
+	FusionPipelineParameters    m_reconstructionParameters;
 
 
-	NUI_IMAGE_RESOLUTION        mdepthImageResolution;
 	//VTK image render
 	vtkImageRender *			mDrawDepth;
 
-
-	HANDLE						mNextDepthFrameEvent;
-	HANDLE						mDepthStreamHandle;
-	
-	LARGE_INTEGER				m_cLastDepthFrameTimeStamp;
+	double						m_fLastDepthFrameTime;		// s, of the source
 	//HANDLE			mNextColorFrameEvent;
 	//HANDLE			mColorStreamHandle;
 
-	//FUSION parameter
-
-	/// <summary>
-	/// Frames from the depth input
-	/// </summary>
-	NUI_DEPTH_IMAGE_PIXEL*      m_pDepthImagePixelBuffer;
-	NUI_FUSION_IMAGE_FRAME*     m_pDepthFloatImage;
-
-	/// Frames generated from ray-casting the Reconstruction Volume
-	NUI_FUSION_IMAGE_FRAME*     m_pPointCloud;
-
-	/// Images for display
-	NUI_FUSION_IMAGE_FRAME*     m_pShadedSurface;
-	NUI_FUSION_RECONSTRUCTION_PARAMETERS reconstructionParams;
+	/// Native shading of the point cloud, used unless --shading=sdk
+	PointCloudShader            m_shader;
 
 	/// <summary>
 	/// Camera Tracking parameters
@@ -96,88 +118,168 @@ private:
 	/// </summary>
 	bool                        m_bAutoResetReconstructionOnTimeout;
 
-	BYTE*						m_depthRGBX;
+	int                         m_cFrameCounter;
+	double                      m_fStartTime;
+	Timing::Timer               m_timer;
+
 
-	Matrix4						m_worldToCameraTransform;
+	//file Name
+	string						filename;
 
 	/// <summary>
-	// The default Kinect Fusion World to Volume Transform
+	/// Runtime configuration
 	/// </summary>
-	Matrix4						m_defaultWorldToVolumeTransform;
+	FusionConfig                m_config;
 
+	/// <summary>
+	/// Presentation: the fusion thread publishes shaded frames into m_frameSlot and
+	/// the render loop on the UI thread presents the latest one at its own pace.
+	/// </summary>
+	LatestFrameSlot             m_frameSlot;
+	std::thread                 m_fusionThread;
+	std::atomic<bool>           m_bFusionRunning;
+	long long                   m_cFusedFrames;
+	PresentStats                m_presentStats;
+	long long                   m_cPresentedInInterval;
+	double                      m_fLatencySumMs;
+	double                      m_fLatencyMaxMs;
+	double                      m_fPresentIntervalStart;
 
 	/// <summary>
-	/// Processing parameters
+	/// Mesh review: meshes are loaded on m_reviewLoader and picked up by the render loop
 	/// </summary>
-	unsigned short				m_cMaxIntegrationWeight;
-	float                       m_fMinDepthThreshold;
-	float                       m_fMaxDepthThreshold;
-	bool                        m_bMirrorDepthFrame;
-	int                         m_cFrameCounter;
-	double                      m_fStartTime;
-	Timing::Timer               m_timer;
-	bool                        m_isInit;
-	KinectFusionMeshTypes       m_saveMeshFormat;
+	std::thread                 m_reviewLoader;
+	std::atomic<bool>           m_bReviewLoading;
+	std::mutex                  m_reviewLock;
+	vtkSmartPointer<vtkPolyData> m_pendingReviewMesh;
 
+	/// <summary>
+	/// Live 3D preview, re-meshed from the blocks the camera has seen
+	/// </summary>
+	MeshPreview                 m_preview;
 
-	//file Name
-	string						filename;
-	
+	/// <summary>
+	/// Keeps processDepth within --frame-budget by lowering the tracking effort, the integrated
+	/// frames and the frames raycast and shown, instead of falling behind the sensor
+	/// </summary>
+	QualityGovernor             m_governor;
+
+	/// <summary>
+	/// Headless mode: decimated frames and preview renders written in the background
+	/// </summary>
+	ThumbnailWriter             m_thumbnails;
+	double                      m_fNextThumbnailTime;
+
+	/// <summary>
+	/// World space points of every n-th frame written in the background (--point-export); a due
+	/// raycast is taken from the next frame that is raycast
+	/// </summary>
+	PointCloudExporter          m_pointExporter;
+	bool                        m_bPointExportPending;
 
+	/// <summary>
+	/// Every frame's pose, tracking status and alignment residual (--pose-log); the residual is -1
+	/// when the reconstruction did not measure it
+	/// </summary>
+	PoseLogWriter               m_poseLog;
 
 	/// <summary>
-	/// Parameter to translate the reconstruction based on the minimum depth setting. When set to
-	/// false, the reconstruction volume +Z axis starts at the camera lens and extends into the scene.
-	/// Setting this true in the constructor will move the volume forward along +Z away from the
-	/// camera by the minimum depth threshold to enable capture of very small reconstruction volumes
-	/// by setting a non-identity camera transformation in the ResetReconstruction call.
-	/// Small volumes should be shifted, as the Kinect hardware has a minimum sensing limit of ~0.35m,
-	/// inside which no valid depth is returned, hence it is difficult to initialize and track robustly  
-	/// when the majority of a small volume is inside this distance.
+	/// Telemetry: periodic snapshots to --telemetry and the on-screen overlay
 	/// </summary>
-	bool                        m_bTranslateResetPoseByMinDepthThreshold;
+	long long                   m_cFusedAtIntervalStart;
+	bool                        m_bTelemetryOverlay;
+	double                      m_fNextTelemetryWrite;
+	double                      m_fNextOverlayUpdate;
+
 
 	/// <summary>
-	/// Copy the extended depth data out of a Kinect image frame
+	/// Reset the reconstruction camera pose and clear the volume; throws on failure
 	/// </summary>
-	/// <returns>S_OK on success, otherwise failure code</returns>
-	HRESULT						CopyExtendedDepth(NUI_IMAGE_FRAME &imageFrame);
+	void                        ResetReconstruction();
 
+	/// <summary>
+	/// Count a processed frame and let the quality governor adjust the following ones
+	/// </summary>
+	void                        FinishFrame(QualitySample& sample, Timing::Clock::time_point start);
 
 	/// <summary>
-	/// Reset the reconstruction camera pose and clear the volume.
+	/// Create the reconstruction volume, sized to the memory budget with --volume=auto, and the
+	/// per-frame outputs around it
 	/// </summary>
-	/// <returns>S_OK on success, otherwise failure code</returns>
-	HRESULT                     ResetReconstruction();
+	void						initReconstruction();
 
+	/// <summary>
+	/// Body of the fusion thread: process depth frames as the source delivers them, until it ends
+	/// </summary>
+	void						FusionLoop();
+	void						StartFusionThread();
+	void						StopFusionThread();
 
-	void						initKinectFusion();
-	void						createInstance();
-    const Matrix4&				IdentityMatrix();
+	/// <summary>
+	/// Load a mesh file in the background and show it next to the live view once ready
+	/// </summary>
+	void						LoadReviewMesh(const string& meshFile);
 
 	/// <summary>
-	/// Calculate a mesh for the current volume.
+	/// Set up the live mesh preview for the current volume
 	/// </summary>
-	/// <returns>S_OK on success, otherwise failure code</returns>
-	HRESULT						CalculateMesh(INuiFusionMesh** ppMesh);
+	void						InitMeshPreview();
 
 	/// <summary>
-	/// The reconstruction processor
+	/// Turn the live mesh preview on or off
 	/// </summary>
-	HRESULT						SaveFile(INuiFusionMesh* pMesh, KinectFusionMeshTypes *saveMeshType);
-	
-	
+	void						SetPreviewEnabled(bool enabled);
+
+	/// <summary>
+	/// Headless main loop: present on a plain timer instead of the interactor until
+	/// fusion stops or Ctrl+C is pressed
+	/// </summary>
+	void						RunHeadless();
+
+	/// <summary>
+	/// Headless presentation: queue the frame, and a render of the mesh preview, as
+	/// thumbnails when one is due
+	/// </summary>
+	void						WriteThumbnails(const LatestFrameSlot::Frame& frame);
+
+	/// <summary>
+	/// Render loop: write the telemetry snapshot and refresh the overlay when due
+	/// </summary>
+	void						UpdateTelemetry();
+	void						SetTelemetryOverlay(bool enabled);
+
+	/// <summary>
+	/// Start a trace capture, or stop it and write the timeline to --trace (trace.json by default)
+	/// </summary>
+	void						SetTracing(bool enabled);
+
+	/// <summary>
+	/// Print the live and peak memory of every tag against the budget
+	/// </summary>
+	void						PrintMemoryReport();
+
 
 public:
-	DepthSensor();	
+	DepthSensor(std::unique_ptr<DepthSource> source, std::unique_ptr<Reconstruction> reconstruction,
+		const FusionConfig& config = FusionConfig());
 	void init();
 	/// <summary>
 	/// Main processing function
 	/// </summary>
 	void Update();
-	void processDepth();
+	void processDepth(const DepthFrame& frame);
+
+	/// <summary>
+	/// Render loop tick: present the latest fused frame if there is a new one
+	/// </summary>
+	void Present();
+
+	/// <summary>
+	/// Statistics of the render loop over the last display interval
+	/// </summary>
+	PresentStats GetPresentStats() const { return m_presentStats; }
 
-	//Creating and saving mesh of reconstruction as .obj file
+	//Creating and saving mesh of reconstruction as .stl or .obj file
 	bool SaveMesh();
 	~DepthSensor();
 };
@@ -246,7 +348,7 @@ public:
 		if (vtkCommand::TimerEvent == eventId)
 		{
 			/*std::cout << "timer eventId:" << eventId << std::endl;*/
-			m_sensor->processDepth();
+			m_sensor->Present();
 		}
 	}
 
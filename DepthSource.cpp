@@ -0,0 +1,78 @@
+#include "DepthSource.h"
+#include "RecordedDepthSource.h"
+#include "SyntheticDepthSource.h"
+
+#include <thread>
+
+
+DepthSourceSettings::DepthSourceSettings()
+	: frameRateHz(0)
+	, loop(false)
+	, width(320)
+	, height(240)
+	, frames(90)
+	, noise(1.0f)
+	, seed(1)
+	, holdFrames(0)
+{
+}
+
+
+FramePacer::FramePacer()
+	: m_interval(Timing::Clock::duration::zero())
+	, m_started(false)
+{
+}
+
+
+void FramePacer::Start(double frameRateHz)
+{
+	m_interval = (frameRateHz > 0)
+		? std::chrono::duration_cast<Timing::Clock::duration>(std::chrono::duration<double>(1.0 / frameRateHz))
+		: Timing::Clock::duration::zero();
+	m_started = false;
+}
+
+
+bool FramePacer::Wait(int timeoutMs)
+{
+	if (m_interval == Timing::Clock::duration::zero())
+	{
+		return true;
+	}
+
+	Timing::Clock::time_point now = Timing::Clock::now();
+	if (!m_started)
+	{
+		m_started = true;
+		m_nextDue = now;
+	}
+	if (m_nextDue > now)
+	{
+		Timing::Clock::duration timeout = std::chrono::milliseconds(timeoutMs);
+		if (m_nextDue - now > timeout)
+		{
+			std::this_thread::sleep_for(timeout);
+			return false;
+		}
+		std::this_thread::sleep_until(m_nextDue);
+		now = m_nextDue;
+	}
+
+	m_nextDue += m_interval;
+	if (m_nextDue < now)
+	{
+		m_nextDue = now + m_interval;
+	}
+	return true;
+}
+
+
+std::unique_ptr<DepthSource> CreateDepthSource(const std::string& name, const DepthSourceSettings& settings)
+{
+	if (name == "synthetic")
+	{
+		return std::unique_ptr<DepthSource>(new SyntheticDepthSource(settings));
+	}
+	return std::unique_ptr<DepthSource>(new RecordedDepthSource(name, settings));
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "Timer.h"
+
+#include <memory>
+#include <string>
+
+/// <summary>
+/// One depth frame of a source, valid until the next call to NextFrame
+/// </summary>
+struct DepthFrame
+{
+	const unsigned short*       pDepthMm;			// width * height depths in mm, 0 = no reading
+	int                         width;
+	int                         height;
+	double                      timestamp;			// s, from the start of the stream
+	long long                   index;
+};
+
+enum DepthFrameStatus
+{
+	DepthFrameReady,
+	DepthFrameTimeout,			// no frame within the timeout, try again
+	DepthFrameEnd,				// the stream is over
+	DepthFrameError				// the source failed, see Error()
+};
+
+/// <summary>
+/// Where depth frames come from: the Kinect, a recorded sequence or the synthetic scene, so that
+/// the pipeline and the viewer run the same way on any of them, and on any platform but for the
+/// Kinect itself.
+/// </summary>
+class DepthSource
+{
+public:
+	virtual ~DepthSource() {}
+
+	virtual const char* Name() const = 0;
+
+	/// <summary>
+	/// Start delivering frames; the frame size is known from then on
+	/// </summary>
+	/// <returns>false when the source cannot be opened, with the reason in Error()</returns>
+	virtual bool Open() = 0;
+
+	virtual int Width() const = 0;
+	virtual int Height() const = 0;
+
+	/// <summary>
+	/// Wait up to timeoutMs for the next frame
+	/// </summary>
+	virtual DepthFrameStatus NextFrame(DepthFrame& frame, int timeoutMs) = 0;
+
+	/// <summary>
+	/// Ground truth world-to-camera transform of the last frame, when the source knows it
+	/// </summary>
+	virtual bool GroundTruth(Mat4& worldToCamera) const { (void)worldToCamera; return false; }
+
+	const std::string& Error() const { return m_error; }
+
+protected:
+	std::string                 m_error;
+};
+
+/// <summary>
+/// Settings of the sources without a sensor
+/// </summary>
+struct DepthSourceSettings
+{
+	/// <summary>
+	/// Frames are delivered at this rate, like a sensor; 0 delivers them as fast as they are asked for
+	/// </summary>
+	double                      frameRateHz;
+
+	/// <summary>
+	/// Recorded sequences start over at the end, with the timestamps starting over too, like a
+	/// looping .xed file; the synthetic scene never ends when frames is 0
+	/// </summary>
+	bool                        loop;
+
+	/// <summary>
+	/// Synthetic scene: size, frame count, noise scale, seed, and frames the camera holds still
+	/// before it starts moving
+	/// </summary>
+	int                         width;
+	int                         height;
+	int                         frames;
+	float                       noise;
+	unsigned int                seed;
+	int                         holdFrames;
+
+	DepthSourceSettings();
+};
+
+/// <summary>
+/// Paces the sources without a sensor at a frame rate, so that they can stand in for one
+/// </summary>
+class FramePacer
+{
+public:
+	FramePacer();
+
+	/// <summary>
+	/// Frames per second; 0 lets every frame through at once
+	/// </summary>
+	void Start(double frameRateHz);
+
+	/// <summary>
+	/// Wait up to timeoutMs for the next frame to be due. A frame the caller was too late for is
+	/// not made up for, as a sensor drops it too.
+	/// </summary>
+	/// <returns>false when the frame is not due within the timeout</returns>
+	bool Wait(int timeoutMs);
+
+private:
+	Timing::Clock::duration     m_interval;
+	Timing::Clock::time_point   m_nextDue;
+	bool                        m_started;
+};
+
+/// <summary>
+/// Create a source without a sensor: "synthetic" for the synthetic scene, otherwise the directory
+/// of a recorded sequence (see RecordedDepthSource). The Kinect source is created by the
+/// application, as it only exists on Windows.
+/// </summary>
+std::unique_ptr<DepthSource> CreateDepthSource(const std::string& name, const DepthSourceSettings& settings);
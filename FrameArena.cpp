@@ -0,0 +1,118 @@
+
+#include "FrameArena.h"
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+
+FrameArena::FrameArena()
+	: m_pBlock(nullptr)
+	, m_pAllocation(nullptr)
+	, m_capacity(0)
+	, m_used(0)
+	, m_demand(0)
+	, m_peakDemand(0)
+	, m_overflows(0)
+	, m_frame(0)
+{
+}
+
+
+FrameArena::~FrameArena()
+{
+	Reset();
+	ReleaseBlock();
+}
+
+
+void FrameArena::ReleaseBlock()
+{
+	::operator delete(m_pAllocation);
+	m_pAllocation = nullptr;
+	m_pBlock = nullptr;
+	m_capacity = 0;
+	m_memory.Release();
+}
+
+
+void FrameArena::Reserve(size_t bytes)
+{
+	bytes = AlignUp(bytes, cAlignment);
+	if (bytes <= m_capacity)
+	{
+		return;
+	}
+
+	ReleaseBlock();
+	m_pAllocation = ::operator new(bytes + cAlignment);
+	m_pBlock = (unsigned char*)AlignUp((size_t)(uintptr_t)m_pAllocation, cAlignment);
+	m_capacity = bytes;
+	m_used = 0;
+	m_memory.Reserve(MemoryScratch, (long long)(bytes + cAlignment));
+}
+
+
+void* FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+	alignment = (alignment > 0) ? alignment : cAlignment;
+	size_t start = AlignUp(m_used, alignment);
+	m_demand = AlignUp(m_demand, alignment) + bytes;
+
+	if (start + bytes <= m_capacity)
+	{
+		m_used = start + bytes;
+		return m_pBlock + start;
+	}
+
+	// does not fit: the heap serves this frame, and Reset grows the block for the next ones
+	m_overflows++;
+	void* pAllocation = ::operator new(bytes + alignment);
+	m_overflow.push_back(pAllocation);
+	return (void*)AlignUp((size_t)(uintptr_t)pAllocation, alignment);
+}
+
+
+void FrameArena::Reset()
+{
+#if FRAME_ARENA_CHECKS
+	if (nullptr != m_pBlock)
+	{
+		memset(m_pBlock, 0xFF, m_used);
+	}
+#endif
+
+	for (size_t i = 0; i < m_overflow.size(); ++i)
+	{
+		::operator delete(m_overflow[i]);
+	}
+	m_overflow.clear();
+
+	if (m_demand > m_peakDemand)
+	{
+		m_peakDemand = m_demand;
+	}
+	if (m_demand > m_capacity)
+	{
+		Reserve(m_demand);
+	}
+
+	m_used = 0;
+	m_demand = 0;
+	m_frame++;
+}
+
+
+void FrameArena::StaleUse(unsigned int allocatedFrame, unsigned int currentFrame)
+{
+	fprintf(stderr, "Frame arena memory of frame %u used in frame %u, after the arena was reset\n", allocatedFrame, currentFrame);
+	abort();
+}
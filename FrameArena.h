@@ -0,0 +1,149 @@
+#pragma once
+
+#include "MemoryAccounting.h"
+
+#include <vector>
+#include <stddef.h>
+
+// Debug builds check that arena memory is not used after the frame that allocated it
+#if !defined(FRAME_ARENA_CHECKS) && !defined(NDEBUG)
+#define FRAME_ARENA_CHECKS 1
+#endif
+
+template <class T> class ArenaPtr;
+
+/// <summary>
+/// Bump allocator for the scratch buffers of one frame: allocating is a pointer increment and
+/// Reset releases everything at once at the end of the frame. The block is reserved up front from
+/// the frame size, so a steady stream of frames never reaches the heap. A frame that needs more
+/// than the reserve still gets its memory, from the heap, and the block grows to that frame's
+/// demand at the next Reset.
+///
+/// An arena belongs to the thread running the frame; it takes no lock. Parallel loops allocate
+/// their buffers before the loop and share them.
+/// </summary>
+class FrameArena
+{
+public:
+	/// <summary>
+	/// Default alignment: a cache line, so that buffers written by different threads never share
+	/// one, which also suits any SIMD load
+	/// </summary>
+	static const size_t cAlignment = 64;
+
+	FrameArena();
+	~FrameArena();
+
+	/// <summary>
+	/// Make the block at least this many bytes; only between frames, as it invalidates the memory
+	/// handed out
+	/// </summary>
+	void Reserve(size_t bytes);
+
+	void* Allocate(size_t bytes, size_t alignment = cAlignment);
+
+	/// <summary>
+	/// Uninitialized array of count Ts
+	/// </summary>
+	template <class T>
+	ArenaPtr<T> AllocateArray(size_t count)
+	{
+		return ArenaPtr<T>(static_cast<T*>(Allocate(count * sizeof(T), alignof(T) > cAlignment ? alignof(T) : cAlignment)), *this);
+	}
+
+	/// <summary>
+	/// End of frame: release every allocation in O(1). With FRAME_ARENA_CHECKS the released
+	/// memory is also filled with 0xFF (NaN as float) so a stale raw pointer reads garbage.
+	/// </summary>
+	void Reset();
+
+	size_t Capacity() const { return m_capacity; }
+	size_t Used() const { return m_used; }
+
+	/// <summary>
+	/// Most bytes a single frame has asked for, including what did not fit
+	/// </summary>
+	size_t PeakDemand() const { return m_peakDemand; }
+
+	/// <summary>
+	/// Allocations that did not fit in the block and went to the heap
+	/// </summary>
+	long long Overflows() const { return m_overflows; }
+
+	/// <summary>
+	/// Number of Resets so far; memory is valid during the frame it was allocated in
+	/// </summary>
+	unsigned int Frame() const { return m_frame; }
+
+	/// <summary>
+	/// Reports the use of memory from an earlier frame and aborts
+	/// </summary>
+	static void StaleUse(unsigned int allocatedFrame, unsigned int currentFrame);
+
+private:
+	FrameArena(const FrameArena&);
+	FrameArena& operator=(const FrameArena&);
+
+	void ReleaseBlock();
+
+	unsigned char*              m_pBlock;			// aligned start of the block
+	void*                       m_pAllocation;		// as returned by operator new
+	size_t                      m_capacity;
+	size_t                      m_used;
+	size_t                      m_demand;			// this frame, in the block or not
+	size_t                      m_peakDemand;
+	std::vector<void*>          m_overflow;			// heap blocks of this frame
+	long long                   m_overflows;
+	unsigned int                m_frame;
+	MemoryReservation           m_memory;
+};
+
+
+/// <summary>
+/// Pointer to arena memory. With FRAME_ARENA_CHECKS it remembers the frame it was allocated in
+/// and aborts when dereferenced after the arena was reset, so scratch memory kept past the frame
+/// boundary is caught where it is used; otherwise it is a plain pointer.
+/// </summary>
+template <class T>
+class ArenaPtr
+{
+public:
+	ArenaPtr()
+		: m_p(nullptr)
+#if FRAME_ARENA_CHECKS
+		, m_pArena(nullptr)
+		, m_frame(0)
+#endif
+	{
+	}
+
+	ArenaPtr(T* p, const FrameArena& arena)
+		: m_p(p)
+#if FRAME_ARENA_CHECKS
+		, m_pArena(&arena)
+		, m_frame(arena.Frame())
+#endif
+	{
+		(void)arena;
+	}
+
+	T* get() const
+	{
+#if FRAME_ARENA_CHECKS
+		if (nullptr != m_pArena && m_pArena->Frame() != m_frame)
+		{
+			FrameArena::StaleUse(m_frame, m_pArena->Frame());
+		}
+#endif
+		return m_p;
+	}
+
+	T& operator[](size_t i) const { return get()[i]; }
+
+private:
+	T*                          m_p;
+#if FRAME_ARENA_CHECKS
+	const FrameArena*           m_pArena;
+	unsigned int                m_frame;
+#endif
+};
@@ -0,0 +1,868 @@
+
+// Benchmark of every native pipeline stage in isolation, on synthetic depth frames (or a recorded
+// 16 bit PGM depth frame) at the three Kinect depth resolutions. Reports ns/op, throughput, heap
+// allocations and the compulsory bytes each stage reads and writes, writes JSON, and compares
+// against a saved baseline. The vectorized kernels run at the highest SimdLevel of the CPU, or at
+// --simd; --self-test only checks every level against the scalar kernels (see RunSimdSelfTest) and
+// loads small and empty meshes in the temporary directory. --perf adds the cache and data TLB miss
+// rates and the page faults of every stage, from the Linux perf counters.
+// --numa-nodes runs on the threads and memory of the first nodes only: compare --numa-nodes=1
+// with the default (every node) to see how integration scales from one socket to all of them.
+//
+// The Kinect Fusion SDK calls of the viewer cannot run without a sensor, so most rows time the
+// native pipeline (FusionPipeline's stages) in their place: those rows name the SDK call they stand
+// in for (see SdkCounterpart), in the console and as "standsInFor" in the JSON. The depth filters,
+// the shading and Draw are the viewer's own code and are timed as it runs them.
+//
+//   FusionBenchmark [--json=results.json] [--baseline=old.json] [--tolerance=0.10] [--seed=1]
+//                   [--min-time=0.3] [--depth=frame.pgm] [--stage=name] [--no-pin]
+//                   [--voxels-per-meter=128] [--volume=256x192x256]
+//                   [--simd=scalar|sse4.1|avx2|avx512] [--self-test] [--perf] [--numa-nodes=N]
+
+#include "DepthProcessing.h"
+#include "DepthFilter.h"
+#include "DepthImageIO.h"
+#include "IcpTracker.h"
+#include "TsdfVolume.h"
+#include "PointCloudShader.h"
+#include "PixelConvert.h"
+#include "MeshLoader.h"
+#include "MeshWriter.h"
+#include "NumaTopology.h"
+#include "PerfCounters.h"
+#include "SimdKernels.h"
+#include "SyntheticScene.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "HeapCounter.h"
+
+#ifdef FUSION_BENCHMARK_VTK
+#include "vtkImageRender.h"
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+////////////////////////////////////////////////////////
+// Measurement
+
+struct BenchmarkResult
+{
+	std::string                 stage;
+	std::string                 resolution;
+	int                         iterations;
+	double                      nsPerOp;			// median
+	double                      itemsPerOp;
+	std::string                 itemUnit;
+	double                      allocationsPerOp;
+	double                      allocatedBytesPerOp;
+	double                      bytesMovedPerOp;
+	PerfCounts                  perf;				// over all timed calls, with --perf
+	std::string                 standsInFor;		// SDK call, empty for the viewer's own code
+};
+
+struct BenchmarkOptions
+{
+	std::string                 jsonPath;
+	std::string                 baselinePath;
+	std::string                 depthPath;
+	std::string                 stageFilter;
+	double                      tolerance;
+	double                      minSeconds;
+	unsigned int                seed;
+	bool                        pin;
+	VolumeParameters            volume;
+	bool                        selfTest;
+	bool                        perf;
+	int                         numaNodes;			// 0 = every node
+
+	BenchmarkOptions()
+		: tolerance(0.10)
+		, minSeconds(0.3)
+		, seed(1)
+		, pin(true)
+		, volume(128.0f, 256, 192, 256)
+		, selfTest(false)
+		, perf(false)
+		, numaNodes(0)
+	{
+	}
+};
+
+static BenchmarkOptions s_options;
+static std::vector<BenchmarkResult> s_results;
+static PerfCounters s_perf;
+
+
+/// <summary>
+/// Per call: the miss rates and misses, and the page faults, of the events that could be counted
+/// </summary>
+static void PrintPerf(const BenchmarkResult& result)
+{
+	const PerfCounts& counts = result.perf;
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(2);
+	const PerfEvent misses[2] = { PerfCacheMisses, PerfDtlbLoadMisses };
+	const PerfEvent accesses[2] = { PerfCacheReferences, PerfDtlbLoads };
+	for (int i = 0; i < 2; ++i)
+	{
+		if (counts.value[misses[i]] >= 0)
+		{
+			line << " " << PerfEventName(misses[i]) << " " << counts.value[misses[i]] * 1e-6 / result.iterations << " M/op";
+			if (counts.Rate(misses[i], accesses[i]) >= 0)
+			{
+				line << " (" << counts.Rate(misses[i], accesses[i]) * 100.0 << "%)";
+			}
+		}
+	}
+	if (counts.value[PerfPageFaults] >= 0)
+	{
+		line << " " << PerfEventName(PerfPageFaults) << " " << std::setprecision(1)
+			<< (double)counts.value[PerfPageFaults] / result.iterations << "/op";
+	}
+	std::cout << "    perf:" << (line.str().empty() ? " no counters" : line.str()) << std::endl;
+}
+
+
+/// <summary>
+/// The Kinect Fusion SDK call of the viewer that a native stage stands in for, nullptr if the
+/// viewer runs the stage itself
+/// </summary>
+static const char* SdkCounterpart(const std::string& stage)
+{
+	static const char* const counterparts[][2] =
+	{
+		{ "depth-convert", "NuiFusionDepthToDepthFloatFrame" },
+		{ "pyramid", "ProcessFrame" },
+		{ "vertex-normal", "ProcessFrame" },
+		{ "vertex-normal-maps", "ProcessFrame" },
+		{ "vertex-normal-coarse", "ProcessFrame" },
+		{ "icp", "ProcessFrame" },
+		{ "integrate", "ProcessFrame" },
+		{ "raycast", "CalculatePointCloud" },
+		{ "marching-cubes", "CalculateMesh" },
+		{ "stl-writer", "WriteBinarySTLMeshFile" },
+		{ "obj-writer", "WriteAsciiObjMeshFile" },
+	};
+	for (size_t i = 0; i < sizeof(counterparts) / sizeof(counterparts[0]); ++i)
+	{
+		if (stage == counterparts[i][0])
+		{
+			return counterparts[i][1];
+		}
+	}
+	return nullptr;
+}
+
+/// <summary>
+/// Time fn one call at a time for at least minSeconds (and 5 calls) after 3 warm-up calls.
+/// reset runs before every call, untimed, to restore the input state.
+/// </summary>
+template <class Fn, class Reset>
+static void Measure(const std::string& stage, const std::string& resolution, double itemsPerOp, const char* itemUnit,
+	double bytesMovedPerOp, Fn fn, Reset reset)
+{
+	if (!s_options.stageFilter.empty() && s_options.stageFilter != stage)
+	{
+		return;
+	}
+
+	for (int i = 0; i < 3; ++i)
+	{
+		reset();
+		fn();
+	}
+
+	std::vector<double> samples;
+	long long allocations = 0, allocatedBytes = 0;
+	s_perf.Reset();
+	Timing::Clock::time_point begin = Timing::Clock::now();
+	while (samples.size() < 5 || std::chrono::duration<double>(Timing::Clock::now() - begin).count() < s_options.minSeconds)
+	{
+		reset();
+		long long allocationsBefore = HeapAllocationCount();
+		long long bytesBefore = HeapAllocatedBytes();
+		s_perf.Start();
+		Timing::Clock::time_point start = Timing::Clock::now();
+		fn();
+		Timing::Clock::time_point end = Timing::Clock::now();
+		s_perf.Stop();
+		allocations += HeapAllocationCount() - allocationsBefore;
+		allocatedBytes += HeapAllocatedBytes() - bytesBefore;
+		samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+	}
+	std::sort(samples.begin(), samples.end());
+
+	BenchmarkResult result;
+	result.stage = stage;
+	result.resolution = resolution;
+	result.iterations = (int)samples.size();
+	result.nsPerOp = samples[samples.size() / 2];
+	result.itemsPerOp = itemsPerOp;
+	result.itemUnit = itemUnit;
+	result.allocationsPerOp = (double)allocations / samples.size();
+	result.allocatedBytesPerOp = (double)allocatedBytes / samples.size();
+	result.bytesMovedPerOp = bytesMovedPerOp;
+	result.perf = s_perf.Read();
+	const char* pCounterpart = SdkCounterpart(stage);
+	result.standsInFor = (nullptr != pCounterpart) ? pCounterpart : "";
+	s_results.push_back(result);
+
+	std::cout << "  " << std::left << std::setw(22) << stage << std::setw(10) << resolution << std::right << std::fixed
+		<< std::setprecision(3) << std::setw(12) << result.nsPerOp * 1e-6 << " ms/op "
+		<< std::setprecision(1) << std::setw(10) << itemsPerOp / result.nsPerOp * 1e3 << " M" << itemUnit << "/s "
+		<< std::setprecision(2) << std::setw(8) << bytesMovedPerOp / result.nsPerOp << " GB/s "
+		<< std::setprecision(1) << std::setw(8) << result.allocationsPerOp << " allocs/op"
+		<< (result.standsInFor.empty() ? "" : "  native, for ") << result.standsInFor << std::endl;
+	if (s_options.perf)
+	{
+		PrintPerf(result);
+	}
+}
+
+/// <summary>
+/// Median ms/op of a stage measured before, -1 if it was not (see --stage)
+/// </summary>
+static double MeasuredMs(const std::string& stage, const std::string& resolution)
+{
+	for (size_t i = 0; i < s_results.size(); ++i)
+	{
+		if (s_results[i].stage == stage && s_results[i].resolution == resolution)
+		{
+			return s_results[i].nsPerOp * 1e-6;
+		}
+	}
+	return -1.0;
+}
+
+template <class Fn>
+static void Measure(const std::string& stage, const std::string& resolution, double itemsPerOp, const char* itemUnit,
+	double bytesMovedPerOp, Fn fn)
+{
+	Measure(stage, resolution, itemsPerOp, itemUnit, bytesMovedPerOp, fn, []() {});
+}
+
+
+////////////////////////////////////////////////////////
+// Stages
+
+/// <summary>
+/// All stages at one depth resolution. The volume is filled with the first frames of the
+/// synthetic sequence (or the recorded frame), the last of which also seeds the tracking model.
+/// </summary>
+static void RunResolution(int width, int height, const std::vector<unsigned short>* pRecorded)
+{
+	std::ostringstream name;
+	name << width << "x" << height;
+	const std::string resolution = name.str();
+	const double pixels = (double)width * height;
+	const CameraIntrinsics intrinsics = KinectDepthIntrinsics();
+	const float minDepth = 0.35f, maxDepth = 8.0f;
+	const int levels = (width >= 320) ? 3 : 2;
+
+	SyntheticScene scene(s_options.seed);
+	std::vector<unsigned short> depthMm((size_t)width * height);
+	std::vector<unsigned short> nextDepthMm((size_t)width * height);
+	const int modelFrame = 15;
+	Mat4 modelPose = scene.CameraPose(modelFrame);
+	Mat4 nextPose = scene.CameraPose(modelFrame + 1);
+	if (nullptr != pRecorded)
+	{
+		depthMm = *pRecorded;
+		nextDepthMm = *pRecorded;
+		SetIdentity(modelPose);
+		nextPose = modelPose;
+	}
+	else
+	{
+		scene.RenderDepth(modelPose, intrinsics, width, height, 1.0f, modelFrame, depthMm.data());
+		scene.RenderDepth(nextPose, intrinsics, width, height, 1.0f, modelFrame + 1, nextDepthMm.data());
+	}
+
+	std::vector<float> depth((size_t)width * height);
+	std::vector<float> nextDepth((size_t)width * height);
+	ConvertDepthToFloat(depthMm.data(), width, height, minDepth, maxDepth, false, depth.data());
+	ConvertDepthToFloat(nextDepthMm.data(), width, height, minDepth, maxDepth, false, nextDepth.data());
+
+	Measure("depth-convert", resolution, pixels, "pixel", pixels * (2 + 4), [&]()
+	{
+		ConvertDepthToFloat(depthMm.data(), width, height, minDepth, maxDepth, false, depth.data());
+	});
+
+	// the filters run in place, so every call starts again from the converted frame
+	std::vector<float> filtered((size_t)width * height);
+	DepthFilterSettings filterSettings;
+	filterSettings.bilateral = true;
+	DepthFilter bilateral;
+	bilateral.Initialize(filterSettings, width, height);
+	Measure("depth-filter", resolution, pixels, "pixel", pixels * 4 * 6, [&]()
+	{
+		bilateral.Apply(filtered.data());
+	}, [&]()
+	{
+		filtered = depth;
+	});
+	filterSettings.bilateral = false;
+	filterSettings.temporalFrames = 3;
+	DepthFilter median;
+	median.Initialize(filterSettings, width, height);
+	Measure("temporal-median", resolution, pixels, "pixel", pixels * 4 * 8, [&]()
+	{
+		median.Apply(filtered.data());
+	}, [&]()
+	{
+		filtered = depth;
+	});
+
+	DepthPyramid pyramid;
+	pyramid.Resize(width, height, levels);
+	double pyramidBytes = 0;
+	for (int level = 0; level < levels; ++level)
+	{
+		// level 0 is copied in, every level is written once and read once by the next
+		pyramidBytes += (double)pyramid.Width(level) * pyramid.Height(level) * 4 * 2;
+	}
+	pyramidBytes += pixels * 4;
+	Measure("pyramid", resolution, pixels, "pixel", pyramidBytes, [&]()
+	{
+		pyramid.Build(nextDepth.data());
+	});
+
+	std::vector<float> framePoints((size_t)width * height * 6);
+	Measure("vertex-normal", resolution, pixels, "pixel", pixels * (4 + 24 + 24), [&]()
+	{
+		ComputeVertexNormalMap(nextDepth.data(), width, height, intrinsics, framePoints.data());
+	});
+
+	// the model: a few frames integrated along the ground truth path
+	TsdfVolume volume;
+	volume.Initialize(s_options.volume);
+	if (nullptr != pRecorded)
+	{
+		volume.Integrate(depth.data(), width, height, intrinsics, modelPose, 200);
+	}
+	else
+	{
+		std::vector<unsigned short> warmMm((size_t)width * height);
+		std::vector<float> warm((size_t)width * height);
+		for (int frame = 0; frame <= modelFrame; frame += 3)
+		{
+			Mat4 pose = scene.CameraPose(frame);
+			scene.RenderDepth(pose, intrinsics, width, height, 1.0f, frame, warmMm.data());
+			ConvertDepthToFloat(warmMm.data(), width, height, minDepth, maxDepth, false, warm.data());
+			volume.Integrate(warm.data(), width, height, intrinsics, pose, 200);
+		}
+	}
+
+	std::vector<float> model((size_t)width * height * 6);
+	volume.Raycast(modelPose, intrinsics, width, height, model.data());
+
+	// the maps of every level in planes, computed once per frame for all their readers, and only
+	// the coarse levels, which is all tracking reads once the quality governor skips level 0
+	pyramid.Build(nextDepth.data());
+	VertexNormalMaps frameMaps;
+	frameMaps.Resize(width, height, levels);
+	double mapsBytes = 0;
+	for (int level = 0; level < levels; ++level)
+	{
+		mapsBytes += (double)pyramid.Width(level) * pyramid.Height(level) * (4 + 24);
+	}
+	Measure("vertex-normal-maps", resolution, pixels, "pixel", mapsBytes, [&]()
+	{
+		for (int level = 0; level < levels; ++level)
+		{
+			frameMaps.Level(level);
+		}
+	}, [&]()
+	{
+		frameMaps.SetFrame(pyramid, intrinsics);
+	});
+	Measure("vertex-normal-coarse", resolution, pixels, "pixel", mapsBytes - pixels * (4 + 24), [&]()
+	{
+		for (int level = 1; level < levels; ++level)
+		{
+			frameMaps.Level(level);
+		}
+	}, [&]()
+	{
+		frameMaps.SetFrame(pyramid, intrinsics);
+	});
+
+	const double pointsMs = MeasuredMs("vertex-normal", resolution);
+	const double mapsMs = MeasuredMs("vertex-normal-maps", resolution);
+	const double lazyMs = MeasuredMs("vertex-normal-coarse", resolution);
+	if (pointsMs > 0 && mapsMs > 0 && lazyMs > 0)
+	{
+		std::cout << "    vertex-normal: " << std::setprecision(3) << mapsMs << " ms for the " << levels
+			<< " levels once per frame (" << lazyMs << " ms without level 0), against " << pointsMs
+			<< " ms per reader for level 0 alone as 6-float points" << std::endl;
+	}
+
+	IcpTracker tracker;
+	tracker.Resize(width, height, levels);
+	Mat4 tracked = modelPose;
+	frameMaps.SetFrame(pyramid, intrinsics);
+	IcpResult icp = tracker.Track(frameMaps, intrinsics, model.data(), modelPose, tracked);
+	int icpIterations = icp.iterations;
+	double icpBytes = mapsBytes + (double)icpIterations * pixels * (24 + 24);
+	Measure("icp", resolution, pixels, "pixel", icpBytes, [&]()
+	{
+		icp = tracker.Track(frameMaps, intrinsics, model.data(), modelPose, tracked);
+	}, [&]()
+	{
+		tracked = modelPose;
+		frameMaps.SetFrame(pyramid, intrinsics);
+	});
+	std::cout << "    icp: " << (icp.tracked ? "tracked" : "LOST") << ", " << icp.iterations << " iterations, "
+		<< icp.inliers << " inliers, residual " << icp.residual * 1000.0f << " mm" << std::endl;
+
+	const double voxels = (double)s_options.volume.VoxelCount();
+	Measure("integrate", resolution, voxels, "voxel", voxels * 4 * 2 + pixels * 4, [&]()
+	{
+		volume.Integrate(nextDepth.data(), width, height, intrinsics, nextPose, 200);
+	});
+
+	std::vector<float> points((size_t)width * height * 6);
+	Measure("raycast", resolution, pixels, "pixel", pixels * 24, [&]()
+	{
+		volume.Raycast(nextPose, intrinsics, width, height, points.data());
+	});
+
+	PointCloudShader shader;
+	std::vector<unsigned char> shaded((size_t)width * height * 4);
+	Measure("shade", resolution, pixels, "pixel", pixels * (24 + 4), [&]()
+	{
+		shader.Shade(points.data(), width * 6 * sizeof(float), width, height, nextPose, shaded.data(), width * 4);
+	});
+
+	// the shading kernel alone, on one thread
+	Measure("shade-rows", resolution, pixels, "pixel", pixels * (24 + 4), [&]()
+	{
+		ShadePointCloudRows(points.data(), width * 6 * sizeof(float), width, 0, height, nextPose, shader.Parameters(),
+			shaded.data(), width * 4);
+	});
+
+#ifdef FUSION_BENCHMARK_VTK
+	vtkImageRender render;
+	render.Initialize(width, height, width * 4, true);
+	Measure("draw", resolution, pixels, "pixel", pixels * (4 + 4), [&]()
+	{
+		render.Draw(shaded.data(), width, height, 4);
+	});
+#else
+	// without VTK, the part of vtkImageRender::Draw that touches every pixel
+	std::vector<unsigned char> rgba((size_t)width * height * 4);
+	Measure("draw", resolution, pixels, "pixel", pixels * (4 + 4), [&]()
+	{
+		ConvertBGRXToRGBA(shaded.data(), width * 4, rgba.data(), width, height, true);
+	});
+#endif
+}
+
+
+/// <summary>
+/// Stages that depend on the volume, not on the depth resolution
+/// </summary>
+static void RunVolume()
+{
+	const CameraIntrinsics intrinsics = KinectDepthIntrinsics();
+	const int width = 640, height = 480;
+	SyntheticScene scene(s_options.seed);
+
+	TsdfVolume volume;
+	volume.Initialize(s_options.volume);
+	std::vector<unsigned short> depthMm((size_t)width * height);
+	std::vector<float> depth((size_t)width * height);
+	for (int frame = 0; frame < 60; frame += 5)
+	{
+		Mat4 pose = scene.CameraPose(frame);
+		scene.RenderDepth(pose, intrinsics, width, height, 1.0f, frame, depthMm.data());
+		ConvertDepthToFloat(depthMm.data(), width, height, 0.35f, 8.0f, false, depth.data());
+		volume.Integrate(depth.data(), width, height, intrinsics, pose, 200);
+	}
+
+	std::ostringstream name;
+	name << s_options.volume.voxelCountX << "x" << s_options.volume.voxelCountY << "x" << s_options.volume.voxelCountZ;
+	const std::string resolution = name.str();
+	const double voxels = (double)s_options.volume.VoxelCount();
+	std::cout << "    volume: " << PageKindName(volume.Pages()) << " pages on " << volume.NodeCount()
+		<< (1 == volume.NodeCount() ? " NUMA node" : " NUMA nodes") << std::endl;
+
+	std::vector<float> triangles;
+	volume.CalculateMesh(triangles);
+	Measure("marching-cubes", resolution, voxels, "voxel", voxels * 4, [&]()
+	{
+		volume.CalculateMesh(triangles);
+	});
+
+	const size_t triangleCount = triangles.size() / 9;
+	std::cout << "    mesh: " << triangleCount << " triangles" << std::endl;
+	if (0 == triangleCount)
+	{
+		return;
+	}
+
+	const std::string stlPath = "fusion_benchmark.stl";
+	const std::string objPath = "fusion_benchmark.obj";
+	Measure("stl-writer", resolution, (double)triangleCount, "triangle", (double)triangleCount * (36 + 50), [&]()
+	{
+		WriteBinarySTL(stlPath.c_str(), triangles.data(), triangleCount);
+	});
+
+	WriteAsciiOBJ(objPath.c_str(), triangles.data(), triangleCount);
+	std::ifstream objFile(objPath.c_str(), std::ios::binary | std::ios::ate);
+	double objBytes = (double)objFile.tellg();
+	objFile.close();
+	Measure("obj-writer", resolution, (double)triangleCount, "triangle", (double)triangleCount * 36 + objBytes, [&]()
+	{
+		WriteAsciiOBJ(objPath.c_str(), triangles.data(), triangleCount);
+	});
+
+	remove(stlPath.c_str());
+	remove(objPath.c_str());
+}
+
+
+////////////////////////////////////////////////////////
+// Results and baselines
+
+static std::string ResultKey(const BenchmarkResult& r)
+{
+	return r.stage + "@" + r.resolution;
+}
+
+static bool WriteJson(const std::string& path)
+{
+	std::ofstream file(path.c_str());
+	if (!file)
+	{
+		return false;
+	}
+
+	// one result per line, so baselines can be compared (and diffed) line by line
+	file << std::setprecision(10);
+	file << "{\"benchmark\":\"FusionBenchmark\",\"seed\":" << s_options.seed << ",\"threads\":" << ThreadPool::Instance().Concurrency()
+		<< ",\"pinned\":" << (s_options.pin ? "true" : "false") << ",\"numaNodes\":" << NumaTopology::System().NodeCount() << ",\"simd\":\"" << SimdLevelName(ActiveSimdLevel())
+		<< "\",\"results\":[\n";
+	for (size_t i = 0; i < s_results.size(); ++i)
+	{
+		const BenchmarkResult& r = s_results[i];
+		file << "{\"stage\":\"" << r.stage << "\",\"resolution\":\"" << r.resolution << "\",\"iterations\":" << r.iterations
+			<< ",\"nsPerOp\":" << r.nsPerOp << ",\"itemsPerOp\":" << r.itemsPerOp << ",\"itemUnit\":\"" << r.itemUnit
+			<< "\",\"itemsPerSecond\":" << r.itemsPerOp / r.nsPerOp * 1e9
+			<< ",\"allocationsPerOp\":" << r.allocationsPerOp << ",\"allocatedBytesPerOp\":" << r.allocatedBytesPerOp
+			<< ",\"bytesMovedPerOp\":" << r.bytesMovedPerOp << ",\"gbPerSecond\":" << r.bytesMovedPerOp / r.nsPerOp;
+		if (!r.standsInFor.empty())
+		{
+			file << ",\"standsInFor\":\"" << r.standsInFor << "\"";
+		}
+		if (s_options.perf)
+		{
+			// totals over the timed calls, -1 where the event could not be counted
+			for (int e = 0; e < PerfEventCount; ++e)
+			{
+				file << ",\"" << PerfEventName((PerfEvent)e) << "\":" << r.perf.value[e];
+			}
+		}
+		file << "}"
+			<< (i + 1 < s_results.size() ? "," : "") << "\n";
+	}
+	file << "]}\n";
+	return (bool)file;
+}
+
+/// <summary>
+/// Value of "key": in one line of a results file
+/// </summary>
+static std::string FieldOf(const std::string& line, const std::string& key)
+{
+	std::string pattern = "\"" + key + "\":";
+	size_t start = line.find(pattern);
+	if (std::string::npos == start)
+	{
+		return std::string();
+	}
+	start += pattern.size();
+	if (start < line.size() && line[start] == '"')
+	{
+		size_t end = line.find('"', start + 1);
+		return line.substr(start + 1, end - start - 1);
+	}
+	size_t end = line.find_first_of(",}", start);
+	return line.substr(start, end - start);
+}
+
+/// <summary>
+/// Compare with a baseline run; a stage regresses when it is slower by more than the tolerance
+/// </summary>
+/// <returns>the number of regressions, or -1 if the baseline cannot be read</returns>
+static int CompareWithBaseline(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		return -1;
+	}
+
+	std::vector<std::pair<std::string, double> > baseline;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::string stage = FieldOf(line, "stage");
+		if (!stage.empty())
+		{
+			baseline.push_back(std::make_pair(stage + "@" + FieldOf(line, "resolution"), atof(FieldOf(line, "nsPerOp").c_str())));
+		}
+	}
+
+	int regressions = 0;
+	std::cout << "Compared with " << path << " (tolerance " << s_options.tolerance * 100 << "%):" << std::endl;
+	for (size_t i = 0; i < s_results.size(); ++i)
+	{
+		const std::string key = ResultKey(s_results[i]);
+		for (size_t j = 0; j < baseline.size(); ++j)
+		{
+			if (baseline[j].first != key || baseline[j].second <= 0)
+			{
+				continue;
+			}
+			double ratio = s_results[i].nsPerOp / baseline[j].second;
+			bool regressed = ratio > 1.0 + s_options.tolerance;
+			regressions += regressed ? 1 : 0;
+			std::cout << "  " << std::left << std::setw(32) << key << std::right << std::fixed << std::setprecision(3)
+				<< std::setw(8) << ratio << "x time" << (regressed ? "  REGRESSION" : (ratio < 1.0 - s_options.tolerance ? "  faster" : ""))
+				<< std::endl;
+		}
+	}
+	return regressions;
+}
+
+
+////////////////////////////////////////////////////////
+// Mesh loader self test
+
+/// <summary>
+/// Directory for the files of the self test: TMPDIR (TEMP on Windows), or the system's default
+/// </summary>
+static std::string TemporaryDirectory()
+{
+#ifdef _WIN32
+	const char* pDirectory = getenv("TEMP");
+	return (nullptr != pDirectory && *pDirectory) ? std::string(pDirectory) + "\\" : std::string(".\\");
+#else
+	const char* pDirectory = getenv("TMPDIR");
+	return (nullptr != pDirectory && *pDirectory) ? std::string(pDirectory) + "/" : std::string("/tmp/");
+#endif
+}
+
+/// <summary>
+/// Write bytes to a temporary file, load it, delete it and check the outcome and the mesh size, one
+/// line per case. What the loader prints is kept back unless the case fails, so that a rejection
+/// the case expects reports nothing.
+/// </summary>
+static bool TestLoad(std::ostream& out, const char* name, const char* extension, const void* pBytes, size_t byteCount,
+	bool expectLoaded, size_t expectVertices, size_t expectTriangles)
+{
+	const std::string filename = TemporaryDirectory() + "fusion_benchmark_selftest." + extension;
+	FILE* pFile = fopen(filename.c_str(), "wb");
+	bool written = nullptr != pFile;
+	written = written && (0 == byteCount || byteCount == fwrite(pBytes, 1, byteCount, pFile));
+	written = (nullptr != pFile) && (0 == fclose(pFile)) && written;
+	if (!written)
+	{
+		remove(filename.c_str());
+		out << "  " << name << ": cannot write " << filename << std::endl;
+		return false;
+	}
+
+	LoadedMesh mesh;
+	std::ostringstream loaderOutput;
+	std::streambuf* pConsole = std::cout.rdbuf(loaderOutput.rdbuf());
+	bool loaded = LoadMeshFile(filename.c_str(), mesh);
+	std::cout.rdbuf(pConsole);
+	remove(filename.c_str());
+
+	bool passed = (loaded == expectLoaded)
+		&& (!loaded || (mesh.VertexCount() == expectVertices && mesh.TriangleCount() == expectTriangles));
+	out << "  " << name << ": " << (loaded ? "loaded " : "rejected ") << mesh.VertexCount() << " vertices, "
+		<< mesh.TriangleCount() << " triangles" << (passed ? "" : " (unexpected)") << std::endl;
+	if (!passed)
+	{
+		out << loaderOutput.str();
+	}
+	return passed;
+}
+
+/// <summary>
+/// Load small STL and OBJ files, empty ones included, and check the mesh sizes
+/// </summary>
+/// <returns>false if any case loads wrongly</returns>
+static bool RunMeshLoaderSelfTest(std::ostream& out)
+{
+	out << "Mesh loader self test:" << std::endl;
+	bool passed = true;
+
+	// binary STL: header and triangle count only, then two triangles sharing an edge
+	unsigned char stl[84 + 2 * 50] = {};
+	passed &= TestLoad(out, "empty stl", "stl", stl, 84, true, 0, 0);
+	const float corners[2][9] = { { 0, 0, 0, 1, 0, 0, 0, 1, 0 }, { 1, 0, 0, 1, 1, 0, 0, 1, 0 } };
+	const unsigned int triangleCount = 2;
+	memcpy(stl + 80, &triangleCount, sizeof(triangleCount));
+	for (int t = 0; t < 2; ++t)
+	{
+		memcpy(stl + 84 + t * 50 + 12, corners[t], sizeof(corners[t]));
+	}
+	passed &= TestLoad(out, "two triangle stl", "stl", stl, sizeof(stl), true, 4, 2);
+
+	// OBJ: no bytes at all, no records, vertices without faces, a quad
+	const char cComment[] = "# nothing\n";
+	const char cPoints[] = "v 0 0 0\nv 1 0 0\n";
+	const char cQuad[] = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n";
+	passed &= TestLoad(out, "zero byte obj", "obj", "", 0, false, 0, 0);
+	passed &= TestLoad(out, "comment only obj", "obj", cComment, sizeof(cComment) - 1, true, 0, 0);
+	passed &= TestLoad(out, "faceless obj", "obj", cPoints, sizeof(cPoints) - 1, true, 2, 0);
+	passed &= TestLoad(out, "quad obj", "obj", cQuad, sizeof(cQuad) - 1, true, 4, 2);
+
+	out << (passed ? "All mesh loader cases pass" : "NOT all mesh loader cases pass") << std::endl;
+	return passed;
+}
+
+
+static bool ParseVolume(const std::string& value, VolumeParameters& volume)
+{
+	return 3 == sscanf(value.c_str(), "%dx%dx%d", &volume.voxelCountX, &volume.voxelCountY, &volume.voxelCountZ)
+		&& volume.voxelCountX >= 8 && volume.voxelCountY >= 8 && volume.voxelCountZ >= 8;
+}
+
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument(argv[i]);
+		size_t equals = argument.find('=');
+		std::string name = argument.substr(0, equals);
+		std::string value = (std::string::npos == equals) ? std::string() : argument.substr(equals + 1);
+
+		if (name == "--json") s_options.jsonPath = value;
+		else if (name == "--baseline") s_options.baselinePath = value;
+		else if (name == "--tolerance") s_options.tolerance = atof(value.c_str());
+		else if (name == "--seed") s_options.seed = (unsigned int)strtoul(value.c_str(), nullptr, 10);
+		else if (name == "--min-time") s_options.minSeconds = atof(value.c_str());
+		else if (name == "--depth") s_options.depthPath = value;
+		else if (name == "--stage") s_options.stageFilter = value;
+		else if (name == "--no-pin") s_options.pin = false;
+		else if (name == "--voxels-per-meter") s_options.volume.voxelsPerMeter = (float)atof(value.c_str());
+		else if (name == "--volume" && ParseVolume(value, s_options.volume)) {}
+		else if (name == "--simd")
+		{
+			SimdLevel level;
+			if (!ParseSimdLevel(value, level) || !SetSimdLevel(level))
+			{
+				std::cerr << "The SIMD level " << value << " is unknown or not supported here (up to "
+					<< SimdLevelName(DetectSimdLevel()) << ")" << std::endl;
+				return 1;
+			}
+		}
+		else if (name == "--self-test") s_options.selfTest = true;
+		else if (name == "--perf") s_options.perf = true;
+		else if (name == "--numa-nodes") s_options.numaNodes = atoi(value.c_str());
+		else
+		{
+			std::cerr << "Unknown or invalid option " << argument << std::endl;
+			return 1;
+		}
+	}
+
+	if (s_options.selfTest)
+	{
+		bool passed = RunSimdSelfTest(std::cout);
+		passed &= RunMeshLoaderSelfTest(std::cout);
+		return passed ? 0 : 1;
+	}
+
+	// before the thread pool starts, which sizes itself from the nodes kept
+	if (0 != s_options.numaNodes && !NumaTopology::System().UseNodes(s_options.numaNodes))
+	{
+		std::cerr << "Cannot run on " << s_options.numaNodes << " NUMA node(s) of " << NumaTopology::System().NodeCount() << std::endl;
+		return 1;
+	}
+
+	bool pinned = s_options.pin && ThreadPool::Instance().PinThreads();
+	std::cout << "FusionBenchmark: " << ThreadPool::Instance().Concurrency() << " threads" << (pinned ? " (pinned)" : "")
+		<< ", seed " << s_options.seed << ", volume " << s_options.volume.voxelCountX << "x" << s_options.volume.voxelCountY
+		<< "x" << s_options.volume.voxelCountZ << " at " << s_options.volume.voxelsPerMeter << " voxels/m, SIMD "
+		<< SimdLevelName(ActiveSimdLevel()) << std::endl;
+	std::cout << "Rows marked \"native, for\" time the native pipeline in place of that Kinect Fusion SDK call" << std::endl;
+	NumaTopology::System().Report(std::cout);
+
+	// once the pool's threads exist, so that the counters follow them too
+	if (s_options.perf)
+	{
+		std::cout << "perf counters:";
+		if (s_perf.Open())
+		{
+			for (int e = 0; e < PerfEventCount; ++e)
+			{
+				std::cout << " " << PerfEventName((PerfEvent)e) << (s_perf.Available((PerfEvent)e) ? "" : " (unavailable)");
+			}
+			std::cout << std::endl;
+		}
+		else
+		{
+			std::cout << " unavailable on this system" << std::endl;
+		}
+	}
+
+	if (!s_options.depthPath.empty())
+	{
+		std::vector<unsigned short> recorded;
+		int width = 0, height = 0;
+		if (!ReadDepthPgm(s_options.depthPath.c_str(), recorded, width, height))
+		{
+			std::cerr << "Cannot read the depth frame " << s_options.depthPath << std::endl;
+			return 1;
+		}
+		RunResolution(width, height, &recorded);
+	}
+	else
+	{
+		const int sizes[3][2] = { { 80, 60 }, { 320, 240 }, { 640, 480 } };
+		for (int i = 0; i < 3; ++i)
+		{
+			RunResolution(sizes[i][0], sizes[i][1], nullptr);
+		}
+	}
+	RunVolume();
+
+	if (!s_options.jsonPath.empty() && !WriteJson(s_options.jsonPath))
+	{
+		std::cerr << "Cannot write " << s_options.jsonPath << std::endl;
+		return 1;
+	}
+
+	if (!s_options.baselinePath.empty())
+	{
+		int regressions = CompareWithBaseline(s_options.baselinePath);
+		if (regressions < 0)
+		{
+			std::cerr << "Cannot read the baseline " << s_options.baselinePath << std::endl;
+			return 1;
+		}
+		if (regressions > 0)
+		{
+			std::cout << regressions << " stage(s) regressed" << std::endl;
+			return 2;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,587 @@
+
+#include "FusionConfig.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static double ParseDouble(const std::string& name, const std::string& value)
+{
+	char* end = nullptr;
+	double result = strtod(value.c_str(), &end);
+	if (value.empty() || *end != '\0')
+	{
+		throw std::runtime_error("Invalid value '" + value + "' for option " + name);
+	}
+	return result;
+}
+
+
+static int ParseInt(const std::string& name, const std::string& value)
+{
+	char* end = nullptr;
+	long result = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0')
+	{
+		throw std::runtime_error("Invalid value '" + value + "' for option " + name);
+	}
+	return (int)result;
+}
+
+
+static void ParseTriple(const std::string& name, const std::string& value, float triple[3])
+{
+	char trailing = 0;
+	if (3 != sscanf(value.c_str(), "%fx%fx%f%c", &triple[0], &triple[1], &triple[2], &trailing)
+		|| !(triple[0] > 0 && triple[1] > 0 && triple[2] > 0))
+	{
+		throw std::runtime_error("Invalid value '" + value + "' for option " + name + ", expected XxYxZ");
+	}
+}
+
+
+static bool ParseBool(const std::string& name, const std::string& value)
+{
+	if (value == "1" || value == "true" || value == "on")
+	{
+		return true;
+	}
+	if (value == "0" || value == "false" || value == "off")
+	{
+		return false;
+	}
+	throw std::runtime_error("Invalid value '" + value + "' for option " + name);
+}
+
+
+FusionConfig::FusionConfig()
+	: source("kinect")
+	, presentHz(60.0)
+	, previewEnabled(false)
+	, sdkShading(false)
+	, telemetryInterval(5.0)
+	, telemetryOverlay(false)
+	, traceEvents(1 << 16)
+	, headless(false)
+	, thumbnailHz(1.0)
+	, thumbnailDirectory("thumbnails")
+	, thumbnailScale(2)
+	, memoryBudgetMb(0)
+	, volumeAuto(false)
+	, simdAuto(true)
+	, simd(SimdScalar)
+{
+	// the sources without a sensor stand in for the Kinect
+	sourceSettings.frameRateHz = 30.0;
+	sourceSettings.width = 640;
+	sourceSettings.height = 480;
+	sourceSettings.frames = 0;
+}
+
+
+bool FusionConfig::SetOption(const std::string& name, const std::string& value)
+{
+	if (name == "source")
+	{
+		if (value.empty())
+		{
+			throw std::runtime_error("source must not be empty");
+		}
+		source = value;
+	}
+	else if (name == "source-rate")
+	{
+		sourceSettings.frameRateHz = ParseDouble(name, value);
+		if (sourceSettings.frameRateHz < 0)
+		{
+			throw std::runtime_error("source-rate must not be negative");
+		}
+	}
+	else if (name == "source-loop")
+	{
+		sourceSettings.loop = ParseBool(name, value);
+	}
+	else if (name == "resolution")
+	{
+		char trailing = 0;
+		if (2 != sscanf(value.c_str(), "%dx%d%c", &sourceSettings.width, &sourceSettings.height, &trailing)
+			|| sourceSettings.width < 40 || sourceSettings.height < 30)
+		{
+			throw std::runtime_error("Invalid value '" + value + "' for option " + name + ", expected WxH of at least 40x30");
+		}
+	}
+	else if (name == "synthetic-frames")
+	{
+		sourceSettings.frames = ParseInt(name, value);
+		if (sourceSettings.frames < 0)
+		{
+			throw std::runtime_error("synthetic-frames must not be negative");
+		}
+	}
+	else if (name == "synthetic-noise")
+	{
+		sourceSettings.noise = (float)ParseDouble(name, value);
+		if (sourceSettings.noise < 0)
+		{
+			throw std::runtime_error("synthetic-noise must not be negative");
+		}
+	}
+	else if (name == "synthetic-seed")
+	{
+		sourceSettings.seed = (unsigned int)ParseInt(name, value);
+	}
+	else if (name == "present-hz")
+	{
+		presentHz = ParseDouble(name, value);
+		if (presentHz < 0)
+		{
+			throw std::runtime_error("present-hz must not be negative");
+		}
+	}
+	else if (name == "preview")
+	{
+		previewEnabled = ParseBool(name, value);
+	}
+	else if (name == "preview-hz")
+	{
+		preview.updateHz = ParseDouble(name, value);
+		if (preview.updateHz <= 0)
+		{
+			throw std::runtime_error("preview-hz must be positive");
+		}
+	}
+	else if (name == "preview-blocks-per-update")
+	{
+		preview.maxBlocksPerUpdate = ParseInt(name, value);
+		if (preview.maxBlocksPerUpdate < 1)
+		{
+			throw std::runtime_error("preview-blocks-per-update must be at least 1");
+		}
+	}
+	else if (name == "preview-max-triangles")
+	{
+		preview.maxTriangles = ParseInt(name, value);
+		if (preview.maxTriangles < 1)
+		{
+			throw std::runtime_error("preview-max-triangles must be at least 1");
+		}
+	}
+	else if (name == "preview-lod-distance")
+	{
+		preview.lodDistance = (float)ParseDouble(name, value);
+		if (preview.lodDistance <= 0)
+		{
+			throw std::runtime_error("preview-lod-distance must be positive");
+		}
+	}
+	else if (name == "shading")
+	{
+		sdkShading = (value == "sdk");
+		if (!sdkShading && !ParseShadingMode(value, shading.mode))
+		{
+			throw std::runtime_error("Invalid value '" + value + "' for option " + name);
+		}
+	}
+	else if (name == "telemetry")
+	{
+		telemetryPath = value;
+	}
+	else if (name == "telemetry-interval")
+	{
+		telemetryInterval = ParseDouble(name, value);
+		if (telemetryInterval <= 0)
+		{
+			throw std::runtime_error("telemetry-interval must be positive");
+		}
+	}
+	else if (name == "telemetry-overlay")
+	{
+		telemetryOverlay = ParseBool(name, value);
+	}
+	else if (name == "trace")
+	{
+		tracePath = value;
+	}
+	else if (name == "trace-events")
+	{
+		traceEvents = ParseInt(name, value);
+		if (traceEvents < 1024)
+		{
+			throw std::runtime_error("trace-events must be at least 1024");
+		}
+	}
+	else if (name == "headless")
+	{
+		headless = ParseBool(name, value);
+	}
+	else if (name == "thumbnail-hz")
+	{
+		thumbnailHz = ParseDouble(name, value);
+		if (thumbnailHz < 0)
+		{
+			throw std::runtime_error("thumbnail-hz must not be negative");
+		}
+	}
+	else if (name == "thumbnail-dir")
+	{
+		if (value.empty())
+		{
+			throw std::runtime_error("thumbnail-dir must not be empty");
+		}
+		thumbnailDirectory = value;
+	}
+	else if (name == "thumbnail-scale")
+	{
+		thumbnailScale = ParseInt(name, value);
+		if (thumbnailScale < 1)
+		{
+			throw std::runtime_error("thumbnail-scale must be at least 1");
+		}
+	}
+	else if (name == "volume")
+	{
+		float counts[3];
+		ParseTriple(name, value, counts);
+		volume.voxelCountX = (int)counts[0];
+		volume.voxelCountY = (int)counts[1];
+		volume.voxelCountZ = (int)counts[2];
+		if (volume.voxelCountX % 32 != 0 || volume.voxelCountY % 32 != 0 || volume.voxelCountZ % 32 != 0)
+		{
+			throw std::runtime_error("volume voxel counts must be multiples of 32");
+		}
+	}
+	else if (name == "voxels-per-meter")
+	{
+		volume.voxelsPerMeter = (float)ParseDouble(name, value);
+		if (volume.voxelsPerMeter <= 0)
+		{
+			throw std::runtime_error("voxels-per-meter must be positive");
+		}
+	}
+	else if (name == "volume-auto")
+	{
+		volumeAuto = ParseBool(name, value);
+	}
+	else if (name == "volume-extent")
+	{
+		ParseTriple(name, value, volumeSizing.extent);
+	}
+	else if (name == "volume-budget")
+	{
+		volumeSizing.budgetBytes = ParseDouble(name, value) * 1024.0 * 1024.0;
+		if (volumeSizing.budgetBytes <= 0)
+		{
+			throw std::runtime_error("volume-budget must be positive");
+		}
+	}
+	else if (name == "min-voxels-per-meter")
+	{
+		volumeSizing.minVoxelsPerMeter = (float)ParseDouble(name, value);
+		if (volumeSizing.minVoxelsPerMeter <= 0)
+		{
+			throw std::runtime_error("min-voxels-per-meter must be positive");
+		}
+	}
+	else if (name == "max-voxels-per-meter")
+	{
+		volumeSizing.maxVoxelsPerMeter = (float)ParseDouble(name, value);
+		if (volumeSizing.maxVoxelsPerMeter <= 0)
+		{
+			throw std::runtime_error("max-voxels-per-meter must be positive");
+		}
+	}
+	else if (name == "lazy-integration")
+	{
+		integration.enabled = ParseBool(name, value);
+	}
+	else if (name == "lazy-min-translation")
+	{
+		integration.minTranslation = (float)ParseDouble(name, value);
+		if (integration.minTranslation < 0)
+		{
+			throw std::runtime_error("lazy-min-translation must not be negative");
+		}
+	}
+	else if (name == "lazy-min-rotation")
+	{
+		integration.minRotation = (float)ParseDouble(name, value);
+		if (integration.minRotation < 0)
+		{
+			throw std::runtime_error("lazy-min-rotation must not be negative");
+		}
+	}
+	else if (name == "lazy-min-changed")
+	{
+		integration.minChangedFraction = (float)ParseDouble(name, value);
+		if (integration.minChangedFraction < 0 || integration.minChangedFraction > 1)
+		{
+			throw std::runtime_error("lazy-min-changed must be between 0 and 1");
+		}
+	}
+	else if (name == "lazy-max-skipped")
+	{
+		integration.maxSkippedFrames = ParseInt(name, value);
+		if (integration.maxSkippedFrames < 0)
+		{
+			throw std::runtime_error("lazy-max-skipped must not be negative");
+		}
+	}
+	else if (name == "depth-filter")
+	{
+		depthFilter.bilateral = ParseBool(name, value);
+	}
+	else if (name == "depth-filter-radius")
+	{
+		depthFilter.radius = ParseInt(name, value);
+		if (depthFilter.radius < 1 || depthFilter.radius > DepthFilter::cMaxRadius)
+		{
+			throw std::runtime_error("depth-filter-radius must be between 1 and 4");
+		}
+	}
+	else if (name == "depth-filter-sigma-space")
+	{
+		depthFilter.sigmaSpace = (float)ParseDouble(name, value);
+		if (depthFilter.sigmaSpace <= 0)
+		{
+			throw std::runtime_error("depth-filter-sigma-space must be positive");
+		}
+	}
+	else if (name == "depth-filter-sigma-depth")
+	{
+		depthFilter.sigmaDepth = (float)ParseDouble(name, value);
+		if (depthFilter.sigmaDepth <= 0)
+		{
+			throw std::runtime_error("depth-filter-sigma-depth must be positive");
+		}
+	}
+	else if (name == "depth-filter-min-support")
+	{
+		depthFilter.minSupport = (float)ParseDouble(name, value);
+		if (depthFilter.minSupport < 0 || depthFilter.minSupport > 1)
+		{
+			throw std::runtime_error("depth-filter-min-support must be between 0 and 1");
+		}
+	}
+	else if (name == "temporal-median")
+	{
+		depthFilter.temporalFrames = ParseInt(name, value);
+		if (depthFilter.temporalFrames != 1 && depthFilter.temporalFrames != 3 && depthFilter.temporalFrames != 5)
+		{
+			throw std::runtime_error("temporal-median must be 1, 3 or 5");
+		}
+	}
+	else if (name == "temporal-median-gate")
+	{
+		depthFilter.temporalGate = (float)ParseDouble(name, value);
+		if (depthFilter.temporalGate < 0)
+		{
+			throw std::runtime_error("temporal-median-gate must not be negative");
+		}
+	}
+	else if (name == "point-export")
+	{
+		pointExport.directory = value;
+	}
+	else if (name == "point-export-interval")
+	{
+		pointExport.frameInterval = ParseInt(name, value);
+		if (pointExport.frameInterval < 1)
+		{
+			throw std::runtime_error("point-export-interval must be at least 1");
+		}
+	}
+	else if (name == "point-export-source")
+	{
+		if (!ParsePointExportSource(value, pointExport.source))
+		{
+			throw std::runtime_error("Invalid value '" + value + "' for option " + name + ", expected raycast or depth");
+		}
+	}
+	else if (name == "point-export-format")
+	{
+		if (!ParsePointExportFormat(value, pointExport.format))
+		{
+			throw std::runtime_error("Invalid value '" + value + "' for option " + name + ", expected ply or pcd");
+		}
+	}
+	else if (name == "point-export-voxel")
+	{
+		pointExport.voxelSize = (float)ParseDouble(name, value);
+		if (pointExport.voxelSize < 0)
+		{
+			throw std::runtime_error("point-export-voxel must not be negative");
+		}
+	}
+	else if (name == "point-export-threads")
+	{
+		pointExport.threads = ParseInt(name, value);
+		if (pointExport.threads < 1)
+		{
+			throw std::runtime_error("point-export-threads must be at least 1");
+		}
+	}
+	else if (name == "pose-log")
+	{
+		poseLogPath = value;
+	}
+	else if (name == "quality-governor")
+	{
+		governor.enabled = ParseBool(name, value);
+	}
+	else if (name == "frame-budget")
+	{
+		governor.frameBudgetMs = ParseDouble(name, value);
+		if (governor.frameBudgetMs <= 0)
+		{
+			throw std::runtime_error("frame-budget must be positive");
+		}
+	}
+	else if (name == "simd")
+	{
+		simdAuto = (value == "auto");
+		if (!simdAuto && !ParseSimdLevel(value, simd))
+		{
+			throw std::runtime_error("Invalid value '" + value + "' for option " + name + ", expected auto, scalar, sse4.1, avx2 or avx512");
+		}
+	}
+	else if (name == "config")
+	{
+		LoadFile(value);
+	}
+	else if (name == "memory-budget")
+	{
+		memoryBudgetMb = ParseDouble(name, value);
+		if (memoryBudgetMb < 0)
+		{
+			throw std::runtime_error("memory-budget must not be negative");
+		}
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+
+void FusionConfig::ParseCommandLine(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg(argv[i]);
+		if (arg.compare(0, 2, "--") != 0)
+		{
+			throw std::runtime_error("Unexpected argument " + arg);
+		}
+
+		std::string::size_type eq = arg.find('=');
+		std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+		std::string value = (eq == std::string::npos) ? "1" : arg.substr(eq + 1);
+
+		if (!SetOption(name, value))
+		{
+			throw std::runtime_error("Unknown option --" + name);
+		}
+	}
+}
+
+
+void FusionConfig::LoadFile(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		throw std::runtime_error("Cannot read the configuration file " + path);
+	}
+
+	const char* const blanks = " \t\r";
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		line = line.substr(0, line.find('#'));
+		if (std::string::npos == line.find_first_not_of(blanks))
+		{
+			continue;
+		}
+
+		std::string::size_type eq = line.find('=');
+		if (std::string::npos == eq)
+		{
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected name = value");
+		}
+		std::string name = line.substr(0, eq);
+		std::string value = line.substr(eq + 1);
+		name = name.substr(name.find_first_not_of(blanks), name.find_last_not_of(blanks) - name.find_first_not_of(blanks) + 1);
+		std::string::size_type first = value.find_first_not_of(blanks);
+		value = (std::string::npos == first) ? std::string() : value.substr(first, value.find_last_not_of(blanks) - first + 1);
+
+		if (!SetOption(name, value))
+		{
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": unknown option " + name);
+		}
+	}
+}
+
+
+void FusionConfig::Print() const
+{
+	std::cout << "Configuration:" << std::endl;
+	std::cout << "  source = " << source << std::endl;
+	std::cout << "  source-rate = " << sourceSettings.frameRateHz << std::endl;
+	std::cout << "  source-loop = " << (sourceSettings.loop ? 1 : 0) << std::endl;
+	std::cout << "  resolution = " << sourceSettings.width << "x" << sourceSettings.height << std::endl;
+	std::cout << "  synthetic-frames = " << sourceSettings.frames << std::endl;
+	std::cout << "  synthetic-noise = " << sourceSettings.noise << std::endl;
+	std::cout << "  synthetic-seed = " << sourceSettings.seed << std::endl;
+	std::cout << "  present-hz = " << presentHz << std::endl;
+	std::cout << "  preview = " << (previewEnabled ? 1 : 0) << std::endl;
+	std::cout << "  preview-hz = " << preview.updateHz << std::endl;
+	std::cout << "  preview-blocks-per-update = " << preview.maxBlocksPerUpdate << std::endl;
+	std::cout << "  preview-max-triangles = " << preview.maxTriangles << std::endl;
+	std::cout << "  preview-lod-distance = " << preview.lodDistance << std::endl;
+	std::cout << "  shading = " << (sdkShading ? "sdk" : ShadingModeName(shading.mode)) << std::endl;
+	std::cout << "  telemetry = " << telemetryPath << std::endl;
+	std::cout << "  telemetry-interval = " << telemetryInterval << std::endl;
+	std::cout << "  telemetry-overlay = " << (telemetryOverlay ? 1 : 0) << std::endl;
+	std::cout << "  trace = " << tracePath << std::endl;
+	std::cout << "  trace-events = " << traceEvents << std::endl;
+	std::cout << "  headless = " << (headless ? 1 : 0) << std::endl;
+	std::cout << "  thumbnail-hz = " << thumbnailHz << std::endl;
+	std::cout << "  thumbnail-dir = " << thumbnailDirectory << std::endl;
+	std::cout << "  thumbnail-scale = " << thumbnailScale << std::endl;
+	std::cout << "  memory-budget = " << memoryBudgetMb << std::endl;
+	std::cout << "  volume = " << volume.voxelCountX << "x" << volume.voxelCountY << "x" << volume.voxelCountZ << std::endl;
+	std::cout << "  voxels-per-meter = " << volume.voxelsPerMeter << std::endl;
+	std::cout << "  volume-auto = " << (volumeAuto ? 1 : 0) << std::endl;
+	std::cout << "  volume-extent = " << volumeSizing.extent[0] << "x" << volumeSizing.extent[1] << "x" << volumeSizing.extent[2] << std::endl;
+	std::cout << "  volume-budget = " << volumeSizing.budgetBytes / (1024.0 * 1024.0) << std::endl;
+	std::cout << "  min-voxels-per-meter = " << volumeSizing.minVoxelsPerMeter << std::endl;
+	std::cout << "  max-voxels-per-meter = " << volumeSizing.maxVoxelsPerMeter << std::endl;
+	std::cout << "  lazy-integration = " << (integration.enabled ? 1 : 0) << std::endl;
+	std::cout << "  lazy-min-translation = " << integration.minTranslation << std::endl;
+	std::cout << "  lazy-min-rotation = " << integration.minRotation << std::endl;
+	std::cout << "  lazy-min-changed = " << integration.minChangedFraction << std::endl;
+	std::cout << "  lazy-max-skipped = " << integration.maxSkippedFrames << std::endl;
+	std::cout << "  depth-filter = " << (depthFilter.bilateral ? 1 : 0) << std::endl;
+	std::cout << "  depth-filter-radius = " << depthFilter.radius << std::endl;
+	std::cout << "  depth-filter-sigma-space = " << depthFilter.sigmaSpace << std::endl;
+	std::cout << "  depth-filter-sigma-depth = " << depthFilter.sigmaDepth << std::endl;
+	std::cout << "  depth-filter-min-support = " << depthFilter.minSupport << std::endl;
+	std::cout << "  temporal-median = " << depthFilter.temporalFrames << std::endl;
+	std::cout << "  temporal-median-gate = " << depthFilter.temporalGate << std::endl;
+	std::cout << "  point-export = " << pointExport.directory << std::endl;
+	std::cout << "  point-export-interval = " << pointExport.frameInterval << std::endl;
+	std::cout << "  point-export-source = " << PointExportSourceName(pointExport.source) << std::endl;
+	std::cout << "  point-export-format = " << PointExportFormatName(pointExport.format) << std::endl;
+	std::cout << "  point-export-voxel = " << pointExport.voxelSize << std::endl;
+	std::cout << "  point-export-threads = " << pointExport.threads << std::endl;
+	std::cout << "  pose-log = " << poseLogPath << std::endl;
+	std::cout << "  quality-governor = " << (governor.enabled ? 1 : 0) << std::endl;
+	std::cout << "  frame-budget = " << governor.frameBudgetMs << std::endl;
+	std::cout << "  simd = " << (simdAuto ? "auto" : SimdLevelName(simd)) << std::endl;
+}
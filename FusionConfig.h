@@ -0,0 +1,180 @@
+#pragma once
+
+#include "CpuFeatures.h"
+#include "DepthFilter.h"
+#include "DepthSource.h"
+#include "IntegrationPolicy.h"
+#include "MeshPreview.h"
+#include "PointCloudExporter.h"
+#include "PointCloudShader.h"
+#include "QualityGovernor.h"
+#include "VolumeSizing.h"
+
+#include <string>
+
+/// <summary>
+/// Runtime options of the fusion application.
+/// Every option can be given on the command line as --name=value, or in a file of name = value
+/// lines read with --config=file.
+/// </summary>
+class FusionConfig
+{
+public:
+	FusionConfig();
+
+	/// <summary>
+	/// --source=kinect|synthetic|directory: the Kinect, the synthetic scene, or a recorded sequence.
+	/// The sources without a sensor deliver --source-rate frames per second and, with
+	/// --source-loop=1, start over at the end. Frames are --resolution=WxH pixels: 80x60, 320x240 or
+	/// 640x480 for the Kinect, any size for the synthetic scene. The synthetic scene is --synthetic-frames long (0 = endless), with
+	/// --synthetic-noise and --synthetic-seed.
+	/// </summary>
+	std::string                 source;
+	DepthSourceSettings         sourceSettings;
+
+	/// <summary>
+	/// Presentation rate of the viewer in Hz.
+	/// 0 presents every new frame as fast as the swap chain (vsync) allows.
+	/// </summary>
+	double                      presentHz;
+
+	/// <summary>
+	/// Show the live 3D mesh preview from the start (toggle with 'p')
+	/// </summary>
+	bool                        previewEnabled;
+
+	/// <summary>
+	/// Limits of the live mesh preview: --preview-hz, --preview-blocks-per-update,
+	/// --preview-max-triangles, --preview-lod-distance
+	/// </summary>
+	MeshPreviewSettings         preview;
+
+	/// <summary>
+	/// --shading=lambert|phong|normals|depth shades the raycast natively,
+	/// --shading=sdk keeps NuiFusionShadePointCloud (the Kinect source, in the SDK volume, only)
+	/// </summary>
+	bool                        sdkShading;
+	ShadingParameters           shading;
+
+	/// <summary>
+	/// Telemetry snapshot file (.json or .csv, empty = none), rewritten every telemetryInterval seconds
+	/// and at exit
+	/// </summary>
+	std::string                 telemetryPath;
+	double                      telemetryInterval;
+
+	/// <summary>
+	/// Show the stage latencies over the live image (toggle with 'o')
+	/// </summary>
+	bool                        telemetryOverlay;
+
+	/// <summary>
+	/// Chrome trace file; when set, tracing runs from startup and is written at exit.
+	/// 'c' starts and stops a capture at runtime either way.
+	/// </summary>
+	std::string                 tracePath;
+
+	/// <summary>
+	/// Trace ring size per thread, in events; older events are overwritten
+	/// </summary>
+	int                         traceEvents;
+
+	/// <summary>
+	/// Run without a window or interactor. Frames and the mesh preview are rendered offscreen
+	/// and written as thumbnails; stop with Ctrl+C.
+	/// </summary>
+	bool                        headless;
+
+	/// <summary>
+	/// Headless output: thumbnails per second (0 = none), output directory and downscale factor
+	/// </summary>
+	double                      thumbnailHz;
+	std::string                 thumbnailDirectory;
+	int                         thumbnailScale;
+
+	/// <summary>
+	/// Memory budget in MB for the accounted buffers (0 = unlimited). Past it the optional caches,
+	/// the mesh preview and the thumbnail buffers, shrink or are refused; 'm' prints the usage.
+	/// </summary>
+	double                      memoryBudgetMb;
+
+	/// <summary>
+	/// Reconstruction volume: --volume=XxYxZ voxels at --voxels-per-meter. With --volume-auto=1 it
+	/// is sized instead to the finest resolution at which --volume-extent=XxYxZ (in m) fits in
+	/// --volume-budget (in MB), between --min-voxels-per-meter and --max-voxels-per-meter.
+	/// A volume the SDK cannot create is shrunk until it can.
+	/// </summary>
+	VolumeParameters            volume;
+	bool                        volumeAuto;
+	VolumeSizingRequest         volumeSizing;
+
+	/// <summary>
+	/// --lazy-integration=1 integrates frames in which neither the camera (--lazy-min-translation
+	/// in m, --lazy-min-rotation in rad) nor the depth image (--lazy-min-changed fraction of the
+	/// pixels) changed only every --lazy-max-skipped + 1 frames; tracking still runs on every frame
+	/// </summary>
+	IntegrationPolicySettings   integration;
+
+	/// <summary>
+	/// --depth-filter=1 smooths the depth before tracking and integration with a bilateral filter
+	/// of --depth-filter-radius pixels (up to 4), --depth-filter-sigma-space (in pixels) and
+	/// --depth-filter-sigma-depth (in m at 1 m), dropping the pixels with less than
+	/// --depth-filter-min-support of their neighbours' weight. --temporal-median=3 or 5 first takes
+	/// the median of each pixel over that many frames, leaving out the earlier depths further than
+	/// --temporal-median-gate (in m at 1 m) from the current one.
+	/// </summary>
+	DepthFilterSettings         depthFilter;
+
+	/// <summary>
+	/// --point-export=dir writes the world space points of every --point-export-interval-th frame to
+	/// dir as --point-export-format=ply|pcd: --point-export-source=raycast takes the raycast of the
+	/// model, --point-export-source=depth the frame's depth placed with the tracked pose. The points
+	/// are averaged over a grid of --point-export-voxel (in m, 0 = none) by --point-export-threads
+	/// threads of the exporter's own, in the background; frames that arrive while the writer is
+	/// busy are dropped and counted.
+	/// </summary>
+	PointCloudExportSettings    pointExport;
+
+	/// <summary>
+	/// Binary log of every frame's pose, tracking status and residual (empty = none), written in the
+	/// background; PoseLogConvert turns it into a TUM or KITTI trajectory
+	/// </summary>
+	std::string                 poseLogPath;
+
+	/// <summary>
+	/// --quality-governor=1 keeps frames within --frame-budget (in ms) by lowering the tracking
+	/// iterations, the integrated frames and the frames raycast and shown, and raises them back when
+	/// there is room. Decisions are logged to the telemetry events.
+	/// </summary>
+	QualityGovernorSettings     governor;
+
+	/// <summary>
+	/// --simd=scalar|sse4.1|avx2|avx512 runs the vectorized kernels at that level instead of the
+	/// highest one the CPU supports (--simd=auto), to compare them
+	/// </summary>
+	bool                        simdAuto;
+	SimdLevel                   simd;
+
+	/// <summary>
+	/// Parse --name=value arguments into this configuration
+	/// </summary>
+	/// <remarks>Throws std::runtime_error on unknown options or malformed values</remarks>
+	void ParseCommandLine(int argc, char* argv[]);
+
+	/// <summary>
+	/// Set a single option by name
+	/// </summary>
+	/// <returns>false when the option name is unknown</returns>
+	bool SetOption(const std::string& name, const std::string& value);
+
+	/// <summary>
+	/// Read name = value lines, # starts a comment
+	/// </summary>
+	/// <remarks>Throws std::runtime_error if the file cannot be read or holds a bad option</remarks>
+	void LoadFile(const std::string& path);
+
+	/// <summary>
+	/// Print the options and their current values
+	/// </summary>
+	void Print() const;
+};
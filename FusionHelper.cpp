@@ -2,6 +2,9 @@
 #include "FusionHelper.h"
 #define _USE_MATH_DEFINES
 
+#include <iostream>
+#include <string>
+
 
 
 
@@ -114,9 +117,9 @@ HRESULT WriteBinarySTLMeshFile(INuiFusionMesh *mesh, char *FileName, bool flipYZ
 
     //show the information of the mesh
 	std::string str(FileName);
-	cout << "Mesh: " << str << endl;
-	cout << "Vertices: "<< numVertices << endl;
-	cout << "Face: "<< numTriangles << endl;
+	std::cout << "Mesh: " << str << std::endl;
+	std::cout << "Vertices: "<< numVertices << std::endl;
+	std::cout << "Face: "<< numTriangles << std::endl;
 
 	return hr;
 }
@@ -249,58 +252,9 @@ HRESULT WriteAsciiObjMeshFile(INuiFusionMesh *mesh, char* FileName, bool flipYZ)
 
 	//show the information of the mesh
 	std::string str(FileName);
-	cout << "Mesh: " << str << endl;
-	cout << "Vertices: " << numVertices << endl;
-	cout << "Face: " << numTriangles << endl;
+	std::cout << "Mesh: " << str << std::endl;
+	std::cout << "Vertices: " << numVertices << std::endl;
+	std::cout << "Face: " << numTriangles << std::endl;
 
 	return hr;
 }
-
-
-
-//function to read stl or obj file
-bool ReadModelFile(char * filename, KinectFusionMeshTypes MeshType)
-{
-
-	// Visualize
-	vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
-
-
-	if (MeshType == Obj)
-	{
-		vtkSmartPointer<vtkOBJReader> reader = vtkSmartPointer<vtkOBJReader>::New();
-		reader->SetFileName(filename);
-		reader->Update();
-		mapper->SetInputConnection(reader->GetOutputPort());
-	}
-
-	else if (MeshType == Stl)
-	{
-		vtkSmartPointer<vtkSTLReader> reader = vtkSmartPointer<vtkSTLReader>::New();
-			reader->SetFileName(filename);
-		reader->Update();
-		mapper->SetInputConnection(reader->GetOutputPort());
-	}
-	else
-	{
-		return false;
-	}	
-
-	vtkSmartPointer<vtkActor> actor =vtkSmartPointer<vtkActor>::New();
-	actor->SetMapper(mapper);
-
-	vtkSmartPointer<vtkRenderer> renderer =vtkSmartPointer<vtkRenderer>::New();
-	vtkSmartPointer<vtkRenderWindow> renderWindow =vtkSmartPointer<vtkRenderWindow>::New();
-	renderWindow->AddRenderer(renderer);
-	vtkSmartPointer<vtkRenderWindowInteractor> renderWindowInteractor =vtkSmartPointer<vtkRenderWindowInteractor>::New();
-	renderWindowInteractor->SetRenderWindow(renderWindow);
-
-	renderer->AddActor(actor);
-	renderer->SetBackground(.3, .6, .3); // Background color green
-
-	renderWindow->Render();
-	renderWindowInteractor->Start();
-	cout << "Reading file successed " <<  endl;
-	return true;
-
-}
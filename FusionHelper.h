@@ -1,7 +1,9 @@
 #pragma once
 
+#include <windows.h>
+#include <NuiApi.h>
 #include <NuiKinectFusionApi.h>
-#include "vtkImageRender.h"
+#include "FusionMath.h"
 #include <vector>
 #include <stdio.h>
 #include <string.h>
@@ -50,7 +52,13 @@ HRESULT WriteAsciiObjMeshFile(INuiFusionMesh *mesh, char* FileName, bool flipYZ
 /// Set Identity in a Matrix4
 void SetIdentityMatrix(Matrix4 &mat);
 
-
-//read model File 
-bool ReadModelFile(char * filename, KinectFusionMeshTypes MeshType);
-
+/// <summary>
+/// Matrix4 as a Mat4; both have the same layout
+/// </summary>
+inline Mat4 ToMat4(const Matrix4& mat)
+{
+	static_assert(sizeof(Mat4) == sizeof(Matrix4), "Mat4 must match the layout of Matrix4");
+	Mat4 result;
+	memcpy(&result, &mat, sizeof(result));
+	return result;
+}
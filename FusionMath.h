@@ -0,0 +1,137 @@
+#pragma once
+
+#include <math.h>
+
+/// <summary>
+/// 4x4 matrix with the memory layout of the Kinect Fusion Matrix4: row-major, applied to
+/// row vectors (p' = p * M), so the translation lives in M41, M42, M43.
+/// </summary>
+struct Mat4
+{
+	float M11, M12, M13, M14;
+	float M21, M22, M23, M24;
+	float M31, M32, M33, M34;
+	float M41, M42, M43, M44;
+};
+
+/// <summary>
+/// Set Identity in a Mat4
+/// </summary>
+inline void SetIdentity(Mat4& mat)
+{
+	mat.M11 = 1; mat.M12 = 0; mat.M13 = 0; mat.M14 = 0;
+	mat.M21 = 0; mat.M22 = 1; mat.M23 = 0; mat.M24 = 0;
+	mat.M31 = 0; mat.M32 = 0; mat.M33 = 1; mat.M34 = 0;
+	mat.M41 = 0; mat.M42 = 0; mat.M43 = 0; mat.M44 = 1;
+}
+
+/// <summary>
+/// p' = p * M for a point (w = 1)
+/// </summary>
+inline void TransformPoint(const Mat4& m, const float p[3], float out[3])
+{
+	float x = p[0], y = p[1], z = p[2];
+	out[0] = x * m.M11 + y * m.M21 + z * m.M31 + m.M41;
+	out[1] = x * m.M12 + y * m.M22 + z * m.M32 + m.M42;
+	out[2] = x * m.M13 + y * m.M23 + z * m.M33 + m.M43;
+}
+
+/// <summary>
+/// v' = v * M for a direction (w = 0)
+/// </summary>
+inline void TransformVector(const Mat4& m, const float v[3], float out[3])
+{
+	float x = v[0], y = v[1], z = v[2];
+	out[0] = x * m.M11 + y * m.M21 + z * m.M31;
+	out[1] = x * m.M12 + y * m.M22 + z * m.M32;
+	out[2] = x * m.M13 + y * m.M23 + z * m.M33;
+}
+
+/// <summary>
+/// a * b: applying the result equals applying a, then b
+/// </summary>
+inline Mat4 Multiply(const Mat4& a, const Mat4& b)
+{
+	const float* pa = &a.M11;
+	const float* pb = &b.M11;
+	Mat4 r;
+	float* pr = &r.M11;
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			pr[i * 4 + j] = pa[i * 4 + 0] * pb[0 * 4 + j] + pa[i * 4 + 1] * pb[1 * 4 + j]
+				+ pa[i * 4 + 2] * pb[2 * 4 + j] + pa[i * 4 + 3] * pb[3 * 4 + j];
+		}
+	}
+	return r;
+}
+
+/// <summary>
+/// Inverse of an affine transform (last column 0, 0, 0, 1)
+/// </summary>
+inline Mat4 InverseAffine(const Mat4& m)
+{
+	// inverse of the upper 3x3 by cofactors
+	float c11 = m.M22 * m.M33 - m.M23 * m.M32;
+	float c12 = m.M23 * m.M31 - m.M21 * m.M33;
+	float c13 = m.M21 * m.M32 - m.M22 * m.M31;
+	float det = m.M11 * c11 + m.M12 * c12 + m.M13 * c13;
+	float inv = (det != 0) ? 1.0f / det : 0.0f;
+
+	Mat4 r;
+	r.M11 = c11 * inv;
+	r.M12 = (m.M13 * m.M32 - m.M12 * m.M33) * inv;
+	r.M13 = (m.M12 * m.M23 - m.M13 * m.M22) * inv;
+	r.M21 = c12 * inv;
+	r.M22 = (m.M11 * m.M33 - m.M13 * m.M31) * inv;
+	r.M23 = (m.M13 * m.M21 - m.M11 * m.M23) * inv;
+	r.M31 = c13 * inv;
+	r.M32 = (m.M12 * m.M31 - m.M11 * m.M32) * inv;
+	r.M33 = (m.M11 * m.M22 - m.M12 * m.M21) * inv;
+	r.M14 = 0; r.M24 = 0; r.M34 = 0; r.M44 = 1;
+
+	// t' = -t * R^-1
+	float t[3] = { -m.M41, -m.M42, -m.M43 };
+	float it[3];
+	TransformVector(r, t, it);
+	r.M41 = it[0]; r.M42 = it[1]; r.M43 = it[2];
+	return r;
+}
+
+/// <summary>
+/// Position of the camera in world space for a world-to-camera transform
+/// </summary>
+inline void CameraPosition(const Mat4& worldToCamera, float out[3])
+{
+	Mat4 cameraToWorld = InverseAffine(worldToCamera);
+	out[0] = cameraToWorld.M41;
+	out[1] = cameraToWorld.M42;
+	out[2] = cameraToWorld.M43;
+}
+
+/// <summary>
+/// Pinhole camera intrinsics normalized by the image size, like NUI_FUSION_CAMERA_PARAMETERS:
+/// a camera space point (x, y, z) projects to u = fx * x / z + px, v = fy * y / z + py in [0, 1].
+/// </summary>
+struct CameraIntrinsics
+{
+	float focalLengthX;
+	float focalLengthY;
+	float principalPointX;
+	float principalPointY;
+};
+
+/// <summary>
+/// Intrinsics of the Kinect for Windows depth camera
+/// (NUI_KINECT_DEPTH_NORM_FOCAL_LENGTH_X/Y, centered principal point)
+/// </summary>
+inline CameraIntrinsics KinectDepthIntrinsics()
+{
+	CameraIntrinsics intrinsics;
+	intrinsics.focalLengthX = 0.72113f;
+	intrinsics.focalLengthY = 0.96104f;
+	intrinsics.principalPointX = 0.5f;
+	intrinsics.principalPointY = 0.5f;
+	return intrinsics;
+}
@@ -0,0 +1,283 @@
+
+#include "FusionPipeline.h"
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <string.h>
+
+
+static const StageId s_stageFusionFrame = Telemetry::Instance().RegisterStage("fusion-frame");
+static const StageId s_stageDepthFloat = Telemetry::Instance().RegisterStage("depth-float");
+static const StageId s_stageDepthFilter = Telemetry::Instance().RegisterStage("depth-filter");
+static const StageId s_stageProcessFrame = Telemetry::Instance().RegisterStage("process-frame");
+static const StageId s_stageAlign = Telemetry::Instance().RegisterStage("align");
+static const StageId s_stageIntegrate = Telemetry::Instance().RegisterStage("integrate");
+static const StageId s_stagePointCloud = Telemetry::Instance().RegisterStage("point-cloud");
+static const CounterId s_counterFusedFrames = Telemetry::Instance().RegisterCounter("fused-frames");
+static const CounterId s_counterIntegratedFrames = Telemetry::Instance().RegisterCounter("integrated-frames");
+static const CounterId s_counterSkippedIntegrations = Telemetry::Instance().RegisterCounter("skipped-integrations");
+static const CounterId s_counterLostFrames = Telemetry::Instance().RegisterCounter("lost-frames");
+static const CounterId s_counterResets = Telemetry::Instance().RegisterCounter("resets");
+
+
+FusionPipelineParameters::FusionPipelineParameters()
+	: truncationDistance(0.03f)
+	, minDepth(0.35f)
+	, maxDepth(8.0f)
+	, mirrorDepth(false)
+	, maxIntegrationWeight(200)
+	, pyramidLevels(3)
+	, resetOnLostFrames(100)
+{
+}
+
+
+FusionPipeline::FusionPipeline()
+	: m_width(0)
+	, m_height(0)
+	, m_intrinsics(KinectDepthIntrinsics())
+	, m_frameCount(0)
+	, m_lostFrameCount(0)
+{
+	SetIdentity(m_worldToCamera);
+}
+
+
+/// <summary>
+/// Pyramid levels to track on; coarse levels below 20 pixels are too small to track
+/// </summary>
+static int TrackingLevels(const FusionPipelineParameters& parameters, int height)
+{
+	int levels = 1;
+	while (levels < parameters.pyramidLevels && levels < IcpParameters::cMaxLevels && (height >> levels) >= 20)
+	{
+		++levels;
+	}
+	return levels;
+}
+
+
+size_t FusionPipeline::ScratchBytes(const FusionPipelineParameters& parameters, int width, int height)
+{
+	// the float depth, then the half resolution raycast of the lowest quality level
+	(void)parameters;
+	return (size_t)width * height * sizeof(float) + FrameArena::cAlignment
+		+ (size_t)((width + 1) / 2) * ((height + 1) / 2) * 6 * sizeof(float) + FrameArena::cAlignment;
+}
+
+
+static double MillisecondsSince(Timing::Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Timing::Clock::now() - start).count();
+}
+
+
+/// <summary>
+/// Raycast at 1/step of the resolution, repeating every point over a step x step block of the
+/// full resolution point cloud; the intrinsics are normalized, so they hold at any resolution
+/// </summary>
+static void RaycastAtStep(const TsdfVolume& volume, const Mat4& worldToCamera, const CameraIntrinsics& intrinsics,
+	int width, int height, int step, FrameArena& scratch, float* pPoints)
+{
+	if (step <= 1)
+	{
+		volume.Raycast(worldToCamera, intrinsics, width, height, pPoints);
+		return;
+	}
+
+	const int lowWidth = (width + step - 1) / step;
+	const int lowHeight = (height + step - 1) / step;
+	ArenaPtr<float> low = scratch.AllocateArray<float>((size_t)lowWidth * lowHeight * 6);
+	volume.Raycast(worldToCamera, intrinsics, lowWidth, lowHeight, low.get());
+
+	const size_t rowFloats = (size_t)width * 6;
+	for (int y = 0; y < height; ++y)
+	{
+		float* pRow = pPoints + y * rowFloats;
+		if (0 != y % step)
+		{
+			memcpy(pRow, pRow - rowFloats, rowFloats * sizeof(float));
+			continue;
+		}
+		const float* pLow = low.get() + (size_t)(y / step) * lowWidth * 6;
+		for (int x = 0; x < width; ++x)
+		{
+			memcpy(pRow + x * 6, pLow + (x / step) * 6, 6 * sizeof(float));
+		}
+	}
+}
+
+
+void FusionPipeline::Initialize(const FusionPipelineParameters& parameters, int width, int height)
+{
+	m_parameters = parameters;
+	m_width = width;
+	m_height = height;
+
+	int levels = TrackingLevels(parameters, height);
+
+	m_volume.Initialize(parameters.volume, parameters.truncationDistance);
+	m_pyramid.Resize(width, height, levels);
+	m_frameMaps.Resize(width, height, levels);
+	m_tracker.Resize(width, height, levels);
+	m_integrationPolicy.Initialize(parameters.integration, width, height);
+	m_depthFilter.Initialize(parameters.depthFilter, width, height);
+	SetQuality(m_quality);
+	m_scratch.Reset();
+	m_scratch.Reserve(ScratchBytes(parameters, width, height));
+	m_pointCloud.assign((size_t)width * height * 6, 0.0f);
+	Reset();
+}
+
+
+void FusionPipeline::Reset()
+{
+	m_volume.Reset();
+	std::fill(m_pointCloud.begin(), m_pointCloud.end(), 0.0f);
+	m_integrationPolicy.Reset();
+	m_depthFilter.Reset();
+	SetIdentity(m_worldToCamera);
+	m_frameCount = 0;
+	m_lostFrameCount = 0;
+}
+
+
+void FusionPipeline::SetQuality(const QualityLevel& quality)
+{
+	m_quality = quality;
+
+	IcpParameters icp = m_parameters.icp;
+	for (int level = 0; level < IcpParameters::cMaxLevels; ++level)
+	{
+		if (icp.iterations[level] > 0)
+		{
+			int iterations = (int)(icp.iterations[level] * quality.iterationScale + 0.5f);
+			icp.iterations[level] = (iterations > 1) ? iterations : 1;
+		}
+	}
+	// keep the coarsest level whatever the quality
+	for (int level = 0; level < quality.skippedTrackingLevels && level + 1 < m_pyramid.Levels(); ++level)
+	{
+		icp.iterations[level] = 0;
+	}
+	m_tracker.SetParameters(icp);
+	m_integrationPolicy.SetMinInterval(quality.integrationInterval);
+}
+
+
+FusionFrameResult FusionPipeline::ProcessFrame(const unsigned short* pDepthMm)
+{
+	ScopedStageTimer frameTimer(s_stageFusionFrame);
+
+	FusionFrameResult result;
+	result.tracked = false;
+	result.integrated = false;
+	result.reset = false;
+	result.icp.tracked = false;
+	result.icp.iterations = 0;
+	result.icp.inliers = 0;
+	result.icp.residual = 0.0f;
+	result.filterMs = 0;
+	result.trackingMs = 0;
+	result.integrationMs = 0;
+	result.raycastMs = 0;
+
+	ArenaPtr<float> depth = m_scratch.AllocateArray<float>((size_t)m_width * m_height);
+	{
+		ScopedStageTimer stageTimer(s_stageDepthFloat);
+		ConvertDepthToFloat(pDepthMm, m_width, m_height, m_parameters.minDepth, m_parameters.maxDepth,
+			m_parameters.mirrorDepth, depth.get());
+	}
+
+	if (m_depthFilter.Settings().Enabled())
+	{
+		ScopedStageTimer stageTimer(s_stageDepthFilter);
+		Timing::Clock::time_point start = Timing::Clock::now();
+		m_depthFilter.Apply(depth.get());
+		result.filterMs = MillisecondsSince(start);
+	}
+
+	{
+		ScopedStageTimer stageTimer(s_stageProcessFrame);
+
+		// the maps of a level are computed when first read, by tracking or by FrameMaps
+		m_pyramid.Build(depth.get());
+		m_frameMaps.SetFrame(m_pyramid, m_intrinsics);
+
+		// like ProcessFrame, the first frame after a reset defines the model and is not tracked
+		if (0 == m_frameCount)
+		{
+			result.tracked = true;
+		}
+		else
+		{
+			ScopedStageTimer alignTimer(s_stageAlign);
+			Timing::Clock::time_point start = Timing::Clock::now();
+			Mat4 pose = m_worldToCamera;
+			result.icp = m_tracker.Track(m_frameMaps, m_intrinsics, m_pointCloud.data(), m_worldToCamera, pose);
+			result.tracked = result.icp.tracked;
+			if (result.tracked)
+			{
+				m_worldToCamera = pose;
+			}
+			result.trackingMs = MillisecondsSince(start);
+		}
+
+		if (result.tracked)
+		{
+			if (m_integrationPolicy.Decide(m_worldToCamera, pDepthMm))
+			{
+				ScopedStageTimer integrateTimer(s_stageIntegrate);
+				Timing::Clock::time_point start = Timing::Clock::now();
+				m_volume.Integrate(depth.get(), m_width, m_height, m_intrinsics, m_worldToCamera,
+					m_parameters.maxIntegrationWeight);
+				result.integrated = true;
+				result.integrationMs = MillisecondsSince(start);
+				Telemetry::Instance().Add(s_counterIntegratedFrames);
+			}
+			else
+			{
+				Telemetry::Instance().Add(s_counterSkippedIntegrations);
+			}
+			m_lostFrameCount = 0;
+		}
+		else
+		{
+			m_lostFrameCount++;
+			Telemetry::Instance().Add(s_counterLostFrames);
+		}
+	}
+
+	if (m_parameters.resetOnLostFrames > 0 && m_lostFrameCount >= m_parameters.resetOnLostFrames)
+	{
+		m_scratch.Reset();
+		Reset();
+		result.reset = true;
+		Telemetry::Instance().Add(s_counterResets);
+		return result;
+	}
+
+	// raycast all the time, even when tracking failed, so the next frame can try again
+	{
+		ScopedStageTimer stageTimer(s_stagePointCloud);
+		Timing::Clock::time_point start = Timing::Clock::now();
+		RaycastAtStep(m_volume, m_worldToCamera, m_intrinsics, m_width, m_height, m_quality.raycastStep, m_scratch,
+			m_pointCloud.data());
+		result.raycastMs = MillisecondsSince(start);
+	}
+
+	// the per-frame buffers are not needed past this point
+	m_scratch.Reset();
+
+	m_frameCount++;
+	Telemetry::Instance().Add(s_counterFusedFrames);
+	return result;
+}
+
+
+size_t FusionPipeline::MemoryBytes() const
+{
+	return m_volume.MemoryBytes() + m_pyramid.MemoryBytes() + m_frameMaps.MemoryBytes() + m_scratch.Capacity()
+		+ m_integrationPolicy.MemoryBytes() + m_depthFilter.MemoryBytes()
+		+ m_pointCloud.capacity() * sizeof(float);
+}
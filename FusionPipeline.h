@@ -0,0 +1,176 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "DepthProcessing.h"
+#include "DepthFilter.h"
+#include "IcpTracker.h"
+#include "TsdfVolume.h"
+#include "FrameArena.h"
+#include "IntegrationPolicy.h"
+#include "QualityGovernor.h"
+
+#include <vector>
+
+/// <summary>
+/// Settings of the native pipeline; the defaults match the Kinect Fusion ones used by DepthSensor
+/// </summary>
+struct FusionPipelineParameters
+{
+	VolumeParameters            volume;
+	float                       truncationDistance;	// m
+
+	/// <summary>
+	/// Depths outside [minDepth, maxDepth] (in m) are ignored
+	/// </summary>
+	float                       minDepth;
+	float                       maxDepth;
+	bool                        mirrorDepth;
+
+	/// <summary>
+	/// Denoising of the float depth before tracking and integration; off by default
+	/// </summary>
+	DepthFilterSettings         depthFilter;
+
+	unsigned short              maxIntegrationWeight;
+	int                         pyramidLevels;
+	IcpParameters               icp;
+
+	/// <summary>
+	/// Which tracked frames are integrated; by default still frames are integrated at a reduced rate
+	/// </summary>
+	IntegrationPolicySettings   integration;
+
+	/// <summary>
+	/// Clear the volume after this many consecutive lost frames; 0 never resets
+	/// </summary>
+	int                         resetOnLostFrames;
+
+	FusionPipelineParameters();
+};
+
+/// <summary>
+/// What happened to one frame
+/// </summary>
+struct FusionFrameResult
+{
+	bool                        tracked;
+	bool                        integrated;		// false when the frame was not tracked or the policy skipped it
+	bool                        reset;				// the volume was cleared after too many lost frames
+	IcpResult                   icp;
+
+	/// <summary>
+	/// Time spent filtering the depth, tracking, integrating and raycasting, in ms, for the quality governor
+	/// </summary>
+	double                      filterMs;
+	double                      trackingMs;
+	double                      integrationMs;
+	double                      raycastMs;
+};
+
+/// <summary>
+/// Native, platform neutral counterpart of DepthSensor::processDepth: depth conversion, tracking
+/// against the model, integration and the point cloud of the model from the new pose, which is
+/// both the image to shade and the tracking reference of the next frame. Each step is timed into
+/// the telemetry stage of the same name as in DepthSensor, plus "align" and "integrate" for the
+/// two halves of process-frame, and "depth-filter" when a depth filter is set. Tracking runs on every frame, integration on the frames the
+/// integration policy picks. Per-frame buffers come from a frame arena sized by Initialize, so
+/// after the first frames ProcessFrame does not touch the heap.
+/// </summary>
+class FusionPipeline
+{
+public:
+	FusionPipeline();
+
+	/// <summary>
+	/// Allocate the volume and every per-frame buffer for depth frames of the given size
+	/// </summary>
+	void Initialize(const FusionPipelineParameters& parameters, int width, int height);
+
+	/// <summary>
+	/// Clear the volume and put the camera back at the world origin, like ResetReconstruction
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Run one depth frame through the pipeline
+	/// </summary>
+	/// <param name="pDepthMm">width * height depths in mm, 0 = no reading</param>
+	FusionFrameResult ProcessFrame(const unsigned short* pDepthMm);
+
+	/// <summary>
+	/// Run the following frames at a quality level of the quality governor: fewer ICP iterations
+	/// and pyramid levels, a raycast at lower resolution whose points are repeated to the full
+	/// size, fewer integrated frames. The display interval is for the caller to apply.
+	/// </summary>
+	void SetQuality(const QualityLevel& quality);
+	const QualityLevel& Quality() const { return m_quality; }
+
+	const FusionPipelineParameters& Parameters() const { return m_parameters; }
+	int Width() const { return m_width; }
+	int Height() const { return m_height; }
+
+	const Mat4& WorldToCamera() const { return m_worldToCamera; }
+
+	/// <summary>
+	/// World space position and normal per pixel (6 floats), as seen from WorldToCamera
+	/// </summary>
+	const float* PointCloud() const { return m_pointCloud.data(); }
+
+	/// <summary>
+	/// Depth in m of the last frame, filtered, as it was tracked and integrated
+	/// </summary>
+	const float* FrameDepth() const { return m_pyramid.Level(0); }
+	const CameraIntrinsics& Intrinsics() const { return m_intrinsics; }
+
+	const TsdfVolume& Volume() const { return m_volume; }
+
+	/// <summary>
+	/// Vertex and normal maps of the last frame, in camera space, shared with tracking: a level
+	/// tracking did not compute is computed on the first call to Level
+	/// </summary>
+	VertexNormalMaps& FrameMaps() { return m_frameMaps; }
+
+	/// <summary>
+	/// Integration decisions since the last reset
+	/// </summary>
+	const IntegrationPolicyStats& IntegrationStats() const { return m_integrationPolicy.Stats(); }
+
+	/// <summary>
+	/// Arena of the per-frame buffers, reset at the end of every frame
+	/// </summary>
+	const FrameArena& Scratch() const { return m_scratch; }
+
+	/// <summary>
+	/// Frame arena bytes one frame of the given size takes
+	/// </summary>
+	static size_t ScratchBytes(const FusionPipelineParameters& parameters, int width, int height);
+
+	/// <summary>
+	/// Frames processed since the last reset, and the consecutive lost frames among them
+	/// </summary>
+	int FrameCount() const { return m_frameCount; }
+	int LostFrameCount() const { return m_lostFrameCount; }
+
+	size_t MemoryBytes() const;
+
+private:
+	FusionPipelineParameters    m_parameters;
+	int                         m_width;
+	int                         m_height;
+	CameraIntrinsics            m_intrinsics;
+	DepthFilter                 m_depthFilter;
+
+	TsdfVolume                  m_volume;
+	DepthPyramid                m_pyramid;
+	VertexNormalMaps            m_frameMaps;
+	IcpTracker                  m_tracker;
+	IntegrationPolicy           m_integrationPolicy;
+	FrameArena                  m_scratch;
+	std::vector<float, TaggedAllocator<float, MemoryFrames> > m_pointCloud;
+
+	QualityLevel                m_quality;
+
+	Mat4                        m_worldToCamera;
+	int                         m_frameCount;
+	int                         m_lostFrameCount;
+};
@@ -0,0 +1,302 @@
+// Offline re-integration: fuses a recorded depth sequence into a fresh volume along the poses of
+// a pose log (see PoseLogWriter), with no tracking, raycasting or shading, as fast as the volume
+// can take the frames. A scan tracked live at a coarse volume can so be rebuilt at a finer one,
+// or with another truncation or weight limit, many times faster than it was recorded. The frames
+// are integrated --batch at a time, each brick taking the whole batch while it is in cache (see
+// TsdfVolume::IntegrateBatch), spread over the NUMA slabs of the volume, while a thread of its own
+// loads, converts and filters the next batch.
+//
+//   FusionReintegrate --poses=log.bin [--sequence=dir | --synthetic=90] [--size=320x240] [--noise=1.0]
+//                     [--seed=1] [--hold=0] [--voxels-per-meter=128] [--volume=256x192x256]
+//                     [--truncation=0.03] [--max-weight=200] [--min-depth=0.35] [--max-depth=8]
+//                     [--depth-filter=1] [--temporal-median=3] [--batch=1] [--mesh=out.stl] [--no-pin]
+//
+// Only the frames since the last reset of the log are integrated, as the volume of the live run
+// held those only, and lost frames are skipped. Frames are matched to the log by timestamp,
+// within 20 ms. The poses are in the world of the native pipeline (the logs of FusionReplay),
+// whose volume placement is the default one of TsdfVolume; a log of the viewer is in the world
+// of the Kinect Fusion SDK, so its mesh comes out shifted. A synthetic log must be replayed
+// with the --size, --noise, --seed and --hold it was recorded with.
+//
+// Exit status: 0 on success, 1 on bad input or when a file cannot be read or written.
+
+#include "DepthFilter.h"
+#include "DepthProcessing.h"
+#include "DepthSource.h"
+#include "FusionPipeline.h"
+#include "MeshWriter.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "Trajectory.h"
+#include "TsdfVolume.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static const double cMatchSeconds = 0.02;
+static const double cRealTimeHz = 30.0;
+
+
+/// <summary>
+/// Frames converted and filtered for one IntegrateBatch call; the last one of the sequence may
+/// hold fewer than --batch frames, or none
+/// </summary>
+struct FrameBatch
+{
+	std::vector<float>   depths;
+	TsdfIntegrationFrame frames[TsdfVolume::cMaxBatchFrames];
+	int                  count;
+	bool                 last;
+};
+
+
+static double SecondsSince(Timing::Clock::time_point start)
+{
+	return std::chrono::duration<double>(Timing::Clock::now() - start).count();
+}
+
+static bool ParseSize(const std::string& value, int& width, int& height)
+{
+	return 2 == sscanf(value.c_str(), "%dx%d", &width, &height) && width >= 40 && height >= 30;
+}
+
+static bool ParseVolume(const std::string& value, VolumeParameters& volume)
+{
+	return 3 == sscanf(value.c_str(), "%dx%dx%d", &volume.voxelCountX, &volume.voxelCountY, &volume.voxelCountZ)
+		&& volume.voxelCountX >= 8 && volume.voxelCountY >= 8 && volume.voxelCountZ >= 8;
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::string sequence, posesPath, meshPath;
+	DepthSourceSettings synthetic;
+	FusionPipelineParameters parameters;
+	parameters.volume = VolumeParameters(128.0f, 256, 192, 256);
+	int batch = 1;
+	bool pin = true;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument(argv[i]);
+		size_t equals = argument.find('=');
+		std::string name = argument.substr(0, equals);
+		std::string value = (std::string::npos == equals) ? std::string() : argument.substr(equals + 1);
+
+		if (name == "--sequence") sequence = value;
+		else if (name == "--poses") posesPath = value;
+		else if (name == "--mesh") meshPath = value;
+		else if (name == "--synthetic" && (synthetic.frames = atoi(value.c_str())) > 0) {}
+		else if (name == "--size" && ParseSize(value, synthetic.width, synthetic.height)) {}
+		else if (name == "--noise") synthetic.noise = (float)atof(value.c_str());
+		else if (name == "--seed") synthetic.seed = (unsigned int)strtoul(value.c_str(), nullptr, 10);
+		else if (name == "--hold") synthetic.holdFrames = atoi(value.c_str());
+		else if (name == "--voxels-per-meter") parameters.volume.voxelsPerMeter = (float)atof(value.c_str());
+		else if (name == "--volume" && ParseVolume(value, parameters.volume)) {}
+		else if (name == "--truncation") parameters.truncationDistance = (float)atof(value.c_str());
+		else if (name == "--max-weight") parameters.maxIntegrationWeight = (unsigned short)atoi(value.c_str());
+		else if (name == "--min-depth") parameters.minDepth = (float)atof(value.c_str());
+		else if (name == "--max-depth") parameters.maxDepth = (float)atof(value.c_str());
+		else if (name == "--depth-filter") parameters.depthFilter.bilateral = (0 != atoi(value.c_str()));
+		else if (name == "--temporal-median") parameters.depthFilter.temporalFrames = atoi(value.c_str());
+		else if (name == "--batch" && (batch = atoi(value.c_str())) >= 1 && batch <= TsdfVolume::cMaxBatchFrames) {}
+		else if (name == "--no-pin") pin = false;
+		else
+		{
+			std::cerr << "Unknown or invalid option " << argument << std::endl;
+			return 1;
+		}
+	}
+	if (posesPath.empty() || parameters.volume.voxelsPerMeter <= 0 || parameters.truncationDistance <= 0
+		|| parameters.maxIntegrationWeight < 1)
+	{
+		std::cerr << "Usage: FusionReintegrate --poses=log.bin [--sequence=dir | --synthetic=90] [--volume=256x192x256]"
+			" [--voxels-per-meter=128] [--truncation=0.03] [--max-weight=200] [--batch=1] [--mesh=out.stl]" << std::endl;
+		return 1;
+	}
+
+	std::vector<PoseLogRecord> records;
+	if (!ReadPoseLog(posesPath.c_str(), records) || records.empty())
+	{
+		std::cerr << "Cannot read the pose log " << posesPath << std::endl;
+		return 1;
+	}
+
+	// the volume of the live run held the frames since its last reset only
+	size_t firstRecord = 0;
+	for (size_t r = 0; r < records.size(); ++r)
+	{
+		firstRecord = (PoseReset == records[r].status) ? r : firstRecord;
+	}
+
+	std::unique_ptr<DepthSource> source = CreateDepthSource(sequence.empty() ? std::string("synthetic") : sequence, synthetic);
+	if (!source->Open())
+	{
+		std::cerr << "Cannot open " << source->Name() << ": " << source->Error() << std::endl;
+		return 1;
+	}
+	const int width = source->Width(), height = source->Height();
+	const size_t pixels = (size_t)width * height;
+	const CameraIntrinsics intrinsics = KinectDepthIntrinsics();
+
+	bool pinned = pin && ThreadPool::Instance().PinThreads();
+	TsdfVolume volume;
+	volume.Initialize(parameters.volume, parameters.truncationDistance);
+	DepthFilter depthFilter;
+	depthFilter.Initialize(parameters.depthFilter, width, height);
+	std::cout << "FusionReintegrate: " << ThreadPool::Instance().Concurrency() << " threads" << (pinned ? " (pinned)" : "")
+		<< ", volume " << parameters.volume.voxelCountX << "x" << parameters.volume.voxelCountY << "x"
+		<< parameters.volume.voxelCountZ << " at " << parameters.volume.voxelsPerMeter << " voxels/m on "
+		<< volume.NodeCount() << " node(s), batches of " << batch << std::endl;
+
+	// the next batch is loaded, converted and filtered on a thread of its own while the current
+	// one integrates; the filter runs on a pool of its own, as one running on the shared pool would
+	// leave the integration loops serial (see ThreadPool::ParallelFor)
+	FrameBatch batches[2];
+	for (FrameBatch& slot : batches)
+	{
+		slot.depths.resize(pixels * batch);
+	}
+	std::mutex batchMutex;
+	std::condition_variable batchReady;
+	long long produced = 0, consumed = 0;
+
+	int integrated = 0, lost = 0, unmatched = 0;
+	double loadingSeconds = 0, firstTimestamp = -1, lastTimestamp = 0;
+	std::string loadError;
+	Timing::Clock::time_point wallStart = Timing::Clock::now();
+	std::thread loader([&]()
+	{
+		ThreadPool filterPool(1);
+		size_t cursor = firstRecord;
+		DepthFrame depth;
+		DepthFrameStatus status = DepthFrameReady;
+		for (bool last = false; !last; )
+		{
+			{
+				std::unique_lock<std::mutex> lock(batchMutex);
+				batchReady.wait(lock, [&]() { return produced - consumed < 2; });
+			}
+			FrameBatch& slot = batches[produced % 2];
+			slot.count = 0;
+			Timing::Clock::time_point start = Timing::Clock::now();
+			while (slot.count < batch && cursor < records.size() && DepthFrameEnd != (status = source->NextFrame(depth, 1000)))
+			{
+				if (DepthFrameError == status)
+				{
+					loadError = source->Error();
+					break;
+				}
+				if (DepthFrameReady != status)
+				{
+					continue;
+				}
+
+				// both run in time order: the cursor only moves forward
+				while (cursor < records.size() && records[cursor].timestamp < depth.timestamp - cMatchSeconds)
+				{
+					++cursor;
+				}
+				if (cursor >= records.size() || records[cursor].timestamp > depth.timestamp + cMatchSeconds)
+				{
+					unmatched += (cursor > firstRecord) ? 1 : 0;
+					continue;
+				}
+				const PoseLogRecord& record = records[cursor++];
+
+				// the filter sees every frame, as in the live run, so that its temporal median matches
+				float* pDepth = slot.depths.data() + pixels * slot.count;
+				ConvertDepthToFloat(depth.pDepthMm, width, height, parameters.minDepth, parameters.maxDepth, parameters.mirrorDepth, pDepth);
+				if (depthFilter.Settings().Enabled())
+				{
+					depthFilter.Apply(pDepth, filterPool);
+				}
+				if (PoseLost != record.status)
+				{
+					slot.frames[slot.count].pDepth = pDepth;
+					slot.frames[slot.count].worldToCamera = record.worldToCamera;
+					++slot.count;
+					++integrated;
+				}
+				else
+				{
+					++lost;
+				}
+				firstTimestamp = (firstTimestamp < 0) ? depth.timestamp : firstTimestamp;
+				lastTimestamp = depth.timestamp;
+			}
+			loadingSeconds += SecondsSince(start);
+			last = slot.count < batch;
+			slot.last = last;
+
+			std::lock_guard<std::mutex> lock(batchMutex);
+			++produced;
+			batchReady.notify_all();
+		}
+	});
+
+	double integrationSeconds = 0;
+	for (bool last = false; !last; )
+	{
+		{
+			std::unique_lock<std::mutex> lock(batchMutex);
+			batchReady.wait(lock, [&]() { return consumed < produced; });
+		}
+		const FrameBatch& slot = batches[consumed % 2];
+		last = slot.last;
+		if (slot.count > 0)
+		{
+			Timing::Clock::time_point start = Timing::Clock::now();
+			volume.IntegrateBatch(slot.frames, slot.count, width, height, intrinsics, parameters.maxIntegrationWeight);
+			integrationSeconds += SecondsSince(start);
+		}
+
+		std::lock_guard<std::mutex> lock(batchMutex);
+		++consumed;
+		batchReady.notify_all();
+	}
+	loader.join();
+	const double wallSeconds = SecondsSince(wallStart);
+	if (!loadError.empty())
+	{
+		std::cerr << loadError << std::endl;
+		return 1;
+	}
+	if (0 == integrated)
+	{
+		std::cerr << "No frame of " << source->Name() << " matches the pose log " << posesPath << std::endl;
+		return 1;
+	}
+
+	// real time is the span of the sequence, or the sensor's frame rate for a single frame
+	const double recordedSeconds = std::max(lastTimestamp - firstTimestamp + 1.0 / cRealTimeHz, 1.0 / cRealTimeHz);
+	const double fps = integrated / std::max(integrationSeconds, 1e-9);
+	printf("%d frames integrated (%d lost skipped, %d without a pose) from record %d of %d\n",
+		integrated, lost, unmatched, (int)firstRecord, (int)records.size());
+	printf("integration %.3f s, %.1f frames/s, %.1fx real time; loading %.3f s beside it; wall %.3f s, %.1fx real time\n",
+		integrationSeconds, fps, recordedSeconds / std::max(integrationSeconds, 1e-9), loadingSeconds, wallSeconds,
+		recordedSeconds / std::max(wallSeconds, 1e-9));
+
+	if (!meshPath.empty())
+	{
+		std::vector<float> triangles;
+		const size_t triangleCount = volume.CalculateMesh(triangles);
+		if (!WriteMeshFile(meshPath.c_str(), triangles.data(), triangleCount))
+		{
+			std::cerr << "Cannot write " << meshPath << std::endl;
+			return 1;
+		}
+		printf("%d triangles written to %s\n", (int)triangleCount, meshPath.c_str());
+	}
+	return 0;
+}
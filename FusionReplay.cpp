@@ -0,0 +1,991 @@
+// End-to-end regression harness: replays depth sequences with a known trajectory through the
+// native pipeline (the processDepth equivalent of FusionPipeline plus shading), headless and as
+// fast as frames can be processed. Reports throughput, per-stage p99 latency, peak resident
+// memory, heap allocations per frame once the pipeline is warm, the integrations the integration
+// policy skipped and the time that saved, the ICP iterations per tracked frame, the absolute
+// trajectory error against the ground truth and the distance of the final mesh to the reference surface, and fails when one of them
+// breaches its gate.
+//
+//   FusionReplay [--sequence=dir]... [--synthetic=90] [--size=320x240] [--noise=1.0] [--seed=1]
+//                [--record=dir] [--reference=mesh.stl] [--json=results.json]
+//                [--baseline=old.json] [--tolerance=0.10] [--accuracy-tolerance=0.002]
+//                [--max-ate=0.03] [--max-mesh-error=0.01] [--max-lost-fraction=0.1] [--min-fps=0]
+//                [--max-frame-allocations=0] [--lazy-integration=1] [--hold=0] [--frame-budget=0]
+//                [--voxels-per-meter=128] [--volume=256x192x256] [--volume-budget=MB] [--no-pin]
+//                [--simd=scalar|sse4.1|avx2|avx512] [--depth-filter=1] [--temporal-median=3]
+//                [--point-export=dir] [--point-export-interval=30] [--point-export-source=raycast|depth]
+//                [--point-export-format=ply|pcd] [--point-export-voxel=0.01] [--point-export-threads=1]
+//                [--pose-log=poses.bin] [--thumbnails=dir] [--thumbnail-interval=30] [--thumbnail-scale=2]
+//
+// --volume-budget sizes the volume automatically (see ChooseVolume): the extent of --volume at
+// the finest resolution, from 64 voxels/m, that fits in the budget. --lazy-integration=0
+// integrates every tracked frame. --hold keeps the synthetic camera still for that many frames
+// before it starts moving, like a scan that starts on a tripod. --frame-budget (in ms) runs the
+// quality governor against that budget; its decisions are printed, and its steps reported.
+// --simd runs the vectorized kernels at a lower level than the CPU's best (see SimdKernels.h).
+// --depth-filter=1 and --temporal-median=3 or 5 denoise the depth before tracking (see DepthFilter).
+// --point-export writes the world space points of every --point-export-interval-th frame in the
+// background (see PointCloudExporter); the copy handed to the writer counts as pipeline time.
+// --pose-log logs every frame's pose, tracking status and ICP residual (see PoseLogWriter), also
+// within the pipeline time; with several sequences the log holds the last one.
+// --thumbnails writes the shaded view of every --thumbnail-interval-th frame, shrunk by
+// --thumbnail-scale, as frame_NNNNNN.ppm, encoded in the background (see ThumbnailWriter): the
+// headless output of a machine without a display. Like the pose log, with several sequences the
+// directory holds the frames of the last one.
+//
+// A recorded sequence is a directory in the layout of the TUM RGB-D benchmark (see
+// RecordedDepthSource); --record writes the synthetic sequence in that layout. Without --sequence the synthetic scene is replayed, whose
+// analytic surface is the reference; a recorded sequence is compared with --reference, a mesh in
+// the ground truth world frame.
+//
+// Exit status: 0 when every gate passes, 1 on bad input, 2 when a gate fails.
+
+#include "FusionPipeline.h"
+#include "DepthImageIO.h"
+#include "MeshLoader.h"
+#include "PointCloudExporter.h"
+#include "PointCloudShader.h"
+#include "RecordedDepthSource.h"
+#include "SimdKernels.h"
+#include "SyntheticDepthSource.h"
+#include "Telemetry.h"
+#include "ThumbnailWriter.h"
+#include "NumaTopology.h"
+#include "ThreadPool.h"
+#include "Trajectory.h"
+#include "HeapCounter.h"
+#include "VolumeSizing.h"
+#include "QualityGovernor.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+struct ReplayOptions
+{
+	std::vector<std::string>    sequences;
+	std::string                 recordPath;
+	std::string                 referencePath;
+	std::string                 jsonPath;
+	std::string                 baselinePath;
+	DepthSourceSettings         synthetic;
+	bool                        pin;
+	FusionPipelineParameters    pipeline;
+	double                      volumeBudgetMb;		// 0 = take the volume as given
+	double                      frameBudgetMs;		// 0 = full quality, no governor
+	PointCloudExportSettings    pointExport;
+	std::string                 poseLogPath;
+	std::string                 thumbnailDirectory;	// empty = no thumbnails
+	int                         thumbnailInterval;	// frames
+	int                         thumbnailScale;
+
+	// gates; a negative value disables one
+	double                      tolerance;
+	double                      accuracyTolerance;	// m
+	double                      maxAte;				// m
+	double                      maxMeshError;		// m
+	double                      maxLostFraction;
+	double                      minFps;
+	double                      maxFrameAllocations;	// per frame, once the pipeline is warm
+
+	ReplayOptions()
+		: pin(true)
+		, volumeBudgetMb(0)
+		, frameBudgetMs(0)
+		, thumbnailInterval(30)
+		, thumbnailScale(2)
+		, tolerance(0.10)
+		, accuracyTolerance(0.002)
+		, maxAte(0.03)
+		, maxMeshError(0.01)
+		, maxLostFraction(0.1)
+		, minFps(0)
+		, maxFrameAllocations(0)
+	{
+		pipeline.volume = VolumeParameters(128.0f, 256, 192, 256);
+	}
+};
+
+/// <summary>
+/// Figures of one replayed sequence; accuracy figures are negative when they could not be measured
+/// </summary>
+struct ReplayResult
+{
+	std::string                 sequence;
+	int                         width;
+	int                         height;
+	int                         frames;
+	int                         lostFrames;
+	int                         resets;
+	double                      icpIterations;		// mean per tracked frame
+	double                      fps;				// frames per second of pipeline time
+	double                      wallFps;			// including loading or rendering the input
+	std::vector<std::pair<std::string, double> > stageP99Ms;
+	double                      peakRssMb;
+	double                      frameAllocations;	// heap allocations per warm frame, -1 if none was
+	size_t                      scratchBytes;		// frame arena capacity
+	long long                   scratchOverflows;
+	long long                   integratedFrames;
+	long long                   skippedIntegrations;
+	double                      savedMs;			// skipped integrations at the mean integration time
+	long long                   qualityStepsDown;
+	long long                   qualityStepsUp;
+	int                         finalQualityLevel;	// steps below full quality at the end
+	std::vector<TelemetryEvent> events;
+	MemoryReport                memory;				// accounted buffers, peaks since startup
+	double                      ateRmse;			// m
+	double                      ateMax;				// m
+	PointCloudExportStats       pointExport;
+	PoseLogStats                poseLog;
+	ThumbnailWriterStats        thumbnails;
+	size_t                      triangles;
+	double                      meshMean;			// m
+	double                      meshP95;			// m
+
+	double StageP99(const std::string& stage) const
+	{
+		for (size_t i = 0; i < stageP99Ms.size(); ++i)
+		{
+			if (stageP99Ms[i].first == stage)
+			{
+				return stageP99Ms[i].second;
+			}
+		}
+		return 0;
+	}
+};
+
+static ReplayOptions s_options;
+static const StageId s_stageShading = Telemetry::Instance().RegisterStage("shading");
+static const StageId s_stageCalculateMesh = Telemetry::Instance().RegisterStage("calculate-mesh");
+
+
+/// <summary>
+/// High-water mark of the resident set of the process so far, in bytes
+/// </summary>
+static size_t PeakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	if (0 != getrusage(RUSAGE_SELF, &usage))
+	{
+		return 0;
+	}
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+
+////////////////////////////////////////////////////////
+// Distance to a reference mesh
+
+/// <summary>
+/// Closest point to p on the triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+/// </summary>
+static void ClosestPointOnTriangle(const float p[3], const float a[3], const float b[3], const float c[3], float out[3])
+{
+	float ab[3], ac[3], ap[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		ab[i] = b[i] - a[i];
+		ac[i] = c[i] - a[i];
+		ap[i] = p[i] - a[i];
+	}
+	float d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+	float d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+	if (d1 <= 0 && d2 <= 0)
+	{
+		out[0] = a[0]; out[1] = a[1]; out[2] = a[2];
+		return;
+	}
+
+	float bp[3] = { p[0] - b[0], p[1] - b[1], p[2] - b[2] };
+	float d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+	float d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+	if (d3 >= 0 && d4 <= d3)
+	{
+		out[0] = b[0]; out[1] = b[1]; out[2] = b[2];
+		return;
+	}
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0)
+	{
+		float v = d1 / (d1 - d3);
+		for (int i = 0; i < 3; ++i) out[i] = a[i] + v * ab[i];
+		return;
+	}
+
+	float cp[3] = { p[0] - c[0], p[1] - c[1], p[2] - c[2] };
+	float d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+	float d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+	if (d6 >= 0 && d5 <= d6)
+	{
+		out[0] = c[0]; out[1] = c[1]; out[2] = c[2];
+		return;
+	}
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0)
+	{
+		float w = d2 / (d2 - d6);
+		for (int i = 0; i < 3; ++i) out[i] = a[i] + w * ac[i];
+		return;
+	}
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+	{
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		for (int i = 0; i < 3; ++i) out[i] = b[i] + w * (c[i] - b[i]);
+		return;
+	}
+
+	float denominator = 1.0f / (va + vb + vc);
+	float v = vb * denominator, w = vc * denominator;
+	for (int i = 0; i < 3; ++i) out[i] = a[i] + ab[i] * v + ac[i] * w;
+}
+
+
+/// <summary>
+/// Unsigned distance to a triangle mesh through a uniform grid of triangle lists. Distances are
+/// exact up to the cell size and clamped to it beyond, which is far outside any sane tolerance.
+/// </summary>
+class ReferenceDistance
+{
+public:
+	explicit ReferenceDistance(float cellSize)
+		: m_cellSize(cellSize)
+	{
+	}
+
+	void Build(const LoadedMesh& mesh)
+	{
+		m_mesh = mesh;
+		m_cells.clear();
+		for (size_t t = 0; t < mesh.TriangleCount(); ++t)
+		{
+			int lower[3] = { 1 << 30, 1 << 30, 1 << 30 }, upper[3] = { -(1 << 30), -(1 << 30), -(1 << 30) };
+			for (int v = 0; v < 3; ++v)
+			{
+				const float* p = &mesh.points[mesh.triangles[t * 3 + v] * 3];
+				for (int a = 0; a < 3; ++a)
+				{
+					int cell = (int)floorf(p[a] / m_cellSize);
+					lower[a] = std::min(lower[a], cell);
+					upper[a] = std::max(upper[a], cell);
+				}
+			}
+			for (int z = lower[2]; z <= upper[2]; ++z)
+				for (int y = lower[1]; y <= upper[1]; ++y)
+					for (int x = lower[0]; x <= upper[0]; ++x)
+					{
+						m_cells[Key(x, y, z)].push_back((int)t);
+					}
+		}
+	}
+
+	float Distance(const float p[3]) const
+	{
+		int cx = (int)floorf(p[0] / m_cellSize), cy = (int)floorf(p[1] / m_cellSize), cz = (int)floorf(p[2] / m_cellSize);
+		float best = m_cellSize * m_cellSize;
+		for (int z = cz - 1; z <= cz + 1; ++z)
+			for (int y = cy - 1; y <= cy + 1; ++y)
+				for (int x = cx - 1; x <= cx + 1; ++x)
+				{
+					std::unordered_map<long long, std::vector<int> >::const_iterator cell = m_cells.find(Key(x, y, z));
+					if (cell == m_cells.end())
+					{
+						continue;
+					}
+					for (size_t i = 0; i < cell->second.size(); ++i)
+					{
+						int t = cell->second[i];
+						float closest[3];
+						ClosestPointOnTriangle(p, &m_mesh.points[m_mesh.triangles[t * 3] * 3], &m_mesh.points[m_mesh.triangles[t * 3 + 1] * 3],
+							&m_mesh.points[m_mesh.triangles[t * 3 + 2] * 3], closest);
+						float dx = closest[0] - p[0], dy = closest[1] - p[1], dz = closest[2] - p[2];
+						best = std::min(best, dx * dx + dy * dy + dz * dz);
+					}
+				}
+		return sqrtf(best);
+	}
+
+private:
+	static long long Key(int x, int y, int z)
+	{
+		const long long bias = 1 << 20;
+		return ((x + bias) << 42) | ((y + bias) << 21) | (z + bias);
+	}
+
+	float                       m_cellSize;
+	LoadedMesh                  m_mesh;
+	std::unordered_map<long long, std::vector<int> > m_cells;
+};
+
+
+////////////////////////////////////////////////////////
+// Sequences
+
+/// <summary>
+/// Write the synthetic sequence as a recorded one
+/// </summary>
+static bool RecordSynthetic(const std::string& directory)
+{
+	SyntheticDepthSource source(s_options.synthetic);
+	std::vector<StampedPose> groundTruth;
+	std::ofstream list((directory + "/depth.txt").c_str());
+	if (!list || !source.Open())
+	{
+		return false;
+	}
+
+	list << "# synthetic scene, seed " << s_options.synthetic.seed << "\n# timestamp filename\n" << std::fixed << std::setprecision(6);
+	DepthFrame frame;
+	while (DepthFrameReady == source.NextFrame(frame, 0))
+	{
+		StampedPose pose;
+		pose.timestamp = frame.timestamp;
+		source.GroundTruth(pose.worldToCamera);
+		groundTruth.push_back(pose);
+
+		char name[32];
+		snprintf(name, sizeof(name), "depth_%06d.pgm", (int)frame.index);
+		if (!WriteDepthPgm((directory + "/" + name).c_str(), frame.pDepthMm, frame.width, frame.height))
+		{
+			return false;
+		}
+		list << pose.timestamp << " " << name << "\n";
+	}
+	return (bool)list && WriteTumTrajectory((directory + "/groundtruth.txt").c_str(), groundTruth);
+}
+
+
+/// <summary>
+/// Replay one sequence; an empty directory replays the synthetic scene
+/// </summary>
+static bool Replay(const std::string& directory, const ReferenceDistance* pReference, ReplayResult& result)
+{
+	const bool synthetic = directory.empty();
+	const SyntheticScene scene(s_options.synthetic.seed);
+	std::unique_ptr<DepthSource> source = CreateDepthSource(synthetic ? std::string("synthetic") : directory, s_options.synthetic);
+	if (!source->Open())
+	{
+		std::cerr << "Cannot open " << source->Name() << ": " << source->Error() << std::endl;
+		return false;
+	}
+	const int width = source->Width(), height = source->Height();
+
+	FusionPipeline pipeline;
+	pipeline.Initialize(s_options.pipeline, width, height);
+	QualityGovernorSettings governorSettings;
+	governorSettings.enabled = s_options.frameBudgetMs > 0;
+	governorSettings.frameBudgetMs = s_options.frameBudgetMs;
+	QualityGovernor governor;
+	governor.Initialize(governorSettings);
+	PointCloudShader shader;
+	std::vector<unsigned char> shaded((size_t)width * height * 4);
+	PointCloudExporter exporter;
+	if (s_options.pointExport.Enabled() && !exporter.Start(s_options.pointExport, width, height))
+	{
+		std::cerr << "Cannot create the point export directory " << s_options.pointExport.directory << std::endl;
+		return false;
+	}
+	PoseLogWriter poseLog;
+	if (!s_options.poseLogPath.empty() && !poseLog.Open(s_options.poseLogPath))
+	{
+		std::cerr << "Cannot create the pose log " << s_options.poseLogPath << std::endl;
+		return false;
+	}
+	ThumbnailWriter thumbnails;
+	if (!s_options.thumbnailDirectory.empty() && !thumbnails.Start(s_options.thumbnailDirectory, s_options.thumbnailScale, 4, width, height))
+	{
+		std::cerr << "Cannot create the thumbnail directory " << s_options.thumbnailDirectory << std::endl;
+		return false;
+	}
+	Telemetry::Instance().Reset();
+
+	// the pipeline world is the camera frame of the first frame after a reset: the ground truth is
+	// compared after moving it into that frame
+	bool anchored = false;
+	Mat4 anchor;
+	SetIdentity(anchor);
+
+	double pipelineSeconds = 0, squaredErrorSum = 0;
+	int errorCount = 0;
+	result = ReplayResult();
+	result.sequence = synthetic ? "synthetic" : directory;
+	result.width = width;
+	result.height = height;
+	result.frames = 0;
+	result.lostFrames = 0;
+	result.resets = 0;
+	result.icpIterations = 0;
+	result.ateMax = 0;
+	long long icpIterations = 0;
+	int icpFrames = 0;
+
+	long long warmAllocations = 0;
+	int warmFrames = 0;
+
+	Timing::Clock::time_point wallStart = Timing::Clock::now();
+	DepthFrame depth;
+	for (DepthFrameStatus status; DepthFrameEnd != (status = source->NextFrame(depth, 1000)); )
+	{
+		if (DepthFrameError == status)
+		{
+			std::cerr << source->Error() << std::endl;
+			return false;
+		}
+		if (DepthFrameReady != status)
+		{
+			continue;
+		}
+		Mat4 truth;
+		const bool hasTruth = source->GroundTruth(truth);
+
+		if (0 == pipeline.FrameCount())
+		{
+			anchored = hasTruth;
+			anchor = anchored ? truth : anchor;
+		}
+
+		// the first frames after a reset define the model and size what grows on demand
+		const bool first = 0 == pipeline.FrameCount();
+		bool warm = pipeline.FrameCount() >= 2;
+		long long allocationsBefore = HeapAllocationCount();
+		Timing::Clock::time_point start = Timing::Clock::now();
+		FusionFrameResult frame = pipeline.ProcessFrame(depth.pDepthMm);
+		Timing::Clock::time_point shadingStart = Timing::Clock::now();
+		const bool thumbnailDue = thumbnails.IsRunning() && 0 == depth.index % s_options.thumbnailInterval;
+		if (thumbnailDue || 0 == depth.index % governor.Level().displayInterval)
+		{
+			ScopedStageTimer shadingTimer(s_stageShading);
+			shader.Shade(pipeline.PointCloud(), width * 6 * sizeof(float), width, height, pipeline.WorldToCamera(),
+				shaded.data(), width * 4);
+		}
+		if (thumbnailDue)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "frame_%06lld", depth.index);
+			thumbnails.Submit(name, shaded.data(), width, height, width * 4, ThumbnailBGRX, false);
+		}
+		if (exporter.IsDue(depth.index) && frame.tracked)
+		{
+			if (PointExportDepth == s_options.pointExport.source)
+			{
+				exporter.SubmitDepth(depth.index, pipeline.FrameDepth(), width, height, pipeline.Intrinsics(), pipeline.WorldToCamera());
+			}
+			else
+			{
+				exporter.SubmitPoints(depth.index, pipeline.PointCloud(), width * 6 * sizeof(float), width, height);
+			}
+		}
+		if (poseLog.IsOpen())
+		{
+			PoseLogRecord record;
+			record.timestamp = depth.timestamp;
+			record.frame = depth.index;
+			record.worldToCamera = pipeline.WorldToCamera();
+			record.status = first ? PoseReset : (frame.tracked ? PoseTracked : PoseLost);
+			record.lostFrames = frame.reset ? s_options.pipeline.resetOnLostFrames : pipeline.LostFrameCount();
+			record.residual = frame.icp.tracked ? frame.icp.residual : -1.0f;
+			poseLog.Append(record);
+		}
+		Timing::Clock::time_point end = Timing::Clock::now();
+		pipelineSeconds += std::chrono::duration<double>(end - start).count();
+
+		QualitySample sample;
+		sample.frameMs = std::chrono::duration<double, std::milli>(end - start).count();
+		sample.leverMs[QualityTracking] = frame.trackingMs;
+		sample.leverMs[QualityRaycast] = frame.raycastMs;
+		sample.leverMs[QualityIntegration] = frame.integrationMs;
+		sample.leverMs[QualityDisplay] = std::chrono::duration<double, std::milli>(end - shadingStart).count();
+		if (governor.Update(sample))
+		{
+			pipeline.SetQuality(governor.Level());
+		}
+		if (warm)
+		{
+			warmAllocations += HeapAllocationCount() - allocationsBefore;
+			warmFrames++;
+		}
+
+		result.frames++;
+		result.lostFrames += frame.tracked ? 0 : 1;
+		result.resets += frame.reset ? 1 : 0;
+		if (frame.icp.tracked)
+		{
+			icpIterations += frame.icp.iterations;
+			icpFrames++;
+		}
+
+		// absolute trajectory error of the camera position, both in the anchor frame
+		if (anchored && hasTruth && !frame.reset)
+		{
+			float position[3], truthInAnchor[3], estimate[3];
+			CameraPosition(truth, position);
+			TransformPoint(anchor, position, truthInAnchor);
+			CameraPosition(pipeline.WorldToCamera(), estimate);
+			double dx = estimate[0] - truthInAnchor[0], dy = estimate[1] - truthInAnchor[1], dz = estimate[2] - truthInAnchor[2];
+			double squared = dx * dx + dy * dy + dz * dz;
+			squaredErrorSum += squared;
+			result.ateMax = std::max(result.ateMax, sqrt(squared));
+			errorCount++;
+		}
+	}
+	double wallSeconds = std::chrono::duration<double>(Timing::Clock::now() - wallStart).count();
+	exporter.Stop();
+	result.pointExport = exporter.GetStats();
+	poseLog.Close();
+	result.poseLog = poseLog.GetStats();
+	thumbnails.Stop();
+	result.thumbnails = thumbnails.GetStats();
+
+	result.fps = (pipelineSeconds > 0) ? result.frames / pipelineSeconds : 0;
+	result.wallFps = (wallSeconds > 0) ? result.frames / wallSeconds : 0;
+	result.ateRmse = (errorCount > 0) ? sqrt(squaredErrorSum / errorCount) : -1.0;
+	result.ateMax = (errorCount > 0) ? result.ateMax : -1.0;
+	result.icpIterations = (icpFrames > 0) ? (double)icpIterations / icpFrames : 0.0;
+	result.frameAllocations = (warmFrames > 0) ? (double)warmAllocations / warmFrames : -1.0;
+	result.scratchBytes = pipeline.Scratch().Capacity();
+	result.scratchOverflows = pipeline.Scratch().Overflows();
+
+	TelemetrySnapshot snapshot = Telemetry::Instance().Snapshot();
+	const StageSummary* pIntegrate = snapshot.Stage("integrate");
+	result.integratedFrames = snapshot.Counter("integrated-frames");
+	result.skippedIntegrations = snapshot.Counter("skipped-integrations");
+	result.savedMs = result.skippedIntegrations * ((nullptr != pIntegrate) ? pIntegrate->meanMs : 0.0);
+	result.qualityStepsDown = snapshot.Counter("quality-steps-down");
+	result.qualityStepsUp = snapshot.Counter("quality-steps-up");
+	result.finalQualityLevel = governor.StepsDown();
+	result.events = snapshot.events;
+	const char* stages[] = { "fusion-frame", "depth-float", "depth-filter", "align", "integrate", "point-cloud", "shading" };
+	for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i)
+	{
+		const StageSummary* pStage = snapshot.Stage(stages[i]);
+		result.stageP99Ms.push_back(std::make_pair(std::string(stages[i]), (nullptr != pStage) ? pStage->p99Ms : 0.0));
+	}
+
+	// the final model against the reference surface, in the ground truth world frame
+	std::vector<float> triangles;
+	{
+		ScopedStageTimer meshTimer(s_stageCalculateMesh);
+		pipeline.Volume().CalculateMesh(triangles);
+	}
+	result.triangles = triangles.size() / 9;
+	result.meshMean = -1.0;
+	result.meshP95 = -1.0;
+	if (anchored && result.triangles > 0 && (synthetic || nullptr != pReference))
+	{
+		const Mat4 toWorld = InverseAffine(anchor);
+		const size_t vertexCount = triangles.size() / 3;
+		const size_t stride = std::max<size_t>(1, vertexCount / 200000);
+		std::vector<float> distances;
+		distances.reserve(vertexCount / stride + 1);
+		for (size_t v = 0; v < vertexCount; v += stride)
+		{
+			float p[3];
+			TransformPoint(toWorld, &triangles[v * 3], p);
+			distances.push_back(synthetic ? fabsf(scene.SignedDistance(p)) : pReference->Distance(p));
+		}
+
+		double sum = 0;
+		for (size_t i = 0; i < distances.size(); ++i)
+		{
+			sum += distances[i];
+		}
+		result.meshMean = sum / distances.size();
+		std::nth_element(distances.begin(), distances.begin() + distances.size() * 95 / 100, distances.end());
+		result.meshP95 = distances[distances.size() * 95 / 100];
+	}
+
+	result.peakRssMb = PeakResidentBytes() / (1024.0 * 1024.0);
+	result.memory = MemoryAccounting::Instance().Report();
+	return true;
+}
+
+
+////////////////////////////////////////////////////////
+// Results, baselines and gates
+
+static bool WriteJson(const std::string& path, const std::vector<ReplayResult>& results)
+{
+	std::ofstream file(path.c_str());
+	if (!file)
+	{
+		return false;
+	}
+
+	// one result per line, so baselines can be compared (and diffed) line by line
+	file << std::setprecision(8);
+	file << "{\"benchmark\":\"FusionReplay\",\"seed\":" << s_options.synthetic.seed << ",\"threads\":" << ThreadPool::Instance().Concurrency()
+		<< ",\"simd\":\"" << SimdLevelName(ActiveSimdLevel()) << "\",\"results\":[\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const ReplayResult& r = results[i];
+		file << "{\"sequence\":\"" << r.sequence << "\",\"resolution\":\"" << r.width << "x" << r.height << "\",\"frames\":" << r.frames
+			<< ",\"lostFrames\":" << r.lostFrames << ",\"resets\":" << r.resets << ",\"icpIterations\":" << r.icpIterations << ",\"fps\":" << r.fps << ",\"wallFps\":" << r.wallFps;
+		for (size_t s = 0; s < r.stageP99Ms.size(); ++s)
+		{
+			file << ",\"p99Ms." << r.stageP99Ms[s].first << "\":" << r.stageP99Ms[s].second;
+		}
+		file << ",\"peakRssMb\":" << r.peakRssMb << ",\"accountedPeakMb\":" << r.memory.peakBytes / (1024.0 * 1024.0)
+			<< ",\"frameAllocations\":" << r.frameAllocations << ",\"scratchBytes\":" << r.scratchBytes
+			<< ",\"scratchOverflows\":" << r.scratchOverflows << ",\"integratedFrames\":" << r.integratedFrames
+			<< ",\"skippedIntegrations\":" << r.skippedIntegrations << ",\"savedMs\":" << r.savedMs
+			<< ",\"qualityStepsDown\":" << r.qualityStepsDown << ",\"qualityStepsUp\":" << r.qualityStepsUp
+			<< ",\"finalQualityLevel\":" << r.finalQualityLevel;
+		for (size_t t = 0; t < r.memory.tags.size(); ++t)
+		{
+			file << ",\"peakMb." << r.memory.tags[t].name << "\":" << r.memory.tags[t].peakBytes / (1024.0 * 1024.0);
+		}
+		file << ",\"ateRmseM\":" << r.ateRmse << ",\"ateMaxM\":" << r.ateMax
+			<< ",\"triangles\":" << r.triangles << ",\"meshMeanM\":" << r.meshMean << ",\"meshP95M\":" << r.meshP95 << "}"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	file << "]}\n";
+	return (bool)file;
+}
+
+/// <summary>
+/// Value of "key": in one line of a results file
+/// </summary>
+static std::string FieldOf(const std::string& line, const std::string& key)
+{
+	std::string pattern = "\"" + key + "\":";
+	size_t start = line.find(pattern);
+	if (std::string::npos == start)
+	{
+		return std::string();
+	}
+	start += pattern.size();
+	if (start < line.size() && line[start] == '"')
+	{
+		size_t end = line.find('"', start + 1);
+		return line.substr(start + 1, end - start - 1);
+	}
+	size_t end = line.find_first_of(",}", start);
+	return line.substr(start, end - start);
+}
+
+static int Gate(bool failed, const std::string& sequence, const std::string& message)
+{
+	if (failed)
+	{
+		std::cout << "  FAIL " << sequence << ": " << message << std::endl;
+	}
+	return failed ? 1 : 0;
+}
+
+static std::string Describe(const char* what, double value, const char* relation, double limit)
+{
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(4) << what << " " << value << " " << relation << " " << limit;
+	return text.str();
+}
+
+/// <summary>
+/// Check the absolute gates, and the baseline if given
+/// </summary>
+/// <returns>the number of failed gates, or -1 if the baseline cannot be read</returns>
+static int CheckGates(const std::vector<ReplayResult>& results)
+{
+	int failures = 0;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const ReplayResult& r = results[i];
+		double lostFraction = (r.frames > 0) ? (double)r.lostFrames / r.frames : 1.0;
+		failures += Gate(s_options.maxLostFraction >= 0 && lostFraction > s_options.maxLostFraction, r.sequence,
+			Describe("lost frame fraction", lostFraction, ">", s_options.maxLostFraction));
+		failures += Gate(s_options.maxAte >= 0 && (r.ateRmse < 0 || r.ateRmse > s_options.maxAte), r.sequence,
+			r.ateRmse < 0 ? std::string("no ground truth matched the frames") : Describe("ATE RMSE (m)", r.ateRmse, ">", s_options.maxAte));
+		failures += Gate(s_options.maxMeshError >= 0 && r.meshMean > s_options.maxMeshError, r.sequence,
+			Describe("mean mesh distance (m)", r.meshMean, ">", s_options.maxMeshError));
+		failures += Gate(r.fps < s_options.minFps, r.sequence, Describe("fps", r.fps, "<", s_options.minFps));
+		failures += Gate(s_options.maxFrameAllocations >= 0 && r.frameAllocations > s_options.maxFrameAllocations, r.sequence,
+			Describe("heap allocations per frame", r.frameAllocations, ">", s_options.maxFrameAllocations));
+	}
+
+	if (s_options.baselinePath.empty())
+	{
+		return failures;
+	}
+
+	std::ifstream file(s_options.baselinePath.c_str());
+	if (!file)
+	{
+		return -1;
+	}
+	std::cout << "Compared with " << s_options.baselinePath << " (tolerance " << s_options.tolerance * 100 << "%, accuracy "
+		<< s_options.accuracyTolerance * 1000 << " mm):" << std::endl;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::string sequence = FieldOf(line, "sequence");
+		for (size_t i = 0; i < results.size() && !sequence.empty(); ++i)
+		{
+			const ReplayResult& r = results[i];
+			if (r.sequence != sequence)
+			{
+				continue;
+			}
+			double fps = atof(FieldOf(line, "fps").c_str());
+			double p99 = atof(FieldOf(line, "p99Ms.fusion-frame").c_str());
+			double ate = atof(FieldOf(line, "ateRmseM").c_str());
+			double mesh = atof(FieldOf(line, "meshMeanM").c_str());
+			std::cout << "  " << std::left << std::setw(24) << sequence << std::right << std::fixed << std::setprecision(3)
+				<< std::setw(8) << (fps > 0 ? r.fps / fps : 0) << "x fps " << std::setw(8) << (p99 > 0 ? r.StageP99("fusion-frame") / p99 : 0)
+				<< "x p99, ATE " << std::setprecision(2) << (r.ateRmse - ate) * 1000 << " mm, mesh " << (r.meshMean - mesh) * 1000
+				<< " mm" << std::endl;
+
+			failures += Gate(fps > 0 && r.fps < fps * (1.0 - s_options.tolerance), sequence, Describe("fps", r.fps, "below baseline", fps));
+			failures += Gate(p99 > 0 && r.StageP99("fusion-frame") > p99 * (1.0 + s_options.tolerance), sequence,
+				Describe("frame p99 (ms)", r.StageP99("fusion-frame"), "above baseline", p99));
+			failures += Gate(ate >= 0 && r.ateRmse > ate + s_options.accuracyTolerance, sequence,
+				Describe("ATE RMSE (m)", r.ateRmse, "drifted from baseline", ate));
+			failures += Gate(mesh >= 0 && r.meshMean > mesh + s_options.accuracyTolerance, sequence,
+				Describe("mean mesh distance (m)", r.meshMean, "drifted from baseline", mesh));
+		}
+	}
+	return failures;
+}
+
+
+static void PrintResult(const ReplayResult& r)
+{
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << r.sequence << " (" << r.width << "x" << r.height << "): " << r.frames << " frames, " << r.lostFrames << " lost, "
+		<< r.resets << " resets, " << r.fps << " fps (" << r.wallFps << " with input), peak RSS " << r.peakRssMb << " MB" << std::endl;
+	std::cout << "  " << r.memory.ToText() << std::endl;
+	std::cout << "  " << std::setprecision(2) << r.frameAllocations << " heap allocations per frame, frame arena "
+		<< r.scratchBytes / 1024.0 << " KB, " << r.scratchOverflows << " overflows" << std::endl;
+	std::cout << "  " << r.integratedFrames << " frames integrated, " << r.skippedIntegrations << " skipped, saving "
+		<< std::setprecision(1) << r.savedMs << " ms" << std::endl;
+	if (s_options.frameBudgetMs > 0)
+	{
+		std::cout << "  quality: " << r.qualityStepsDown << " steps down, " << r.qualityStepsUp << " up, ending "
+			<< r.finalQualityLevel << " below full" << std::endl;
+		for (size_t e = 0; e < r.events.size(); ++e)
+		{
+			std::cout << "    " << std::setprecision(2) << r.events[e].seconds << " s " << r.events[e].text << std::endl;
+		}
+	}
+	if (s_options.pointExport.Enabled())
+	{
+		std::cout << "  point export: " << r.pointExport.written << " files, " << r.pointExport.dropped << " dropped, "
+			<< r.pointExport.failed << " failed, " << r.pointExport.points << " points, " << std::setprecision(2)
+			<< r.pointExport.meanWriteMs << " ms per file" << std::endl;
+	}
+	if (!s_options.poseLogPath.empty())
+	{
+		std::cout << "  pose log: " << r.poseLog.written << " records, " << r.poseLog.dropped << " dropped"
+			<< (r.poseLog.failed ? ", write failed" : "") << std::endl;
+	}
+	if (!s_options.thumbnailDirectory.empty())
+	{
+		std::cout << "  thumbnails: " << r.thumbnails.written << " images, "
+			<< r.thumbnails.dropped << " dropped, " << r.thumbnails.failed << " failed, " << std::setprecision(2)
+			<< r.thumbnails.meanEncodeMs << " ms per image" << std::endl;
+	}
+	std::cout << "  p99 ms:";
+	for (size_t s = 0; s < r.stageP99Ms.size(); ++s)
+	{
+		std::cout << " " << r.stageP99Ms[s].first << " " << std::setprecision(2) << r.stageP99Ms[s].second;
+	}
+	std::cout << std::endl;
+	std::cout << std::setprecision(2) << "  " << r.icpIterations << " ICP iterations per tracked frame, ATE RMSE " << r.ateRmse * 1000 << " mm (max " << r.ateMax * 1000 << " mm), mesh "
+		<< r.triangles << " triangles, ";
+	if (r.meshMean >= 0)
+	{
+		std::cout << "distance mean " << r.meshMean * 1000 << " mm, p95 " << r.meshP95 * 1000 << " mm" << std::endl;
+	}
+	else
+	{
+		std::cout << "no reference surface" << std::endl;
+	}
+}
+
+
+static bool ParseSize(const std::string& value, int& width, int& height)
+{
+	return 2 == sscanf(value.c_str(), "%dx%d", &width, &height) && width >= 40 && height >= 30;
+}
+
+static bool ParseVolume(const std::string& value, VolumeParameters& volume)
+{
+	return 3 == sscanf(value.c_str(), "%dx%dx%d", &volume.voxelCountX, &volume.voxelCountY, &volume.voxelCountZ)
+		&& volume.voxelCountX >= 8 && volume.voxelCountY >= 8 && volume.voxelCountZ >= 8;
+}
+
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument(argv[i]);
+		size_t equals = argument.find('=');
+		std::string name = argument.substr(0, equals);
+		std::string value = (std::string::npos == equals) ? std::string() : argument.substr(equals + 1);
+
+		if (name == "--sequence") s_options.sequences.push_back(value);
+		else if (name == "--synthetic" && (s_options.synthetic.frames = atoi(value.c_str())) > 0) {}
+		else if (name == "--size" && ParseSize(value, s_options.synthetic.width, s_options.synthetic.height)) {}
+		else if (name == "--noise") s_options.synthetic.noise = (float)atof(value.c_str());
+		else if (name == "--seed") s_options.synthetic.seed = (unsigned int)strtoul(value.c_str(), nullptr, 10);
+		else if (name == "--record") s_options.recordPath = value;
+		else if (name == "--reference") s_options.referencePath = value;
+		else if (name == "--json") s_options.jsonPath = value;
+		else if (name == "--baseline") s_options.baselinePath = value;
+		else if (name == "--tolerance") s_options.tolerance = atof(value.c_str());
+		else if (name == "--accuracy-tolerance") s_options.accuracyTolerance = atof(value.c_str());
+		else if (name == "--max-ate") s_options.maxAte = atof(value.c_str());
+		else if (name == "--max-mesh-error") s_options.maxMeshError = atof(value.c_str());
+		else if (name == "--max-lost-fraction") s_options.maxLostFraction = atof(value.c_str());
+		else if (name == "--min-fps") s_options.minFps = atof(value.c_str());
+		else if (name == "--max-frame-allocations") s_options.maxFrameAllocations = atof(value.c_str());
+		else if (name == "--voxels-per-meter") s_options.pipeline.volume.voxelsPerMeter = (float)atof(value.c_str());
+		else if (name == "--volume" && ParseVolume(value, s_options.pipeline.volume)) {}
+		else if (name == "--volume-budget") s_options.volumeBudgetMb = atof(value.c_str());
+		else if (name == "--lazy-integration") s_options.pipeline.integration.enabled = (0 != atoi(value.c_str()));
+		else if (name == "--frame-budget") s_options.frameBudgetMs = atof(value.c_str());
+		else if (name == "--depth-filter") s_options.pipeline.depthFilter.bilateral = (0 != atoi(value.c_str()));
+		else if (name == "--temporal-median") s_options.pipeline.depthFilter.temporalFrames = atoi(value.c_str());
+		else if (name == "--point-export") s_options.pointExport.directory = value;
+		else if (name == "--point-export-interval") s_options.pointExport.frameInterval = atoi(value.c_str());
+		else if (name == "--point-export-source" && ParsePointExportSource(value, s_options.pointExport.source)) {}
+		else if (name == "--point-export-format" && ParsePointExportFormat(value, s_options.pointExport.format)) {}
+		else if (name == "--point-export-voxel") s_options.pointExport.voxelSize = (float)atof(value.c_str());
+		else if (name == "--point-export-threads") s_options.pointExport.threads = atoi(value.c_str());
+		else if (name == "--pose-log") s_options.poseLogPath = value;
+		else if (name == "--thumbnails") s_options.thumbnailDirectory = value;
+		else if (name == "--thumbnail-interval" && (s_options.thumbnailInterval = atoi(value.c_str())) >= 1) {}
+		else if (name == "--thumbnail-scale" && (s_options.thumbnailScale = atoi(value.c_str())) >= 1) {}
+		else if (name == "--hold") s_options.synthetic.holdFrames = atoi(value.c_str());
+		else if (name == "--no-pin") s_options.pin = false;
+		else if (name == "--simd")
+		{
+			SimdLevel level;
+			if (!ParseSimdLevel(value, level) || !SetSimdLevel(level))
+			{
+				std::cerr << "The SIMD level " << value << " is unknown or not supported here (up to "
+					<< SimdLevelName(DetectSimdLevel()) << ")" << std::endl;
+				return 1;
+			}
+		}
+		else
+		{
+			std::cerr << "Unknown or invalid option " << argument << std::endl;
+			return 1;
+		}
+	}
+
+	bool pinned = s_options.pin && ThreadPool::Instance().PinThreads();
+	if (s_options.volumeBudgetMb > 0)
+	{
+		VolumeParameters& given = s_options.pipeline.volume;
+		VolumeSizingRequest request;
+		request.budgetBytes = s_options.volumeBudgetMb * 1024.0 * 1024.0;
+		request.extent[0] = given.voxelCountX / given.voxelsPerMeter;
+		request.extent[1] = given.voxelCountY / given.voxelsPerMeter;
+		request.extent[2] = given.voxelCountZ / given.voxelsPerMeter;
+		request.minVoxelsPerMeter = 64.0f;
+		VolumeSizing sizing = ChooseVolume(request, NativeVolumeBackend());
+		given = sizing.volume;
+		std::cout << "Volume sized for " << s_options.volumeBudgetMb << " MB: " << DescribeVolume(given, NativeVolumeBackend())
+			<< (sizing.coversExtent ? "" : ", smaller than the extent") << std::endl;
+	}
+	const VolumeParameters& volume = s_options.pipeline.volume;
+	std::cout << "FusionReplay: " << ThreadPool::Instance().Concurrency() << " threads" << (pinned ? " (pinned)" : "")
+		<< ", volume " << volume.voxelCountX << "x" << volume.voxelCountY << "x" << volume.voxelCountZ << " at "
+		<< volume.voxelsPerMeter << " voxels/m, SIMD " << SimdLevelName(ActiveSimdLevel()) << std::endl;
+	NumaTopology::System().Report(std::cout);
+
+	if (!s_options.recordPath.empty())
+	{
+		if (!RecordSynthetic(s_options.recordPath))
+		{
+			std::cerr << "Cannot record the synthetic sequence into " << s_options.recordPath << std::endl;
+			return 1;
+		}
+		std::cout << "Recorded " << s_options.synthetic.frames << " synthetic frames into " << s_options.recordPath << std::endl;
+		return 0;
+	}
+
+	ReferenceDistance reference(0.05f);
+	if (!s_options.referencePath.empty())
+	{
+		LoadedMesh mesh;
+		const std::string& path = s_options.referencePath;
+		bool obj = path.size() >= 4 && (0 == path.compare(path.size() - 4, 4, ".obj") || 0 == path.compare(path.size() - 4, 4, ".OBJ"));
+		if (!(obj ? LoadAsciiOBJ(path.c_str(), mesh) : LoadBinarySTL(path.c_str(), mesh)))
+		{
+			std::cerr << "Cannot read the reference mesh " << path << std::endl;
+			return 1;
+		}
+		reference.Build(mesh);
+	}
+
+	std::vector<ReplayResult> results;
+	if (s_options.sequences.empty())
+	{
+		s_options.sequences.push_back(std::string());
+	}
+	for (size_t i = 0; i < s_options.sequences.size(); ++i)
+	{
+		ReplayResult result;
+		if (!Replay(s_options.sequences[i], s_options.referencePath.empty() ? nullptr : &reference, result))
+		{
+			return 1;
+		}
+		PrintResult(result);
+		results.push_back(result);
+	}
+
+	if (!s_options.jsonPath.empty() && !WriteJson(s_options.jsonPath, results))
+	{
+		std::cerr << "Cannot write " << s_options.jsonPath << std::endl;
+		return 1;
+	}
+
+	int failures = CheckGates(results);
+	if (failures < 0)
+	{
+		std::cerr << "Cannot read the baseline " << s_options.baselinePath << std::endl;
+		return 1;
+	}
+	if (failures > 0)
+	{
+		std::cout << failures << " gate(s) failed" << std::endl;
+		return 2;
+	}
+	std::cout << "All gates passed" << std::endl;
+	return 0;
+}
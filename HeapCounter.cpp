@@ -0,0 +1,65 @@
+
+#include "HeapCounter.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+
+// GCC mistakes free in the replaced operator delete for a mismatch once both are inlined
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static std::atomic<long long> s_allocations(0);
+static std::atomic<long long> s_allocatedBytes(0);
+
+
+long long HeapAllocationCount()
+{
+	return s_allocations.load(std::memory_order_relaxed);
+}
+
+
+long long HeapAllocatedBytes()
+{
+	return s_allocatedBytes.load(std::memory_order_relaxed);
+}
+
+
+void* operator new(size_t size)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	s_allocatedBytes.fetch_add((long long)size, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (nullptr == p)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
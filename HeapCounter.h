@@ -0,0 +1,8 @@
+#pragma once
+
+/// <summary>
+/// Process-wide count of heap allocations, for the benchmark and the replay harness. Linking
+/// HeapCounter.cpp into a program replaces its global operator new and delete.
+/// </summary>
+long long HeapAllocationCount();
+long long HeapAllocatedBytes();
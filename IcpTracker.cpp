@@ -0,0 +1,295 @@
+
+#include "IcpTracker.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+#include <mutex>
+#include <math.h>
+
+
+IcpParameters::IcpParameters()
+	: distanceThreshold(0.1f)
+	, normalThreshold(0.8f)
+	, minInlierFraction(0.1f)
+	, maxTranslation(0.15f)
+	, maxRotation(0.35f)
+{
+	// finest level first; the coarse levels are cheap, so they take most of the iterations
+	iterations[0] = 4;
+	iterations[1] = 5;
+	iterations[2] = 10;
+	iterations[3] = 10;
+}
+
+
+/// <summary>
+/// Rigid transform in column convention: p' = R p + t
+/// </summary>
+struct Rigid
+{
+	double R[3][3];
+	double t[3];
+};
+
+static Rigid ToRigid(const Mat4& m)
+{
+	// Mat4 is applied to row vectors, so its 3x3 block is R transposed
+	const float* a = &m.M11;
+	Rigid r;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			r.R[j][i] = a[i * 4 + j];
+		}
+		r.t[i] = a[12 + i];
+	}
+	return r;
+}
+
+static Mat4 ToMat4(const Rigid& r)
+{
+	Mat4 m;
+	float* a = &m.M11;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			a[i * 4 + j] = (float)r.R[j][i];
+		}
+		a[i * 4 + 3] = 0.0f;
+		a[12 + i] = (float)r.t[i];
+	}
+	a[15] = 1.0f;
+	return m;
+}
+
+/// <summary>
+/// Rotation of angle |w| about w (Rodrigues)
+/// </summary>
+static void RotationFromVector(const double w[3], double R[3][3])
+{
+	double theta = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+	double k[3] = { 0, 0, 0 };
+	if (theta > 1e-12)
+	{
+		k[0] = w[0] / theta; k[1] = w[1] / theta; k[2] = w[2] / theta;
+	}
+	double c = cos(theta), s = sin(theta), v = 1.0 - c;
+	R[0][0] = c + k[0] * k[0] * v;        R[0][1] = k[0] * k[1] * v - k[2] * s; R[0][2] = k[0] * k[2] * v + k[1] * s;
+	R[1][0] = k[1] * k[0] * v + k[2] * s; R[1][1] = c + k[1] * k[1] * v;        R[1][2] = k[1] * k[2] * v - k[0] * s;
+	R[2][0] = k[2] * k[0] * v - k[1] * s; R[2][1] = k[2] * k[1] * v + k[0] * s; R[2][2] = c + k[2] * k[2] * v;
+}
+
+/// <summary>
+/// Solve A x = b for a symmetric positive definite 6x6 A by Cholesky decomposition
+/// </summary>
+static bool SolveCholesky6(const double A[6][6], const double b[6], double x[6])
+{
+	double L[6][6] = { { 0 } };
+	for (int i = 0; i < 6; ++i)
+	{
+		for (int j = 0; j <= i; ++j)
+		{
+			double sum = A[i][j];
+			for (int k = 0; k < j; ++k)
+			{
+				sum -= L[i][k] * L[j][k];
+			}
+			if (i == j)
+			{
+				if (sum <= 1e-12)
+				{
+					return false;
+				}
+				L[i][i] = sqrt(sum);
+			}
+			else
+			{
+				L[i][j] = sum / L[j][j];
+			}
+		}
+	}
+
+	double y[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		double sum = b[i];
+		for (int k = 0; k < i; ++k)
+		{
+			sum -= L[i][k] * y[k];
+		}
+		y[i] = sum / L[i][i];
+	}
+	for (int i = 5; i >= 0; --i)
+	{
+		double sum = y[i];
+		for (int k = i + 1; k < 6; ++k)
+		{
+			sum -= L[k][i] * x[k];
+		}
+		x[i] = sum / L[i][i];
+	}
+	return true;
+}
+
+
+IcpTracker::IcpTracker()
+	: m_width(0)
+	, m_height(0)
+	, m_levels(0)
+{
+}
+
+
+void IcpTracker::Resize(int width, int height, int levels)
+{
+	m_width = width;
+	m_height = height;
+	m_levels = (levels < IcpParameters::cMaxLevels) ? levels : IcpParameters::cMaxLevels;
+}
+
+
+IcpResult IcpTracker::Track(VertexNormalMaps& frame, const CameraIntrinsics& intrinsics, const float* pModelPoints,
+	const Mat4& modelWorldToCamera, Mat4& worldToCamera)
+{
+	IcpResult result;
+	result.tracked = false;
+	result.iterations = 0;
+	result.inliers = 0;
+	result.residual = 0.0f;
+
+	const int levels = (frame.Levels() < m_levels) ? frame.Levels() : m_levels;
+
+	// model pixels are looked up at full resolution whatever the frame level
+	IcpRowParameters row;
+	row.model = modelWorldToCamera;
+	row.fx = intrinsics.focalLengthX * m_width;
+	row.fy = intrinsics.focalLengthY * m_height;
+	row.cx = intrinsics.principalPointX * m_width - 0.5f;
+	row.cy = intrinsics.principalPointY * m_height - 0.5f;
+	row.modelWidth = m_width;
+	row.modelHeight = m_height;
+	row.pModelPoints = pModelPoints;
+	row.distanceThreshold2 = m_parameters.distanceThreshold * m_parameters.distanceThreshold;
+	row.normalThreshold = m_parameters.normalThreshold;
+	const SimdKernels& simd = ActiveSimdKernels();
+
+	const Rigid initial = ToRigid(InverseAffine(worldToCamera));
+	Rigid pose = initial;
+	std::mutex reduceLock;
+
+	int validPixels = 0;
+	for (int level = levels - 1; level >= 0; --level)
+	{
+		const int iterations = (level < IcpParameters::cMaxLevels) ? m_parameters.iterations[level] : 0;
+		if (0 == iterations)
+		{
+			continue;
+		}
+
+		// the maps of the levels without iterations are never computed
+		const VertexNormalLevel& maps = frame.Level(level);
+		const int width = maps.width;
+		const int height = maps.height;
+
+		for (int iteration = 0; iteration < iterations; ++iteration)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					row.R[i][j] = (float)pose.R[i][j];
+				}
+				row.t[i] = (float)pose.t[i];
+			}
+
+			IcpSystem total;
+			total.Clear();
+			int valid = 0;
+
+			ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+			{
+				IcpSystem local;
+				local.Clear();
+				int localValid = 0;
+				for (int y = rowBegin; y < rowEnd; ++y)
+				{
+					const float* ppRow[6];
+					maps.Row(y, ppRow);
+					simd.icpRow(ppRow, width, row, local, localValid);
+				}
+
+				std::lock_guard<std::mutex> lock(reduceLock);
+				total.Add(local);
+				valid += localValid;
+			}, 8);
+
+			result.iterations++;
+			// inliers against the valid pixels of the finest level tracked, which is level 0 unless
+			// it has no iterations
+			result.inliers = total.count;
+			validPixels = valid;
+			if (total.count < 6)
+			{
+				break;
+			}
+
+			double A[6][6];
+			int k = 0;
+			for (int i = 0; i < 6; ++i)
+			{
+				for (int j = i; j < 6; ++j)
+				{
+					A[i][j] = A[j][i] = total.AtA[k++];
+				}
+			}
+			double x[6];
+			if (!SolveCholesky6(A, total.Atb, x))
+			{
+				break;
+			}
+
+			// apply the increment on the world side: p' = dR p + dt
+			double dR[3][3];
+			RotationFromVector(x, dR);
+			Rigid next;
+			for (int i = 0; i < 3; ++i)
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					next.R[i][j] = dR[i][0] * pose.R[0][j] + dR[i][1] * pose.R[1][j] + dR[i][2] * pose.R[2][j];
+				}
+				next.t[i] = dR[i][0] * pose.t[0] + dR[i][1] * pose.t[1] + dR[i][2] * pose.t[2] + x[3 + i];
+			}
+			pose = next;
+			result.residual = (float)sqrt(total.error / total.count);
+
+			// converged once the update is below a tenth of a millimeter and a thousandth of a radian
+			if (x[0] * x[0] + x[1] * x[1] + x[2] * x[2] < 1e-6 && x[3] * x[3] + x[4] * x[4] + x[5] * x[5] < 1e-8)
+			{
+				break;
+			}
+		}
+	}
+
+	// reject too few matches and implausible jumps
+	double dt[3] = { pose.t[0] - initial.t[0], pose.t[1] - initial.t[1], pose.t[2] - initial.t[2] };
+	double translation = sqrt(dt[0] * dt[0] + dt[1] * dt[1] + dt[2] * dt[2]);
+	double trace = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		// trace of R initial^T
+		trace += pose.R[i][0] * initial.R[i][0] + pose.R[i][1] * initial.R[i][1] + pose.R[i][2] * initial.R[i][2];
+	}
+	double cosine = (trace - 1.0) * 0.5;
+	double rotation = acos(cosine > 1.0 ? 1.0 : (cosine < -1.0 ? -1.0 : cosine));
+
+	result.tracked = validPixels > 0 && result.inliers >= m_parameters.minInlierFraction * validPixels
+		&& translation <= m_parameters.maxTranslation && rotation <= m_parameters.maxRotation;
+	if (result.tracked)
+	{
+		worldToCamera = InverseAffine(ToMat4(pose));
+	}
+	return result;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "DepthProcessing.h"
+
+/// <summary>
+/// Settings of the camera tracking
+/// </summary>
+struct IcpParameters
+{
+	static const int            cMaxLevels = VertexNormalMaps::cMaxLevels;
+
+	/// <summary>
+	/// Gauss-Newton iterations per pyramid level, finest level first; a level without iterations
+	/// is not tracked on
+	/// </summary>
+	int                         iterations[cMaxLevels];
+
+	/// <summary>
+	/// Correspondences farther apart (in m) or with normals further apart are rejected
+	/// </summary>
+	float                       distanceThreshold;
+	float                       normalThreshold;		// cosine of the largest angle
+
+	/// <summary>
+	/// Tracking fails below this fraction of the valid frame pixels being matched
+	/// </summary>
+	float                       minInlierFraction;
+
+	/// <summary>
+	/// Tracking fails when the pose moves more than this between two frames (in m, in rad)
+	/// </summary>
+	float                       maxTranslation;
+	float                       maxRotation;
+
+	IcpParameters();
+};
+
+/// <summary>
+/// Outcome of tracking one frame
+/// </summary>
+struct IcpResult
+{
+	bool                        tracked;
+	int                         iterations;
+	int                         inliers;
+
+	/// <summary>
+	/// Root mean square point-to-plane distance of the inliers after the last iteration, in m
+	/// </summary>
+	float                       residual;
+};
+
+/// <summary>
+/// Native replacement of the tracking half of ProcessFrame (AlignDepthFloatToReconstruction):
+/// coarse-to-fine point-to-plane ICP of a depth pyramid against a raycast of the model, with
+/// projective data association. Each iteration is one parallel reduction into a 6x6 system.
+/// </summary>
+class IcpTracker
+{
+public:
+	IcpTracker();
+
+	void SetParameters(const IcpParameters& parameters) { m_parameters = parameters; }
+	const IcpParameters& Parameters() const { return m_parameters; }
+
+	/// <summary>
+	/// Set the frame size and the number of pyramid levels to track on
+	/// </summary>
+	void Resize(int width, int height, int levels);
+
+	/// <summary>
+	/// Align the frame to the model.
+	/// </summary>
+	/// <param name="frame">vertex and normal maps of the new frame, of the size given to Resize; only
+	/// the levels with iterations are computed</param>
+	/// <param name="pModelPoints">world space raycast of the model (6 floats per pixel), seen
+	/// from modelWorldToCamera at the resolution of pyramid level 0</param>
+	/// <param name="worldToCamera">in: initial guess, usually the last pose; out: the tracked
+	/// pose, left unchanged when tracking fails</param>
+	IcpResult Track(VertexNormalMaps& frame, const CameraIntrinsics& intrinsics, const float* pModelPoints,
+		const Mat4& modelWorldToCamera, Mat4& worldToCamera);
+
+private:
+	IcpParameters               m_parameters;
+	int                         m_width;
+	int                         m_height;
+	int                         m_levels;
+};
@@ -0,0 +1,160 @@
+
+#include "IntegrationPolicy.h"
+
+#include <math.h>
+
+
+IntegrationPolicySettings::IntegrationPolicySettings()
+	: enabled(true)
+	, minTranslation(0.005f)
+	, minRotation(0.005f)
+	, depthTolerance(0.01f)
+	, minChangedFraction(0.02f)
+	, maxSkippedFrames(4)
+{
+}
+
+
+IntegrationPolicy::IntegrationPolicy()
+	: m_width(0)
+	, m_height(0)
+	, m_hasReference(false)
+	, m_skippedFrames(0)
+	, m_minInterval(1)
+{
+	SetIdentity(m_referencePose);
+	Reset();
+}
+
+
+void IntegrationPolicy::Initialize(const IntegrationPolicySettings& settings, int width, int height)
+{
+	m_settings = settings;
+	m_width = width;
+	m_height = height;
+	m_referenceDepth.assign((size_t)((width + cSampleStep - 1) / cSampleStep) * ((height + cSampleStep - 1) / cSampleStep), 0);
+	Reset();
+}
+
+
+void IntegrationPolicy::Reset()
+{
+	m_hasReference = false;
+	m_skippedFrames = 0;
+	m_stats.frames = 0;
+	m_stats.integrated = 0;
+	m_stats.skipped = 0;
+	m_stats.translation = 0.0f;
+	m_stats.rotation = 0.0f;
+	m_stats.changedFraction = 0.0f;
+}
+
+
+/// <summary>
+/// Angle of the rotation between the rotation parts of two poses: the trace of a * transpose(b)
+/// is 1 + 2 cos(angle)
+/// </summary>
+static float RotationAngle(const Mat4& a, const Mat4& b)
+{
+	float trace =
+		a.M11 * b.M11 + a.M12 * b.M12 + a.M13 * b.M13 +
+		a.M21 * b.M21 + a.M22 * b.M22 + a.M23 * b.M23 +
+		a.M31 * b.M31 + a.M32 * b.M32 + a.M33 * b.M33;
+	float cosine = (trace - 1.0f) * 0.5f;
+	cosine = (cosine > 1.0f) ? 1.0f : ((cosine < -1.0f) ? -1.0f : cosine);
+	return acosf(cosine);
+}
+
+
+void IntegrationPolicy::TakeReference(const Mat4& worldToCamera, const unsigned short* pDepthMm, int pixelStride)
+{
+	m_referencePose = worldToCamera;
+	size_t sample = 0;
+	for (int y = 0; y < m_height; y += cSampleStep)
+	{
+		const unsigned short* pRow = pDepthMm + (size_t)y * m_width * pixelStride;
+		for (int x = 0; x < m_width; x += cSampleStep)
+		{
+			m_referenceDepth[sample++] = pRow[(size_t)x * pixelStride];
+		}
+	}
+	m_hasReference = true;
+	m_skippedFrames = 0;
+}
+
+
+bool IntegrationPolicy::Decide(const Mat4& worldToCamera, const unsigned short* pDepthMm, int pixelStride)
+{
+	m_stats.frames++;
+
+	// too soon after the last integrated frame for the quality level
+	if (m_hasReference && m_skippedFrames + 1 < m_minInterval)
+	{
+		m_skippedFrames++;
+		m_stats.skipped++;
+		return false;
+	}
+
+	bool integrate = !m_settings.enabled || !m_hasReference || m_skippedFrames >= m_settings.maxSkippedFrames;
+
+	if (m_hasReference)
+	{
+		float position[3];
+		float referencePosition[3];
+		CameraPosition(worldToCamera, position);
+		CameraPosition(m_referencePose, referencePosition);
+		float dx = position[0] - referencePosition[0];
+		float dy = position[1] - referencePosition[1];
+		float dz = position[2] - referencePosition[2];
+		m_stats.translation = sqrtf(dx * dx + dy * dy + dz * dz);
+		m_stats.rotation = RotationAngle(worldToCamera, m_referencePose);
+
+		integrate = integrate || m_stats.translation > m_settings.minTranslation || m_stats.rotation > m_settings.minRotation;
+	}
+
+	// the camera did not move: only a change in the scene makes the frame worth integrating
+	if (!integrate)
+	{
+		const int maxChanged = (int)(m_settings.minChangedFraction * m_referenceDepth.size());
+		const float tolerance = m_settings.depthTolerance * 1e-3f;		// in mm, times the depth in mm squared
+		int changed = 0;
+		size_t sample = 0;
+		for (int y = 0; y < m_height; y += cSampleStep)
+		{
+			const unsigned short* pRow = pDepthMm + (size_t)y * m_width * pixelStride;
+			for (int x = 0; x < m_width; x += cSampleStep)
+			{
+				int depth = pRow[(size_t)x * pixelStride];
+				int reference = m_referenceDepth[sample++];
+				if (depth == reference)
+				{
+					continue;
+				}
+				if (0 == depth || 0 == reference)
+				{
+					changed++;
+					continue;
+				}
+				float difference = (float)(depth > reference ? depth - reference : reference - depth);
+				if (difference > tolerance * (float)depth * (float)depth)
+				{
+					changed++;
+				}
+			}
+		}
+		m_stats.changedFraction = (float)changed / (float)m_referenceDepth.size();
+		integrate = changed > maxChanged;
+	}
+
+	if (integrate)
+	{
+		TakeReference(worldToCamera, pDepthMm, pixelStride);
+		m_stats.integrated++;
+	}
+	else
+	{
+		m_skippedFrames++;
+		m_stats.skipped++;
+	}
+	return integrate;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "MemoryAccounting.h"
+
+#include <vector>
+
+/// <summary>
+/// When a tracked frame is worth integrating. A frame that neither moved the camera nor changed
+/// the depth image since the last integrated frame adds little beyond noise averaging, so it is
+/// integrated at a reduced rate instead of every frame; tracking still runs on every frame.
+/// </summary>
+struct IntegrationPolicySettings
+{
+	/// <summary>
+	/// false integrates every tracked frame
+	/// </summary>
+	bool                        enabled;
+
+	/// <summary>
+	/// The camera moved when it is this far (in m) or turned this much (in rad) from where the
+	/// last integrated frame was taken
+	/// </summary>
+	float                       minTranslation;
+	float                       minRotation;
+
+	/// <summary>
+	/// A sampled pixel changed when its depth differs by more than this (in m) from the last
+	/// integrated frame, at 1 m; the tolerance grows with the square of the depth, like the
+	/// sensor noise. Appearing and vanishing readings count as changes too.
+	/// </summary>
+	float                       depthTolerance;
+
+	/// <summary>
+	/// The depth image changed when more than this fraction of the sampled pixels did
+	/// </summary>
+	float                       minChangedFraction;
+
+	/// <summary>
+	/// A still frame is integrated anyway after this many skipped ones, to keep averaging noise
+	/// </summary>
+	int                         maxSkippedFrames;
+
+	IntegrationPolicySettings();
+};
+
+/// <summary>
+/// Decisions since the last reset
+/// </summary>
+struct IntegrationPolicyStats
+{
+	int                         frames;
+	int                         integrated;
+	int                         skipped;
+
+	/// <summary>
+	/// What the last decision saw, against the last integrated frame
+	/// </summary>
+	float                       translation;		// m
+	float                       rotation;			// rad
+	float                       changedFraction;
+};
+
+/// <summary>
+/// Decides per tracked frame whether to integrate it, from the pose and a sparse sample of the
+/// depth image compared with those of the last integrated frame. Comparing with the last
+/// integrated frame rather than the previous one keeps a slow drift from going unintegrated.
+/// The reference is sized by Initialize, so Decide does not allocate.
+/// </summary>
+class IntegrationPolicy
+{
+public:
+	/// <summary>
+	/// Every cSampleStep-th pixel of every cSampleStep-th row is compared
+	/// </summary>
+	static const int            cSampleStep = 4;
+
+	IntegrationPolicy();
+
+	void Initialize(const IntegrationPolicySettings& settings, int width, int height);
+	const IntegrationPolicySettings& Settings() const { return m_settings; }
+
+	/// <summary>
+	/// Integrate at most every n-th frame, whatever the motion; 1 lets every frame through. Set
+	/// by the quality governor, and applied even when the policy is disabled.
+	/// </summary>
+	void SetMinInterval(int frames) { m_minInterval = (frames > 1) ? frames : 1; }
+
+	/// <summary>
+	/// Forget the reference, so the next frame is integrated; call whenever the volume is cleared
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Whether to integrate a tracked frame; a frame to integrate becomes the new reference
+	/// </summary>
+	/// <param name="worldToCamera">tracked pose of the frame</param>
+	/// <param name="pDepthMm">depths in mm, 0 = no reading, of the size given to Initialize</param>
+	/// <param name="pixelStride">distance between two pixels in unsigned shorts, e.g. 2 for the
+	/// depth of NUI_DEPTH_IMAGE_PIXEL</param>
+	bool Decide(const Mat4& worldToCamera, const unsigned short* pDepthMm, int pixelStride = 1);
+
+	const IntegrationPolicyStats& Stats() const { return m_stats; }
+
+	size_t MemoryBytes() const { return m_referenceDepth.capacity() * sizeof(unsigned short); }
+
+private:
+	void TakeReference(const Mat4& worldToCamera, const unsigned short* pDepthMm, int pixelStride);
+
+	IntegrationPolicySettings   m_settings;
+	int                         m_width;
+	int                         m_height;
+
+	bool                        m_hasReference;
+	Mat4                        m_referencePose;
+	std::vector<unsigned short, TaggedAllocator<unsigned short, MemoryFrames> > m_referenceDepth;
+	int                         m_skippedFrames;
+	int                         m_minInterval;
+
+	IntegrationPolicyStats      m_stats;
+};
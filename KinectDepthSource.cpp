@@ -0,0 +1,169 @@
+#include "KinectDepthSource.h"
+
+
+/// <summary>
+/// The NUI_IMAGE_RESOLUTION of a depth frame size
+/// </summary>
+/// <returns>NUI_IMAGE_RESOLUTION_INVALID if the Kinect has no depth stream of that size</returns>
+static NUI_IMAGE_RESOLUTION DepthResolution(int width, int height)
+{
+	if (640 == width && 480 == height)
+	{
+		return NUI_IMAGE_RESOLUTION_640x480;
+	}
+	if (320 == width && 240 == height)
+	{
+		return NUI_IMAGE_RESOLUTION_320x240;
+	}
+	if (80 == width && 60 == height)
+	{
+		return NUI_IMAGE_RESOLUTION_80x60;
+	}
+	return NUI_IMAGE_RESOLUTION_INVALID;
+}
+
+
+KinectDepthSource::KinectDepthSource(int width, int height)
+	: m_pNuiSensor(nullptr)
+	, m_hNextDepthFrameEvent(INVALID_HANDLE_VALUE)
+	, m_hDepthStreamHandle(INVALID_HANDLE_VALUE)
+	, m_depthImageResolution(DepthResolution(width, height))
+	, m_width(width)
+	, m_height(height)
+	, m_frameIndex(0)
+	, m_firstTimeStamp(0)
+{
+}
+
+
+KinectDepthSource::~KinectDepthSource()
+{
+	if (nullptr != m_pNuiSensor)
+	{
+		m_pNuiSensor->NuiShutdown();
+		m_pNuiSensor->Release();
+	}
+	if (INVALID_HANDLE_VALUE != m_hNextDepthFrameEvent)
+	{
+		CloseHandle(m_hNextDepthFrameEvent);
+	}
+}
+
+
+bool KinectDepthSource::Open()
+{
+	if (NUI_IMAGE_RESOLUTION_INVALID == m_depthImageResolution)
+	{
+		m_error = "the Kinect has no " + std::to_string(m_width) + "x" + std::to_string(m_height)
+			+ " depth stream, use 80x60, 320x240 or 640x480";
+		return false;
+	}
+
+	int count = 0;
+	NuiGetSensorCount(&count);
+	if (0 == count)
+	{
+		m_error = "no valid Kinect is connected";
+		return false;
+	}
+	NuiCreateSensorByIndex(0, &m_pNuiSensor);
+	if (nullptr == m_pNuiSensor || S_OK != m_pNuiSensor->NuiStatus())
+	{
+		m_error = "the Kinect is not ready to work";
+		return false;
+	}
+
+	if (FAILED(m_pNuiSensor->NuiInitialize(NUI_INITIALIZE_FLAG_USES_DEPTH)))
+	{
+		m_error = "NuiInitialize failed";
+		return false;
+	}
+
+	// An event signalled when depth data is available, and the depth stream signalling it
+	m_hNextDepthFrameEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (FAILED(m_pNuiSensor->NuiImageStreamOpen(NUI_IMAGE_TYPE_DEPTH, m_depthImageResolution, 0, 2,
+		m_hNextDepthFrameEvent, &m_hDepthStreamHandle)))
+	{
+		m_error = "NuiImageStreamOpen failed";
+		return false;
+	}
+
+	m_depthMm.resize((size_t)m_width * m_height);
+	m_frameIndex = 0;
+	return true;
+}
+
+
+DepthFrameStatus KinectDepthSource::NextFrame(DepthFrame& frame, int timeoutMs)
+{
+	if (WaitForSingleObject(m_hNextDepthFrameEvent, timeoutMs) != WAIT_OBJECT_0)
+	{
+		return DepthFrameTimeout;
+	}
+
+	NUI_IMAGE_FRAME imageFrame;
+	if (FAILED(m_pNuiSensor->NuiImageStreamGetNextFrame(m_hDepthStreamHandle, 0, &imageFrame)))
+	{
+		m_error = "NuiImageStreamGetNextFrame failed";
+		return DepthFrameError;
+	}
+	bool copied = CopyExtendedDepth(imageFrame);
+	LONGLONG timeStamp = imageFrame.liTimeStamp.QuadPart;
+
+	// Release the Kinect camera frame
+	m_pNuiSensor->NuiImageStreamReleaseFrame(m_hDepthStreamHandle, &imageFrame);
+	if (!copied)
+	{
+		return DepthFrameError;
+	}
+
+	if (0 == m_frameIndex)
+	{
+		m_firstTimeStamp = timeStamp;
+	}
+	frame.pDepthMm = m_depthMm.data();
+	frame.width = m_width;
+	frame.height = m_height;
+	frame.timestamp = (timeStamp - m_firstTimeStamp) / 1000.0;
+	frame.index = m_frameIndex++;
+	return DepthFrameReady;
+}
+
+
+bool KinectDepthSource::CopyExtendedDepth(NUI_IMAGE_FRAME& imageFrame)
+{
+	INuiFrameTexture* extendedDepthTex = nullptr;
+	// Extract the extended depth in NUI_DEPTH_IMAGE_PIXEL format from the frame
+	BOOL nearModeOperational = FALSE;
+	if (FAILED(m_pNuiSensor->NuiImageFrameGetDepthImagePixelFrameTexture(m_hDepthStreamHandle, &imageFrame,
+		&nearModeOperational, &extendedDepthTex)))
+	{
+		m_error = "error getting the extended depth texture";
+		return false;
+	}
+
+	// Lock the frame data to access the un-clamped NUI_DEPTH_IMAGE_PIXELs
+	NUI_LOCKED_RECT extendedDepthLockedRect;
+	HRESULT hr = extendedDepthTex->LockRect(0, &extendedDepthLockedRect, nullptr, 0);
+	if (FAILED(hr) || extendedDepthLockedRect.Pitch == 0)
+	{
+		m_error = "error getting the extended depth texture pixels";
+		return false;
+	}
+	if (extendedDepthTex->BufferLen() < (INT)(m_depthMm.size() * sizeof(NUI_DEPTH_IMAGE_PIXEL)))
+	{
+		extendedDepthTex->UnlockRect(0);
+		m_error = "the extended depth texture is smaller than the frame";
+		return false;
+	}
+
+	// Keep the depth only, so that the frame can be returned
+	const NUI_DEPTH_IMAGE_PIXEL* pPixels = reinterpret_cast<const NUI_DEPTH_IMAGE_PIXEL*>(extendedDepthLockedRect.pBits);
+	for (size_t i = 0; i < m_depthMm.size(); ++i)
+	{
+		m_depthMm[i] = pPixels[i].depth;
+	}
+
+	extendedDepthTex->UnlockRect(0);
+	return true;
+}
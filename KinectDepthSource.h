@@ -0,0 +1,50 @@
+#pragma once
+
+#include "DepthSource.h"
+#include "MemoryAccounting.h"
+
+#include <windows.h>
+#include <NuiApi.h>
+
+#include <vector>
+
+/// <summary>
+/// Depth frames of the first Kinect v1 connected, with the extended (unclamped) depth.
+/// Windows only.
+/// </summary>
+class KinectDepthSource : public DepthSource
+{
+public:
+	/// <summary>
+	/// The depth stream is opened at width x height, which must be one of the Kinect v1 depth
+	/// resolutions (80x60, 320x240 or 640x480); Open fails otherwise
+	/// </summary>
+	KinectDepthSource(int width = 640, int height = 480);
+	~KinectDepthSource();
+
+	const char* Name() const { return "kinect"; }
+	bool Open();
+	int Width() const { return m_width; }
+	int Height() const { return m_height; }
+	DepthFrameStatus NextFrame(DepthFrame& frame, int timeoutMs);
+
+private:
+	KinectDepthSource(const KinectDepthSource&);
+	KinectDepthSource& operator=(const KinectDepthSource&);
+
+	/// <summary>
+	/// Copy the extended depth out of a Kinect image frame
+	/// </summary>
+	/// <returns>false on failure, with the reason in m_error</returns>
+	bool CopyExtendedDepth(NUI_IMAGE_FRAME& imageFrame);
+
+	INuiSensor*                 m_pNuiSensor;
+	HANDLE                      m_hNextDepthFrameEvent;
+	HANDLE                      m_hDepthStreamHandle;
+	NUI_IMAGE_RESOLUTION        m_depthImageResolution;
+	int                         m_width;
+	int                         m_height;
+	std::vector<unsigned short, TaggedAllocator<unsigned short, MemoryFrames> > m_depthMm;
+	long long                   m_frameIndex;
+	LONGLONG                    m_firstTimeStamp;	// ms
+};
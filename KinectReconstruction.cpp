@@ -0,0 +1,526 @@
+#include "KinectReconstruction.h"
+#include "FusionHelper.h"
+#include "Telemetry.h"
+
+#include <chrono>
+#include <iostream>
+#include <string.h>
+
+
+// The same stages and counters as FusionPipeline, so that telemetry compares the two
+static const StageId s_stageFusionFrame = Telemetry::Instance().RegisterStage("fusion-frame");
+static const StageId s_stageCapture = Telemetry::Instance().RegisterStage("capture");
+static const StageId s_stageDepthFloat = Telemetry::Instance().RegisterStage("depth-float");
+static const StageId s_stageDepthFilter = Telemetry::Instance().RegisterStage("depth-filter");
+static const StageId s_stageProcessFrame = Telemetry::Instance().RegisterStage("process-frame");
+static const StageId s_stagePointCloud = Telemetry::Instance().RegisterStage("point-cloud");
+static const StageId s_stageCalculateMesh = Telemetry::Instance().RegisterStage("calculate-mesh");
+static const CounterId s_counterFusedFrames = Telemetry::Instance().RegisterCounter("fused-frames");
+static const CounterId s_counterIntegratedFrames = Telemetry::Instance().RegisterCounter("integrated-frames");
+static const CounterId s_counterSkippedIntegrations = Telemetry::Instance().RegisterCounter("skipped-integrations");
+static const CounterId s_counterLostFrames = Telemetry::Instance().RegisterCounter("lost-frames");
+
+
+/// <summary>
+/// Copy depths in mm into the NUI_DEPTH_IMAGE_PIXELs DepthToDepthFloatFrame takes
+/// </summary>
+static void PackDepth(const unsigned short* pDepthMm, int width, int height, NUI_DEPTH_IMAGE_PIXEL* pPixels)
+{
+	const int pixels = width * height;
+	for (int i = 0; i < pixels; ++i)
+	{
+		pPixels[i].playerIndex = 0;
+		pPixels[i].depth = pDepthMm[i];
+	}
+}
+
+
+static double MillisecondsSince(Timing::Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Timing::Clock::now() - start).count();
+}
+
+
+KinectReconstruction::KinectReconstruction(bool sdkShading, bool alignApart)
+	: m_width(0)
+	, m_height(0)
+	, m_bSdkShading(sdkShading)
+	, m_bAlignApart(alignApart)
+	, m_pVolume(nullptr)
+	, m_pDepthFloatImage(nullptr)
+	, m_pPointCloud(nullptr)
+	, m_pShadedSurface(nullptr)
+	, m_cAlignIterations(NUI_FUSION_DEFAULT_ALIGN_ITERATION_COUNT)
+	, m_bTranslateResetPoseByMinDepthThreshold(true)
+	, m_cFrameCount(0)
+{
+	SetIdentityMatrix(m_worldToCameraTransform);
+	SetIdentityMatrix(m_defaultWorldToVolumeTransform);
+}
+
+
+KinectReconstruction::~KinectReconstruction()
+{
+	if (nullptr != m_pDepthFloatImage)
+	{
+		NuiFusionReleaseImageFrame(m_pDepthFloatImage);
+	}
+	if (nullptr != m_pPointCloud)
+	{
+		NuiFusionReleaseImageFrame(m_pPointCloud);
+	}
+	if (nullptr != m_pShadedSurface)
+	{
+		NuiFusionReleaseImageFrame(m_pShadedSurface);
+	}
+	SafeRelease(m_pVolume);
+}
+
+
+bool KinectReconstruction::Initialize(const FusionPipelineParameters& parameters, int width, int height)
+{
+	m_parameters = parameters;
+	m_width = width;
+	m_height = height;
+
+	// Create the Kinect Fusion Reconstruction Volume, smaller and smaller until the device can hold it
+	const VolumeBackend backend = Backend();
+	VolumeParameters volume = parameters.volume;
+	HRESULT hr = S_OK;
+	for (;;)
+	{
+		m_reconstructionParams.voxelsPerMeter = volume.voxelsPerMeter;
+		m_reconstructionParams.voxelCountX = volume.voxelCountX;
+		m_reconstructionParams.voxelCountY = volume.voxelCountY;
+		m_reconstructionParams.voxelCountZ = volume.voxelCountZ;
+		hr = NuiFusionCreateReconstruction(
+			&m_reconstructionParams,
+			NUI_FUSION_RECONSTRUCTION_PROCESSOR_TYPE_AMP,
+			-1,
+			&m_worldToCameraTransform,
+			&m_pVolume);
+		VolumeParameters failed = volume;
+		if (SUCCEEDED(hr) || !ShrinkVolume(volume, backend))
+		{
+			break;
+		}
+		std::cout << "Could not create the volume (" << DescribeVolume(failed, backend) << "), trying a smaller one" << std::endl;
+	}
+	if (FAILED(hr))
+	{
+		m_error = "NuiFusionCreateReconstruction failed.";
+		return false;
+	}
+
+	// 4 bytes per voxel, held by the SDK (on the GPU with the AMP processor)
+	m_volumeMemory.Reserve(MemoryVolume, (long long)VolumeBytes(volume, backend));
+
+	// Save the default world to volume transformation to be optionally used in Reset
+	hr = m_pVolume->GetCurrentWorldToVolumeTransform(&m_defaultWorldToVolumeTransform);
+	if (FAILED(hr))
+	{
+		m_error = "Failed in call to GetCurrentWorldToVolumeTransform.";
+		return false;
+	}
+
+	// DepthFloatImage  Frames generated from the depth input
+	hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_FLOAT, width, height, nullptr, &m_pDepthFloatImage);
+	if (FAILED(hr))
+	{
+		m_error = "NuiFusionCreateImageFrame failed (Float).";
+		return false;
+	}
+
+	// PointCloud   Create images to raycast the Reconstruction Volume
+	hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_POINT_CLOUD, width, height, nullptr, &m_pPointCloud);
+	if (FAILED(hr))
+	{
+		m_error = "NuiFusionCreateImageFrame failed (PointCloud).";
+		return false;
+	}
+
+	// ShadedSurface  Create images to raycast the Reconstruction Volume(color)
+	hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_COLOR, width, height, nullptr, &m_pShadedSurface);
+	if (FAILED(hr))
+	{
+		m_error = "NuiFusionCreateImageFrame failed (Color).";
+		return false;
+	}
+
+	// float depth, 6 float point cloud and BGRX colour per pixel
+	m_imageFrameMemory.Reserve(MemoryFrames, (long long)width * height * (4 + 24 + 4));
+
+	try
+	{
+		m_depthImagePixels.resize((size_t)width * height);
+	}
+	catch (const std::bad_alloc&)
+	{
+		m_error = "Failed to initialize Kinect Fusion depth image pixel buffer.";
+		return false;
+	}
+	m_integrationPolicy.Initialize(parameters.integration, width, height);
+	m_depthFilter.Initialize(parameters.depthFilter, width, height);
+
+	// This call will set the world-volume transformation
+	return Reset();
+}
+
+
+bool KinectReconstruction::Reset()
+{
+	if (nullptr == m_pVolume)
+	{
+		m_error = "Kinect Fusion reconstruction volume not initialized.";
+		return false;
+	}
+
+	HRESULT hr = S_OK;
+	SetIdentityMatrix(m_worldToCameraTransform);
+	// Translate the reconstruction volume location away from the world origin by an amount equal
+	// to the minimum depth threshold. This ensures that some depth signal falls inside the volume.
+	// If set false, the default world origin is set to the center of the front face of the
+	// volume, which has the effect of locating the volume directly in front of the initial camera
+	// positionto the with the +Z axis in volume along the initial camera direction of view.
+	if (m_bTranslateResetPoseByMinDepthThreshold)
+	{
+		Matrix4 worldToVolumeTransform = m_defaultWorldToVolumeTransform;
+
+		// Translate the volume in the Z axis by the minDepthThreshold distance
+		float minDist = (m_parameters.minDepth < m_parameters.maxDepth) ? m_parameters.minDepth : m_parameters.maxDepth;
+		worldToVolumeTransform.M43 -= (minDist * m_reconstructionParams.voxelsPerMeter);
+
+		hr = m_pVolume->ResetReconstruction(&m_worldToCameraTransform, &worldToVolumeTransform);
+	}
+	else
+	{
+		hr = m_pVolume->ResetReconstruction(&m_worldToCameraTransform, nullptr);
+	}
+
+	m_cFrameCount = 0;
+	m_integrationPolicy.Reset();
+	m_depthFilter.Reset();
+	if (FAILED(hr))
+	{
+		m_error = "Failed to reset reconstruction.";
+		return false;
+	}
+	return true;
+}
+
+
+void KinectReconstruction::SetQuality(const QualityLevel& quality)
+{
+	// The SDK has no control over the tracking pyramid: skipping the finest level becomes
+	// halving the align iterations once more
+	int iterations = (int)(NUI_FUSION_DEFAULT_ALIGN_ITERATION_COUNT * quality.iterationScale + 0.5f) >> quality.skippedTrackingLevels;
+	m_cAlignIterations = (unsigned short)((iterations > 1) ? iterations : 1);
+	m_integrationPolicy.SetMinInterval(quality.integrationInterval);
+}
+
+
+bool KinectReconstruction::ProcessFrame(const unsigned short* pDepthMm, ReconstructionFrame& frame)
+{
+	ScopedStageTimer frameTimer(s_stageFusionFrame);
+	frame.tracked = false;
+	frame.integrated = false;
+	frame.residual = -1.0f;
+	frame.trackingMs = 0;
+	frame.integrationMs = 0;
+	frame.raycastMs = 0;
+
+	{
+		// The SDK takes the depth as NUI_DEPTH_IMAGE_PIXELs
+		ScopedStageTimer stageTimer(s_stageCapture);
+		PackDepth(pDepthMm, m_width, m_height, m_depthImagePixels.data());
+	}
+
+
+	////////////////////////////////////////////////////////
+	// Depth to DepthFloat
+
+	// Convert the pixels describing extended depth as unsigned short type in millimeters to depth
+	// as floating point type in meters.
+	HRESULT hr = S_OK;
+	{
+		ScopedStageTimer stageTimer(s_stageDepthFloat);
+		hr = m_pVolume->DepthToDepthFloatFrame(m_depthImagePixels.data(), (UINT)(m_depthImagePixels.size() * sizeof(NUI_DEPTH_IMAGE_PIXEL)),
+			m_pDepthFloatImage, m_parameters.minDepth, m_parameters.maxDepth, m_parameters.mirrorDepth);
+	}
+	if (FAILED(hr))
+	{
+		m_error = "Kinect Fusion NuiFusionDepthToDepthFloatFrame call failed.";
+		return false;
+	}
+
+	// Denoise the float depth in place, on the CPU copy of the frame the SDK tracks and integrates
+	if (m_depthFilter.Settings().Enabled())
+	{
+		ScopedStageTimer stageTimer(s_stageDepthFilter);
+		INuiFrameTexture * pDepthTexture = m_pDepthFloatImage->pFrameTexture;
+		NUI_LOCKED_RECT depthLockedRect;
+		if (SUCCEEDED(pDepthTexture->LockRect(0, &depthLockedRect, nullptr, 0)))
+		{
+			// the filter takes packed rows, which is how the SDK allocates float frames
+			if (depthLockedRect.Pitch == m_width * (int)sizeof(float))
+			{
+				m_depthFilter.Apply((float *)depthLockedRect.pBits);
+			}
+			pDepthTexture->UnlockRect(0);
+		}
+	}
+
+
+	////////////////////////////////////////////////////////
+	// ProcessFrame
+
+	// Perform the camera tracking and update the Kinect Fusion Volume
+	// This will create memory on the GPU, upload the image, run camera tracking and integrate the
+	// data into the Reconstruction Volume if successful. Note that passing nullptr as the final
+	// parameter will use and update the internal camera pose.
+	// With lazy integration the two halves run separately, and still frames are integrated at a
+	// reduced rate.
+	{
+		ScopedStageTimer stageTimer(s_stageProcessFrame);
+		if (m_integrationPolicy.Settings().enabled || m_bAlignApart)
+		{
+			hr = AlignAndIntegrate(frame);
+		}
+		else
+		{
+			hr = m_pVolume->ProcessFrame(m_pDepthFloatImage, NUI_FUSION_DEFAULT_ALIGN_ITERATION_COUNT, m_parameters.maxIntegrationWeight, &m_worldToCameraTransform);
+			frame.integrated = SUCCEEDED(hr);
+			if (frame.integrated)
+			{
+				Telemetry::Instance().Add(s_counterIntegratedFrames);
+			}
+		}
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = m_pVolume->GetCurrentWorldToCameraTransform(&m_worldToCameraTransform);
+		if (FAILED(hr))
+		{
+			m_error = "Failed in call to GetCurrentWorldToCameraTransform.";
+			return false;
+		}
+		frame.tracked = true;
+	}
+	else if (hr == E_NUI_FUSION_TRACKING_ERROR)
+	{
+		Telemetry::Instance().Add(s_counterLostFrames);
+	}
+	else
+	{
+		m_error = "Kinect Fusion ProcessFrame call failed!";
+		return false;
+	}
+
+	m_cFrameCount++;
+	Telemetry::Instance().Add(s_counterFusedFrames);
+	return true;
+}
+
+
+HRESULT KinectReconstruction::AlignAndIntegrate(ReconstructionFrame& frame)
+{
+	// Like ProcessFrame, the first frame after a reset defines the model and is not tracked
+	HRESULT hr = S_OK;
+	if (0 != m_cFrameCount)
+	{
+		Timing::Clock::time_point alignStart = Timing::Clock::now();
+		hr = m_pVolume->AlignDepthFloatToReconstruction(m_pDepthFloatImage, m_cAlignIterations, nullptr, &frame.residual, nullptr);
+		frame.trackingMs = MillisecondsSince(alignStart);
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+	}
+
+	Matrix4 trackedPose;
+	hr = m_pVolume->GetCurrentWorldToCameraTransform(&trackedPose);
+	if (FAILED(hr))
+	{
+		return hr;
+	}
+
+	// The policy reads the millimetre depth of NUI_DEPTH_IMAGE_PIXEL, two unsigned shorts apart
+	if (!m_integrationPolicy.Decide(ToMat4(trackedPose), &m_depthImagePixels[0].depth, 2))
+	{
+		Telemetry::Instance().Add(s_counterSkippedIntegrations);
+		return S_OK;
+	}
+
+	Timing::Clock::time_point integrateStart = Timing::Clock::now();
+	hr = m_pVolume->IntegrateFrame(m_pDepthFloatImage, m_parameters.maxIntegrationWeight, &trackedPose);
+	frame.integrationMs = MillisecondsSince(integrateStart);
+	if (SUCCEEDED(hr))
+	{
+		frame.integrated = true;
+		Telemetry::Instance().Add(s_counterIntegratedFrames);
+	}
+	return hr;
+}
+
+
+bool KinectReconstruction::CalculatePointCloud()
+{
+	// The SDK tracks against a raycast of its own, so this one only feeds the display and the export
+	HRESULT hr = S_OK;
+	{
+		ScopedStageTimer stageTimer(s_stagePointCloud);
+		hr = m_pVolume->CalculatePointCloud(m_pPointCloud, &m_worldToCameraTransform);
+	}
+	if (FAILED(hr))
+	{
+		m_error = "Kinect Fusion CalculatePointCloud call failed.";
+		return false;
+	}
+	return true;
+}
+
+
+bool KinectReconstruction::Shade(PointCloudShader& shader, unsigned char* pDst, int dstStride)
+{
+	if (m_bSdkShading)
+	{
+		HRESULT hr = NuiFusionShadePointCloud(m_pPointCloud, &m_worldToCameraTransform, nullptr, m_pShadedSurface, nullptr);
+		if (FAILED(hr))
+		{
+			m_error = "Kinect Fusion NuiFusionShadePointCloud call failed.";
+			return false;
+		}
+	}
+
+	// With native shading the point cloud is read and shaded straight into the destination,
+	// otherwise the SDK shaded surface is copied there
+	INuiFrameTexture * pSourceTexture = m_bSdkShading ? m_pShadedSurface->pFrameTexture : m_pPointCloud->pFrameTexture;
+	NUI_LOCKED_RECT SourceLockedRect;
+
+	// Lock the frame data so the Kinect knows not to modify it while we're reading it
+	if (FAILED(pSourceTexture->LockRect(0, &SourceLockedRect, nullptr, 0)) || 0 == SourceLockedRect.Pitch)
+	{
+		m_error = "Cannot lock the Kinect Fusion image frame.";
+		return false;
+	}
+
+	const int rowBytes = m_width * 4;
+	if (m_bSdkShading)
+	{
+		const BYTE * pSrc = (const BYTE *)SourceLockedRect.pBits;
+		for (int y = 0; y < m_height; ++y)
+		{
+			memcpy(pDst + y * dstStride, pSrc + y * SourceLockedRect.Pitch, rowBytes);
+		}
+	}
+	else
+	{
+		shader.Shade((const float *)SourceLockedRect.pBits, SourceLockedRect.Pitch, m_width, m_height,
+			ToMat4(m_worldToCameraTransform), pDst, dstStride);
+	}
+
+	// We're done with the texture so unlock it
+	pSourceTexture->UnlockRect(0);
+	return true;
+}
+
+
+void KinectReconstruction::ExportPoints(PointCloudExporter& exporter, long long frame, PointExportSource source)
+{
+	// Only the copy into the exporter's buffer runs here; when the writer is behind, the frame is dropped
+	NUI_FUSION_IMAGE_FRAME* pFrame = (PointExportDepth == source) ? m_pDepthFloatImage : m_pPointCloud;
+	INuiFrameTexture * pTexture = pFrame->pFrameTexture;
+	NUI_LOCKED_RECT lockedRect;
+	if (FAILED(pTexture->LockRect(0, &lockedRect, nullptr, 0)))
+	{
+		return;
+	}
+	if (pFrame == m_pPointCloud)
+	{
+		// the SDK raycast is in world space, like the one the shader reads
+		exporter.SubmitPoints(frame, (const float *)lockedRect.pBits, lockedRect.Pitch, m_width, m_height);
+	}
+	else if (lockedRect.Pitch == m_width * (int)sizeof(float))
+	{
+		exporter.SubmitDepth(frame, (const float *)lockedRect.pBits, m_width, m_height,
+			KinectDepthIntrinsics(), ToMat4(m_worldToCameraTransform));
+	}
+	pTexture->UnlockRect(0);
+}
+
+
+bool KinectReconstruction::ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+	std::vector<short>& samples)
+{
+	samples.resize((size_t)samplesX * samplesY * samplesZ);
+	HRESULT hr = m_pVolume->ExportVolumeBlock(x, y, z, samplesX, samplesY, samplesZ, step,
+		(UINT)(samples.size() * sizeof(short)), samples.data());
+	return SUCCEEDED(hr);
+}
+
+
+bool KinectReconstruction::SaveMesh(const std::string& path)
+{
+	INuiFusionMesh *mesh = nullptr;
+	HRESULT hr = S_OK;
+	{
+		ScopedStageTimer meshTimer(s_stageCalculateMesh);
+		hr = m_pVolume->CalculateMesh(1, &mesh);
+	}
+	if (FAILED(hr))
+	{
+		m_error = "Kinect Fusion CalculateMesh call failed.";
+		return false;
+	}
+
+	// vertices (and normals) plus indices, held by the SDK until the mesh is released
+	MemoryReservation meshMemory;
+	meshMemory.Reserve(MemoryMesh, (long long)mesh->VertexCount() * 2 * sizeof(Vector3)
+		+ (long long)mesh->TriangleVertexIndexCount() * sizeof(int));
+
+	// the writers take a char*
+	std::vector<char> filename(path.begin(), path.end());
+	filename.push_back('\0');
+	if (path.substr(path.find_last_of(".") + 1) == "obj")
+	{
+		std::cout << "Creating and saving mesh in format obj,please waiting...... " << std::endl;
+		hr = WriteAsciiObjMeshFile(mesh, filename.data());
+	}
+	else
+	{
+		std::cout << "Creating and saving mesh in format stl,please waiting...... " << std::endl;
+		hr = WriteBinarySTLMeshFile(mesh, filename.data());
+	}
+	SafeRelease(mesh);
+
+	if (FAILED(hr))
+	{
+		m_error = "Error saving Kinect Fusion mesh!";
+		return false;
+	}
+	return true;
+}
+
+
+Mat4 KinectReconstruction::WorldToCamera() const
+{
+	return ToMat4(m_worldToCameraTransform);
+}
+
+
+Mat4 KinectReconstruction::VolumeToWorld() const
+{
+	Matrix4 worldToVolume = m_defaultWorldToVolumeTransform;
+	if (nullptr != m_pVolume)
+	{
+		m_pVolume->GetCurrentWorldToVolumeTransform(&worldToVolume);
+	}
+	return InverseAffine(ToMat4(worldToVolume));
+}
+
+
+VolumeParameters KinectReconstruction::Volume() const
+{
+	return VolumeParameters(m_reconstructionParams.voxelsPerMeter, m_reconstructionParams.voxelCountX,
+		m_reconstructionParams.voxelCountY, m_reconstructionParams.voxelCountZ);
+}
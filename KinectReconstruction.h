@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Reconstruction.h"
+#include "DepthFilter.h"
+#include "IntegrationPolicy.h"
+#include "MemoryAccounting.h"
+
+#include <windows.h>
+#include <NuiApi.h>
+#include <NuiKinectFusionApi.h>
+
+#include <vector>
+
+/// <summary>
+/// The Kinect Fusion SDK volume (INuiFusionReconstruction on the AMP processor), with the depth
+/// filter and the integration policy of the native pipeline around it. Windows only.
+/// </summary>
+class KinectReconstruction : public Reconstruction
+{
+public:
+	/// <param name="sdkShading">shade with NuiFusionShadePointCloud instead of the shader given to Shade</param>
+	/// <param name="alignApart">track and integrate in two calls timed apart, for the quality governor,
+	/// instead of ProcessFrame; always the case with the integration policy on</param>
+	KinectReconstruction(bool sdkShading, bool alignApart);
+	~KinectReconstruction();
+
+	const char* Name() const { return "kinect-fusion"; }
+	VolumeBackend Backend() const { return KinectFusionBackend(); }
+
+	/// <summary>
+	/// The SDK raycasts at the full depth resolution only
+	/// </summary>
+	bool ScalesRaycast() const { return false; }
+
+	bool Initialize(const FusionPipelineParameters& parameters, int width, int height);
+	bool Reset();
+	bool ProcessFrame(const unsigned short* pDepthMm, ReconstructionFrame& frame);
+	void SetQuality(const QualityLevel& quality);
+	bool CalculatePointCloud();
+	bool Shade(PointCloudShader& shader, unsigned char* pDst, int dstStride);
+	void ExportPoints(PointCloudExporter& exporter, long long frame, PointExportSource source);
+	bool ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+		std::vector<short>& samples);
+	bool SaveMesh(const std::string& path);
+
+	Mat4 WorldToCamera() const;
+	Mat4 VolumeToWorld() const;
+	CameraIntrinsics Intrinsics() const { return KinectDepthIntrinsics(); }
+	VolumeParameters Volume() const;
+
+private:
+	KinectReconstruction(const KinectReconstruction&);
+	KinectReconstruction& operator=(const KinectReconstruction&);
+
+	/// <summary>
+	/// Track the depth float frame and integrate it if the integration policy says so
+	/// </summary>
+	/// <returns>S_OK on success, E_NUI_FUSION_TRACKING_ERROR when tracking failed, otherwise failure code</returns>
+	HRESULT AlignAndIntegrate(ReconstructionFrame& frame);
+
+	FusionPipelineParameters    m_parameters;
+	int                         m_width;
+	int                         m_height;
+	bool                        m_bSdkShading;
+	bool                        m_bAlignApart;
+
+	INuiFusionReconstruction*   m_pVolume;
+	NUI_FUSION_RECONSTRUCTION_PARAMETERS m_reconstructionParams;
+
+	/// <summary>
+	/// Frames from the depth source, in the layout DepthToDepthFloatFrame takes
+	/// </summary>
+	std::vector<NUI_DEPTH_IMAGE_PIXEL, TaggedAllocator<NUI_DEPTH_IMAGE_PIXEL, MemoryFrames> > m_depthImagePixels;
+	NUI_FUSION_IMAGE_FRAME*     m_pDepthFloatImage;
+
+	/// Frames generated from ray-casting the Reconstruction Volume
+	NUI_FUSION_IMAGE_FRAME*     m_pPointCloud;
+
+	/// Images for display, with SDK shading
+	NUI_FUSION_IMAGE_FRAME*     m_pShadedSurface;
+
+	/// <summary>
+	/// Denoises the depth float frame before ProcessFrame (--depth-filter, --temporal-median)
+	/// </summary>
+	DepthFilter                 m_depthFilter;
+
+	/// <summary>
+	/// Which tracked frames are integrated (--lazy-integration); when enabled ProcessFrame is split
+	/// into AlignDepthFloatToReconstruction on every frame and IntegrateFrame on the frames it picks
+	/// </summary>
+	IntegrationPolicy           m_integrationPolicy;
+	unsigned short              m_cAlignIterations;
+
+	/// <summary>
+	/// Memory held by the SDK for the volume and the three image frames, in the accounting
+	/// </summary>
+	MemoryReservation           m_volumeMemory;
+	MemoryReservation           m_imageFrameMemory;
+
+	Matrix4                     m_worldToCameraTransform;
+
+	/// <summary>
+	/// The default Kinect Fusion World to Volume Transform
+	/// </summary>
+	Matrix4                     m_defaultWorldToVolumeTransform;
+
+	/// <summary>
+	/// Parameter to translate the reconstruction based on the minimum depth setting. When set to
+	/// false, the reconstruction volume +Z axis starts at the camera lens and extends into the scene.
+	/// Setting this true in the constructor will move the volume forward along +Z away from the
+	/// camera by the minimum depth threshold to enable capture of very small reconstruction volumes
+	/// by setting a non-identity camera transformation in the ResetReconstruction call.
+	/// Small volumes should be shifted, as the Kinect hardware has a minimum sensing limit of ~0.35m,
+	/// inside which no valid depth is returned, hence it is difficult to initialize and track robustly
+	/// when the majority of a small volume is inside this distance.
+	/// </summary>
+	bool                        m_bTranslateResetPoseByMinDepthThreshold;
+
+	/// <summary>
+	/// Frames processed since the last reset; the first one defines the model and is not tracked
+	/// </summary>
+	int                         m_cFrameCount;
+};
@@ -0,0 +1,76 @@
+
+#include "LatestFrameSlot.h"
+#include <stddef.h>
+
+
+LatestFrameSlot::LatestFrameSlot()
+	: m_writeIndex(0)
+	, m_readIndex(1)
+	, m_ready(2)
+	, m_dropped(0)
+	, m_published(0)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		m_frames[i].width = 0;
+		m_frames[i].height = 0;
+		m_frames[i].stride = 0;
+		m_frames[i].frameId = -1;
+		m_frames[i].publishTime = 0;
+	}
+}
+
+
+void LatestFrameSlot::Initialize(int width, int height, int bytesPerPixel)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		m_frames[i].pixels.assign((size_t)width * height * bytesPerPixel, 0);
+		m_frames[i].width = width;
+		m_frames[i].height = height;
+		m_frames[i].stride = width * bytesPerPixel;
+		m_frames[i].frameId = -1;
+		m_frames[i].publishTime = 0;
+	}
+	m_writeIndex = 0;
+	m_readIndex = 1;
+	m_ready.store(2, std::memory_order_release);
+	m_dropped.store(0, std::memory_order_relaxed);
+	m_published.store(0, std::memory_order_relaxed);
+}
+
+
+unsigned char* LatestFrameSlot::BeginWrite()
+{
+	return m_frames[m_writeIndex].pixels.data();
+}
+
+
+void LatestFrameSlot::EndWrite(long long frameId, double publishTime)
+{
+	m_frames[m_writeIndex].frameId = frameId;
+	m_frames[m_writeIndex].publishTime = publishTime;
+
+	// hand the filled buffer over and take back whatever was published before
+	int previous = m_ready.exchange(m_writeIndex | cFreshBit, std::memory_order_acq_rel);
+	if (previous & cFreshBit)
+	{
+		// the consumer never saw the previous frame
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+	m_writeIndex = previous & ~cFreshBit;
+	m_published.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+const LatestFrameSlot::Frame* LatestFrameSlot::AcquireLatest()
+{
+	if (0 == (m_ready.load(std::memory_order_acquire) & cFreshBit))
+	{
+		return nullptr;
+	}
+
+	int latest = m_ready.exchange(m_readIndex, std::memory_order_acq_rel);
+	m_readIndex = latest & ~cFreshBit;
+	return &m_frames[m_readIndex];
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "MemoryAccounting.h"
+
+#include <atomic>
+#include <vector>
+
+/// <summary>
+/// Single-producer / single-consumer "latest frame wins" mailbox built on triple buffering.
+/// The producer (fusion thread) never blocks: it always owns a back buffer to write into and
+/// publishes it with one atomic exchange. The consumer (render loop) takes the most recent
+/// published frame; frames that were overwritten before being taken are counted as dropped.
+/// </summary>
+class LatestFrameSlot
+{
+public:
+	struct Frame
+	{
+		std::vector<unsigned char, TaggedAllocator<unsigned char, MemoryFrames> > pixels;
+		int                        width;
+		int                        height;
+		int                        stride;
+		long long                  frameId;
+		/// <summary>
+		/// Time (in s, Timing::Timer clock) at which the producer published the frame
+		/// </summary>
+		double                     publishTime;
+	};
+
+	LatestFrameSlot();
+
+	/// <summary>
+	/// Allocate the three buffers. Must be called before any producer or consumer runs.
+	/// </summary>
+	void Initialize(int width, int height, int bytesPerPixel);
+
+	/// <summary>
+	/// Producer: get the buffer to fill for the next frame. Never blocks.
+	/// </summary>
+	unsigned char* BeginWrite();
+
+	/// <summary>
+	/// Producer: publish the buffer returned by BeginWrite as the latest frame.
+	/// </summary>
+	void EndWrite(long long frameId, double publishTime);
+
+	/// <summary>
+	/// Consumer: take the latest published frame.
+	/// </summary>
+	/// <returns>the frame, or nullptr when nothing new was published since the last call</returns>
+	const Frame* AcquireLatest();
+
+	/// <summary>
+	/// Number of published frames that were replaced before the consumer took them
+	/// </summary>
+	long long DroppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	/// <summary>
+	/// Number of frames published so far
+	/// </summary>
+	long long PublishedCount() const { return m_published.load(std::memory_order_relaxed); }
+
+private:
+	static const int        cFreshBit = 4;
+
+	Frame                   m_frames[3];
+
+	// index of the buffer owned by the producer
+	int                     m_writeIndex;
+
+	// index of the buffer owned by the consumer
+	int                     m_readIndex;
+
+	// index of the published buffer, with cFreshBit set until the consumer takes it
+	std::atomic<int>        m_ready;
+
+	std::atomic<long long>  m_dropped;
+	std::atomic<long long>  m_published;
+};
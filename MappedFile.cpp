@@ -0,0 +1,139 @@
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile()
+	: m_pData(nullptr)
+	, m_size(0)
+#ifdef _WIN32
+	, m_hFile(INVALID_HANDLE_VALUE)
+	, m_hMapping(nullptr)
+#else
+	, m_fd(-1)
+#endif
+{
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+	m_hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || 0 == size.QuadPart)
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (nullptr == m_hMapping)
+	{
+		Close();
+		return false;
+	}
+
+	m_pData = (const unsigned char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (nullptr == m_pData)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+void MappedFile::Close()
+{
+	if (nullptr != m_pData)
+	{
+		UnmapViewOfFile(m_pData);
+	}
+	if (nullptr != m_hMapping)
+	{
+		CloseHandle(m_hMapping);
+	}
+	if (INVALID_HANDLE_VALUE != m_hFile)
+	{
+		CloseHandle(m_hFile);
+	}
+	m_pData = nullptr;
+	m_size = 0;
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::Open(const char* filename)
+{
+	Close();
+
+	m_fd = open(filename, O_RDONLY);
+	if (m_fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || 0 == st.st_size)
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)st.st_size;
+
+	void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (MAP_FAILED == p)
+	{
+		m_size = 0;
+		Close();
+		return false;
+	}
+	// the whole file is read front to back by the parsers
+	madvise(p, m_size, MADV_WILLNEED);
+	m_pData = (const unsigned char*)p;
+	return true;
+}
+
+
+void MappedFile::Close()
+{
+	if (nullptr != m_pData)
+	{
+		munmap((void*)m_pData, m_size);
+	}
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+	}
+	m_pData = nullptr;
+	m_size = 0;
+	m_fd = -1;
+}
+
+#endif
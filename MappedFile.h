@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+/// <summary>
+/// Read-only memory mapping of a whole file
+/// </summary>
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	/// <summary>
+	/// Map the file into memory
+	/// </summary>
+	/// <returns>false if the file cannot be opened or mapped</returns>
+	bool Open(const char* filename);
+
+	/// <summary>
+	/// Unmap the file
+	/// </summary>
+	void Close();
+
+	const unsigned char* Data() const { return m_pData; }
+	size_t Size() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const unsigned char*    m_pData;
+	size_t                  m_size;
+
+#ifdef _WIN32
+	void*                   m_hFile;
+	void*                   m_hMapping;
+#else
+	int                     m_fd;
+#endif
+};
@@ -0,0 +1,271 @@
+
+#include "MarchingCubes.h"
+
+
+// Cube corners and edges, in the usual marching cubes numbering
+static const int cCornerOffset[8][3] =
+{
+	{ 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+	{ 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }
+};
+
+static const int cEdgeCorners[12][2] =
+{
+	{ 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 },
+	{ 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 },
+	{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+};
+
+// Corners of each face, counter-clockwise seen from outside the cube
+static const int cFaceCorners[6][4] =
+{
+	{ 0, 3, 2, 1 }, { 4, 5, 6, 7 },
+	{ 0, 1, 5, 4 }, { 3, 7, 6, 2 },
+	{ 0, 4, 7, 3 }, { 1, 2, 6, 5 }
+};
+
+static const int cMaxCaseTriangles = 5;
+
+
+/// <summary>
+/// Triangulation of the 256 inside/outside corner configurations.
+/// Rather than a hand-typed table, every case is derived from the cube faces: on each face the
+/// cut edges are joined so that every run of inside corners is cut off on its own, the
+/// face segments are chained into closed loops and each loop is fanned into triangles from a
+/// vertex whose diagonals stay off the cube faces.
+/// The choice on a face only depends on the 4 corners of that face, so the two cubes sharing
+/// it always agree and the surface has no cracks.
+/// </summary>
+struct MarchingCubesTable
+{
+	// edge indices, 3 per triangle, terminated by -1
+	signed char     triangles[256][cMaxCaseTriangles * 3 + 1];
+
+	// bit e set when edge e is cut
+	unsigned short  cutEdges[256];
+
+	MarchingCubesTable()
+	{
+		for (int config = 0; config < 256; ++config)
+		{
+			Build(config);
+		}
+	}
+
+	static bool ShareFace(int e0, int e1)
+	{
+		for (int f = 0; f < 6; ++f)
+		{
+			int found = 0;
+			for (int k = 0; k < 4; ++k)
+			{
+				int e = EdgeBetween(cFaceCorners[f][k], cFaceCorners[f][(k + 1) & 3]);
+				found += (e == e0) + (e == e1);
+			}
+			if (found == 2)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static int EdgeBetween(int a, int b)
+	{
+		for (int e = 0; e < 12; ++e)
+		{
+			if ((cEdgeCorners[e][0] == a && cEdgeCorners[e][1] == b) || (cEdgeCorners[e][0] == b && cEdgeCorners[e][1] == a))
+			{
+				return e;
+			}
+		}
+		return -1;
+	}
+
+	void Build(int config)
+	{
+		int next[12];
+		for (int e = 0; e < 12; ++e)
+		{
+			next[e] = -1;
+		}
+
+		cutEdges[config] = 0;
+		for (int e = 0; e < 12; ++e)
+		{
+			bool inA = 0 != ((config >> cEdgeCorners[e][0]) & 1);
+			bool inB = 0 != ((config >> cEdgeCorners[e][1]) & 1);
+			if (inA != inB)
+			{
+				cutEdges[config] |= (unsigned short)(1 << e);
+			}
+		}
+
+		// Face segments: from the edge entering a run of inside corners to the edge leaving it
+		for (int f = 0; f < 6; ++f)
+		{
+			const int* q = cFaceCorners[f];
+			for (int k = 0; k < 4; ++k)
+			{
+				int previous = q[(k + 3) & 3];
+				bool inPrevious = 0 != ((config >> previous) & 1);
+				bool inCurrent = 0 != ((config >> q[k]) & 1);
+				if (inPrevious || !inCurrent)
+				{
+					continue;
+				}
+
+				int m = k;
+				while ((config >> q[(m + 1) & 3]) & 1)
+				{
+					m = (m + 1) & 3;
+				}
+				next[EdgeBetween(previous, q[k])] = EdgeBetween(q[m], q[(m + 1) & 3]);
+			}
+		}
+
+		// Chain the segments into loops and fan each loop
+		int count = 0;
+		bool visited[12] = { false };
+		for (int start = 0; start < 12; ++start)
+		{
+			if (next[start] < 0 || visited[start])
+			{
+				continue;
+			}
+
+			int loop[12];
+			int length = 0;
+			for (int e = start; !visited[e]; e = next[e])
+			{
+				visited[e] = true;
+				loop[length++] = e;
+			}
+
+			// Fan from a vertex whose diagonals all cross the cube interior: a diagonal lying
+			// in a face would duplicate a segment of the neighbouring cube
+			int first = 0;
+			for (int candidate = 0; candidate < length; ++candidate)
+			{
+				bool interior = true;
+				for (int i = 2; i + 1 < length && interior; ++i)
+				{
+					interior = !ShareFace(loop[candidate], loop[(candidate + i) % length]);
+				}
+				if (interior)
+				{
+					first = candidate;
+					break;
+				}
+			}
+
+			for (int i = 1; i + 1 < length; ++i)
+			{
+				triangles[config][count++] = (signed char)loop[first];
+				triangles[config][count++] = (signed char)loop[(first + i) % length];
+				triangles[config][count++] = (signed char)loop[(first + i + 1) % length];
+			}
+		}
+		triangles[config][count] = -1;
+	}
+};
+
+static const MarchingCubesTable& CaseTable()
+{
+	static const MarchingCubesTable table;
+	return table;
+}
+
+
+size_t ExtractIsoSurface(const TsdfBlock& block, std::vector<float>& triangles)
+{
+	const MarchingCubesTable& table = CaseTable();
+	const int sx = block.sizeX;
+	const int sy = block.sizeY;
+	const int sz = block.sizeZ;
+	if (sx < 2 || sy < 2 || sz < 2)
+	{
+		return 0;
+	}
+
+	const size_t strideY = (size_t)sx;
+	const size_t strideZ = (size_t)sx * sy;
+	const size_t cornerOffset[8] =
+	{
+		0, 1, 1 + strideY, strideY,
+		strideZ, 1 + strideZ, 1 + strideY + strideZ, strideY + strideZ
+	};
+	const int cTruncated = 32767;
+
+	size_t appended = 0;
+	for (int z = 0; z + 1 < sz; ++z)
+	{
+		for (int y = 0; y + 1 < sy; ++y)
+		{
+			size_t rowBase = (size_t)z * strideZ + (size_t)y * strideY;
+			for (int x = 0; x + 1 < sx; ++x)
+			{
+				size_t base = rowBase + x;
+
+				int value[8];
+				int config = 0;
+				bool observed = true;
+				int minValue = cTruncated;
+				int maxValue = -cTruncated;
+				for (int c = 0; c < 8; ++c)
+				{
+					size_t index = base + cornerOffset[c];
+					value[c] = block.tsdf[index];
+					if (block.weights ? (0 == block.weights[index]) : (block.zeroIsUnobserved && 0 == value[c]))
+					{
+						observed = false;
+						break;
+					}
+					config |= (value[c] < 0) << c;
+					minValue = (value[c] < minValue) ? value[c] : minValue;
+					maxValue = (value[c] > maxValue) ? value[c] : maxValue;
+				}
+
+				// fully truncated on both sides is an occlusion boundary, not a surface
+				if (!observed || 0 == config || 255 == config || (minValue <= -cTruncated && maxValue >= cTruncated))
+				{
+					continue;
+				}
+
+				// Interpolate the crossing on every cut edge once
+				float vertex[12][3];
+				unsigned int cut = table.cutEdges[config];
+				for (int e = 0; e < 12; ++e)
+				{
+					if (0 == (cut & (1u << e)))
+					{
+						continue;
+					}
+					int a = cEdgeCorners[e][0];
+					int b = cEdgeCorners[e][1];
+					float t = (float)value[a] / (float)(value[a] - value[b]);
+					for (int k = 0; k < 3; ++k)
+					{
+						float p = (float)cCornerOffset[a][k] + t * (float)(cCornerOffset[b][k] - cCornerOffset[a][k]);
+						int cell = (k == 0) ? x : ((k == 1) ? y : z);
+						vertex[e][k] = block.origin[k] + block.spacing * ((float)cell + p);
+					}
+				}
+
+				const signed char* tri = table.triangles[config];
+				for (; *tri >= 0; tri += 3)
+				{
+					for (int v = 0; v < 3; ++v)
+					{
+						const float* p = vertex[(int)tri[v]];
+						triangles.push_back(p[0]);
+						triangles.push_back(p[1]);
+						triangles.push_back(p[2]);
+					}
+					appended++;
+				}
+			}
+		}
+	}
+	return appended;
+}
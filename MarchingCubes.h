@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+/// <summary>
+/// A box of TSDF samples to extract a surface from. Samples are stored x fastest, then y, then z.
+/// The TSDF is scaled to [-32767, 32767]; negative is behind the surface, positive in front of it.
+/// </summary>
+struct TsdfBlock
+{
+	const short*                tsdf;
+
+	/// <summary>
+	/// Integration weight per sample, or nullptr. Cubes touching a sample of weight 0 are skipped.
+	/// </summary>
+	const unsigned short*       weights;
+
+	/// <summary>
+	/// When weights is nullptr, treat a TSDF of exactly 0 as unobserved
+	/// (the state of voxels that the Kinect Fusion volume never integrated)
+	/// </summary>
+	bool                        zeroIsUnobserved;
+
+	int                         sizeX;
+	int                         sizeY;
+	int                         sizeZ;
+
+	/// <summary>
+	/// World position of sample (0, 0, 0) and world distance between neighbouring samples
+	/// </summary>
+	float                       origin[3];
+	float                       spacing;
+};
+
+/// <summary>
+/// Extract the zero crossing of a TSDF block with marching cubes.
+/// Triangles are appended as 9 floats (3 world space corners) each, wound counter-clockwise
+/// when seen from the positive (free space) side. Neighbouring blocks that share a face of
+/// samples produce a crack-free surface.
+/// </summary>
+/// <param name="block">the samples</param>
+/// <param name="triangles">receives the triangles</param>
+/// <returns>number of triangles appended</returns>
+size_t ExtractIsoSurface(const TsdfBlock& block, std::vector<float>& triangles);
@@ -0,0 +1,277 @@
+
+#include "MemoryAccounting.h"
+
+#include <sstream>
+#include <iomanip>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+
+MemoryAccounting& MemoryAccounting::Instance()
+{
+	static MemoryAccounting accounting;
+	return accounting;
+}
+
+
+const char* MemoryAccounting::TagName(MemoryTag tag)
+{
+	static const char* const names[MemoryTagCount] = { "volume", "frames", "pyramid", "mesh", "preview", "thumbnails", "display", "scratch", "export" };
+	return (tag >= 0 && tag < MemoryTagCount) ? names[tag] : "unknown";
+}
+
+
+MemoryAccounting::MemoryAccounting()
+	: m_budget(0)
+	, m_liveTotal(0)
+	, m_peakTotal(0)
+{
+	for (int i = 0; i < MemoryTagCount; ++i)
+	{
+		m_live[i].store(0, std::memory_order_relaxed);
+		m_peak[i].store(0, std::memory_order_relaxed);
+		m_refused[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+
+void MemoryAccounting::RaisePeak(std::atomic<long long>& peak, long long value)
+{
+	long long current = peak.load(std::memory_order_relaxed);
+	while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+
+void MemoryAccounting::Add(MemoryTag tag, long long bytes)
+{
+	long long live = m_live[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	long long total = m_liveTotal.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	if (bytes > 0)
+	{
+		RaisePeak(m_peak[tag], live);
+		RaisePeak(m_peakTotal, total);
+	}
+}
+
+
+bool MemoryAccounting::Admit(MemoryTag tag, long long bytes)
+{
+	if (bytes <= Available())
+	{
+		return true;
+	}
+	m_refused[tag].fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+
+long long MemoryAccounting::Available() const
+{
+	long long budget = Budget();
+	if (budget <= 0)
+	{
+		return 1ll << 62;
+	}
+	long long available = budget - LiveTotal();
+	return (available > 0) ? available : 0;
+}
+
+
+MemoryReport MemoryAccounting::Report() const
+{
+	MemoryReport report;
+	report.budgetBytes = Budget();
+	report.liveBytes = LiveTotal();
+	report.peakBytes = m_peakTotal.load(std::memory_order_relaxed);
+	for (int i = 0; i < MemoryTagCount; ++i)
+	{
+		MemoryTagUsage usage;
+		usage.name = TagName((MemoryTag)i);
+		usage.liveBytes = m_live[i].load(std::memory_order_relaxed);
+		usage.peakBytes = m_peak[i].load(std::memory_order_relaxed);
+		usage.refused = m_refused[i].load(std::memory_order_relaxed);
+		report.tags.push_back(usage);
+	}
+	return report;
+}
+
+
+std::string MemoryReport::ToJson() const
+{
+	std::ostringstream json;
+	json << "{ \"budgetBytes\": " << budgetBytes << ", \"liveBytes\": " << liveBytes << ", \"peakBytes\": " << peakBytes
+		<< ", \"tags\": {";
+	for (size_t i = 0; i < tags.size(); ++i)
+	{
+		const MemoryTagUsage& t = tags[i];
+		json << " \"" << t.name << "\": { \"liveBytes\": " << t.liveBytes << ", \"peakBytes\": " << t.peakBytes
+			<< ", \"refused\": " << t.refused << " }" << (i + 1 < tags.size() ? "," : "");
+	}
+	json << " } }";
+	return json.str();
+}
+
+
+std::string MemoryReport::ToText() const
+{
+	const double mb = 1.0 / (1024.0 * 1024.0);
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(1);
+	text << "memory " << liveBytes * mb << " MB (peak " << peakBytes * mb;
+	if (budgetBytes > 0)
+	{
+		text << ", budget " << budgetBytes * mb;
+	}
+	text << "):";
+	for (size_t i = 0; i < tags.size(); ++i)
+	{
+		const MemoryTagUsage& t = tags[i];
+		if (0 == t.peakBytes && 0 == t.refused)
+		{
+			continue;
+		}
+		text << " " << t.name << " " << t.liveBytes * mb << "/" << t.peakBytes * mb;
+		if (t.refused > 0)
+		{
+			text << " (" << t.refused << " refused)";
+		}
+	}
+	return text.str();
+}
+
+
+////////////////////////////////////////////////////////
+// PageBuffer
+
+const char* PageKindName(PageKind kind)
+{
+	switch (kind)
+	{
+	case PagesNone: return "none";
+	case PagesSmall: return "small";
+	case PagesTransparentHuge: return "transparent huge";
+	case PagesHuge: return "huge";
+	}
+	return "unknown";
+}
+
+
+#ifdef _WIN32
+
+bool PageBuffer::Allocate(MemoryTag tag, size_t bytes)
+{
+	Release();
+	if (0 == bytes)
+	{
+		return true;
+	}
+
+	// large pages need SeLockMemoryPrivilege; without it the call fails and small pages do
+	size_t largePage = GetLargePageMinimum();
+	if (largePage > 0)
+	{
+		size_t rounded = (bytes + largePage - 1) / largePage * largePage;
+		m_pMapping = VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		m_kind = PagesHuge;
+	}
+	if (nullptr == m_pMapping)
+	{
+		m_pMapping = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		m_kind = PagesSmall;
+	}
+	if (nullptr == m_pMapping)
+	{
+		m_kind = PagesNone;
+		return false;
+	}
+
+	m_pData = m_pMapping;
+	m_bytes = bytes;
+	m_tag = tag;
+	MemoryAccounting::Instance().Add(m_tag, (long long)m_bytes);
+	return true;
+}
+
+
+void PageBuffer::Release()
+{
+	if (nullptr != m_pMapping)
+	{
+		VirtualFree(m_pMapping, 0, MEM_RELEASE);
+		MemoryAccounting::Instance().Add(m_tag, -(long long)m_bytes);
+	}
+	m_pData = m_pMapping = nullptr;
+	m_mappingBytes = m_bytes = 0;
+	m_kind = PagesNone;
+}
+
+#else
+
+bool PageBuffer::Allocate(MemoryTag tag, size_t bytes)
+{
+	Release();
+	if (0 == bytes)
+	{
+		return true;
+	}
+
+	const size_t hugePage = 2 * 1024 * 1024;
+#ifdef MAP_HUGETLB
+	// reserved huge pages exist only where the administrator set some aside
+	size_t rounded = (bytes + hugePage - 1) / hugePage * hugePage;
+	void* p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (MAP_FAILED != p)
+	{
+		m_pData = m_pMapping = p;
+		m_mappingBytes = rounded;
+		m_kind = PagesHuge;
+	}
+#endif
+
+	if (nullptr == m_pMapping)
+	{
+		// one huge page more, so that the buffer can start on a huge page boundary
+		size_t mappingBytes = bytes + hugePage;
+		void* mapping = mmap(nullptr, mappingBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == mapping)
+		{
+			return false;
+		}
+		m_pMapping = mapping;
+		m_mappingBytes = mappingBytes;
+		m_pData = (void*)(((size_t)mapping + hugePage - 1) & ~(hugePage - 1));
+		m_kind = PagesSmall;
+#ifdef MADV_HUGEPAGE
+		if (0 == madvise(m_pData, bytes, MADV_HUGEPAGE))
+		{
+			m_kind = PagesTransparentHuge;
+		}
+#endif
+	}
+
+	m_bytes = bytes;
+	m_tag = tag;
+	MemoryAccounting::Instance().Add(m_tag, (long long)m_bytes);
+	return true;
+}
+
+
+void PageBuffer::Release()
+{
+	if (nullptr != m_pMapping)
+	{
+		munmap(m_pMapping, m_mappingBytes);
+		MemoryAccounting::Instance().Add(m_tag, -(long long)m_bytes);
+	}
+	m_pData = m_pMapping = nullptr;
+	m_mappingBytes = m_bytes = 0;
+	m_kind = PagesNone;
+}
+
+#endif
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/// <summary>
+/// What a large buffer is for; every accounted byte belongs to exactly one tag
+/// </summary>
+enum MemoryTag
+{
+	MemoryVolume = 0,		// reconstruction volume, native or held by the SDK
+	MemoryFrames = 1,		// depth, float depth, point cloud and shaded frames
+	MemoryPyramid = 2,		// tracking pyramids and vertex / normal maps
+	MemoryMesh = 3,			// meshes being extracted, saved or reviewed
+	MemoryPreview = 4,		// live preview triangle buffer (optional)
+	MemoryThumbnails = 5,	// thumbnail encoder buffers (optional)
+	MemoryDisplay = 6,		// images handed to VTK
+	MemoryScratch = 7,		// per-frame scratch arenas
+	MemoryExport = 8,		// point cloud export buffers (optional)
+	MemoryTagCount = 9
+};
+
+/// <summary>
+/// Usage of one tag
+/// </summary>
+struct MemoryTagUsage
+{
+	std::string                 name;
+	long long                   liveBytes;
+	long long                   peakBytes;
+
+	/// <summary>
+	/// Optional allocations turned down because they would have exceeded the budget
+	/// </summary>
+	long long                   refused;
+};
+
+/// <summary>
+/// Point-in-time copy of the accounting
+/// </summary>
+struct MemoryReport
+{
+	long long                   budgetBytes;		// 0 = unlimited
+	long long                   liveBytes;
+	long long                   peakBytes;
+	std::vector<MemoryTagUsage> tags;
+
+	std::string ToJson() const;
+
+	/// <summary>
+	/// One line, live / peak MB per tag with a non-zero peak
+	/// </summary>
+	std::string ToText() const;
+};
+
+/// <summary>
+/// Process-wide accounting of the large buffers, by tag, against an optional budget.
+/// Required buffers (the volume, the frames) are always accounted, even past the budget, which
+/// then shows in the report; optional caches ask Admit first and shrink or do without when
+/// refused. Accounting is a few relaxed atomics, so any thread may allocate or query.
+/// </summary>
+class MemoryAccounting
+{
+public:
+	static MemoryAccounting& Instance();
+
+	static const char* TagName(MemoryTag tag);
+
+	/// <summary>
+	/// Budget in bytes for all tags together; 0 = unlimited
+	/// </summary>
+	void SetBudget(long long bytes) { m_budget.store(bytes, std::memory_order_relaxed); }
+	long long Budget() const { return m_budget.load(std::memory_order_relaxed); }
+
+	/// <summary>
+	/// Account bytes allocated (positive) or freed (negative) under a tag
+	/// </summary>
+	void Add(MemoryTag tag, long long bytes);
+
+	/// <summary>
+	/// Whether an optional allocation of the given size fits in the budget. A refusal is counted
+	/// against the tag; the caller accounts the allocation itself if it goes ahead.
+	/// </summary>
+	bool Admit(MemoryTag tag, long long bytes);
+
+	/// <summary>
+	/// Bytes left before the budget is reached; a very large value without a budget
+	/// </summary>
+	long long Available() const;
+
+	long long Live(MemoryTag tag) const { return m_live[tag].load(std::memory_order_relaxed); }
+	long long LiveTotal() const { return m_liveTotal.load(std::memory_order_relaxed); }
+
+	MemoryReport Report() const;
+
+private:
+	MemoryAccounting();
+	MemoryAccounting(const MemoryAccounting&);
+	MemoryAccounting& operator=(const MemoryAccounting&);
+
+	static void RaisePeak(std::atomic<long long>& peak, long long value);
+
+	std::atomic<long long>      m_budget;
+	std::atomic<long long>      m_live[MemoryTagCount];
+	std::atomic<long long>      m_peak[MemoryTagCount];
+	std::atomic<long long>      m_refused[MemoryTagCount];
+	std::atomic<long long>      m_liveTotal;
+	std::atomic<long long>      m_peakTotal;
+};
+
+
+/// <summary>
+/// Standard allocator that accounts its memory under a tag, so that std::vector buffers are
+/// tracked with no other change: std::vector&lt;float, TaggedAllocator&lt;float, MemoryPyramid&gt; &gt;
+/// </summary>
+template <class T, MemoryTag Tag>
+class TaggedAllocator
+{
+public:
+	typedef T value_type;
+
+	template <class U>
+	struct rebind
+	{
+		typedef TaggedAllocator<U, Tag> other;
+	};
+
+	TaggedAllocator() {}
+
+	template <class U>
+	TaggedAllocator(const TaggedAllocator<U, Tag>&) {}
+
+	T* allocate(size_t count)
+	{
+		T* p = static_cast<T*>(::operator new(count * sizeof(T)));
+		MemoryAccounting::Instance().Add(Tag, (long long)(count * sizeof(T)));
+		return p;
+	}
+
+	void deallocate(T* p, size_t count)
+	{
+		MemoryAccounting::Instance().Add(Tag, -(long long)(count * sizeof(T)));
+		::operator delete(p);
+	}
+};
+
+template <class T, class U, MemoryTag Tag>
+inline bool operator==(const TaggedAllocator<T, Tag>&, const TaggedAllocator<U, Tag>&) { return true; }
+
+template <class T, class U, MemoryTag Tag>
+inline bool operator!=(const TaggedAllocator<T, Tag>&, const TaggedAllocator<U, Tag>&) { return false; }
+
+
+/// <summary>
+/// Bytes held outside our allocators, e.g. by the Kinect Fusion SDK, accounted while the
+/// reservation lives
+/// </summary>
+class MemoryReservation
+{
+public:
+	MemoryReservation() : m_tag(MemoryVolume), m_bytes(0) {}
+	~MemoryReservation() { Release(); }
+
+	void Reserve(MemoryTag tag, long long bytes)
+	{
+		Release();
+		m_tag = tag;
+		m_bytes = bytes;
+		MemoryAccounting::Instance().Add(m_tag, m_bytes);
+	}
+
+	void Release()
+	{
+		if (0 != m_bytes)
+		{
+			MemoryAccounting::Instance().Add(m_tag, -m_bytes);
+			m_bytes = 0;
+		}
+	}
+
+	long long Bytes() const { return m_bytes; }
+
+private:
+	MemoryReservation(const MemoryReservation&);
+	MemoryReservation& operator=(const MemoryReservation&);
+
+	MemoryTag                   m_tag;
+	long long                   m_bytes;
+};
+
+
+/// <summary>
+/// How the pages of a PageBuffer are backed
+/// </summary>
+enum PageKind
+{
+	PagesNone = 0,				// nothing allocated
+	PagesSmall = 1,				// the system page size
+	PagesTransparentHuge = 2,	// Linux transparent huge pages, asked for with madvise
+	PagesHuge = 3				// reserved huge pages (hugetlbfs) or Windows large pages
+};
+
+const char* PageKindName(PageKind kind);
+
+/// <summary>
+/// A large zero-filled buffer taken straight from the system, accounted under a tag while it
+/// lives. Backed by huge pages where the system grants them, so that a buffer walked in any
+/// order misses the TLB far less: reserved huge pages first, then transparent huge pages on
+/// Linux, or large pages on Windows when the process holds SeLockMemoryPrivilege; small pages
+/// otherwise.
+/// </summary>
+class PageBuffer
+{
+public:
+	PageBuffer() : m_pData(nullptr), m_pMapping(nullptr), m_mappingBytes(0), m_bytes(0), m_tag(MemoryVolume), m_kind(PagesNone) {}
+	~PageBuffer() { Release(); }
+
+	/// <returns>false, holding nothing, if the system is out of memory</returns>
+	bool Allocate(MemoryTag tag, size_t bytes);
+	void Release();
+
+	void* Data() const { return m_pData; }
+	size_t Bytes() const { return m_bytes; }
+	PageKind Kind() const { return m_kind; }
+
+private:
+	PageBuffer(const PageBuffer&);
+	PageBuffer& operator=(const PageBuffer&);
+
+	void*                       m_pData;
+	void*                       m_pMapping;			// what the system handed out, m_pData lies inside
+	size_t                      m_mappingBytes;
+	size_t                      m_bytes;
+	MemoryTag                   m_tag;
+	PageKind                    m_kind;
+};
@@ -0,0 +1,634 @@
+
+#include "MeshLoader.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+
+static double SecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+////////////////////////////////////////////////////////
+// Vertex welding
+
+static const int cWeldShardBits = 6;
+static const int cWeldShards = 1 << cWeldShardBits;
+
+/// <summary>
+/// Bit pattern of a coordinate with -0 folded onto +0, so both weld together
+/// </summary>
+static inline unsigned int CanonicalBits(float f)
+{
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return (bits == 0x80000000u) ? 0u : bits;
+}
+
+static inline unsigned long long HashVertex(const float* p)
+{
+	unsigned long long h = CanonicalBits(p[0]) * 0x9E3779B97F4A7C15ull;
+	h ^= CanonicalBits(p[1]) * 0xC2B2AE3D27D4EB4Full;
+	h ^= CanonicalBits(p[2]) * 0x165667B19E3779F9ull;
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline bool SameVertex(const float* a, const float* b)
+{
+	return CanonicalBits(a[0]) == CanonicalBits(b[0])
+		&& CanonicalBits(a[1]) == CanonicalBits(b[1])
+		&& CanonicalBits(a[2]) == CanonicalBits(b[2]);
+}
+
+
+size_t WeldVertices(const float* positions, size_t vertexCount, const int* indices, size_t indexCount, LoadedMesh& mesh)
+{
+	ThreadPool& pool = ThreadPool::Instance();
+	const int n = (int)vertexCount;
+
+	// 1. hash every input vertex
+	std::vector<unsigned long long> hashes(vertexCount);
+	pool.ParallelFor(0, n, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			hashes[i] = HashVertex(positions + (size_t)i * 3);
+		}
+	}, 4096);
+
+	// 2. stable scatter of the vertex ids into shards chosen by the top hash bits
+	const int ranges = pool.Concurrency() * 4;
+	std::vector<int> counts((size_t)ranges * cWeldShards, 0);
+	pool.ParallelTasks(ranges, [&](int r)
+	{
+		int begin = (int)((long long)n * r / ranges);
+		int end = (int)((long long)n * (r + 1) / ranges);
+		int* rangeCounts = &counts[(size_t)r * cWeldShards];
+		for (int i = begin; i < end; ++i)
+		{
+			rangeCounts[hashes[i] >> (64 - cWeldShardBits)]++;
+		}
+	});
+
+	std::vector<int> shardBegin(cWeldShards + 1, 0);
+	std::vector<int> offsets((size_t)ranges * cWeldShards);
+	int running = 0;
+	for (int s = 0; s < cWeldShards; ++s)
+	{
+		shardBegin[s] = running;
+		for (int r = 0; r < ranges; ++r)
+		{
+			offsets[(size_t)r * cWeldShards + s] = running;
+			running += counts[(size_t)r * cWeldShards + s];
+		}
+	}
+	shardBegin[cWeldShards] = running;
+
+	std::vector<int> order(vertexCount);
+	pool.ParallelTasks(ranges, [&](int r)
+	{
+		int begin = (int)((long long)n * r / ranges);
+		int end = (int)((long long)n * (r + 1) / ranges);
+		int* rangeOffsets = &offsets[(size_t)r * cWeldShards];
+		for (int i = begin; i < end; ++i)
+		{
+			order[rangeOffsets[hashes[i] >> (64 - cWeldShardBits)]++] = i;
+		}
+	});
+
+	// 3. weld each shard independently with an open-addressing table
+	std::vector<int> localIds(vertexCount);
+	std::vector<std::vector<int> > shardUnique(cWeldShards);
+	pool.ParallelTasks(cWeldShards, [&](int s)
+	{
+		int begin = shardBegin[s];
+		int end = shardBegin[s + 1];
+		if (begin == end)
+		{
+			return;
+		}
+
+		size_t tableSize = 16;
+		while (tableSize < (size_t)(end - begin) * 2)
+		{
+			tableSize <<= 1;
+		}
+		std::vector<int> table(tableSize, -1);
+		std::vector<int>& unique = shardUnique[s];
+
+		for (int k = begin; k < end; ++k)
+		{
+			int i = order[k];
+			const float* p = positions + (size_t)i * 3;
+			size_t slot = (size_t)hashes[i] & (tableSize - 1);
+			for (;;)
+			{
+				int id = table[slot];
+				if (id < 0)
+				{
+					id = (int)unique.size();
+					unique.push_back(i);
+					table[slot] = id;
+					localIds[k] = id;
+					break;
+				}
+				if (SameVertex(positions + (size_t)unique[id] * 3, p))
+				{
+					localIds[k] = id;
+					break;
+				}
+				slot = (slot + 1) & (tableSize - 1);
+			}
+		}
+	});
+
+	// 4. give each shard a contiguous block of output ids and write the results
+	std::vector<int> shardBase(cWeldShards + 1, 0);
+	for (int s = 0; s < cWeldShards; ++s)
+	{
+		shardBase[s + 1] = shardBase[s] + (int)shardUnique[s].size();
+	}
+
+	mesh.points.resize((size_t)shardBase[cWeldShards] * 3);
+	std::vector<int> remap(vertexCount);
+	pool.ParallelTasks(cWeldShards, [&](int s)
+	{
+		const std::vector<int>& unique = shardUnique[s];
+		float* out = mesh.points.data() + (size_t)shardBase[s] * 3;
+		for (size_t u = 0; u < unique.size(); ++u)
+		{
+			memcpy(out + u * 3, positions + (size_t)unique[u] * 3, 3 * sizeof(float));
+		}
+		for (int k = shardBegin[s]; k < shardBegin[s + 1]; ++k)
+		{
+			remap[order[k]] = shardBase[s] + localIds[k];
+		}
+	});
+
+	// 5. remap the triangles
+	mesh.triangles.resize(indexCount);
+	pool.ParallelFor(0, (int)indexCount, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			mesh.triangles[i] = remap[indices ? indices[i] : i];
+		}
+	}, 4096);
+
+	size_t scratchBytes = hashes.capacity() * sizeof(unsigned long long)
+		+ (order.capacity() + localIds.capacity() + remap.capacity()) * sizeof(int)
+		+ (size_t)shardBase[cWeldShards] * sizeof(int) * 3;
+	return scratchBytes;
+}
+
+
+////////////////////////////////////////////////////////
+// Binary STL
+
+bool LoadBinarySTL(const char* filename, LoadedMesh& mesh, MeshLoadStats* pStats)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		std::cout << "Cannot open " << filename << std::endl;
+		return false;
+	}
+
+	const size_t cHeaderBytes = 84;
+	const size_t cTriangleBytes = 50;
+	unsigned int numTriangles = 0;
+	if (file.Size() >= cHeaderBytes)
+	{
+		memcpy(&numTriangles, file.Data() + 80, sizeof(numTriangles));
+	}
+	if (file.Size() < cHeaderBytes || file.Size() != cHeaderBytes + (size_t)numTriangles * cTriangleBytes)
+	{
+		std::cout << filename << " is not a binary STL file" << std::endl;
+		return false;
+	}
+
+	// Copy the 3 corners of every triangle; normals and attributes are skipped
+	std::vector<float> soup((size_t)numTriangles * 9);
+	const unsigned char* pTriangles = file.Data() + cHeaderBytes;
+	ThreadPool::Instance().ParallelFor(0, (int)numTriangles, [&](int begin, int end)
+	{
+		for (int t = begin; t < end; ++t)
+		{
+			memcpy(&soup[(size_t)t * 9], pTriangles + (size_t)t * cTriangleBytes + 12, 9 * sizeof(float));
+		}
+	}, 4096);
+	double parseSeconds = SecondsSince(start);
+
+	std::chrono::steady_clock::time_point weldStart = std::chrono::steady_clock::now();
+	size_t scratchBytes = WeldVertices(soup.data(), (size_t)numTriangles * 3, nullptr, (size_t)numTriangles * 3, mesh);
+
+	if (nullptr != pStats)
+	{
+		pStats->fileBytes = file.Size();
+		pStats->triangleCount = numTriangles;
+		pStats->inputVertexCount = (size_t)numTriangles * 3;
+		pStats->weldedVertexCount = mesh.VertexCount();
+		pStats->parseSeconds = parseSeconds;
+		pStats->weldSeconds = SecondsSince(weldStart);
+		pStats->totalSeconds = SecondsSince(start);
+		pStats->peakBytes = soup.capacity() * sizeof(float) + scratchBytes + mesh.triangles.capacity() * sizeof(int);
+		pStats->meshBytes = mesh.MemoryBytes();
+	}
+	return true;
+}
+
+
+////////////////////////////////////////////////////////
+// ASCII OBJ
+
+static inline bool IsBlank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static inline bool IsDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* SkipBlanks(const char* p, const char* end)
+{
+	while (p < end && IsBlank(*p))
+	{
+		++p;
+	}
+	return p;
+}
+
+static inline const char* NextLine(const char* p, const char* end)
+{
+	const char* eol = (const char*)memchr(p, '\n', end - p);
+	return eol ? eol + 1 : end;
+}
+
+/// <summary>
+/// Locale independent decimal float parser, accurate to float precision
+/// </summary>
+static const char* ParseFloat(const char* p, const char* end, float& value, bool& ok)
+{
+	static const double cPow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	p = SkipBlanks(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		++p;
+	}
+
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for (; p < end && IsDigit(*p); ++p, any = true)
+	{
+		if (digits < 18)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += (mantissa != 0);
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		for (++p; p < end && IsDigit(*p); ++p, any = true)
+		{
+			if (digits < 18)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += (mantissa != 0);
+				exponent--;
+			}
+		}
+	}
+	if (!any)
+	{
+		ok = false;
+		return p;
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		++p;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negativeExponent = (*p == '-');
+			++p;
+		}
+		int e = 0;
+		for (; p < end && IsDigit(*p); ++p)
+		{
+			e = (e < 10000) ? e * 10 + (*p - '0') : e;
+		}
+		exponent += negativeExponent ? -e : e;
+	}
+
+	double result = (double)mantissa;
+	if (exponent >= 0 && exponent <= 22)
+	{
+		result *= cPow10[exponent];
+	}
+	else if (exponent < 0 && exponent >= -22)
+	{
+		result /= cPow10[-exponent];
+	}
+	else
+	{
+		result *= pow(10.0, exponent);
+	}
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+static const char* ParseIndex(const char* p, const char* end, long long& index, bool& ok)
+{
+	p = SkipBlanks(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		++p;
+	}
+	if (p >= end || !IsDigit(*p))
+	{
+		ok = false;
+		return p;
+	}
+	long long value = 0;
+	for (; p < end && IsDigit(*p); ++p)
+	{
+		value = value * 10 + (*p - '0');
+	}
+	index = negative ? -value : value;
+
+	// skip the texture and normal references of v/vt/vn
+	while (p < end && !IsBlank(*p) && *p != '\r' && *p != '\n')
+	{
+		++p;
+	}
+	return p;
+}
+
+static inline bool IsVertexRecord(const char* p, const char* end)
+{
+	return p + 1 < end && p[0] == 'v' && IsBlank(p[1]);
+}
+
+static inline bool IsFaceRecord(const char* p, const char* end)
+{
+	return p + 1 < end && p[0] == 'f' && IsBlank(p[1]);
+}
+
+/// <summary>
+/// Number of vertex references on a face line
+/// </summary>
+static int CountFaceCorners(const char* p, const char* end)
+{
+	int corners = 0;
+	p += 1;
+	for (;;)
+	{
+		p = SkipBlanks(p, end);
+		if (p >= end || *p == '\r' || *p == '\n' || *p == '#')
+		{
+			break;
+		}
+		corners++;
+		while (p < end && !IsBlank(*p) && *p != '\r' && *p != '\n')
+		{
+			++p;
+		}
+	}
+	return corners;
+}
+
+struct ObjChunk
+{
+	const char*     begin;
+	const char*     end;
+	size_t          vertexCount;
+	size_t          triangleCount;
+	size_t          firstVertex;
+	size_t          firstTriangle;
+	bool            ok;
+};
+
+
+bool LoadAsciiOBJ(const char* filename, LoadedMesh& mesh, MeshLoadStats* pStats)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		std::cout << "Cannot open " << filename << std::endl;
+		return false;
+	}
+
+	ThreadPool& pool = ThreadPool::Instance();
+	const char* data = (const char*)file.Data();
+	const char* dataEnd = data + file.Size();
+
+	// Split the file into chunks that start at line beginnings
+	const size_t cMinChunkBytes = 1 << 20;
+	size_t chunkCount = (size_t)pool.Concurrency() * 4;
+	if (chunkCount > file.Size() / cMinChunkBytes + 1)
+	{
+		chunkCount = file.Size() / cMinChunkBytes + 1;
+	}
+
+	std::vector<ObjChunk> chunks(chunkCount);
+	for (size_t c = 0; c < chunkCount; ++c)
+	{
+		const char* begin = data + file.Size() * c / chunkCount;
+		const char* end = data + file.Size() * (c + 1) / chunkCount;
+		chunks[c].begin = (c == 0) ? data : NextLine(begin - 1, dataEnd);
+		chunks[c].end = (c + 1 == chunkCount) ? dataEnd : NextLine(end - 1, dataEnd);
+		chunks[c].ok = true;
+	}
+	for (size_t c = 1; c < chunkCount; ++c)
+	{
+		// a very long line may swallow a whole chunk
+		if (chunks[c].begin < chunks[c - 1].end)
+		{
+			chunks[c].begin = chunks[c - 1].end;
+		}
+		if (chunks[c].end < chunks[c].begin)
+		{
+			chunks[c].end = chunks[c].begin;
+		}
+	}
+
+	// Pass 1: count records so that every chunk knows where its output goes
+	pool.ParallelTasks((int)chunkCount, [&](int c)
+	{
+		ObjChunk& chunk = chunks[c];
+		chunk.vertexCount = 0;
+		chunk.triangleCount = 0;
+		for (const char* p = chunk.begin; p < chunk.end; p = NextLine(p, chunk.end))
+		{
+			const char* q = SkipBlanks(p, chunk.end);
+			if (IsVertexRecord(q, chunk.end))
+			{
+				chunk.vertexCount++;
+			}
+			else if (IsFaceRecord(q, chunk.end))
+			{
+				int corners = CountFaceCorners(q, chunk.end);
+				chunk.triangleCount += (corners >= 3) ? corners - 2 : 0;
+			}
+		}
+	});
+
+	size_t totalVertices = 0;
+	size_t totalTriangles = 0;
+	for (size_t c = 0; c < chunkCount; ++c)
+	{
+		chunks[c].firstVertex = totalVertices;
+		chunks[c].firstTriangle = totalTriangles;
+		totalVertices += chunks[c].vertexCount;
+		totalTriangles += chunks[c].triangleCount;
+	}
+
+	// Pass 2: parse every chunk straight into its slice of the output
+	std::vector<float> positions(totalVertices * 3);
+	std::vector<int> indices(totalTriangles * 3);
+	pool.ParallelTasks((int)chunkCount, [&](int c)
+	{
+		ObjChunk& chunk = chunks[c];
+		size_t vertex = chunk.firstVertex;
+		size_t triangle = chunk.firstTriangle;
+		std::vector<int> corners;
+
+		for (const char* p = chunk.begin; p < chunk.end && chunk.ok; p = NextLine(p, chunk.end))
+		{
+			const char* q = SkipBlanks(p, chunk.end);
+			if (IsVertexRecord(q, chunk.end))
+			{
+				q += 1;
+				for (int k = 0; k < 3; ++k)
+				{
+					q = ParseFloat(q, chunk.end, positions[vertex * 3 + k], chunk.ok);
+				}
+				vertex++;
+			}
+			else if (IsFaceRecord(q, chunk.end))
+			{
+				int count = CountFaceCorners(q, chunk.end);
+				corners.resize(count);
+				q += 1;
+				for (int k = 0; k < count; ++k)
+				{
+					long long index = 0;
+					q = ParseIndex(q, chunk.end, index, chunk.ok);
+					// OBJ indices are 1-based, negative ones count back from the last vertex read
+					long long absolute = (index > 0) ? index - 1 : (long long)vertex + index;
+					if (index == 0 || absolute < 0 || absolute >= (long long)totalVertices)
+					{
+						chunk.ok = false;
+					}
+					corners[k] = (int)absolute;
+				}
+				for (int k = 2; k < count && chunk.ok; ++k)
+				{
+					indices[triangle * 3 + 0] = corners[0];
+					indices[triangle * 3 + 1] = corners[k - 1];
+					indices[triangle * 3 + 2] = corners[k];
+					triangle++;
+				}
+			}
+		}
+	});
+
+	for (size_t c = 0; c < chunkCount; ++c)
+	{
+		if (!chunks[c].ok)
+		{
+			std::cout << filename << " contains malformed v or f records" << std::endl;
+			return false;
+		}
+	}
+	double parseSeconds = SecondsSince(start);
+
+	std::chrono::steady_clock::time_point weldStart = std::chrono::steady_clock::now();
+	size_t scratchBytes = WeldVertices(positions.data(), totalVertices, indices.data(), indices.size(), mesh);
+
+	if (nullptr != pStats)
+	{
+		pStats->fileBytes = file.Size();
+		pStats->triangleCount = totalTriangles;
+		pStats->inputVertexCount = totalVertices;
+		pStats->weldedVertexCount = mesh.VertexCount();
+		pStats->parseSeconds = parseSeconds;
+		pStats->weldSeconds = SecondsSince(weldStart);
+		pStats->totalSeconds = SecondsSince(start);
+		pStats->peakBytes = (positions.capacity() * sizeof(float)) + indices.capacity() * sizeof(int) + scratchBytes + mesh.triangles.capacity() * sizeof(int);
+		pStats->meshBytes = mesh.MemoryBytes();
+	}
+	return true;
+}
+
+
+bool LoadMeshFile(const char* filename, LoadedMesh& mesh, MeshLoadStats* pStats)
+{
+	std::string name(filename);
+	std::string extension = name.substr(name.find_last_of(".") + 1);
+	for (size_t i = 0; i < extension.size(); ++i)
+	{
+		extension[i] = (char)tolower(extension[i]);
+	}
+
+	if (extension == "stl")
+	{
+		return LoadBinarySTL(filename, mesh, pStats);
+	}
+	if (extension == "obj")
+	{
+		return LoadAsciiOBJ(filename, mesh, pStats);
+	}
+
+	std::cout << "Unsupported mesh file " << filename << std::endl;
+	return false;
+}
+
+
+void PrintMeshLoadStats(const char* filename, const MeshLoadStats& stats)
+{
+	const double cMB = 1024.0 * 1024.0;
+	double millions = stats.triangleCount / 1e6;
+
+	std::cout << "Mesh: " << filename << std::endl;
+	std::cout << "  Triangles: " << stats.triangleCount << ", vertices: " << stats.inputVertexCount
+		<< " -> " << stats.weldedVertexCount << " welded" << std::endl;
+	std::cout << "  Load: " << stats.totalSeconds * 1000.0 << " ms (parse " << stats.parseSeconds * 1000.0
+		<< " ms, weld " << stats.weldSeconds * 1000.0 << " ms)" << std::endl;
+	std::cout << "  Memory: " << stats.meshBytes / cMB << " MB mesh, " << stats.peakBytes / cMB << " MB peak" << std::endl;
+	if (millions > 0)
+	{
+		std::cout << "  Per million triangles: " << stats.totalSeconds * 1000.0 / millions << " ms, "
+			<< stats.meshBytes / cMB / millions << " MB mesh, "
+			<< stats.peakBytes / cMB / millions << " MB peak" << std::endl;
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "MemoryAccounting.h"
+
+#include <vector>
+#include <stddef.h>
+
+/// <summary>
+/// Indexed triangle mesh read from disk, with duplicate vertices welded
+/// </summary>
+struct LoadedMesh
+{
+	/// <summary>
+	/// x, y, z per vertex
+	/// </summary>
+	std::vector<float, TaggedAllocator<float, MemoryMesh> > points;
+
+	/// <summary>
+	/// 3 vertex indices per triangle
+	/// </summary>
+	std::vector<int, TaggedAllocator<int, MemoryMesh> > triangles;
+
+	size_t VertexCount() const { return points.size() / 3; }
+	size_t TriangleCount() const { return triangles.size() / 3; }
+
+	/// <summary>
+	/// Heap memory held by the mesh, in bytes
+	/// </summary>
+	size_t MemoryBytes() const { return points.capacity() * sizeof(float) + triangles.capacity() * sizeof(int); }
+};
+
+/// <summary>
+/// Timings and memory figures of one load
+/// </summary>
+struct MeshLoadStats
+{
+	size_t                      fileBytes;
+	size_t                      triangleCount;
+	size_t                      inputVertexCount;
+	size_t                      weldedVertexCount;
+
+	/// <summary>
+	/// Mapping and parsing the file into a triangle soup, in s
+	/// </summary>
+	double                      parseSeconds;
+
+	/// <summary>
+	/// Welding the soup into an indexed mesh, in s
+	/// </summary>
+	double                      weldSeconds;
+	double                      totalSeconds;
+
+	/// <summary>
+	/// High-water mark of heap memory used while loading, in bytes
+	/// </summary>
+	size_t                      peakBytes;
+
+	/// <summary>
+	/// Memory held by the loaded mesh, in bytes
+	/// </summary>
+	size_t                      meshBytes;
+};
+
+/// <summary>
+/// Load a binary .STL file through a memory mapping, parsing triangles in parallel
+/// </summary>
+/// <param name="filename">the file to read</param>
+/// <param name="mesh">receives the welded mesh</param>
+/// <param name="pStats">optional load statistics</param>
+/// <returns>indicates success or failure</returns>
+bool LoadBinarySTL(const char* filename, LoadedMesh& mesh, MeshLoadStats* pStats = nullptr);
+
+/// <summary>
+/// Load an ASCII Wavefront .OBJ file through a memory mapping, parsing chunks of lines in parallel.
+/// Only v and f records are read; faces with more than 3 vertices are triangulated as fans.
+/// </summary>
+/// <param name="filename">the file to read</param>
+/// <param name="mesh">receives the welded mesh</param>
+/// <param name="pStats">optional load statistics</param>
+/// <returns>indicates success or failure</returns>
+bool LoadAsciiOBJ(const char* filename, LoadedMesh& mesh, MeshLoadStats* pStats = nullptr);
+
+/// <summary>
+/// Load a .stl or .obj file, chosen by extension
+/// </summary>
+bool LoadMeshFile(const char* filename, LoadedMesh& mesh, MeshLoadStats* pStats = nullptr);
+
+/// <summary>
+/// Merge bit-identical vertices using a hash partitioned into independent shards, one thread per shard.
+/// The result does not depend on the number of threads.
+/// </summary>
+/// <param name="positions">x, y, z per input vertex</param>
+/// <param name="vertexCount">number of input vertices</param>
+/// <param name="indices">3 input vertex indices per triangle, or nullptr for a triangle soup (0, 1, 2, 3...)</param>
+/// <param name="indexCount">number of entries in indices, or 3 * triangles for a soup</param>
+/// <param name="mesh">receives the welded points and remapped triangles</param>
+/// <returns>bytes of temporary memory used</returns>
+size_t WeldVertices(const float* positions, size_t vertexCount, const int* indices, size_t indexCount, LoadedMesh& mesh);
+
+/// <summary>
+/// Print load time and memory, normalized per million triangles
+/// </summary>
+void PrintMeshLoadStats(const char* filename, const MeshLoadStats& stats);
@@ -0,0 +1,515 @@
+
+#include "MeshPreview.h"
+#include "MarchingCubes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+
+/// <summary>
+/// Below this capacity the preview is not worth its memory
+/// </summary>
+static const int cMinPreviewTriangles = 10000;
+
+
+MeshPreviewSettings::MeshPreviewSettings()
+	: blockVoxels(32)
+	, updateHz(2.0)
+	, maxBlocksPerUpdate(64)
+	, maxTriangles(500000)
+	, lodDistance(1.5f)
+{
+}
+
+
+MeshPreview::MeshPreview()
+	: m_dirtyCount(0)
+	, m_generation(0)
+	, m_appliedGeneration(0)
+	, m_usedTriangles(0)
+	, m_bRunning(false)
+	, m_updates(0)
+	, m_blocksMeshed(0)
+	, m_blocksOverBudget(0)
+	, m_liveTriangles(0)
+	, m_lastUpdateMs(0)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		m_voxelCount[k] = 0;
+		m_blockCount[k] = 0;
+		m_cameraPosition[k] = 0;
+	}
+	SetIdentity(m_volumeToWorld);
+}
+
+
+MeshPreview::~MeshPreview()
+{
+	Stop();
+}
+
+
+void MeshPreview::Initialize(const MeshPreviewSettings& settings, int voxelCountX, int voxelCountY, int voxelCountZ,
+	const Mat4& volumeToWorld, const TsdfBlockExporter& exporter)
+{
+	Stop();
+
+	m_settings = settings;
+	m_exporter = exporter;
+	m_voxelCount[0] = voxelCountX;
+	m_voxelCount[1] = voxelCountY;
+	m_voxelCount[2] = voxelCountZ;
+	for (int k = 0; k < 3; ++k)
+	{
+		m_blockCount[k] = (m_voxelCount[k] + m_settings.blockVoxels - 1) / m_settings.blockVoxels;
+	}
+	int blocks = m_blockCount[0] * m_blockCount[1] * m_blockCount[2];
+
+	m_volumeToWorld = volumeToWorld;
+	m_dirty.assign(blocks, 0);
+	m_dirtyCount = 0;
+
+	BlockRange empty = { 0, 0, 0 };
+	m_ranges.assign(blocks, empty);
+	m_freeRanges.clear();
+	// release the old buffer before asking the budget for the new one
+	std::vector<float, TaggedAllocator<float, MemoryPreview> >().swap(m_points);
+	const long long bytesPerTriangle = 9 * sizeof(float);
+	if (!MemoryAccounting::Instance().Admit(MemoryPreview, m_settings.maxTriangles * bytesPerTriangle))
+	{
+		long long fit = MemoryAccounting::Instance().Available() / bytesPerTriangle;
+		m_settings.maxTriangles = (fit >= cMinPreviewTriangles) ? (int)fit : 0;
+	}
+	m_points.assign((size_t)m_settings.maxTriangles * 9, 0.0f);
+	m_usedTriangles = 0;
+	m_liveTriangles = 0;
+	m_patches.clear();
+}
+
+
+void MeshPreview::Start()
+{
+	if (m_bRunning || m_dirty.empty() || m_points.empty())
+	{
+		return;
+	}
+	m_bRunning = true;
+	m_worker = std::thread(&MeshPreview::WorkerLoop, this);
+}
+
+
+void MeshPreview::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeLock);
+		m_bRunning = false;
+	}
+	m_wake.notify_all();
+	if (m_worker.joinable())
+	{
+		m_worker.join();
+	}
+}
+
+
+void MeshPreview::MarkVisibleBlocksDirty(const Mat4& worldToCamera, const CameraIntrinsics& intrinsics, float minDepth, float maxDepth)
+{
+	if (m_dirty.empty())
+	{
+		return;
+	}
+
+	const int b = m_settings.blockVoxels;
+	Mat4 volumeToCamera;
+	{
+		std::lock_guard<std::mutex> lock(m_dirtyLock);
+		volumeToCamera = Multiply(m_volumeToWorld, worldToCamera);
+		CameraPosition(worldToCamera, m_cameraPosition);
+	}
+
+	// bounding sphere of a block, in camera space units
+	float blockEdge[3] = { (float)b, 0, 0 };
+	float edgeCamera[3];
+	TransformVector(volumeToCamera, blockEdge, edgeCamera);
+	float radius = 0.87f * sqrtf(edgeCamera[0] * edgeCamera[0] + edgeCamera[1] * edgeCamera[1] + edgeCamera[2] * edgeCamera[2]);
+
+	std::vector<int> visible;
+	for (int z = 0; z < m_blockCount[2]; ++z)
+	{
+		for (int y = 0; y < m_blockCount[1]; ++y)
+		{
+			for (int x = 0; x < m_blockCount[0]; ++x)
+			{
+				float center[3] = { (x + 0.5f) * b, (y + 0.5f) * b, (z + 0.5f) * b };
+				float c[3];
+				TransformPoint(volumeToCamera, center, c);
+
+				if (c[2] + radius < minDepth || c[2] - radius > maxDepth)
+				{
+					continue;
+				}
+				if (c[2] > radius)
+				{
+					// conservative test against the image borders, widened by the sphere
+					float u = intrinsics.focalLengthX * c[0] / c[2] + intrinsics.principalPointX;
+					float v = intrinsics.focalLengthY * c[1] / c[2] + intrinsics.principalPointY;
+					float marginU = intrinsics.focalLengthX * radius / (c[2] - radius);
+					float marginV = intrinsics.focalLengthY * radius / (c[2] - radius);
+					if (u < -marginU || u > 1.0f + marginU || v < -marginV || v > 1.0f + marginV)
+					{
+						continue;
+					}
+				}
+				visible.push_back((z * m_blockCount[1] + y) * m_blockCount[0] + x);
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_dirtyLock);
+	for (size_t i = 0; i < visible.size(); ++i)
+	{
+		if (!m_dirty[visible[i]])
+		{
+			m_dirty[visible[i]] = 1;
+			m_dirtyCount++;
+		}
+	}
+}
+
+
+void MeshPreview::Reset(const Mat4& volumeToWorld)
+{
+	std::lock_guard<std::mutex> lock(m_dirtyLock);
+	m_volumeToWorld = volumeToWorld;
+	std::fill(m_dirty.begin(), m_dirty.end(), (unsigned char)0);
+	m_dirtyCount = 0;
+	m_generation++;
+}
+
+
+float MeshPreview::BlockDistance(int block, const Mat4& volumeToWorld, const float cameraPosition[3]) const
+{
+	const int b = m_settings.blockVoxels;
+	int x = block % m_blockCount[0];
+	int y = (block / m_blockCount[0]) % m_blockCount[1];
+	int z = block / (m_blockCount[0] * m_blockCount[1]);
+	float center[3] = { (x + 0.5f) * b, (y + 0.5f) * b, (z + 0.5f) * b };
+	float world[3];
+	TransformPoint(volumeToWorld, center, world);
+	float dx = world[0] - cameraPosition[0];
+	float dy = world[1] - cameraPosition[1];
+	float dz = world[2] - cameraPosition[2];
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+
+void MeshPreview::MeshBlock(int block, const Mat4& volumeToWorld, const float cameraPosition[3], BlockPatch& patch)
+{
+	const int b = m_settings.blockVoxels;
+	int origin[3] =
+	{
+		(block % m_blockCount[0]) * b,
+		((block / m_blockCount[0]) % m_blockCount[1]) * b,
+		(block / (m_blockCount[0] * m_blockCount[1])) * b
+	};
+
+	// level of detail from the distance to the camera
+	float distance = BlockDistance(block, volumeToWorld, cameraPosition);
+	int step = 1;
+	if (distance > 2.0f * m_settings.lodDistance)
+	{
+		step = 4;
+	}
+	else if (distance > m_settings.lodDistance)
+	{
+		step = 2;
+	}
+
+	// one extra sample per axis so the surface joins the neighbouring block;
+	// the export may not read past the end of the volume (origin + samples * step <= count)
+	int samples[3];
+	for (int k = 0; k < 3; ++k)
+	{
+		samples[k] = std::min(b / step + 1, (m_voxelCount[k] - origin[k]) / step);
+	}
+
+	std::vector<short> tsdf;
+	if (samples[0] < 2 || samples[1] < 2 || samples[2] < 2
+		|| !m_exporter(origin[0], origin[1], origin[2], samples[0], samples[1], samples[2], step, tsdf))
+	{
+		return;
+	}
+
+	TsdfBlock tsdfBlock;
+	tsdfBlock.tsdf = tsdf.data();
+	tsdfBlock.weights = nullptr;
+	tsdfBlock.zeroIsUnobserved = true;
+	tsdfBlock.sizeX = samples[0];
+	tsdfBlock.sizeY = samples[1];
+	tsdfBlock.sizeZ = samples[2];
+	tsdfBlock.origin[0] = (float)origin[0];
+	tsdfBlock.origin[1] = (float)origin[1];
+	tsdfBlock.origin[2] = (float)origin[2];
+	tsdfBlock.spacing = (float)step;
+	ExtractIsoSurface(tsdfBlock, patch.triangles);
+
+	// voxel coordinates to world space
+	for (size_t i = 0; i + 2 < patch.triangles.size(); i += 3)
+	{
+		float world[3];
+		TransformPoint(volumeToWorld, &patch.triangles[i], world);
+		patch.triangles[i + 0] = world[0];
+		patch.triangles[i + 1] = world[1];
+		patch.triangles[i + 2] = world[2];
+	}
+}
+
+
+void MeshPreview::WorkerLoop()
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(1.0 / (m_settings.updateHz > 0 ? m_settings.updateHz : 1.0)));
+	Clock::time_point nextUpdate = Clock::now();
+
+	while (m_bRunning)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_wakeLock);
+			m_wake.wait_until(lock, nextUpdate, [&]() { return !m_bRunning; });
+			if (!m_bRunning)
+			{
+				break;
+			}
+		}
+		Clock::time_point start = Clock::now();
+		nextUpdate = start + period;
+
+		// Take the dirty blocks nearest to the camera
+		std::vector<int> blocks;
+		Mat4 volumeToWorld;
+		float cameraPosition[3];
+		unsigned int generation;
+		{
+			std::lock_guard<std::mutex> lock(m_dirtyLock);
+			if (0 == m_dirtyCount)
+			{
+				continue;
+			}
+			volumeToWorld = m_volumeToWorld;
+			memcpy(cameraPosition, m_cameraPosition, sizeof(cameraPosition));
+			generation = m_generation;
+			for (int i = 0; i < (int)m_dirty.size(); ++i)
+			{
+				if (m_dirty[i])
+				{
+					blocks.push_back(i);
+				}
+			}
+
+			std::vector<float> distance(m_dirty.size(), 0.0f);
+			for (size_t i = 0; i < blocks.size(); ++i)
+			{
+				distance[blocks[i]] = BlockDistance(blocks[i], volumeToWorld, cameraPosition);
+			}
+			std::sort(blocks.begin(), blocks.end(), [&](int a, int b) { return distance[a] < distance[b]; });
+			if ((int)blocks.size() > m_settings.maxBlocksPerUpdate)
+			{
+				blocks.resize(m_settings.maxBlocksPerUpdate);
+			}
+			for (size_t i = 0; i < blocks.size(); ++i)
+			{
+				m_dirty[blocks[i]] = 0;
+			}
+			m_dirtyCount -= (int)blocks.size();
+		}
+
+		std::vector<BlockPatch> patches(blocks.size());
+		for (size_t i = 0; i < blocks.size() && m_bRunning; ++i)
+		{
+			patches[i].block = blocks[i];
+			patches[i].generation = generation;
+			MeshBlock(blocks[i], volumeToWorld, cameraPosition, patches[i]);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_patchLock);
+			for (size_t i = 0; i < patches.size(); ++i)
+			{
+				m_patches.push_back(BlockPatch());
+				m_patches.back().block = patches[i].block;
+				m_patches.back().generation = patches[i].generation;
+				m_patches.back().triangles.swap(patches[i].triangles);
+			}
+		}
+
+		m_updates++;
+		m_blocksMeshed += (long long)blocks.size();
+		m_lastUpdateMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+}
+
+
+void MeshPreview::ReleaseRange(BlockRange& range)
+{
+	if (range.capacity > 0)
+	{
+		// collapse the triangles to a point so they do not render
+		memset(&m_points[(size_t)range.start * 9], 0, (size_t)range.capacity * 9 * sizeof(float));
+		m_freeRanges.push_back(range);
+	}
+	m_liveTriangles -= range.count;
+	range.start = 0;
+	range.count = 0;
+	range.capacity = 0;
+}
+
+
+bool MeshPreview::AllocateRange(int triangles, BlockRange& range)
+{
+	// a little slack so that a block growing by a few triangles stays in place
+	int capacity = triangles + triangles / 4 + 16;
+
+	for (size_t i = 0; i < m_freeRanges.size(); ++i)
+	{
+		if (m_freeRanges[i].capacity >= triangles)
+		{
+			range = m_freeRanges[i];
+			m_freeRanges[i] = m_freeRanges.back();
+			m_freeRanges.pop_back();
+			return true;
+		}
+	}
+
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		int available = m_settings.maxTriangles - m_usedTriangles;
+		if (available >= triangles)
+		{
+			range.start = m_usedTriangles;
+			range.capacity = std::min(capacity, available);
+			m_usedTriangles += range.capacity;
+			return true;
+		}
+		Compact();
+	}
+	return false;
+}
+
+
+void MeshPreview::Compact()
+{
+	// Move every block to the front of the buffer in start order and trim its slack
+	std::vector<int> order;
+	for (int i = 0; i < (int)m_ranges.size(); ++i)
+	{
+		if (m_ranges[i].capacity > 0)
+		{
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return m_ranges[a].start < m_ranges[b].start; });
+
+	int next = 0;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		BlockRange& range = m_ranges[order[i]];
+		if (range.start != next)
+		{
+			memmove(&m_points[(size_t)next * 9], &m_points[(size_t)range.start * 9], (size_t)range.count * 9 * sizeof(float));
+		}
+		range.start = next;
+		range.capacity = range.count;
+		next += range.count;
+	}
+
+	memset(&m_points[(size_t)next * 9], 0, (size_t)(m_settings.maxTriangles - next) * 9 * sizeof(float));
+	m_usedTriangles = next;
+	m_freeRanges.clear();
+}
+
+
+bool MeshPreview::ApplyPendingUpdates()
+{
+	std::vector<BlockPatch> patches;
+	{
+		std::lock_guard<std::mutex> lock(m_patchLock);
+		patches.swap(m_patches);
+	}
+
+	unsigned int generation;
+	{
+		std::lock_guard<std::mutex> lock(m_dirtyLock);
+		generation = m_generation;
+	}
+
+	bool changed = false;
+	if (generation != m_appliedGeneration)
+	{
+		// the reconstruction was reset: drop everything
+		BlockRange empty = { 0, 0, 0 };
+		std::fill(m_ranges.begin(), m_ranges.end(), empty);
+		m_freeRanges.clear();
+		std::fill(m_points.begin(), m_points.end(), 0.0f);
+		m_usedTriangles = 0;
+		m_liveTriangles = 0;
+		m_appliedGeneration = generation;
+		changed = true;
+	}
+
+	for (size_t i = 0; i < patches.size(); ++i)
+	{
+		const BlockPatch& patch = patches[i];
+		if (patch.generation != generation)
+		{
+			continue;
+		}
+
+		BlockRange& range = m_ranges[patch.block];
+		int triangles = (int)(patch.triangles.size() / 9);
+
+		if (triangles > range.capacity)
+		{
+			ReleaseRange(range);
+			if (triangles > 0 && !AllocateRange(triangles, range))
+			{
+				m_blocksOverBudget++;
+				changed = true;
+				continue;
+			}
+		}
+
+		// swap the block's triangles in place and collapse what is left of its range
+		if (triangles > 0)
+		{
+			memcpy(&m_points[(size_t)range.start * 9], patch.triangles.data(), patch.triangles.size() * sizeof(float));
+		}
+		if (range.capacity > triangles)
+		{
+			memset(&m_points[(size_t)(range.start + triangles) * 9], 0, (size_t)(range.capacity - triangles) * 9 * sizeof(float));
+		}
+		m_liveTriangles += triangles - range.count;
+		range.count = triangles;
+		changed = true;
+	}
+	return changed;
+}
+
+
+MeshPreviewStats MeshPreview::GetStats()
+{
+	MeshPreviewStats stats;
+	stats.updates = m_updates;
+	stats.blocksMeshed = m_blocksMeshed;
+	stats.blocksOverBudget = m_blocksOverBudget;
+	{
+		std::lock_guard<std::mutex> lock(m_dirtyLock);
+		stats.dirtyBlocks = m_dirtyCount;
+	}
+	stats.liveTriangles = m_liveTriangles;
+	stats.capacityTriangles = m_settings.maxTriangles;
+	stats.lastUpdateMs = m_lastUpdateMs;
+	return stats;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "MemoryAccounting.h"
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/// <summary>
+/// Limits of the live mesh preview
+/// </summary>
+struct MeshPreviewSettings
+{
+	/// <summary>
+	/// Edge length of a preview block, in voxels
+	/// </summary>
+	int                         blockVoxels;
+
+	/// <summary>
+	/// Maximum number of preview updates per second
+	/// </summary>
+	double                      updateHz;
+
+	/// <summary>
+	/// Maximum number of blocks re-meshed by one update
+	/// </summary>
+	int                         maxBlocksPerUpdate;
+
+	/// <summary>
+	/// Capacity of the preview mesh; blocks that do not fit are left out. The buffer is an
+	/// optional cache: it shrinks to what the memory budget leaves, down to nothing.
+	/// </summary>
+	int                         maxTriangles;
+
+	/// <summary>
+	/// Blocks farther than this from the camera (in m) are meshed at half resolution,
+	/// and beyond twice this distance at quarter resolution
+	/// </summary>
+	float                       lodDistance;
+
+	MeshPreviewSettings();
+};
+
+/// <summary>
+/// Statistics of the live mesh preview
+/// </summary>
+struct MeshPreviewStats
+{
+	long long                   updates;
+	long long                   blocksMeshed;
+	long long                   blocksOverBudget;
+	int                         dirtyBlocks;
+	int                         liveTriangles;
+	int                         capacityTriangles;
+	double                      lastUpdateMs;
+};
+
+/// <summary>
+/// Read a box of TSDF samples out of the reconstruction volume.
+/// The box starts at voxel (x, y, z) and has samplesX * samplesY * samplesZ samples taken every
+/// step voxels, stored x fastest. Returns false if the volume could not be read.
+/// </summary>
+typedef std::function<bool(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step, std::vector<short>& samples)> TsdfBlockExporter;
+
+/// <summary>
+/// Live 3D preview of the reconstruction, re-meshed incrementally.
+/// The fusion thread marks the blocks in the camera frustum as dirty after integrating a frame.
+/// A background thread re-meshes the nearest dirty blocks at a bounded rate and the render
+/// thread patches their triangles into a fixed-capacity triangle soup in place, so the rest
+/// of the mesh is left untouched. Each block owns a range of triangles; a block whose new
+/// triangles do not fit in its range moves to a free range, and unused triangles are
+/// collapsed to a point so they are invisible.
+/// </summary>
+class MeshPreview
+{
+public:
+	MeshPreview();
+	~MeshPreview();
+
+	/// <summary>
+	/// Size the block grid and the triangle buffer. Call before Start. CapacityTriangles is 0
+	/// when the memory budget leaves no room for the preview, which then cannot start.
+	/// </summary>
+	/// <param name="settings">limits of the preview</param>
+	/// <param name="voxelCountX">volume size in voxels along x</param>
+	/// <param name="voxelCountY">volume size in voxels along y</param>
+	/// <param name="voxelCountZ">volume size in voxels along z</param>
+	/// <param name="volumeToWorld">transform from voxel coordinates to world space</param>
+	/// <param name="exporter">reads TSDF samples out of the volume</param>
+	void Initialize(const MeshPreviewSettings& settings, int voxelCountX, int voxelCountY, int voxelCountZ,
+		const Mat4& volumeToWorld, const TsdfBlockExporter& exporter);
+
+	/// <summary>
+	/// Start / stop the background meshing thread
+	/// </summary>
+	void Start();
+	void Stop();
+	bool IsRunning() const { return m_bRunning; }
+
+	/// <summary>
+	/// Fusion thread: mark the blocks seen by the camera as changed
+	/// </summary>
+	void MarkVisibleBlocksDirty(const Mat4& worldToCamera, const CameraIntrinsics& intrinsics, float minDepth, float maxDepth);
+
+	/// <summary>
+	/// Drop all triangles, e.g. after the reconstruction was reset
+	/// </summary>
+	void Reset(const Mat4& volumeToWorld);
+
+	/// <summary>
+	/// Render thread: copy the blocks meshed since the last call into the triangle buffer
+	/// </summary>
+	/// <returns>true if the buffer changed</returns>
+	bool ApplyPendingUpdates();
+
+	/// <summary>
+	/// Triangle soup of CapacityTriangles() triangles, 9 floats each. Only touched by ApplyPendingUpdates.
+	/// </summary>
+	float* Points() { return m_points.empty() ? nullptr : &m_points[0]; }
+	int CapacityTriangles() const { return m_settings.maxTriangles; }
+
+	MeshPreviewStats GetStats();
+
+private:
+	MeshPreview(const MeshPreview&);
+	MeshPreview& operator=(const MeshPreview&);
+
+	struct BlockRange
+	{
+		int                     start;
+		int                     count;
+		int                     capacity;
+	};
+
+	struct BlockPatch
+	{
+		int                     block;
+		unsigned int            generation;
+		std::vector<float>      triangles;
+	};
+
+	void WorkerLoop();
+	void MeshBlock(int block, const Mat4& volumeToWorld, const float cameraPosition[3], BlockPatch& patch);
+	float BlockDistance(int block, const Mat4& volumeToWorld, const float cameraPosition[3]) const;
+
+	// triangle range management, render thread only
+	void ReleaseRange(BlockRange& range);
+	bool AllocateRange(int triangles, BlockRange& range);
+	void Compact();
+
+	MeshPreviewSettings         m_settings;
+	TsdfBlockExporter           m_exporter;
+	int                         m_voxelCount[3];
+	int                         m_blockCount[3];
+
+	// shared between the fusion thread and the worker
+	std::mutex                  m_dirtyLock;
+	std::vector<unsigned char>  m_dirty;
+	int                         m_dirtyCount;
+	Mat4                        m_volumeToWorld;
+	float                       m_cameraPosition[3];
+	unsigned int                m_generation;
+
+	// finished blocks, handed from the worker to the render thread
+	std::mutex                  m_patchLock;
+	std::vector<BlockPatch>     m_patches;
+	unsigned int                m_appliedGeneration;
+
+	// render thread only
+	std::vector<float, TaggedAllocator<float, MemoryPreview> > m_points;
+	std::vector<BlockRange>     m_ranges;
+	std::vector<BlockRange>     m_freeRanges;
+	int                         m_usedTriangles;
+
+	std::thread                 m_worker;
+	std::atomic<bool>           m_bRunning;
+	std::mutex                  m_wakeLock;
+	std::condition_variable     m_wake;
+
+	std::atomic<long long>      m_updates;
+	std::atomic<long long>      m_blocksMeshed;
+	long long                   m_blocksOverBudget;
+	int                         m_liveTriangles;
+	std::atomic<double>         m_lastUpdateMs;
+};
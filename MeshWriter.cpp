@@ -0,0 +1,121 @@
+
+#include "MeshWriter.h"
+#include "MeshLoader.h"
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+
+/// <summary>
+/// fopen with a large buffer, so the writers can emit small records without a syscall each
+/// </summary>
+static FILE* OpenForWriting(const char* filename, bool binary, std::vector<char>& buffer)
+{
+	FILE* file = fopen(filename, binary ? "wb" : "w");
+	if (nullptr != file)
+	{
+		buffer.resize(1 << 20);
+		setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+	}
+	return file;
+}
+
+
+bool WriteBinarySTL(const char* filename, const float* triangles, size_t triangleCount, bool flipYZ)
+{
+	std::vector<char> buffer;
+	FILE* file = OpenForWriting(filename, true, buffer);
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	const unsigned char header[80] = { 0 };
+	unsigned int count = (unsigned int)triangleCount;
+	fwrite(header, 1, sizeof(header), file);
+	fwrite(&count, sizeof(count), 1, file);
+
+	// normal, 3 corners and a 2 byte attribute: 50 bytes per triangle
+	const float sign = flipYZ ? -1.0f : 1.0f;
+	unsigned char record[50];
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		float corners[9];
+		for (int v = 0; v < 3; ++v)
+		{
+			corners[v * 3 + 0] = triangles[t * 9 + v * 3 + 0];
+			corners[v * 3 + 1] = triangles[t * 9 + v * 3 + 1] * sign;
+			corners[v * 3 + 2] = triangles[t * 9 + v * 3 + 2] * sign;
+		}
+
+		float a[3] = { corners[3] - corners[0], corners[4] - corners[1], corners[5] - corners[2] };
+		float b[3] = { corners[6] - corners[0], corners[7] - corners[1], corners[8] - corners[2] };
+		float normal[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+		float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float inv = (length > 0.0f) ? 1.0f / length : 0.0f;
+		for (int i = 0; i < 3; ++i)
+		{
+			normal[i] *= inv;
+		}
+
+		memcpy(record, normal, 12);
+		memcpy(record + 12, corners, 36);
+		record[48] = record[49] = 0;
+		fwrite(record, 1, sizeof(record), file);
+	}
+
+	bool ok = !ferror(file);
+	ok = (0 == fclose(file)) && ok;
+	return ok;
+}
+
+
+bool WriteAsciiOBJ(const char* filename, const float* triangles, size_t triangleCount, bool flipYZ)
+{
+	LoadedMesh mesh;
+	WeldVertices(triangles, triangleCount * 3, nullptr, triangleCount * 3, mesh);
+
+	std::vector<char> buffer;
+	FILE* file = OpenForWriting(filename, false, buffer);
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	const float sign = flipYZ ? -1.0f : 1.0f;
+	fprintf(file, "# %u vertices, %u triangles\n", (unsigned int)mesh.VertexCount(), (unsigned int)mesh.TriangleCount());
+	for (size_t v = 0; v < mesh.VertexCount(); ++v)
+	{
+		fprintf(file, "v %g %g %g\n", mesh.points[v * 3], mesh.points[v * 3 + 1] * sign, mesh.points[v * 3 + 2] * sign);
+	}
+
+	// OBJ indices start at 1
+	for (size_t t = 0; t < mesh.TriangleCount(); ++t)
+	{
+		fprintf(file, "f %d %d %d\n", mesh.triangles[t * 3] + 1, mesh.triangles[t * 3 + 1] + 1, mesh.triangles[t * 3 + 2] + 1);
+	}
+
+	bool ok = !ferror(file);
+	ok = (0 == fclose(file)) && ok;
+	return ok;
+}
+
+
+bool WriteMeshFile(const char* filename, const float* triangles, size_t triangleCount, bool flipYZ)
+{
+	std::string name(filename);
+	std::string extension = name.substr(name.find_last_of('.') + 1);
+	for (size_t i = 0; i < extension.size(); ++i)
+	{
+		extension[i] = (char)tolower((unsigned char)extension[i]);
+	}
+	if (extension == "obj")
+	{
+		return WriteAsciiOBJ(filename, triangles, triangleCount, flipYZ);
+	}
+	return WriteBinarySTL(filename, triangles, triangleCount, flipYZ);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/// <summary>
+/// Write a triangle soup (9 floats per triangle) as a binary .STL file. Portable counterpart of
+/// WriteBinarySTLMeshFile for meshes that do not come from an INuiFusionMesh.
+/// </summary>
+/// <param name="flipYZ">negate y and z, turning the y-down camera convention into y-up</param>
+/// <returns>indicates success or failure</returns>
+bool WriteBinarySTL(const char* filename, const float* triangles, size_t triangleCount, bool flipYZ = true);
+
+/// <summary>
+/// Write a triangle soup as an ASCII Wavefront .OBJ file with shared vertices welded.
+/// Portable counterpart of WriteAsciiObjMeshFile.
+/// </summary>
+bool WriteAsciiOBJ(const char* filename, const float* triangles, size_t triangleCount, bool flipYZ = true);
+
+/// <summary>
+/// Write a .stl or .obj file, chosen by extension
+/// </summary>
+bool WriteMeshFile(const char* filename, const float* triangles, size_t triangleCount, bool flipYZ = true);
@@ -0,0 +1,96 @@
+#include "NativeReconstruction.h"
+#include "MeshWriter.h"
+#include "MemoryAccounting.h"
+#include "Telemetry.h"
+
+#include <new>
+
+
+static const StageId s_stageCalculateMesh = Telemetry::Instance().RegisterStage("calculate-mesh");
+
+
+bool NativeReconstruction::Initialize(const FusionPipelineParameters& parameters, int width, int height)
+{
+	try
+	{
+		m_pipeline.Initialize(parameters, width, height);
+	}
+	catch (const std::bad_alloc&)
+	{
+		m_error = "Cannot allocate the volume (" + DescribeVolume(parameters.volume, Backend()) + ")";
+		return false;
+	}
+	return true;
+}
+
+
+bool NativeReconstruction::Reset()
+{
+	m_pipeline.Reset();
+	return true;
+}
+
+
+bool NativeReconstruction::ProcessFrame(const unsigned short* pDepthMm, ReconstructionFrame& frame)
+{
+	FusionFrameResult result = m_pipeline.ProcessFrame(pDepthMm);
+	frame.tracked = result.tracked;
+	frame.integrated = result.integrated;
+	frame.residual = result.icp.tracked ? result.icp.residual : -1.0f;
+	frame.trackingMs = result.trackingMs;
+	frame.integrationMs = result.integrationMs;
+	frame.raycastMs = result.raycastMs;
+	return true;
+}
+
+
+bool NativeReconstruction::Shade(PointCloudShader& shader, unsigned char* pDst, int dstStride)
+{
+	const int width = m_pipeline.Width();
+	shader.Shade(m_pipeline.PointCloud(), width * 6 * sizeof(float), width, m_pipeline.Height(),
+		m_pipeline.WorldToCamera(), pDst, dstStride);
+	return true;
+}
+
+
+void NativeReconstruction::ExportPoints(PointCloudExporter& exporter, long long frame, PointExportSource source)
+{
+	const int width = m_pipeline.Width(), height = m_pipeline.Height();
+	if (PointExportDepth == source)
+	{
+		exporter.SubmitDepth(frame, m_pipeline.FrameDepth(), width, height, m_pipeline.Intrinsics(), m_pipeline.WorldToCamera());
+	}
+	else
+	{
+		exporter.SubmitPoints(frame, m_pipeline.PointCloud(), width * 6 * sizeof(float), width, height);
+	}
+}
+
+
+bool NativeReconstruction::ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+	std::vector<short>& samples)
+{
+	return m_pipeline.Volume().ExportBlock(x, y, z, samplesX, samplesY, samplesZ, step, samples);
+}
+
+
+bool NativeReconstruction::SaveMesh(const std::string& path)
+{
+	std::vector<float> triangles;
+	size_t triangleCount = 0;
+	{
+		ScopedStageTimer meshTimer(s_stageCalculateMesh);
+		triangleCount = m_pipeline.Volume().CalculateMesh(triangles);
+	}
+
+	// the triangle soup, until it is written
+	MemoryReservation meshMemory;
+	meshMemory.Reserve(MemoryMesh, (long long)(triangles.capacity() * sizeof(float)));
+
+	if (!WriteMeshFile(path.c_str(), triangles.data(), triangleCount))
+	{
+		m_error = "Cannot write the mesh to " + path;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Reconstruction.h"
+#include "FusionPipeline.h"
+
+/// <summary>
+/// The native pipeline behind the viewer: what FusionReplay runs, shaded and meshed the way the
+/// Kinect Fusion SDK volume is. Builds on every platform.
+/// </summary>
+class NativeReconstruction : public Reconstruction
+{
+public:
+	const char* Name() const { return "native"; }
+	VolumeBackend Backend() const { return NativeVolumeBackend(); }
+	bool ScalesRaycast() const { return true; }
+
+	bool Initialize(const FusionPipelineParameters& parameters, int width, int height);
+	bool Reset();
+	bool ProcessFrame(const unsigned short* pDepthMm, ReconstructionFrame& frame);
+	void SetQuality(const QualityLevel& quality) { m_pipeline.SetQuality(quality); }
+
+	/// <summary>
+	/// The pipeline raycasts every frame as the tracking reference of the next one, so the point
+	/// cloud is already there
+	/// </summary>
+	bool CalculatePointCloud() { return true; }
+
+	bool Shade(PointCloudShader& shader, unsigned char* pDst, int dstStride);
+	void ExportPoints(PointCloudExporter& exporter, long long frame, PointExportSource source);
+	bool ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+		std::vector<short>& samples);
+	bool SaveMesh(const std::string& path);
+
+	Mat4 WorldToCamera() const { return m_pipeline.WorldToCamera(); }
+	Mat4 VolumeToWorld() const { return m_pipeline.Volume().VolumeToWorld(); }
+	CameraIntrinsics Intrinsics() const { return m_pipeline.Intrinsics(); }
+	VolumeParameters Volume() const { return m_pipeline.Volume().Parameters(); }
+
+	const FusionPipeline& Pipeline() const { return m_pipeline; }
+
+private:
+	FusionPipeline              m_pipeline;
+};
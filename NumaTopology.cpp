@@ -0,0 +1,276 @@
+
+#include "NumaTopology.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef __linux__
+/// <summary>
+/// Parse a sysfs list such as "0-3,8,10-11"
+/// </summary>
+static std::vector<int> ParseList(const std::string& text)
+{
+	std::vector<int> values;
+	std::istringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		int first = 0, last = 0;
+		char dash = 0;
+		std::istringstream range(item);
+		if (!(range >> first))
+		{
+			continue;
+		}
+		last = (range >> dash >> last && '-' == dash) ? last : first;
+		for (int value = first; value <= last; ++value)
+		{
+			values.push_back(value);
+		}
+	}
+	return values;
+}
+
+
+static std::string ReadLine(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+
+
+/// <summary>
+/// MemFree of a node, from its meminfo ("Node 0 MemFree:   123456 kB")
+/// </summary>
+static unsigned long long NodeFreeBytes(int id)
+{
+	std::ostringstream path;
+	path << "/sys/devices/system/node/node" << id << "/meminfo";
+	std::ifstream file(path.str().c_str());
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t field = line.find("MemFree:");
+		if (std::string::npos != field)
+		{
+			std::istringstream value(line.substr(field + 8));
+			unsigned long long kilobytes = 0;
+			value >> kilobytes;
+			return kilobytes * 1024;
+		}
+	}
+	return 0;
+}
+#endif
+
+
+/// <summary>
+/// "0-3,8" from { 0, 1, 2, 3, 8 }
+/// </summary>
+static std::string FormatList(const std::vector<int>& values)
+{
+	std::ostringstream text;
+	for (size_t i = 0; i < values.size(); )
+	{
+		size_t last = i;
+		while (last + 1 < values.size() && values[last + 1] == values[last] + 1)
+		{
+			last++;
+		}
+		text << (0 == i ? "" : ",") << values[i];
+		if (last > i)
+		{
+			text << "-" << values[last];
+		}
+		i = last + 1;
+	}
+	return text.str();
+}
+
+
+NumaTopology::NumaTopology()
+	: m_pSource("single node")
+{
+#ifdef _WIN32
+	ULONG highest = 0;
+	if (GetNumaHighestNodeNumber(&highest) && highest > 0)
+	{
+		for (ULONG id = 0; id <= highest && (int)m_nodes.size() < cMaxNumaNodes; ++id)
+		{
+			ULONGLONG mask = 0;
+			if (!GetNumaNodeProcessorMask((UCHAR)id, &mask) || 0 == mask)
+			{
+				continue;
+			}
+			NumaNode node;
+			node.id = (int)id;
+			for (int cpu = 0; cpu < 64; ++cpu)
+			{
+				if (0 != (mask & ((ULONGLONG)1 << cpu)))
+				{
+					node.cpus.push_back(cpu);
+				}
+			}
+			ULONGLONG available = 0;
+			node.freeBytes = GetNumaAvailableMemoryNodeEx((USHORT)id, &available) ? available : 0;
+			m_nodes.push_back(node);
+		}
+		m_pSource = "windows";
+	}
+#elif defined(__linux__)
+	// memory-only nodes (no CPUs) are left out: no thread can run next to them
+	std::vector<int> online = ParseList(ReadLine("/sys/devices/system/node/online"));
+	for (size_t i = 0; i < online.size() && (int)m_nodes.size() < cMaxNumaNodes; ++i)
+	{
+		std::ostringstream path;
+		path << "/sys/devices/system/node/node" << online[i] << "/cpulist";
+		NumaNode node;
+		node.id = online[i];
+		node.cpus = ParseList(ReadLine(path.str()));
+		node.freeBytes = NodeFreeBytes(online[i]);
+		if (!node.cpus.empty())
+		{
+			m_nodes.push_back(node);
+		}
+	}
+	if (!m_nodes.empty())
+	{
+		m_pSource = "sysfs";
+	}
+#endif
+
+	if (m_nodes.empty())
+	{
+		int cpus = (int)std::thread::hardware_concurrency();
+		NumaNode node;
+		node.id = 0;
+		node.freeBytes = 0;
+		for (int cpu = 0; cpu < ((cpus > 0) ? cpus : 1); ++cpu)
+		{
+			node.cpus.push_back(cpu);
+		}
+		m_nodes.push_back(node);
+		m_pSource = "single node";
+	}
+}
+
+
+NumaTopology& NumaTopology::System()
+{
+	static NumaTopology topology;
+	return topology;
+}
+
+
+int NumaTopology::CpuCount() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		count += m_nodes[i].cpus.size();
+	}
+	return (int)count;
+}
+
+
+bool NumaTopology::UseNodes(int nodeCount)
+{
+	if (nodeCount < 1 || nodeCount > NodeCount())
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int n = 0; n < nodeCount; ++n)
+	{
+		for (size_t i = 0; i < m_nodes[n].cpus.size(); ++i)
+		{
+			mask |= (DWORD_PTR)1 << (m_nodes[n].cpus[i] % (8 * sizeof(DWORD_PTR)));
+		}
+	}
+	bool ok = 0 != SetProcessAffinityMask(GetCurrentProcess(), mask);
+#elif defined(__linux__)
+	// threads inherit the affinity of the thread that creates them
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int n = 0; n < nodeCount; ++n)
+	{
+		for (size_t i = 0; i < m_nodes[n].cpus.size(); ++i)
+		{
+			CPU_SET(m_nodes[n].cpus[i], &set);
+		}
+	}
+	bool ok = 0 == sched_setaffinity(0, sizeof(set), &set);
+#else
+	bool ok = (1 == nodeCount);
+#endif
+
+	if (ok)
+	{
+		m_nodes.resize(nodeCount);
+	}
+	return ok;
+}
+
+
+bool NumaTopology::BindMemory(void* pData, size_t bytes, int node) const
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	if (nullptr == pData || 0 == bytes || node < 0 || node >= NodeCount())
+	{
+		return false;
+	}
+
+	const int id = m_nodes[node].id;
+	const int cMaskBits = 1024;
+	const int cBitsPerWord = 8 * (int)sizeof(unsigned long);
+	if (id >= cMaskBits)
+	{
+		return false;
+	}
+	unsigned long mask[cMaskBits / (8 * sizeof(unsigned long))] = {};
+	mask[id / cBitsPerWord] = 1UL << (id % cBitsPerWord);
+
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t begin = (size_t)pData & ~(page - 1);
+	const size_t end = ((size_t)pData + bytes + page - 1) & ~(page - 1);
+
+	// the kernel reads maxnode - 1 bits, as libnuma passes them
+	return 0 == syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, mask, (unsigned long)cMaskBits + 1, 0);
+#else
+	(void)pData;
+	(void)bytes;
+	(void)node;
+	return false;
+#endif
+}
+
+
+void NumaTopology::Report(std::ostream& stream) const
+{
+	stream << "NUMA: " << NodeCount() << (1 == NodeCount() ? " node" : " nodes") << " (" << m_pSource << ")" << std::endl;
+	for (int n = 0; n < NodeCount(); ++n)
+	{
+		stream << "  node " << m_nodes[n].id << ": cpus " << FormatList(m_nodes[n].cpus);
+		if (m_nodes[n].freeBytes > 0)
+		{
+			stream << ", " << m_nodes[n].freeBytes / (1024 * 1024) << " MB free";
+		}
+		stream << std::endl;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include <stddef.h>
+
+/// <summary>
+/// Most NUMA nodes the thread pool and the volume tell apart; nodes past it are left out
+/// </summary>
+static const int cMaxNumaNodes = 64;
+
+/// <summary>
+/// One NUMA node: the CPUs that share its memory controller
+/// </summary>
+struct NumaNode
+{
+	int                         id;					// the system's node number
+	std::vector<int>            cpus;
+	unsigned long long          freeBytes;			// free memory at detection, 0 if unknown
+};
+
+/// <summary>
+/// The machine's NUMA nodes, read from /sys/devices/system/node on Linux and from the NUMA API
+/// on Windows, without libnuma. Where neither is available, or the machine has one node, it is
+/// a single node holding every CPU, and nothing below changes placement. Memory is placed on a
+/// node with mbind on Linux; on Windows only the first touch places it, so touch memory from the
+/// threads of the node that should own it (see ThreadPool::ParallelForNodes).
+/// </summary>
+class NumaTopology
+{
+public:
+	/// <summary>
+	/// The process-wide topology, detected on the first call
+	/// </summary>
+	static NumaTopology& System();
+
+	int NodeCount() const { return (int)m_nodes.size(); }
+	const NumaNode& Node(int index) const { return m_nodes[index]; }
+	int CpuCount() const;
+
+	/// <summary>
+	/// Where the topology came from: "sysfs", "windows" or "single node"
+	/// </summary>
+	const char* Source() const { return m_pSource; }
+
+	/// <summary>
+	/// Keep only the first nodeCount nodes, and restrict the process to their CPUs, to compare one
+	/// socket with all of them. Call before the thread pool starts: it is sized from CpuCount.
+	/// </summary>
+	/// <returns>false if the affinity cannot be set or nodeCount is out of range</returns>
+	bool UseNodes(int nodeCount);
+
+	/// <summary>
+	/// Prefer the given node (an index, not the system's number) for the pages of
+	/// [pData, pData + bytes) that are not yet touched. The range is widened to whole pages, so a
+	/// page shared with the next range goes to whichever is bound last.
+	/// </summary>
+	/// <returns>false where memory cannot be bound</returns>
+	bool BindMemory(void* pData, size_t bytes, int node) const;
+
+	/// <summary>
+	/// One line per node: its CPUs and free memory
+	/// </summary>
+	void Report(std::ostream& stream) const;
+
+private:
+	NumaTopology();
+	NumaTopology(const NumaTopology&);
+	NumaTopology& operator=(const NumaTopology&);
+
+	std::vector<NumaNode>       m_nodes;
+	const char*                 m_pSource;
+};
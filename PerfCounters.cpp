@@ -0,0 +1,229 @@
+
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+const char* PerfEventName(PerfEvent event)
+{
+	static const char* const names[PerfEventCount] = { "cache-references", "cache-misses", "dTLB-loads", "dTLB-load-misses", "page-faults" };
+	return (event >= 0 && event < PerfEventCount) ? names[event] : "unknown";
+}
+
+
+PerfCounts::PerfCounts()
+{
+	for (int i = 0; i < PerfEventCount; ++i)
+	{
+		value[i] = -1;
+	}
+}
+
+
+double PerfCounts::Rate(PerfEvent misses, PerfEvent accesses) const
+{
+	if (value[misses] < 0 || value[accesses] <= 0)
+	{
+		return -1.0;
+	}
+	return (double)value[misses] / (double)value[accesses];
+}
+
+
+PerfCounters::PerfCounters()
+{
+}
+
+
+PerfCounters::~PerfCounters()
+{
+	Close();
+}
+
+
+bool PerfCounters::Available(PerfEvent event) const
+{
+	return !m_files[event].empty();
+}
+
+
+#ifdef __linux__
+
+/// <summary>
+/// Type and config of an event for perf_event_open
+/// </summary>
+static void EventAttributes(PerfEvent event, perf_event_attr& attributes)
+{
+	const unsigned long long dtlbRead = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8);
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	switch (event)
+	{
+	case PerfCacheReferences:
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = PERF_COUNT_HW_CACHE_REFERENCES;
+		break;
+	case PerfCacheMisses:
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case PerfDtlbLoads:
+		attributes.type = PERF_TYPE_HW_CACHE;
+		attributes.config = dtlbRead | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+		break;
+	case PerfDtlbLoadMisses:
+		attributes.type = PERF_TYPE_HW_CACHE;
+		attributes.config = dtlbRead | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	default:
+		attributes.type = PERF_TYPE_SOFTWARE;
+		attributes.config = PERF_COUNT_SW_PAGE_FAULTS;
+		break;
+	}
+	attributes.disabled = 1;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+}
+
+
+bool PerfCounters::Open()
+{
+	Close();
+
+	std::vector<int> threads;
+	DIR* tasks = opendir("/proc/self/task");
+	if (nullptr == tasks)
+	{
+		return false;
+	}
+	while (dirent* entry = readdir(tasks))
+	{
+		if ('.' != entry->d_name[0])
+		{
+			threads.push_back(atoi(entry->d_name));
+		}
+	}
+	closedir(tasks);
+
+	bool any = false;
+	for (int e = 0; e < PerfEventCount; ++e)
+	{
+		perf_event_attr attributes;
+		EventAttributes((PerfEvent)e, attributes);
+		for (size_t t = 0; t < threads.size(); ++t)
+		{
+			int file = (int)syscall(__NR_perf_event_open, &attributes, threads[t], -1, -1, 0);
+			if (file < 0)
+			{
+				// an event is counted on every thread or not at all
+				for (size_t i = 0; i < m_files[e].size(); ++i)
+				{
+					close(m_files[e][i]);
+				}
+				m_files[e].clear();
+				break;
+			}
+			m_files[e].push_back(file);
+		}
+		any |= !m_files[e].empty();
+	}
+	return any;
+}
+
+
+void PerfCounters::Close()
+{
+	for (int e = 0; e < PerfEventCount; ++e)
+	{
+		for (size_t i = 0; i < m_files[e].size(); ++i)
+		{
+			close(m_files[e][i]);
+		}
+		m_files[e].clear();
+	}
+}
+
+
+void PerfCounters::ControlAll(unsigned long request)
+{
+	for (int e = 0; e < PerfEventCount; ++e)
+	{
+		for (size_t i = 0; i < m_files[e].size(); ++i)
+		{
+			ioctl(m_files[e][i], request, 0);
+		}
+	}
+}
+
+
+void PerfCounters::Start()
+{
+	ControlAll(PERF_EVENT_IOC_ENABLE);
+}
+
+
+void PerfCounters::Stop()
+{
+	ControlAll(PERF_EVENT_IOC_DISABLE);
+}
+
+
+void PerfCounters::Reset()
+{
+	ControlAll(PERF_EVENT_IOC_RESET);
+}
+
+
+PerfCounts PerfCounters::Read() const
+{
+	PerfCounts counts;
+	for (int e = 0; e < PerfEventCount; ++e)
+	{
+		if (m_files[e].empty())
+		{
+			continue;
+		}
+		double total = 0.0;
+		for (size_t i = 0; i < m_files[e].size(); ++i)
+		{
+			// value, time enabled, time running
+			unsigned long long data[3] = { 0, 0, 0 };
+			if ((ssize_t)sizeof(data) != read(m_files[e][i], data, sizeof(data)))
+			{
+				continue;
+			}
+			total += (data[2] > 0 && data[2] < data[1]) ? (double)data[0] * data[1] / data[2] : (double)data[0];
+		}
+		counts.value[e] = (long long)total;
+	}
+	return counts;
+}
+
+#else
+
+bool PerfCounters::Open()
+{
+	return false;
+}
+
+void PerfCounters::Close() {}
+void PerfCounters::ControlAll(unsigned long) {}
+void PerfCounters::Start() {}
+void PerfCounters::Stop() {}
+void PerfCounters::Reset() {}
+
+PerfCounts PerfCounters::Read() const
+{
+	return PerfCounts();
+}
+
+#endif
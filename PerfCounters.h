@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+/// <summary>
+/// Events PerfCounters counts, in user space only
+/// </summary>
+enum PerfEvent
+{
+	PerfCacheReferences = 0,	// last level cache accesses
+	PerfCacheMisses = 1,		// last level cache misses
+	PerfDtlbLoads = 2,			// loads looked up in the data TLB
+	PerfDtlbLoadMisses = 3,		// of which missed it
+	PerfPageFaults = 4,			// a software event, counted even without a PMU
+	PerfEventCount = 5
+};
+
+const char* PerfEventName(PerfEvent event);
+
+/// <summary>
+/// Counts of every event; -1 for the events that could not be counted
+/// </summary>
+struct PerfCounts
+{
+	long long                   value[PerfEventCount];
+
+	PerfCounts();
+
+	/// <summary>
+	/// misses / accesses, or -1 when either is missing
+	/// </summary>
+	double Rate(PerfEvent misses, PerfEvent accesses) const;
+};
+
+/// <summary>
+/// Hardware event counts of the whole process, on the Linux perf_event interface, to measure
+/// what a memory layout does to the caches and the TLB. The counters are opened on every thread
+/// that exists at Open, so open them once the thread pool has started. Counting needs
+/// perf_event_paranoid at 2 or below and a PMU the kernel exposes, which many virtual machines
+/// lack; the events that cannot be opened read -1. Elsewhere than on Linux nothing is counted.
+/// </summary>
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+
+	/// <returns>true if at least one event can be counted</returns>
+	bool Open();
+	void Close();
+
+	bool Available(PerfEvent event) const;
+
+	/// <summary>
+	/// Count from now on, adding to the counts so far
+	/// </summary>
+	void Start();
+	void Stop();
+
+	/// <summary>
+	/// Zero the counts
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Counts summed over the threads, scaled up where the kernel had to multiplex the counters
+	/// </summary>
+	PerfCounts Read() const;
+
+private:
+	PerfCounters(const PerfCounters&);
+	PerfCounters& operator=(const PerfCounters&);
+
+	void ControlAll(unsigned long request);
+
+	std::vector<int>            m_files[PerfEventCount];	// one per thread
+};
@@ -0,0 +1,28 @@
+
+#include "PixelConvert.h"
+#include "SimdKernels.h"
+
+#include <stddef.h>
+
+
+void ConvertBGRXToRGBAScalar(const unsigned char* pSrc, int srcStride, unsigned char* pDst, int width, int height, bool flipVertical)
+{
+	const int dstStride = width * 4;
+	for (int y = 0; y < height; ++y)
+	{
+		int dstRow = flipVertical ? (height - 1 - y) : y;
+		BgrxToRgbaRowScalar(pSrc + (size_t)y * srcStride, pDst + (size_t)dstRow * dstStride, 0, width);
+	}
+}
+
+
+void ConvertBGRXToRGBA(const unsigned char* pSrc, int srcStride, unsigned char* pDst, int width, int height, bool flipVertical)
+{
+	const int dstStride = width * 4;
+	const SimdKernels& simd = ActiveSimdKernels();
+	for (int y = 0; y < height; ++y)
+	{
+		int dstRow = flipVertical ? (height - 1 - y) : y;
+		simd.bgrxToRgbaRow(pSrc + (size_t)y * srcStride, pDst + (size_t)dstRow * dstStride, width);
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+/// <summary>
+/// Convert a BGRX image (as produced by NuiFusionShadePointCloud) to the RGBA layout expected by
+/// vtkImageData, in a single pass. The top scanline of the source becomes the last row of the
+/// destination because vtkImageData stores its origin at the bottom-left corner.
+/// The alpha channel of the destination is always set to 255.
+/// </summary>
+/// <param name="pSrc">source pixels, 4 bytes per pixel in B,G,R,X order</param>
+/// <param name="srcStride">length (in bytes) of a single source scanline</param>
+/// <param name="pDst">destination pixels, width * height * 4 bytes, tightly packed</param>
+/// <param name="width">width (in pixels) of the image</param>
+/// <param name="height">height (in pixels) of the image</param>
+/// <param name="flipVertical">write source row y to destination row height - 1 - y</param>
+void ConvertBGRXToRGBA(const unsigned char* pSrc, int srcStride, unsigned char* pDst, int width, int height, bool flipVertical = true);
+
+/// <summary>
+/// Reference implementation of ConvertBGRXToRGBA, one pixel at a time.
+/// </summary>
+void ConvertBGRXToRGBAScalar(const unsigned char* pSrc, int srcStride, unsigned char* pDst, int width, int height, bool flipVertical = true);
@@ -0,0 +1,565 @@
+
+#include "PointCloudExporter.h"
+#include "SimdKernels.h"
+
+#include <chrono>
+#include <utility>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/// <summary>
+/// Voxel coordinates are packed in 21 bits each, about 10 km either way at 1 cm
+/// </summary>
+static const int cVoxelBits = 21;
+static const long long cVoxelOffset = 1LL << (cVoxelBits - 1);
+
+
+static bool MakeDirectory(const std::string& directory)
+{
+#ifdef _WIN32
+	int result = _mkdir(directory.c_str());
+#else
+	int result = mkdir(directory.c_str(), 0755);
+#endif
+	return 0 == result || EEXIST == errno;
+}
+
+/// <summary>
+/// Key of the voxel holding the point; the top bit is set so that no key is 0 (empty)
+/// </summary>
+static uint64_t VoxelKey(const float* pPoint, float inverseSize)
+{
+	uint64_t key = 1ULL << 63;
+	for (int i = 0; i < 3; ++i)
+	{
+		long long v = (long long)floorf(pPoint[i] * inverseSize) + cVoxelOffset;
+		v = (v < 0) ? 0 : ((v >= (1LL << cVoxelBits)) ? (1LL << cVoxelBits) - 1 : v);
+		key |= (uint64_t)v << (i * cVoxelBits);
+	}
+	return key;
+}
+
+/// <summary>
+/// Finalizer of splitmix64: every bit of the key reaches the partition and the slot bits
+/// </summary>
+static uint64_t HashKey(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	return key ^ (key >> 31);
+}
+
+/// <summary>
+/// Run fn(task) for every task, on the pool when there is one
+/// </summary>
+template <class TaskFn>
+static void RunTasks(ThreadPool* pPool, int taskCount, const TaskFn& fn)
+{
+	if (nullptr != pPool)
+	{
+		pPool->ParallelTasks(taskCount, fn);
+		return;
+	}
+	for (int task = 0; task < taskCount; ++task)
+	{
+		fn(task);
+	}
+}
+
+
+bool ParsePointExportSource(const std::string& name, PointExportSource& source)
+{
+	for (int s = PointExportRaycast; s <= PointExportDepth; ++s)
+	{
+		if (name == PointExportSourceName((PointExportSource)s))
+		{
+			source = (PointExportSource)s;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+bool ParsePointExportFormat(const std::string& name, PointExportFormat& format)
+{
+	for (int f = PointExportPLY; f <= PointExportPCD; ++f)
+	{
+		if (name == PointExportFormatName((PointExportFormat)f))
+		{
+			format = (PointExportFormat)f;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+const char* PointExportSourceName(PointExportSource source)
+{
+	switch (source)
+	{
+	case PointExportRaycast: return "raycast";
+	case PointExportDepth: return "depth";
+	}
+	return "unknown";
+}
+
+
+const char* PointExportFormatName(PointExportFormat format)
+{
+	switch (format)
+	{
+	case PointExportPLY: return "ply";
+	case PointExportPCD: return "pcd";
+	}
+	return "unknown";
+}
+
+
+PointCloudExportSettings::PointCloudExportSettings()
+	: frameInterval(30)
+	, source(PointExportRaycast)
+	, format(PointExportPLY)
+	, voxelSize(0.01f)
+	, threads(1)
+	, queueDepth(2)
+{
+}
+
+
+PointCloudExporter::PointCloudExporter()
+	: m_bStopping(false)
+	, m_bRunning(false)
+	, m_written(0)
+	, m_dropped(0)
+	, m_failed(0)
+	, m_pointsWritten(0)
+	, m_writeMsSum(0)
+{
+}
+
+
+PointCloudExporter::~PointCloudExporter()
+{
+	Stop();
+}
+
+
+bool PointCloudExporter::Start(const PointCloudExportSettings& settings, int width, int height)
+{
+	Stop();
+	if (!settings.Enabled() || !MakeDirectory(settings.directory))
+	{
+		return false;
+	}
+
+	m_settings = settings;
+	m_settings.threads = (settings.threads > 0) ? settings.threads : 1;
+	m_settings.queueDepth = (settings.queueDepth > 0) ? settings.queueDepth : 1;
+	m_pPool.reset((m_settings.threads > 1) ? new ThreadPool(m_settings.threads - 1) : nullptr);
+	m_partitions.assign(m_settings.threads, Partition());
+	m_free.clear();
+	m_free.resize(m_settings.queueDepth);
+	m_queue.clear();
+	m_queue.reserve(m_settings.queueDepth);
+	Reserve(width, height);
+	m_bStopping = false;
+
+	m_bRunning = true;
+	m_worker = std::thread(&PointCloudExporter::WorkerLoop, this);
+	return true;
+}
+
+
+void PointCloudExporter::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_bStopping = true;
+	}
+	m_wake.notify_all();
+	if (m_worker.joinable())
+	{
+		m_worker.join();
+	}
+	m_bRunning = false;
+	m_pPool.reset();
+}
+
+
+size_t PointCloudExporter::TableSlots(size_t points)
+{
+	// at most half full
+	size_t slots = 64;
+	while (slots < 2 * points)
+	{
+		slots *= 2;
+	}
+	return slots;
+}
+
+
+void PointCloudExporter::Reserve(int width, int height)
+{
+	const size_t pixels = (size_t)width * height;
+	const size_t floats = (PointExportDepth == m_settings.source) ? pixels : pixels * 6;
+	for (size_t j = 0; j < m_free.size(); ++j)
+	{
+		if (MemoryAccounting::Instance().Admit(MemoryExport, (long long)(floats * sizeof(float))))
+		{
+			m_free[j].data.reserve(floats);
+		}
+	}
+
+	m_points.reserve(pixels * 6);
+	m_planes.reserve((PointExportDepth == m_settings.source) ? pixels * 6 : 0);
+	if (m_settings.voxelSize > 0.0f)
+	{
+		// the hash spreads the points evenly; an eighth more covers the partitions that get more
+		const size_t share = pixels / m_partitions.size();
+		for (size_t p = 0; p < m_partitions.size(); ++p)
+		{
+			m_partitions[p].cells.reserve(TableSlots(share + ((m_partitions.size() > 1) ? share / 8 : 0)));
+		}
+	}
+}
+
+
+bool PointCloudExporter::AcquireJob(Job& job, size_t floats)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (!m_bRunning || m_bStopping || m_free.empty())
+		{
+			m_dropped++;
+			return false;
+		}
+		job.data.swap(m_free.back().data);
+		m_free.pop_back();
+	}
+
+	// the buffer keeps its capacity across uses, and only grows when the memory budget allows
+	if (job.data.capacity() < floats
+		&& !MemoryAccounting::Instance().Admit(MemoryExport, (long long)((floats - job.data.capacity()) * sizeof(float))))
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_free.push_back(std::move(job));
+		m_dropped++;
+		return false;
+	}
+	job.data.resize(floats);
+	return true;
+}
+
+
+void PointCloudExporter::QueueJob(Job& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_queue.push_back(std::move(job));
+	}
+	m_wake.notify_one();
+}
+
+
+bool PointCloudExporter::SubmitPoints(long long frame, const float* pPoints, int stride, int width, int height)
+{
+	Job job;
+	if (nullptr == pPoints || !AcquireJob(job, (size_t)width * height * 6))
+	{
+		return false;
+	}
+
+	const size_t rowBytes = (size_t)width * 6 * sizeof(float);
+	for (int y = 0; y < height; ++y)
+	{
+		memcpy(&job.data[(size_t)y * width * 6], reinterpret_cast<const char*>(pPoints) + (size_t)y * stride, rowBytes);
+	}
+	job.frame = frame;
+	job.source = PointExportRaycast;
+	job.width = width;
+	job.height = height;
+	SetIdentity(job.cameraToWorld);
+	QueueJob(job);
+	return true;
+}
+
+
+bool PointCloudExporter::SubmitDepth(long long frame, const float* pDepth, int width, int height,
+	const CameraIntrinsics& intrinsics, const Mat4& worldToCamera)
+{
+	Job job;
+	if (nullptr == pDepth || !AcquireJob(job, (size_t)width * height))
+	{
+		return false;
+	}
+
+	// a sixth of the bytes of a point cloud; the normals are computed by the writer
+	memcpy(job.data.data(), pDepth, (size_t)width * height * sizeof(float));
+	job.frame = frame;
+	job.source = PointExportDepth;
+	job.width = width;
+	job.height = height;
+	job.intrinsics = intrinsics;
+	job.cameraToWorld = InverseAffine(worldToCamera);
+	QueueJob(job);
+	return true;
+}
+
+
+void PointCloudExporter::GatherPoints(const Job& job)
+{
+	const int width = job.width;
+	const int height = job.height;
+	const size_t pixels = (size_t)width * height;
+	const float* pSource = job.data.data();
+
+	if (PointExportDepth == job.source)
+	{
+		VertexNormalRowParameters parameters;
+		parameters.invFx = 1.0f / (job.intrinsics.focalLengthX * width);
+		parameters.invFy = 1.0f / (job.intrinsics.focalLengthY * height);
+		parameters.cx = job.intrinsics.principalPointX * width - 0.5f;
+		parameters.cy = job.intrinsics.principalPointY * height - 0.5f;
+
+		// the same vertex and normal maps as tracking computes, in planes
+		const SimdKernels& simd = ActiveSimdKernels();
+		m_planes.resize(pixels * 6);
+		float* pPlanes = m_planes.data();
+		RunTasks(m_pPool.get(), m_settings.threads, [&](int task)
+		{
+			const int yEnd = (int)((long long)height * (task + 1) / m_settings.threads);
+			for (int y = (int)((long long)height * task / m_settings.threads); y < yEnd; ++y)
+			{
+				float* ppOut[6];
+				for (int i = 0; i < 6; ++i)
+				{
+					ppOut[i] = pPlanes + i * pixels + (size_t)y * width;
+				}
+				const float* pRow = pSource + (size_t)y * width;
+				simd.vertexNormalRow(parameters, pRow, (y + 1 < height) ? pRow + width : nullptr, y, width, ppOut);
+			}
+		});
+	}
+
+	m_points.resize(pixels * 6);
+	float* pOut = m_points.data();
+	size_t count = 0;
+	for (size_t i = 0; i < pixels; ++i)
+	{
+		float point[6];
+		if (PointExportDepth == job.source)
+		{
+			for (int k = 0; k < 6; ++k)
+			{
+				point[k] = m_planes[k * pixels + i];
+			}
+		}
+		else
+		{
+			memcpy(point, pSource + i * 6, sizeof(point));
+		}
+
+		// pixels without a normal have no depth, or no neighbours to take one from
+		if (0.0f == point[3] && 0.0f == point[4] && 0.0f == point[5])
+		{
+			continue;
+		}
+		float* pPoint = pOut + count * 6;
+		TransformPoint(job.cameraToWorld, point, pPoint);
+		TransformVector(job.cameraToWorld, point + 3, pPoint + 3);
+		count++;
+	}
+	m_points.resize(count * 6);
+}
+
+
+void PointCloudExporter::Downsample()
+{
+	const size_t count = m_points.size() / 6;
+	const int partitionCount = (int)m_partitions.size();
+	const float inverseSize = 1.0f / m_settings.voxelSize;
+	const float* pPoints = m_points.data();
+
+	RunTasks(m_pPool.get(), partitionCount, [&](int task)
+	{
+		// every thread hashes every point and keeps those of its partition: the hashing is cheap
+		// next to the inserts, and no two threads ever touch the same table
+		Partition& partition = m_partitions[task];
+		size_t mine = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			mine += ((HashKey(VoxelKey(pPoints + i * 6, inverseSize)) >> 32) % partitionCount == (uint64_t)task) ? 1 : 0;
+		}
+
+		const size_t slots = TableSlots(mine);
+		Cell empty;
+		memset(&empty, 0, sizeof(empty));
+		partition.cells.assign(slots, empty);
+		partition.used = 0;
+		const uint64_t mask = slots - 1;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const float* pPoint = pPoints + i * 6;
+			const uint64_t key = VoxelKey(pPoint, inverseSize);
+			const uint64_t hash = HashKey(key);
+			if ((hash >> 32) % partitionCount != (uint64_t)task)
+			{
+				continue;
+			}
+			uint64_t slot = hash & mask;
+			while (0 != partition.cells[slot].key && key != partition.cells[slot].key)
+			{
+				slot = (slot + 1) & mask;
+			}
+			Cell& cell = partition.cells[slot];
+			if (0 == cell.key)
+			{
+				cell.key = key;
+				partition.used++;
+			}
+			cell.count++;
+			for (int k = 0; k < 6; ++k)
+			{
+				cell.sum[k] += pPoint[k];
+			}
+		}
+	});
+
+	// the averages back into m_points, partition after partition; there are no more of them
+	// than there were points
+	size_t written = 0;
+	float* pOut = m_points.data();
+	for (int p = 0; p < partitionCount; ++p)
+	{
+		const Partition& partition = m_partitions[p];
+		for (size_t slot = 0; slot < partition.cells.size(); ++slot)
+		{
+			const Cell& cell = partition.cells[slot];
+			if (0 == cell.key)
+			{
+				continue;
+			}
+			float* pPoint = pOut + written * 6;
+			const float inverseCount = 1.0f / cell.count;
+			for (int k = 0; k < 3; ++k)
+			{
+				pPoint[k] = cell.sum[k] * inverseCount;
+			}
+			const float length = sqrtf(cell.sum[3] * cell.sum[3] + cell.sum[4] * cell.sum[4] + cell.sum[5] * cell.sum[5]);
+			const float inverseLength = (length > 0.0f) ? 1.0f / length : 0.0f;
+			for (int k = 3; k < 6; ++k)
+			{
+				pPoint[k] = cell.sum[k] * inverseLength;
+			}
+			written++;
+		}
+	}
+	m_points.resize(written * 6);
+}
+
+
+bool PointCloudExporter::WriteFile(long long frame, const float* pPoints, size_t count)
+{
+	const bool ply = (PointExportPLY == m_settings.format);
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/points_%06lld.%s", m_settings.directory.c_str(), frame,
+		PointExportFormatName(m_settings.format));
+	FILE* pFile = fopen(path, "wb");
+	if (nullptr == pFile)
+	{
+		return false;
+	}
+
+	// binary little endian floats, as they are in memory on the platforms we build for
+	if (ply)
+	{
+		fprintf(pFile, "ply\nformat binary_little_endian 1.0\ncomment frame %lld\nelement vertex %llu\n"
+			"property float x\nproperty float y\nproperty float z\n"
+			"property float nx\nproperty float ny\nproperty float nz\nend_header\n", frame, (unsigned long long)count);
+	}
+	else
+	{
+		fprintf(pFile, "# .PCD v0.7 - Point Cloud Data file format\nVERSION 0.7\n"
+			"FIELDS x y z normal_x normal_y normal_z\nSIZE 4 4 4 4 4 4\nTYPE F F F F F F\nCOUNT 1 1 1 1 1 1\n"
+			"WIDTH %llu\nHEIGHT 1\nVIEWPOINT 0 0 0 1 0 0 0\nPOINTS %llu\nDATA binary\n",
+			(unsigned long long)count, (unsigned long long)count);
+	}
+	bool bSuccess = fwrite(pPoints, 6 * sizeof(float), count, pFile) == count;
+	bSuccess = (0 == fclose(pFile)) && bSuccess;
+	return bSuccess;
+}
+
+
+bool PointCloudExporter::Export(const Job& job, long long& points)
+{
+	GatherPoints(job);
+	if (m_settings.voxelSize > 0.0f)
+	{
+		Downsample();
+	}
+	points = (long long)(m_points.size() / 6);
+	return WriteFile(job.frame, m_points.data(), m_points.size() / 6);
+}
+
+
+void PointCloudExporter::WorkerLoop()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wake.wait(lock, [&]() { return m_bStopping || !m_queue.empty(); });
+			if (m_queue.empty())
+			{
+				break;
+			}
+			job = std::move(m_queue.front());
+			m_queue.erase(m_queue.begin());
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		long long points = 0;
+		bool bSuccess = Export(job, points);
+		double writeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (bSuccess)
+		{
+			m_written++;
+			m_pointsWritten += points;
+			m_writeMsSum += writeMs;
+		}
+		else
+		{
+			m_failed++;
+		}
+		m_free.push_back(std::move(job));
+	}
+}
+
+
+PointCloudExportStats PointCloudExporter::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	PointCloudExportStats stats;
+	stats.written = m_written;
+	stats.dropped = m_dropped;
+	stats.failed = m_failed;
+	stats.points = m_pointsWritten;
+	stats.meanWriteMs = (m_written > 0) ? m_writeMsSum / m_written : 0;
+	return stats;
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "MemoryAccounting.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+/// <summary>
+/// What PointCloudExporter writes of a frame
+/// </summary>
+enum PointExportSource
+{
+	PointExportRaycast = 0,		// the raycast of the model, already in world space
+	PointExportDepth = 1		// the frame's depth, back-projected and placed with the tracked pose
+};
+
+/// <summary>
+/// File formats of PointCloudExporter, both binary with float x y z and normal per point
+/// </summary>
+enum PointExportFormat
+{
+	PointExportPLY = 0,
+	PointExportPCD = 1
+};
+
+/// <summary>
+/// Parse "raycast" or "depth", and "ply" or "pcd"
+/// </summary>
+/// <returns>false if the name is unknown</returns>
+bool ParsePointExportSource(const std::string& name, PointExportSource& source);
+bool ParsePointExportFormat(const std::string& name, PointExportFormat& format);
+const char* PointExportSourceName(PointExportSource source);
+const char* PointExportFormatName(PointExportFormat format);
+
+/// <summary>
+/// Settings of the point cloud export
+/// </summary>
+struct PointCloudExportSettings
+{
+	/// <summary>
+	/// Output directory, created if it does not exist (empty = no export)
+	/// </summary>
+	std::string                 directory;
+
+	/// <summary>
+	/// Export every frameInterval-th frame
+	/// </summary>
+	int                         frameInterval;
+
+	PointExportSource           source;
+	PointExportFormat           format;
+
+	/// <summary>
+	/// Edge of the downsampling voxel grid in m: the points of a voxel are written as their
+	/// average (0 = every point)
+	/// </summary>
+	float                       voxelSize;
+
+	/// <summary>
+	/// Threads that downsample a frame, the writer included; they are the exporter's own, so that
+	/// the export never takes the shared pool from the tracking thread
+	/// </summary>
+	int                         threads;
+
+	/// <summary>
+	/// Frames that may wait for the writer
+	/// </summary>
+	int                         queueDepth;
+
+	PointCloudExportSettings();
+
+	bool Enabled() const { return !directory.empty() && frameInterval > 0; }
+};
+
+/// <summary>
+/// Statistics of the point cloud export
+/// </summary>
+struct PointCloudExportStats
+{
+	long long                   written;
+
+	/// <summary>
+	/// Frames refused because the writer was still busy with earlier ones, or because a buffer
+	/// for them did not fit in the memory budget
+	/// </summary>
+	long long                   dropped;
+
+	long long                   failed;
+	long long                   points;				// written, after downsampling
+	double                      meanWriteMs;		// downsampling and writing, per file
+};
+
+/// <summary>
+/// Background writer of world space point clouds, one binary PLY or PCD file per exported frame
+/// (directory/points_NNNNNN.ply). Like ThumbnailWriter, Submit only copies the frame into a
+/// recycled buffer and returns; when every buffer is queued the frame is dropped instead of
+/// waiting. Back-projection, the transform to world space, the voxel grid and the disk I/O all
+/// run on the writer thread.
+/// The voxel grid is a hash of the voxel coordinates split into one partition per thread: each
+/// thread scans the frame for the points that hash into its partition and averages them in a
+/// table of its own, so the threads share nothing and need no atomics. Once the buffers have
+/// the frame size, which Start reserves, neither the caller nor the writer allocates.
+/// </summary>
+class PointCloudExporter
+{
+public:
+	PointCloudExporter();
+	~PointCloudExporter();
+
+	/// <summary>
+	/// Start the writer thread, with buffers for frames of the given size
+	/// </summary>
+	/// <returns>false if the directory cannot be created</returns>
+	bool Start(const PointCloudExportSettings& settings, int width, int height);
+
+	/// <summary>
+	/// Write the queued frames and stop the writer thread
+	/// </summary>
+	void Stop();
+
+	bool IsRunning() const { return m_bRunning; }
+	const PointCloudExportSettings& Settings() const { return m_settings; }
+
+	/// <summary>
+	/// True if the frame is one to export
+	/// </summary>
+	bool IsDue(long long frame) const { return m_bRunning && 0 == frame % m_settings.frameInterval; }
+
+	/// <summary>
+	/// Queue a world space point cloud (6 floats per pixel, position and normal, zero where the
+	/// raycast hit nothing)
+	/// </summary>
+	/// <param name="stride">length (in bytes) of a single row</param>
+	/// <returns>false if the frame was dropped</returns>
+	bool SubmitPoints(long long frame, const float* pPoints, int stride, int width, int height);
+
+	/// <summary>
+	/// Queue a depth image (in m, 0 = invalid) to back-project with the intrinsics and place in
+	/// the world with the inverse of worldToCamera
+	/// </summary>
+	/// <returns>false if the frame was dropped</returns>
+	bool SubmitDepth(long long frame, const float* pDepth, int width, int height, const CameraIntrinsics& intrinsics,
+		const Mat4& worldToCamera);
+
+	PointCloudExportStats GetStats();
+
+private:
+	PointCloudExporter(const PointCloudExporter&);
+	PointCloudExporter& operator=(const PointCloudExporter&);
+
+	struct Job
+	{
+		long long                   frame;
+		PointExportSource           source;
+		std::vector<float, TaggedAllocator<float, MemoryExport> > data;
+		int                         width;
+		int                         height;
+		CameraIntrinsics            intrinsics;
+		Mat4                        cameraToWorld;
+	};
+
+	/// <summary>
+	/// One voxel of a partition's table: the sums of its points' positions and normals
+	/// </summary>
+	struct Cell
+	{
+		uint64_t                    key;				// 0 = empty
+		int                         count;
+		float                       sum[6];
+	};
+
+	struct Partition
+	{
+		std::vector<Cell, TaggedAllocator<Cell, MemoryExport> > cells;
+		int                         used;
+	};
+
+	/// <summary>
+	/// Size the buffers for frames of width * height pixels, those of the queue as far as the
+	/// memory budget allows
+	/// </summary>
+	void Reserve(int width, int height);
+
+	/// <summary>
+	/// Slots of the table of a partition that receives the given number of points
+	/// </summary>
+	static size_t TableSlots(size_t points);
+
+	bool AcquireJob(Job& job, size_t floats);
+	void QueueJob(Job& job);
+	void WorkerLoop();
+	bool Export(const Job& job, long long& points);
+
+	/// <summary>
+	/// World space points of the job (6 floats each, those with a normal) into m_points
+	/// </summary>
+	void GatherPoints(const Job& job);
+
+	/// <summary>
+	/// Average m_points per voxel into m_points
+	/// </summary>
+	void Downsample();
+
+	bool WriteFile(long long frame, const float* pPoints, size_t count);
+
+	PointCloudExportSettings    m_settings;
+	std::unique_ptr<ThreadPool> m_pPool;				// the helper threads, none for a single thread
+
+	std::mutex                  m_lock;
+	std::condition_variable     m_wake;
+	std::vector<Job>            m_free;
+	std::vector<Job>            m_queue;
+	bool                        m_bStopping;
+
+	std::thread                 m_worker;
+	std::atomic<bool>           m_bRunning;
+
+	// writer thread only
+	std::vector<float, TaggedAllocator<float, MemoryExport> > m_points;
+	std::vector<float, TaggedAllocator<float, MemoryExport> > m_planes;	// vertex / normal planes of a depth job
+	std::vector<Partition>      m_partitions;
+
+	long long                   m_written;
+	long long                   m_dropped;
+	long long                   m_failed;
+	long long                   m_pointsWritten;
+	double                      m_writeMsSum;
+};
@@ -0,0 +1,126 @@
+
+#include "PointCloudShader.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+
+
+bool ParseShadingMode(const std::string& name, ShadingMode& mode)
+{
+	for (int m = ShadeLambert; m <= ShadeDepth; ++m)
+	{
+		if (name == ShadingModeName((ShadingMode)m))
+		{
+			mode = (ShadingMode)m;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+const char* ShadingModeName(ShadingMode mode)
+{
+	switch (mode)
+	{
+	case ShadeLambert: return "lambert";
+	case ShadePhong: return "phong";
+	case ShadeNormals: return "normals";
+	case ShadeDepth: return "depth";
+	}
+	return "unknown";
+}
+
+
+ShadingParameters::ShadingParameters()
+	: mode(ShadeLambert)
+	, ambient(0.2f)
+	, diffuse(0.8f)
+	, specular(0.4f)
+	, shininess(16)
+	, minDepth(0.35f)
+	, maxDepth(8.0f)
+{
+}
+
+
+ShadingTerms::ShadingTerms(const ShadingParameters& p)
+{
+	bool unlit = (ShadeNormals == p.mode);
+	mode = p.mode;
+	ambient = unlit ? 1.0f : p.ambient;
+	diffuse = unlit ? 0.0f : p.diffuse;
+	specular = (ShadePhong == p.mode) ? p.specular : 0.0f;
+	shininess = (p.shininess > 0) ? p.shininess : 1;
+	float range = p.maxDepth - p.minDepth;
+	depthScale = (range > 0) ? 1.0f / range : 0.0f;
+	depthOffset = p.minDepth;
+}
+
+
+void ShadePointCloudRowsScalar(const float* pPoints, int pointStride, int width, int rowBegin, int rowEnd,
+	const Mat4& worldToCamera, const ShadingParameters& parameters, unsigned char* pDst, int dstStride)
+{
+	ShadingTerms terms(parameters);
+	for (int y = rowBegin; y < rowEnd; ++y)
+	{
+		const float* pRow = reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(pPoints) + (size_t)y * pointStride);
+		unsigned int* pOut = reinterpret_cast<unsigned int*>(pDst + (size_t)y * dstStride);
+		ShadeRowScalar(pRow, 0, width, worldToCamera, terms, pOut);
+	}
+}
+
+
+void ShadePointCloudRows(const float* pPoints, int pointStride, int width, int rowBegin, int rowEnd,
+	const Mat4& worldToCamera, const ShadingParameters& parameters, unsigned char* pDst, int dstStride)
+{
+	const ShadingTerms terms(parameters);
+	const SimdKernels& simd = ActiveSimdKernels();
+	for (int y = rowBegin; y < rowEnd; ++y)
+	{
+		const float* pRow = reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(pPoints) + (size_t)y * pointStride);
+		unsigned int* pOut = reinterpret_cast<unsigned int*>(pDst + (size_t)y * dstStride);
+		simd.shadeRow(pRow, width, worldToCamera, terms, pOut);
+	}
+}
+
+
+PointCloudShader::PointCloudShader()
+	: m_frames(0)
+	, m_lastNsPerPixel(0)
+	, m_totalNs(0)
+	, m_totalPixels(0)
+{
+}
+
+
+void PointCloudShader::Shade(const float* pPoints, int pointStride, int width, int height, const Mat4& worldToCamera,
+	unsigned char* pDst, int dstStride)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	const ShadingParameters parameters = m_parameters;
+	ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+	{
+		ShadePointCloudRows(pPoints, pointStride, width, rowBegin, rowEnd, worldToCamera, parameters, pDst, dstStride);
+	}, 16);
+
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	long long pixels = (long long)width * height;
+	m_lastNsPerPixel = (pixels > 0) ? ns / pixels : 0;
+	m_totalNs = m_totalNs + ns;
+	m_totalPixels += pixels;
+	m_frames++;
+}
+
+
+ShadingStats PointCloudShader::GetStats() const
+{
+	ShadingStats stats;
+	stats.frames = m_frames;
+	stats.lastNsPerPixel = m_lastNsPerPixel;
+	long long pixels = m_totalPixels;
+	stats.meanNsPerPixel = (pixels > 0) ? m_totalNs / pixels : 0;
+	return stats;
+}
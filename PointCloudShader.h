@@ -0,0 +1,109 @@
+#pragma once
+
+#include "FusionMath.h"
+
+#include <atomic>
+#include <string>
+
+/// <summary>
+/// How PointCloudShader colours the surface
+/// </summary>
+enum ShadingMode
+{
+	ShadeLambert = 0,		// grey, diffuse light from the camera
+	ShadePhong = 1,			// grey, diffuse and specular light from the camera
+	ShadeNormals = 2,		// camera space normal as colour, unlit
+	ShadeDepth = 3			// colour ramp from minDepth (red) to maxDepth (blue), diffuse lit
+};
+
+/// <summary>
+/// Parse "lambert", "phong", "normals" or "depth"
+/// </summary>
+/// <returns>false if the name is unknown</returns>
+bool ParseShadingMode(const std::string& name, ShadingMode& mode);
+const char* ShadingModeName(ShadingMode mode);
+
+/// <summary>
+/// Lighting of the shaded surface. The light sits at the camera.
+/// </summary>
+struct ShadingParameters
+{
+	ShadingMode                 mode;
+	float                       ambient;
+	float                       diffuse;
+
+	/// <summary>
+	/// Phong only: weight and exponent of the specular highlight
+	/// </summary>
+	float                       specular;
+	int                         shininess;
+
+	/// <summary>
+	/// Depth mode: camera distances (in m) mapped to the ends of the colour ramp
+	/// </summary>
+	float                       minDepth;
+	float                       maxDepth;
+
+	ShadingParameters();
+};
+
+/// <summary>
+/// Timing of the shading stage
+/// </summary>
+struct ShadingStats
+{
+	long long                   frames;
+	double                      lastNsPerPixel;
+	double                      meanNsPerPixel;
+};
+
+/// <summary>
+/// Shade rows [rowBegin, rowEnd) of a raycast point cloud into a BGRX image, with the kernels of the
+/// active SimdLevel (see SimdKernels.h).
+/// </summary>
+/// <param name="pPoints">6 floats per pixel: world space position and normal, as written by
+/// INuiFusionReconstruction::CalculatePointCloud. Pixels with a zero normal are empty.</param>
+/// <param name="pointStride">length (in bytes) of a row of points</param>
+/// <param name="worldToCamera">camera pose the point cloud was raycast from</param>
+/// <param name="pDst">BGRX pixels; empty pixels are written black</param>
+/// <param name="dstStride">length (in bytes) of a destination scanline</param>
+void ShadePointCloudRows(const float* pPoints, int pointStride, int width, int rowBegin, int rowEnd,
+	const Mat4& worldToCamera, const ShadingParameters& parameters, unsigned char* pDst, int dstStride);
+
+/// <summary>
+/// Reference implementation of ShadePointCloudRows, one pixel at a time
+/// </summary>
+void ShadePointCloudRowsScalar(const float* pPoints, int pointStride, int width, int rowBegin, int rowEnd,
+	const Mat4& worldToCamera, const ShadingParameters& parameters, unsigned char* pDst, int dstStride);
+
+/// <summary>
+/// Native replacement of NuiFusionShadePointCloud: shades a point cloud split by rows
+/// across the shared ThreadPool and keeps the cost per pixel.
+/// </summary>
+class PointCloudShader
+{
+public:
+	PointCloudShader();
+
+	void SetParameters(const ShadingParameters& parameters) { m_parameters = parameters; }
+	const ShadingParameters& Parameters() const { return m_parameters; }
+
+	/// <summary>
+	/// Shade a whole point cloud of width x height pixels (see ShadePointCloudRows)
+	/// </summary>
+	void Shade(const float* pPoints, int pointStride, int width, int height, const Mat4& worldToCamera,
+		unsigned char* pDst, int dstStride);
+
+	/// <summary>
+	/// Safe to call from any thread
+	/// </summary>
+	ShadingStats GetStats() const;
+
+private:
+	ShadingParameters           m_parameters;
+
+	std::atomic<long long>      m_frames;
+	std::atomic<double>         m_lastNsPerPixel;
+	std::atomic<double>         m_totalNs;
+	std::atomic<long long>      m_totalPixels;
+};
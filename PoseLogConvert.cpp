@@ -0,0 +1,87 @@
+// Converts a binary pose log (see PoseLogWriter) to a text trajectory for the evaluation tools:
+// the TUM RGB-D format ("timestamp tx ty tz qx qy qz qw", for evaluate_ate and evaluate_rpe) or
+// the KITTI odometry format (a 3x4 camera-to-world matrix per line, the timestamps going to
+// out.times.txt). The poses of lost frames are left out unless --keep-lost. Needs neither the
+// Kinect SDK nor VTK.
+//
+//   PoseLogConvert log.bin out.txt [--format=tum|kitti] [--keep-lost]
+//
+// Exit status: 0 on success, 1 on bad input or when a file cannot be read or written.
+
+#include "Trajectory.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+
+int main(int argc, char* argv[])
+{
+	std::string inputPath, outputPath, format("tum");
+	bool keepLost = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument(argv[i]);
+		if (argument.compare(0, 9, "--format=") == 0) format = argument.substr(9);
+		else if (argument == "--keep-lost") keepLost = true;
+		else if (argument.compare(0, 2, "--") != 0 && inputPath.empty()) inputPath = argument;
+		else if (argument.compare(0, 2, "--") != 0 && outputPath.empty()) outputPath = argument;
+		else
+		{
+			std::cerr << "Unknown or invalid option " << argument << std::endl;
+			return 1;
+		}
+	}
+	if (inputPath.empty() || outputPath.empty() || (format != "tum" && format != "kitti"))
+	{
+		std::cerr << "Usage: PoseLogConvert log.bin out.txt [--format=tum|kitti] [--keep-lost]" << std::endl;
+		return 1;
+	}
+
+	std::vector<PoseLogRecord> records;
+	if (!ReadPoseLog(inputPath.c_str(), records))
+	{
+		std::cerr << "Cannot read the pose log " << inputPath << std::endl;
+		return 1;
+	}
+
+	int tracked = 0, resets = 0, lost = 0;
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		tracked += (PoseTracked == records[i].status) ? 1 : 0;
+		resets += (PoseReset == records[i].status) ? 1 : 0;
+		lost += (PoseLost == records[i].status) ? 1 : 0;
+	}
+
+	std::vector<StampedPose> poses;
+	ToStampedPoses(records, keepLost, poses);
+	bool ok;
+	if (format == "tum")
+	{
+		ok = WriteTumTrajectory(outputPath.c_str(), poses);
+	}
+	else
+	{
+		ok = WriteKittiTrajectory(outputPath.c_str(), poses);
+
+		// KITTI keeps the timestamps in a file of their own
+		std::string timesPath = outputPath.substr(0, outputPath.rfind('.')) + ".times.txt";
+		FILE* pTimes = fopen(timesPath.c_str(), "w");
+		ok = ok && nullptr != pTimes;
+		for (size_t i = 0; ok && i < poses.size(); ++i)
+		{
+			fprintf(pTimes, "%.6f\n", poses[i].timestamp);
+		}
+		ok = (nullptr != pTimes) && (0 == fclose(pTimes)) && ok;
+	}
+	if (!ok)
+	{
+		std::cerr << "Cannot write " << outputPath << std::endl;
+		return 1;
+	}
+
+	std::cout << records.size() << " frames (" << tracked << " tracked, " << resets << " resets, " << lost << " lost), "
+		<< poses.size() << " poses written to " << outputPath << std::endl;
+	return 0;
+}
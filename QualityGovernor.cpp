@@ -0,0 +1,191 @@
+
+#include "QualityGovernor.h"
+#include "Telemetry.h"
+
+#include <stdio.h>
+
+
+static const CounterId s_counterStepsDown = Telemetry::Instance().RegisterCounter("quality-steps-down");
+static const CounterId s_counterStepsUp = Telemetry::Instance().RegisterCounter("quality-steps-up");
+static const CounterId s_counterLevel = Telemetry::Instance().RegisterCounter("quality-level");
+
+
+const char* QualityLeverName(QualityLever lever)
+{
+	switch (lever)
+	{
+	case QualityTracking: return "tracking";
+	case QualityRaycast: return "raycast";
+	case QualityIntegration: return "integration";
+	case QualityDisplay: return "display";
+	default: return "unknown";
+	}
+}
+
+
+QualityLevel::QualityLevel()
+	: iterationScale(1.0f)
+	, skippedTrackingLevels(0)
+	, raycastStep(1)
+	, integrationInterval(1)
+	, displayInterval(1)
+{
+}
+
+
+QualityGovernorSettings::QualityGovernorSettings()
+	: enabled(true)
+	, frameBudgetMs(33.3)
+	, raiseFraction(0.7)
+	, windowFrames(15)
+	, raiseWindows(4)
+	, raycastLever(true)
+{
+}
+
+
+QualityGovernor::QualityGovernor()
+{
+	Reset();
+}
+
+
+void QualityGovernor::Initialize(const QualityGovernorSettings& settings)
+{
+	m_settings = settings;
+	Reset();
+}
+
+
+void QualityGovernor::Reset()
+{
+	for (int i = 0; i < QualityLeverCount; ++i)
+	{
+		m_steps[i] = 0;
+		m_windowLeverMs[i] = 0;
+	}
+	m_lowered = 0;
+	m_windowFrameMs = 0;
+	m_windowCount = 0;
+	m_windowsUnder = 0;
+	m_saturatedLogged = false;
+	ApplySteps();
+}
+
+
+int QualityGovernor::MaxStep(QualityLever lever) const
+{
+	if (QualityRaycast == lever)
+	{
+		return m_settings.raycastLever ? 1 : 0;
+	}
+	return cMaxSteps;
+}
+
+
+void QualityGovernor::ApplySteps()
+{
+	static const int s_integrationIntervals[cMaxSteps + 1] = { 1, 2, 3 };
+	static const int s_displayIntervals[cMaxSteps + 1] = { 1, 2, 4 };
+
+	m_level.iterationScale = (m_steps[QualityTracking] > 0) ? 0.5f : 1.0f;
+	m_level.skippedTrackingLevels = (m_steps[QualityTracking] > 1) ? 1 : 0;
+	m_level.raycastStep = 1 + m_steps[QualityRaycast];
+	m_level.integrationInterval = s_integrationIntervals[m_steps[QualityIntegration]];
+	m_level.displayInterval = s_displayIntervals[m_steps[QualityDisplay]];
+	Telemetry::Instance().Set(s_counterLevel, m_lowered);
+}
+
+
+void QualityGovernor::LogDecision(const char* direction, QualityLever lever, int step, double frameMs, double leverMs)
+{
+	char text[sizeof(TelemetryEvent::text)];
+	snprintf(text, sizeof(text), "quality %s: %s step %d/%d, frame %.1f ms for a %.1f ms budget, %s %.1f ms",
+		direction, QualityLeverName(lever), step, MaxStep(lever), frameMs, m_settings.frameBudgetMs,
+		QualityLeverName(lever), leverMs);
+	Telemetry::Instance().LogEvent(text);
+}
+
+
+bool QualityGovernor::Update(const QualitySample& sample)
+{
+	if (!m_settings.enabled)
+	{
+		return false;
+	}
+
+	m_windowFrameMs += sample.frameMs;
+	for (int i = 0; i < QualityLeverCount; ++i)
+	{
+		m_windowLeverMs[i] += sample.leverMs[i];
+	}
+	if (++m_windowCount < m_settings.windowFrames)
+	{
+		return false;
+	}
+
+	const double frameMs = m_windowFrameMs / m_windowCount;
+	double leverMs[QualityLeverCount];
+	for (int i = 0; i < QualityLeverCount; ++i)
+	{
+		leverMs[i] = m_windowLeverMs[i] / m_windowCount;
+		m_windowLeverMs[i] = 0;
+	}
+	m_windowFrameMs = 0;
+	m_windowCount = 0;
+
+	bool changed = false;
+	if (frameMs > m_settings.frameBudgetMs)
+	{
+		// over budget: lower the lever whose stages cost the most, if any is left
+		m_windowsUnder = 0;
+		int costliest = -1;
+		for (int i = 0; i < QualityLeverCount; ++i)
+		{
+			if (m_steps[i] < MaxStep((QualityLever)i) && (costliest < 0 || leverMs[i] > leverMs[costliest]))
+			{
+				costliest = i;
+			}
+		}
+
+		if (costliest >= 0)
+		{
+			QualityLever lever = (QualityLever)costliest;
+			m_steps[lever]++;
+			m_lowerings[m_lowered] = lever;
+			m_loweringCostMs[m_lowered++] = leverMs[lever];
+			ApplySteps();
+			Telemetry::Instance().Add(s_counterStepsDown);
+			LogDecision("down", lever, m_steps[lever], frameMs, leverMs[lever]);
+			changed = true;
+		}
+		else if (!m_saturatedLogged)
+		{
+			char text[sizeof(TelemetryEvent::text)];
+			snprintf(text, sizeof(text), "quality at minimum: frame %.1f ms for a %.1f ms budget", frameMs, m_settings.frameBudgetMs);
+			Telemetry::Instance().LogEvent(text);
+			m_saturatedLogged = true;
+		}
+	}
+	else if (m_lowered > 0 && frameMs < m_settings.frameBudgetMs * m_settings.raiseFraction
+		&& frameMs - leverMs[m_lowerings[m_lowered - 1]] + m_loweringCostMs[m_lowered - 1] <= m_settings.frameBudgetMs)
+	{
+		// well under budget for long enough: raise the lever lowered last
+		if (++m_windowsUnder >= m_settings.raiseWindows)
+		{
+			m_windowsUnder = 0;
+			QualityLever lever = m_lowerings[--m_lowered];
+			m_steps[lever]--;
+			ApplySteps();
+			Telemetry::Instance().Add(s_counterStepsUp);
+			LogDecision("up", lever, m_steps[lever], frameMs, leverMs[lever]);
+			m_saturatedLogged = false;
+			changed = true;
+		}
+	}
+	else
+	{
+		m_windowsUnder = 0;
+	}
+	return changed;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+/// <summary>
+/// What the quality governor can trade for time, each in a few steps
+/// </summary>
+enum QualityLever
+{
+	QualityTracking,			// ICP iterations halved, then the finest pyramid level skipped
+	QualityRaycast,				// the model raycast at half resolution
+	QualityIntegration,			// integrate every second, then every third frame at most
+	QualityDisplay,				// shade and present every second, then every fourth frame
+	QualityLeverCount
+};
+
+const char* QualityLeverName(QualityLever lever);
+
+/// <summary>
+/// Settings the pipeline runs with at the current steps of the levers
+/// </summary>
+struct QualityLevel
+{
+	float                       iterationScale;			// of the ICP iterations of every level
+	int                         skippedTrackingLevels;	// finest pyramid levels not tracked on
+	int                         raycastStep;			// 1 = full resolution, 2 = half
+	int                         integrationInterval;	// integrate at most every n-th frame
+	int                         displayInterval;		// shade and present every n-th frame
+
+	/// <summary>
+	/// Full quality
+	/// </summary>
+	QualityLevel();
+};
+
+struct QualityGovernorSettings
+{
+	/// <summary>
+	/// false keeps full quality whatever the frame time
+	/// </summary>
+	bool                        enabled;
+
+	/// <summary>
+	/// Frame time to stay within, in ms; 33 ms keeps up with the 30 Hz sensor
+	/// </summary>
+	double                      frameBudgetMs;
+
+	/// <summary>
+	/// Quality goes back up only once frames take less than this fraction of the budget, and the
+	/// lever costing again what it cost before it was lowered would still fit in the budget, so
+	/// that a step up does not immediately push the frame time back over it
+	/// </summary>
+	double                      raiseFraction;
+
+	/// <summary>
+	/// Frames averaged per decision, and windows in a row under raiseFraction before a step up
+	/// </summary>
+	int                         windowFrames;
+	int                         raiseWindows;
+
+	/// <summary>
+	/// false where the raycast cannot run at a lower resolution (the Kinect Fusion SDK's): the
+	/// raycast lever is then never lowered
+	/// </summary>
+	bool                        raycastLever;
+
+	QualityGovernorSettings();
+};
+
+/// <summary>
+/// Timings of one frame, in ms: the whole frame and the stages each lever acts on
+/// </summary>
+struct QualitySample
+{
+	double                      frameMs;
+	double                      leverMs[QualityLeverCount];
+};
+
+/// <summary>
+/// Keeps the frame time within a budget by stepping quality levers down and up, so that slow
+/// hardware degrades gracefully instead of falling behind the sensor. Frame times are averaged over
+/// a window; a window over the budget steps down the lever whose stages took the most time, and
+/// several windows in a row well under the budget step the last lowered lever back up. Every
+/// decision is logged to telemetry, along with the "quality-steps-down", "quality-steps-up" and
+/// "quality-level" (steps below full quality) counters. Update does not allocate.
+/// </summary>
+class QualityGovernor
+{
+public:
+	static const int            cMaxSteps = 2;
+
+	QualityGovernor();
+
+	void Initialize(const QualityGovernorSettings& settings);
+	const QualityGovernorSettings& Settings() const { return m_settings; }
+
+	/// <summary>
+	/// Back to full quality, e.g. when the budget changes
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Account one frame
+	/// </summary>
+	/// <returns>true when the quality level changed</returns>
+	bool Update(const QualitySample& sample);
+
+	const QualityLevel& Level() const { return m_level; }
+	int Step(QualityLever lever) const { return m_steps[lever]; }
+
+	/// <summary>
+	/// Steps below full quality, over all levers
+	/// </summary>
+	int StepsDown() const { return m_lowered; }
+
+	/// <summary>
+	/// Steps the lever can go down with these settings; 0 when it is not available
+	/// </summary>
+	int MaxStep(QualityLever lever) const;
+
+private:
+	void ApplySteps();
+	void LogDecision(const char* direction, QualityLever lever, int step, double frameMs, double leverMs);
+
+	QualityGovernorSettings     m_settings;
+	QualityLevel                m_level;
+	int                         m_steps[QualityLeverCount];
+
+	/// <summary>
+	/// Levers in the order they were lowered, so they are raised back in reverse
+	/// </summary>
+	QualityLever                m_lowerings[QualityLeverCount * cMaxSteps];
+	double                      m_loweringCostMs[QualityLeverCount * cMaxSteps];	// of the lever, before
+	int                         m_lowered;
+
+	double                      m_windowFrameMs;
+	double                      m_windowLeverMs[QualityLeverCount];
+	int                         m_windowCount;
+	int                         m_windowsUnder;
+	bool                        m_saturatedLogged;
+};
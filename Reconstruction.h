@@ -0,0 +1,120 @@
+#pragma once
+
+#include "FusionPipeline.h"
+#include "PointCloudExporter.h"
+#include "PointCloudShader.h"
+#include "QualityGovernor.h"
+#include "VolumeSizing.h"
+
+#include <string>
+#include <vector>
+
+/// <summary>
+/// What one depth frame did to the reconstruction
+/// </summary>
+struct ReconstructionFrame
+{
+	bool                        tracked;
+	bool                        integrated;
+
+	/// <summary>
+	/// Alignment residual of the frame, -1 when it was not measured
+	/// </summary>
+	float                       residual;
+
+	/// <summary>
+	/// Time spent tracking, integrating and raycasting for the next frame, in ms, for the quality
+	/// governor; 0 for a step that did not run or is not timed apart
+	/// </summary>
+	double                      trackingMs;
+	double                      integrationMs;
+	double                      raycastMs;
+};
+
+/// <summary>
+/// The volume the viewer fuses depth frames into: the Kinect Fusion SDK one (KinectReconstruction,
+/// Windows only) or the native pipeline (NativeReconstruction), so that the viewer runs on the
+/// sources without a sensor on any platform. Not thread safe: the viewer serializes the calls.
+/// </summary>
+class Reconstruction
+{
+public:
+	virtual ~Reconstruction() {}
+
+	virtual const char* Name() const = 0;
+
+	/// <summary>
+	/// How the volume size translates into memory, for sizing it to a budget
+	/// </summary>
+	virtual VolumeBackend Backend() const = 0;
+
+	/// <summary>
+	/// Whether SetQuality lowers the raycast resolution, the raycast lever of the quality governor
+	/// </summary>
+	virtual bool ScalesRaycast() const = 0;
+
+	/// <summary>
+	/// Create the volume and every per-frame image for depth frames of the given size. The volume
+	/// may come out smaller than asked for when the device cannot hold it, see Volume().
+	/// Automatic resets after lost frames are left to the caller.
+	/// </summary>
+	/// <returns>false on failure, with the reason in Error()</returns>
+	virtual bool Initialize(const FusionPipelineParameters& parameters, int width, int height) = 0;
+
+	/// <summary>
+	/// Clear the volume and put the camera back at the world origin
+	/// </summary>
+	virtual bool Reset() = 0;
+
+	/// <summary>
+	/// Track a depth frame and integrate it when the integration policy says so. A frame that
+	/// could not be tracked is not a failure.
+	/// </summary>
+	/// <param name="pDepthMm">width * height depths in mm, 0 = no reading</param>
+	/// <returns>false on failure, with the reason in Error()</returns>
+	virtual bool ProcessFrame(const unsigned short* pDepthMm, ReconstructionFrame& frame) = 0;
+
+	/// <summary>
+	/// Run the following frames at a quality level of the quality governor; the display
+	/// interval is for the caller to apply
+	/// </summary>
+	virtual void SetQuality(const QualityLevel& quality) = 0;
+
+	/// <summary>
+	/// Raycast the volume from the current pose, for Shade and ExportPoints
+	/// </summary>
+	virtual bool CalculatePointCloud() = 0;
+
+	/// <summary>
+	/// Shade the last point cloud into a BGRX image of the frame size
+	/// </summary>
+	virtual bool Shade(PointCloudShader& shader, unsigned char* pDst, int dstStride) = 0;
+
+	/// <summary>
+	/// Queue the world space points of the last frame for export: its depth, placed with its pose,
+	/// or the last point cloud
+	/// </summary>
+	virtual void ExportPoints(PointCloudExporter& exporter, long long frame, PointExportSource source) = 0;
+
+	/// <summary>
+	/// Read a box of TSDF samples for the live mesh preview (see TsdfBlockExporter)
+	/// </summary>
+	virtual bool ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+		std::vector<short>& samples) = 0;
+
+	/// <summary>
+	/// Mesh the volume and write it as a .stl or .obj file, chosen by extension
+	/// </summary>
+	/// <returns>false on failure, with the reason in Error()</returns>
+	virtual bool SaveMesh(const std::string& path) = 0;
+
+	virtual Mat4 WorldToCamera() const = 0;
+	virtual Mat4 VolumeToWorld() const = 0;
+	virtual CameraIntrinsics Intrinsics() const = 0;
+	virtual VolumeParameters Volume() const = 0;
+
+	const std::string& Error() const { return m_error; }
+
+protected:
+	std::string                 m_error;
+};
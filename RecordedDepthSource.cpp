@@ -0,0 +1,119 @@
+#include "RecordedDepthSource.h"
+#include "DepthImageIO.h"
+
+#include <fstream>
+#include <sstream>
+
+
+bool ReadDepthList(const std::string& directory, std::vector<DepthFrameEntry>& frames)
+{
+	std::ifstream file((directory + "/depth.txt").c_str());
+	if (!file)
+	{
+		return false;
+	}
+
+	frames.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+		std::istringstream fields(line);
+		DepthFrameEntry entry;
+		std::string name;
+		if (!(fields >> entry.timestamp >> name))
+		{
+			return false;
+		}
+		entry.path = directory + "/" + name;
+		frames.push_back(entry);
+	}
+	return !frames.empty();
+}
+
+
+RecordedDepthSource::RecordedDepthSource(const std::string& directory, const DepthSourceSettings& settings)
+	: m_directory(directory)
+	, m_settings(settings)
+	, m_width(0)
+	, m_height(0)
+	, m_next(0)
+	, m_pTruth(nullptr)
+{
+}
+
+
+bool RecordedDepthSource::Open()
+{
+	if (!ReadDepthList(m_directory, m_frames))
+	{
+		m_error = "cannot read " + m_directory + "/depth.txt";
+		return false;
+	}
+
+	// the ground truth is optional, but a file that is there must be readable
+	std::ifstream groundTruth((m_directory + "/groundtruth.txt").c_str());
+	m_groundTruth.clear();
+	if (groundTruth && !ReadTumTrajectory((m_directory + "/groundtruth.txt").c_str(), m_groundTruth))
+	{
+		m_error = "cannot read " + m_directory + "/groundtruth.txt";
+		return false;
+	}
+
+	if (!ReadDepthPgm(m_frames[0].path.c_str(), m_depthMm, m_width, m_height))
+	{
+		m_error = "cannot read the depth frame " + m_frames[0].path;
+		return false;
+	}
+	m_next = 0;
+	m_pTruth = nullptr;
+	m_pacer.Start(m_settings.frameRateHz);
+	return true;
+}
+
+
+DepthFrameStatus RecordedDepthSource::NextFrame(DepthFrame& frame, int timeoutMs)
+{
+	if (m_next >= m_frames.size())
+	{
+		if (!m_settings.loop || m_frames.empty())
+		{
+			return DepthFrameEnd;
+		}
+		m_next = 0;
+	}
+	if (!m_pacer.Wait(timeoutMs))
+	{
+		return DepthFrameTimeout;
+	}
+
+	const DepthFrameEntry& entry = m_frames[m_next];
+	int width = 0, height = 0;
+	if (!ReadDepthPgm(entry.path.c_str(), m_depthMm, width, height) || width != m_width || height != m_height)
+	{
+		m_error = "cannot read the depth frame " + entry.path + ", or it is not of the size of the first";
+		return DepthFrameError;
+	}
+	m_pTruth = FindNearestPose(m_groundTruth, entry.timestamp, 0.02);
+
+	frame.pDepthMm = m_depthMm.data();
+	frame.width = m_width;
+	frame.height = m_height;
+	frame.timestamp = entry.timestamp - m_frames[0].timestamp;
+	frame.index = (long long)m_next++;
+	return DepthFrameReady;
+}
+
+
+bool RecordedDepthSource::GroundTruth(Mat4& worldToCamera) const
+{
+	if (nullptr == m_pTruth)
+	{
+		return false;
+	}
+	worldToCamera = m_pTruth->worldToCamera;
+	return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "DepthSource.h"
+#include "Trajectory.h"
+
+#include <string>
+#include <vector>
+
+struct DepthFrameEntry
+{
+	double                      timestamp;			// s
+	std::string                 path;
+};
+
+/// <summary>
+/// Read depth.txt of a recorded sequence: "timestamp file" per line, files relative to the directory
+/// </summary>
+bool ReadDepthList(const std::string& directory, std::vector<DepthFrameEntry>& frames);
+
+/// <summary>
+/// A sequence recorded in the layout of the TUM RGB-D benchmark: depth.txt lists "timestamp file"
+/// per frame, the files being 16 bit PGM depth images in mm (see DepthImageIO), and the optional
+/// groundtruth.txt holds the camera trajectory (see ReadTumTrajectory), matched to the frames
+/// within 20 ms. Frame timestamps count from the first frame.
+/// </summary>
+class RecordedDepthSource : public DepthSource
+{
+public:
+	RecordedDepthSource(const std::string& directory, const DepthSourceSettings& settings);
+
+	const char* Name() const { return m_directory.c_str(); }
+	bool Open();
+	int Width() const { return m_width; }
+	int Height() const { return m_height; }
+	DepthFrameStatus NextFrame(DepthFrame& frame, int timeoutMs);
+	bool GroundTruth(Mat4& worldToCamera) const;
+
+	size_t FrameCount() const { return m_frames.size(); }
+
+private:
+	std::string                 m_directory;
+	DepthSourceSettings         m_settings;
+	std::vector<DepthFrameEntry> m_frames;
+	std::vector<StampedPose>    m_groundTruth;
+	std::vector<unsigned short> m_depthMm;
+	int                         m_width;
+	int                         m_height;
+	size_t                      m_next;
+	const StampedPose*          m_pTruth;			// of the last frame, nullptr if none matched
+	FramePacer                  m_pacer;
+};
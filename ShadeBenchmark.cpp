@@ -0,0 +1,137 @@
+
+// Microbenchmark for PointCloudShader: shade a synthetic 640x480 raycast of a sphere in
+// every mode and check the SIMD kernel against the scalar reference. Needs neither the
+// Kinect SDK nor VTK.
+
+#include "PointCloudShader.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <math.h>
+
+
+static const int cWidth = 640;
+static const int cHeight = 480;
+
+
+/// <summary>
+/// Point cloud of a sphere of radius 0.5 m, 1.5 m in front of the camera; the corners miss it
+/// </summary>
+static void MakeSphereCloud(std::vector<float>& cloud)
+{
+	const CameraIntrinsics intrinsics = KinectDepthIntrinsics();
+	const float center[3] = { 0.0f, 0.0f, 1.5f };
+	const float radius = 0.5f;
+
+	cloud.assign((size_t)cWidth * cHeight * 6, 0.0f);
+	for (int y = 0; y < cHeight; ++y)
+	{
+		for (int x = 0; x < cWidth; ++x)
+		{
+			float dx = ((x + 0.5f) / cWidth - intrinsics.principalPointX) / intrinsics.focalLengthX;
+			float dy = ((y + 0.5f) / cHeight - intrinsics.principalPointY) / intrinsics.focalLengthY;
+			float length = sqrtf(dx * dx + dy * dy + 1.0f);
+			float d[3] = { dx / length, dy / length, 1.0f / length };
+
+			// |t d - c| = r
+			float b = d[0] * center[0] + d[1] * center[1] + d[2] * center[2];
+			float c = center[0] * center[0] + center[1] * center[1] + center[2] * center[2] - radius * radius;
+			float discriminant = b * b - c;
+			if (discriminant < 0)
+			{
+				continue;
+			}
+			float t = b - sqrtf(discriminant);
+
+			float* p = &cloud[((size_t)y * cWidth + x) * 6];
+			for (int k = 0; k < 3; ++k)
+			{
+				p[k] = t * d[k];
+				p[3 + k] = (p[k] - center[k]) / radius;
+			}
+		}
+	}
+}
+
+
+template <class Fn>
+static double NsPerPixel(int iterations, Fn fn)
+{
+	for (int i = 0; i < 5; ++i)
+	{
+		fn();
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		fn();
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return ns / iterations / ((double)cWidth * cHeight);
+}
+
+
+int main(int argc, char* argv[])
+{
+	int iterations = (argc > 1) ? atoi(argv[1]) : 200;
+	if (iterations <= 0)
+	{
+		iterations = 200;
+	}
+
+	std::vector<float> cloud;
+	MakeSphereCloud(cloud);
+	const int pointStride = cWidth * 6 * sizeof(float);
+	const int dstStride = cWidth * 4;
+
+	Mat4 worldToCamera;
+	SetIdentity(worldToCamera);
+
+	std::vector<unsigned char> reference(dstStride * cHeight);
+	std::vector<unsigned char> simd(dstStride * cHeight);
+	PointCloudShader shader;
+
+	std::cout << "Shade " << cWidth << "x" << cHeight << " over " << iterations << " frames, "
+		<< ThreadPool::Instance().Concurrency() << " threads" << std::endl;
+
+	bool allMatch = true;
+	for (int mode = ShadeLambert; mode <= ShadeDepth; ++mode)
+	{
+		ShadingParameters parameters;
+		parameters.mode = (ShadingMode)mode;
+		shader.SetParameters(parameters);
+
+		double scalarNs = NsPerPixel(iterations, [&]()
+		{
+			ShadePointCloudRowsScalar(cloud.data(), pointStride, cWidth, 0, cHeight, worldToCamera, parameters, reference.data(), dstStride);
+		});
+		double simdNs = NsPerPixel(iterations, [&]()
+		{
+			ShadePointCloudRows(cloud.data(), pointStride, cWidth, 0, cHeight, worldToCamera, parameters, simd.data(), dstStride);
+		});
+		double threadedNs = NsPerPixel(iterations, [&]()
+		{
+			shader.Shade(cloud.data(), pointStride, cWidth, cHeight, worldToCamera, simd.data(), dstStride);
+		});
+
+		// the kernels use the same operations in the same order; allow one step for contracted multiply-adds
+		int maxDifference = 0;
+		for (size_t i = 0; i < reference.size(); ++i)
+		{
+			int difference = abs((int)reference[i] - (int)simd[i]);
+			maxDifference = (difference > maxDifference) ? difference : maxDifference;
+		}
+		bool match = maxDifference <= 1;
+		allMatch = allMatch && match;
+
+		std::cout << "  " << ShadingModeName((ShadingMode)mode) << ": scalar " << scalarNs << " ns/pixel, simd "
+			<< simdNs << " ns/pixel, threaded " << threadedNs << " ns/pixel, output "
+			<< (match ? "matches" : "DIFFERS from") << " the scalar reference" << std::endl;
+	}
+
+	return allMatch ? 0 : 1;
+}
@@ -0,0 +1,807 @@
+
+#include "SimdKernels.h"
+
+#include <atomic>
+#include <iomanip>
+#include <ostream>
+#include <random>
+#include <vector>
+#include <math.h>
+#include <string.h>
+
+
+////////////////////////////////////////////////////////
+// Scalar kernels
+
+void IcpSystem::Clear()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+
+void IcpSystem::Add(const IcpSystem& other)
+{
+	for (int i = 0; i < 21; ++i)
+	{
+		AtA[i] += other.AtA[i];
+	}
+	for (int i = 0; i < 6; ++i)
+	{
+		Atb[i] += other.Atb[i];
+	}
+	error += other.error;
+	count += other.count;
+}
+
+
+void DepthToFloatRowScalar(const unsigned short* pSrc, int xBegin, int width, float minMm, float maxMm, bool mirror,
+	float* pDst)
+{
+	for (int x = xBegin; x < width; ++x)
+	{
+		float mm = (float)pSrc[mirror ? width - 1 - x : x];
+		pDst[x] = (mm >= minMm && mm <= maxMm) ? mm * 0.001f : 0.0f;
+	}
+}
+
+
+void BgrxToRgbaRowScalar(const unsigned char* pSrc, unsigned char* pDst, int xBegin, int width)
+{
+	for (int x = xBegin; x < width; ++x)
+	{
+		// swap the B and R bytes of a little-endian BGRX pixel and force alpha to 255
+		unsigned int p;
+		memcpy(&p, pSrc + x * 4, sizeof(p));
+		p = 0xFF000000u | (p & 0x0000FF00u) | ((p >> 16) & 0x000000FFu) | ((p & 0x000000FFu) << 16);
+		memcpy(pDst + x * 4, &p, sizeof(p));
+	}
+}
+
+
+static inline float Clamp01(float v)
+{
+	return (v < 0.0f) ? 0.0f : ((v > 1.0f) ? 1.0f : v);
+}
+
+static inline float PowInt(float base, int exponent)
+{
+	float result = 1.0f;
+	while (exponent > 0)
+	{
+		if (exponent & 1)
+		{
+			result = result * base;
+		}
+		base = base * base;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+static inline unsigned int ToByte(float v)
+{
+	return (unsigned int)(int)(Clamp01(v) * 255.0f + 0.5f);
+}
+
+
+void ShadeRowScalar(const float* pRow, int xBegin, int width, const Mat4& m, const ShadingTerms& t, unsigned int* pOut)
+{
+	for (int x = xBegin; x < width; ++x)
+	{
+		const float* p = pRow + x * 6;
+
+		// camera space position and normal
+		float cx = p[0] * m.M11 + p[1] * m.M21 + p[2] * m.M31 + m.M41;
+		float cy = p[0] * m.M12 + p[1] * m.M22 + p[2] * m.M32 + m.M42;
+		float cz = p[0] * m.M13 + p[1] * m.M23 + p[2] * m.M33 + m.M43;
+		float nx = p[3] * m.M11 + p[4] * m.M21 + p[5] * m.M31;
+		float ny = p[3] * m.M12 + p[4] * m.M22 + p[5] * m.M32;
+		float nz = p[3] * m.M13 + p[4] * m.M23 + p[5] * m.M33;
+
+		float normalLength2 = p[3] * p[3] + p[4] * p[4] + p[5] * p[5];
+		if (!(normalLength2 > 0.5f) || !(cz > 0.0f))
+		{
+			pOut[x] = 0;
+			continue;
+		}
+
+		// the light is at the camera: l = -c / |c|
+		float distance = sqrtf(cx * cx + cy * cy + cz * cz);
+		float ndl = (0.0f - (nx * cx + ny * cy + nz * cz)) / distance;
+		ndl = (ndl > 0.0f) ? ndl : 0.0f;
+
+		float r = 1.0f, g = 1.0f, b = 1.0f;
+		if (ShadeNormals == t.mode)
+		{
+			r = nx * 0.5f + 0.5f;
+			g = ny * 0.5f + 0.5f;
+			b = nz * 0.5f + 0.5f;
+		}
+		else if (ShadeDepth == t.mode)
+		{
+			float d = Clamp01((cz - t.depthOffset) * t.depthScale);
+			float ramp = d + d - 1.0f;
+			r = 1.0f - d;
+			g = 1.0f - ((ramp > 0.0f) ? ramp : 0.0f - ramp);
+			b = d;
+		}
+
+		float light = t.ambient + t.diffuse * ndl;
+		float highlight = t.specular * PowInt(ndl, t.shininess);
+		pOut[x] = ToByte(b * light + highlight) | (ToByte(g * light + highlight) << 8) | (ToByte(r * light + highlight) << 16);
+	}
+}
+
+
+void IcpRowScalar(const float* const* ppRow, int xBegin, int width, const IcpRowParameters& p, IcpSystem& system,
+	int& valid)
+{
+	const Mat4& model = p.model;
+	for (int x = xBegin; x < width; ++x)
+	{
+		const float v[6] = { ppRow[0][x], ppRow[1][x], ppRow[2][x], ppRow[3][x], ppRow[4][x], ppRow[5][x] };
+		if (v[3] == 0.0f && v[4] == 0.0f && v[5] == 0.0f)
+		{
+			continue;
+		}
+		valid++;
+
+		// frame point and normal in world space under the current estimate
+		float w[3], n[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			w[i] = p.R[i][0] * v[0] + p.R[i][1] * v[1] + p.R[i][2] * v[2] + p.t[i];
+			n[i] = p.R[i][0] * v[3] + p.R[i][1] * v[4] + p.R[i][2] * v[5];
+		}
+
+		// projective association with the model raycast
+		float c[3];
+		c[0] = w[0] * model.M11 + w[1] * model.M21 + w[2] * model.M31 + model.M41;
+		c[1] = w[0] * model.M12 + w[1] * model.M22 + w[2] * model.M32 + model.M42;
+		c[2] = w[0] * model.M13 + w[1] * model.M23 + w[2] * model.M33 + model.M43;
+		if (c[2] <= 0.0f)
+		{
+			continue;
+		}
+		float u = floorf(p.fx * c[0] / c[2] + p.cx + 0.5f);
+		float h = floorf(p.fy * c[1] / c[2] + p.cy + 0.5f);
+		if (!(u >= 0.0f && h >= 0.0f && u < (float)p.modelWidth && h < (float)p.modelHeight))
+		{
+			continue;
+		}
+		const float* q = p.pModelPoints + ((size_t)(int)h * p.modelWidth + (int)u) * 6;
+		const float* nq = q + 3;
+		if (nq[0] == 0.0f && nq[1] == 0.0f && nq[2] == 0.0f)
+		{
+			continue;
+		}
+		float d[3] = { w[0] - q[0], w[1] - q[1], w[2] - q[2] };
+		if (!(d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= p.distanceThreshold2)
+			|| !(n[0] * nq[0] + n[1] * nq[1] + n[2] * nq[2] >= p.normalThreshold))
+		{
+			continue;
+		}
+
+		// r = nq . (p - q); J = [p x nq, nq]
+		float r = d[0] * nq[0] + d[1] * nq[1] + d[2] * nq[2];
+		float J[6] = { w[1] * nq[2] - w[2] * nq[1], w[2] * nq[0] - w[0] * nq[2], w[0] * nq[1] - w[1] * nq[0],
+			nq[0], nq[1], nq[2] };
+		int k = 0;
+		for (int i = 0; i < 6; ++i)
+		{
+			for (int j = i; j < 6; ++j)
+			{
+				system.AtA[k++] += (double)J[i] * J[j];
+			}
+			system.Atb[i] -= (double)J[i] * r;
+		}
+		system.error += (double)r * r;
+		system.count++;
+	}
+}
+
+
+int IntegrateBrickScalar(const TsdfBrickParameters& p, int begin, float baseX, float baseY, float baseZ,
+	TsdfVoxel* pVoxels)
+{
+	int updated = 0;
+	for (int i = begin; i < cBrickVoxels; ++i)
+	{
+		// the inverse of BrickVoxel
+		const float x = (float)((i & 1) | ((i >> 2) & 2) | ((i >> 4) & 4));
+		const float y = (float)(((i >> 1) & 1) | ((i >> 3) & 2) | ((i >> 5) & 4));
+		const float z = (float)(((i >> 2) & 1) | ((i >> 4) & 2) | ((i >> 6) & 4));
+		float camZ = baseZ + x * p.axes[0][2] + y * p.axes[1][2] + z * p.axes[2][2];
+		if (camZ <= 0.0f)
+		{
+			continue;
+		}
+		float camX = baseX + x * p.axes[0][0] + y * p.axes[1][0] + z * p.axes[2][0];
+		float camY = baseY + x * p.axes[0][1] + y * p.axes[1][1] + z * p.axes[2][1];
+		float invZ = 1.0f / camZ;
+		float u = floorf(p.fx * camX * invZ + p.cx + 0.5f);
+		float v = floorf(p.fy * camY * invZ + p.cy + 0.5f);
+		if (!(u >= 0.0f && v >= 0.0f && u < (float)p.width && v < (float)p.height))
+		{
+			continue;
+		}
+		float depth = p.pDepth[(size_t)(int)v * p.width + (int)u];
+		float sdf = depth - camZ;
+		if (depth <= 0.0f || sdf < -p.truncation)
+		{
+			continue;
+		}
+
+		float tsdf = (sdf >= p.truncation) ? 1.0f : sdf * p.invTruncation;
+		unsigned int weight = VoxelWeight(pVoxels[i]);
+		float blended = (VoxelTsdf(pVoxels[i]) * (float)weight + tsdf * p.tsdfScale) / (float)(weight + 1);
+		pVoxels[i] = MakeVoxel((short)blended, (unsigned short)((weight + 1 < p.maxWeight) ? weight + 1 : p.maxWeight));
+		updated++;
+	}
+	return updated;
+}
+
+
+void BilateralRowScalar(const BilateralRowParameters& p, const float* const* ppTaps, int xBegin, int width, float* pOut)
+{
+	const int centre = p.taps / 2;
+	const float lastEntry = (float)(cBilateralLutSize - 1);
+	for (int x = xBegin; x < width; ++x)
+	{
+		const float z = ppTaps[centre][x];
+		if (z <= 0.0f)
+		{
+			pOut[x] = 0.0f;
+			continue;
+		}
+
+		const float invZ2 = 1.0f / (z * z);
+		float sum = 0.0f, weights = 0.0f, support = 0.0f;
+		for (int k = 0; k < p.taps; ++k)
+		{
+			const float depth = ppTaps[k][x];
+			const float difference = depth - z;
+			const float entry = difference * difference * p.lutScale * invZ2 * invZ2;
+			const float weight = (depth > 0.0f) ? p.spatial[k] * p.pRangeLut[(int)((entry < lastEntry) ? entry : lastEntry)] : 0.0f;
+			sum += weight * depth;
+			weights += weight;
+			support += (k == centre) ? 0.0f : weight;
+		}
+		pOut[x] = (support >= p.minSupport) ? sum / weights : 0.0f;
+	}
+}
+
+
+void TemporalMedianRowScalar(const float* const* ppFrames, int frames, int xBegin, int width, float gate, float* pOut)
+{
+	for (int x = xBegin; x < width; ++x)
+	{
+		const float z = ppFrames[0][x];
+		const float tolerance = gate * z * z;
+		float values[cMaxTemporalFrames];
+		for (int f = 0; f < frames; ++f)
+		{
+			const float depth = ppFrames[f][x];
+			const float difference = (depth > z) ? depth - z : z - depth;
+			values[f] = (depth > 0.0f && difference <= tolerance) ? depth : z;
+		}
+
+		// odd-even transposition sort, the network the vector kernels run too
+		for (int round = 0; round < frames; ++round)
+		{
+			for (int i = round & 1; i + 1 < frames; i += 2)
+			{
+				const float low = (values[i] < values[i + 1]) ? values[i] : values[i + 1];
+				const float high = (values[i] < values[i + 1]) ? values[i + 1] : values[i];
+				values[i] = low;
+				values[i + 1] = high;
+			}
+		}
+		pOut[x] = (z > 0.0f) ? values[frames / 2] : 0.0f;
+	}
+}
+
+
+void VertexNormalRowScalar(const VertexNormalRowParameters& p, const float* pRow, const float* pBelow, int y, int xBegin,
+	int width, float* const* ppOut)
+{
+	const float ry = (y - p.cy) * p.invFy;
+	const float rd = (y + 1 - p.cy) * p.invFy;
+	for (int x = xBegin; x < width; ++x)
+	{
+		const float z = pRow[x];
+		const float rx = (x - p.cx) * p.invFx;
+		ppOut[0][x] = rx * z;
+		ppOut[1][x] = ry * z;
+		ppOut[2][x] = z;
+		ppOut[3][x] = ppOut[4][x] = ppOut[5][x] = 0.0f;
+
+		const float zRight = (x + 1 < width) ? pRow[x + 1] : 0.0f;
+		const float zDown = (nullptr != pBelow) ? pBelow[x] : 0.0f;
+		if (z <= 0.0f || zRight <= 0.0f || zDown <= 0.0f)
+		{
+			continue;
+		}
+
+		// right x down points away from the camera in a y-down frame; flip it towards the camera
+		const float ax = (x + 1 - p.cx) * p.invFx * zRight - rx * z, ay = ry * zRight - ry * z, az = zRight - z;
+		const float bx = rx * zDown - rx * z, by = rd * zDown - ry * z, bz = zDown - z;
+		const float nx = az * by - ay * bz;
+		const float ny = ax * bz - az * bx;
+		const float nz = ay * bx - ax * by;
+		const float length2 = nx * nx + ny * ny + nz * nz;
+		if (length2 <= 0.0f)
+		{
+			continue;
+		}
+		const float inv = 1.0f / sqrtf(length2);
+		ppOut[3][x] = nx * inv;
+		ppOut[4][x] = ny * inv;
+		ppOut[5][x] = nz * inv;
+	}
+}
+
+
+static void DepthToFloatRow(const unsigned short* pSrc, int width, float minMm, float maxMm, bool mirror, float* pDst)
+{
+	DepthToFloatRowScalar(pSrc, 0, width, minMm, maxMm, mirror, pDst);
+}
+
+static void BgrxToRgbaRow(const unsigned char* pSrc, unsigned char* pDst, int width)
+{
+	BgrxToRgbaRowScalar(pSrc, pDst, 0, width);
+}
+
+static void ShadeRow(const float* pRow, int width, const Mat4& worldToCamera, const ShadingTerms& terms, unsigned int* pOut)
+{
+	ShadeRowScalar(pRow, 0, width, worldToCamera, terms, pOut);
+}
+
+static void IcpRow(const float* const* ppRow, int width, const IcpRowParameters& parameters, IcpSystem& system, int& valid)
+{
+	IcpRowScalar(ppRow, 0, width, parameters, system, valid);
+}
+
+static int IntegrateBrick(const TsdfBrickParameters& parameters, float baseX, float baseY, float baseZ, TsdfVoxel* pVoxels)
+{
+	return IntegrateBrickScalar(parameters, 0, baseX, baseY, baseZ, pVoxels);
+}
+
+static void BilateralRow(const BilateralRowParameters& parameters, const float* const* ppTaps, int width, float* pOut)
+{
+	BilateralRowScalar(parameters, ppTaps, 0, width, pOut);
+}
+
+static void TemporalMedianRow(const float* const* ppFrames, int frames, int width, float gate, float* pOut)
+{
+	TemporalMedianRowScalar(ppFrames, frames, 0, width, gate, pOut);
+}
+
+static void VertexNormalRow(const VertexNormalRowParameters& parameters, const float* pRow, const float* pBelow, int y,
+	int width, float* const* ppOut)
+{
+	VertexNormalRowScalar(parameters, pRow, pBelow, y, 0, width, ppOut);
+}
+
+
+const SimdKernels* ScalarKernels()
+{
+	static const SimdKernels kernels = { &DepthToFloatRow, &BgrxToRgbaRow, &ShadeRow, &IcpRow, &IntegrateBrick, &BilateralRow,
+		&TemporalMedianRow, &VertexNormalRow };
+	return &kernels;
+}
+
+
+////////////////////////////////////////////////////////
+// Dispatch
+
+const SimdKernels* KernelsForLevel(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdScalar: return ScalarKernels();
+	case SimdSSE41: return SSE41Kernels();
+	case SimdAVX2: return AVX2Kernels();
+	case SimdAVX512: return AVX512Kernels();
+	}
+	return nullptr;
+}
+
+
+/// <summary>
+/// Whether the kernels of a level can run here
+/// </summary>
+static bool IsAvailable(SimdLevel level)
+{
+	return level <= DetectSimdLevel() && nullptr != KernelsForLevel(level);
+}
+
+static SimdLevel BestAvailableLevel()
+{
+	int level = DetectSimdLevel();
+	while (level > SimdScalar && !IsAvailable((SimdLevel)level))
+	{
+		level--;
+	}
+	return (SimdLevel)level;
+}
+
+static std::atomic<int> s_activeLevel(-1);
+
+
+SimdLevel ActiveSimdLevel()
+{
+	int level = s_activeLevel.load();
+	if (level < 0)
+	{
+		int detected = BestAvailableLevel();
+		s_activeLevel.compare_exchange_strong(level, detected);
+		level = s_activeLevel.load();
+	}
+	return (SimdLevel)level;
+}
+
+
+const SimdKernels& ActiveSimdKernels()
+{
+	return *KernelsForLevel(ActiveSimdLevel());
+}
+
+
+bool SetSimdLevel(SimdLevel level)
+{
+	if (!IsAvailable(level))
+	{
+		return false;
+	}
+	s_activeLevel = level;
+	return true;
+}
+
+
+////////////////////////////////////////////////////////
+// Self test
+
+/// <summary>
+/// Random rows, and a brick, shared by every level. The widths are not a multiple of any register width, so
+/// that the vector loops hand a tail to the scalar kernels.
+/// </summary>
+struct SelfTestInput
+{
+	static const int cWidth = 203;
+	static const int cModelWidth = 64;
+	static const int cModelHeight = 48;
+
+	std::vector<unsigned short> depthMm;
+	std::vector<unsigned char> bgrx;
+	std::vector<float> points;			// 6 floats per point, for shading
+	std::vector<float> planes;			// the same points as 6 planes of cWidth floats, for ICP
+	std::vector<float> modelPoints;		// cModelWidth x cModelHeight raycast
+	std::vector<float> depth;			// cModelWidth x cModelHeight depth image
+	std::vector<TsdfVoxel> voxels;
+	std::vector<float> filterRows;		// cMaxBilateralTaps rows of cWidth depths
+	std::vector<float> rangeLut;
+	Mat4 worldToCamera;
+	IcpRowParameters icp;
+	TsdfBrickParameters integrate;
+	BilateralRowParameters bilateral;
+	VertexNormalRowParameters vertexNormal;
+
+	explicit SelfTestInput(unsigned int seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const float fx = 50.0f, fy = 50.0f, cx = cModelWidth * 0.5f, cy = cModelHeight * 0.5f;
+
+		for (int x = 0; x < cWidth; ++x)
+		{
+			depthMm.push_back((unsigned short)(random() % 9000));
+			for (int c = 0; c < 4; ++c)
+			{
+				bgrx.push_back((unsigned char)(random() & 0xFF));
+			}
+		}
+
+		// the model: a bumpy wall 1 to 1.3 m away, facing the camera, with holes
+		for (int v = 0; v < cModelHeight; ++v)
+		{
+			for (int u = 0; u < cModelWidth; ++u)
+			{
+				float z = 1.0f + 0.3f * unit(random);
+				bool hole = unit(random) < 0.1f;
+				float nx = 0.2f * (unit(random) - 0.5f), ny = 0.2f * (unit(random) - 0.5f), nz = -1.0f;
+				float length = sqrtf(nx * nx + ny * ny + nz * nz);
+				const float point[6] = { (u - cx) / fx * z, (v - cy) / fy * z, z, nx / length, ny / length, nz / length };
+				for (int i = 0; i < 6; ++i)
+				{
+					modelPoints.push_back(hole ? 0.0f : point[i]);
+				}
+				depth.push_back(hole ? 0.0f : z);
+			}
+		}
+
+		// frame points near the model, some outside the view, some without a normal
+		for (int x = 0; x < cWidth; ++x)
+		{
+			int u = (int)(random() % (cModelWidth + 8)) - 4;
+			int v = (int)(random() % cModelHeight);
+			float z = 1.0f + 0.3f * unit(random);
+			float nx = 0.4f * (unit(random) - 0.5f), ny = 0.4f * (unit(random) - 0.5f), nz = -1.0f;
+			float length = sqrtf(nx * nx + ny * ny + nz * nz);
+			bool empty = unit(random) < 0.1f;
+			const float point[6] = { (u - cx) / fx * z, (v - cy) / fy * z, z, nx / length, ny / length, nz / length };
+			for (int i = 0; i < 6; ++i)
+			{
+				points.push_back((empty && i >= 3) ? 0.0f : point[i]);
+			}
+		}
+		for (int i = 0; i < 6; ++i)
+		{
+			for (int x = 0; x < cWidth; ++x)
+			{
+				planes.push_back(points[x * 6 + i]);
+			}
+		}
+
+		SetIdentity(worldToCamera);
+		worldToCamera.M41 = 0.01f;
+		worldToCamera.M43 = 0.02f;
+
+		for (int i = 0; i < 3; ++i)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				icp.R[i][j] = (i == j) ? 1.0f : 0.0f;
+			}
+		}
+		icp.R[0][1] = 0.01f;
+		icp.R[1][0] = -0.01f;
+		icp.t[0] = 0.005f;
+		icp.t[1] = -0.003f;
+		icp.t[2] = 0.01f;
+		SetIdentity(icp.model);
+		icp.fx = fx;
+		icp.fy = fy;
+		icp.cx = cx - 0.5f;
+		icp.cy = cy - 0.5f;
+		icp.modelWidth = cModelWidth;
+		icp.modelHeight = cModelHeight;
+		icp.pModelPoints = modelPoints.data();
+		icp.distanceThreshold2 = 0.1f * 0.1f;
+		icp.normalThreshold = 0.8f;
+
+		// a brick of voxels skewed across the view, through the wall
+		const float axes[3][3] = { { 0.01f, 0.001f, 0.003f }, { -0.002f, 0.008f, 0.001f }, { 0.001f, -0.002f, 0.01f } };
+		memcpy(integrate.axes, axes, sizeof(axes));
+		integrate.fx = fx;
+		integrate.fy = fy;
+		integrate.cx = cx - 0.5f;
+		integrate.cy = cy - 0.5f;
+		integrate.width = cModelWidth;
+		integrate.height = cModelHeight;
+		integrate.pDepth = depth.data();
+		integrate.truncation = 0.03f;
+		integrate.invTruncation = 1.0f / 0.03f;
+		integrate.tsdfScale = 32767.0f;
+		integrate.maxWeight = 200;
+		for (int i = 0; i < cBrickVoxels; ++i)
+		{
+			short tsdf = (short)((int)(random() % 65535) - 32767);
+			voxels.push_back(MakeVoxel(tsdf, (unsigned short)(random() % 201)));
+		}
+
+		// depth rows of a noisy surface with steps to a background, holes and flying pixels
+		for (int row = 0; row < cMaxBilateralTaps; ++row)
+		{
+			for (int x = 0; x < cWidth; ++x)
+			{
+				float z = ((x / 17) % 3 == 2) ? 2.5f : 1.0f + 0.002f * x;
+				z += 0.004f * (unit(random) - 0.5f);
+				float r = unit(random);
+				filterRows.push_back((r < 0.05f) ? 0.0f : ((r < 0.1f) ? 1.0f + 1.5f * unit(random) : z));
+			}
+		}
+		for (int i = 0; i < cBilateralLutSize; ++i)
+		{
+			rangeLut.push_back((i + 1 < cBilateralLutSize) ? expf(-0.5f * i * 9.0f / cBilateralLutSize) : 0.0f);
+		}
+		bilateral.taps = cMaxBilateralTaps;
+		for (int k = 0; k < cMaxBilateralTaps; ++k)
+		{
+			const float offset = (float)(k - cMaxBilateralTaps / 2);
+			bilateral.spatial[k] = expf(-0.5f * offset * offset / (2.0f * 2.0f));
+		}
+		bilateral.pRangeLut = rangeLut.data();
+		bilateral.lutScale = cBilateralLutSize / 9.0f / (0.01f * 0.01f);
+		bilateral.minSupport = 0.5f;
+
+		vertexNormal.invFx = 1.0f / fx;
+		vertexNormal.invFy = 1.0f / fy;
+		vertexNormal.cx = cx - 0.5f;
+		vertexNormal.cy = cy - 0.5f;
+	}
+};
+
+
+/// <summary>
+/// Print the outcome of one comparison
+/// </summary>
+static bool Report(std::ostream& out, SimdLevel level, const char* kernel, bool passed, const std::string& detail)
+{
+	out << "  " << std::left << std::setw(8) << SimdLevelName(level) << std::setw(18) << kernel << std::right
+		<< (passed ? "ok" : "MISMATCH") << (detail.empty() ? "" : " (" + detail + ")") << std::endl;
+	return passed;
+}
+
+
+/// <summary>
+/// Largest difference between the channels of two rows of BGRX pixels
+/// </summary>
+static int MaxChannelDifference(const std::vector<unsigned int>& a, const std::vector<unsigned int>& b)
+{
+	int maxDifference = 0;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			int difference = abs((int)((a[i] >> shift) & 0xFF) - (int)((b[i] >> shift) & 0xFF));
+			maxDifference = (difference > maxDifference) ? difference : maxDifference;
+		}
+	}
+	return maxDifference;
+}
+
+
+static bool TestLevel(std::ostream& out, SimdLevel level, const SimdKernels& scalar, const SimdKernels& kernels,
+	const SelfTestInput& input)
+{
+	const int width = SelfTestInput::cWidth;
+	bool passed = true;
+
+	// depth and pixel conversions are exact
+	for (int mirror = 0; mirror < 2; ++mirror)
+	{
+		std::vector<float> expected(width), actual(width);
+		scalar.depthToFloatRow(input.depthMm.data(), width, 350.0f, 8000.0f, 0 != mirror, expected.data());
+		kernels.depthToFloatRow(input.depthMm.data(), width, 350.0f, 8000.0f, 0 != mirror, actual.data());
+		passed &= Report(out, level, mirror ? "depth-mirrored" : "depth-to-float", expected == actual, std::string());
+	}
+	{
+		std::vector<unsigned char> expected(width * 4), actual(width * 4);
+		scalar.bgrxToRgbaRow(input.bgrx.data(), expected.data(), width);
+		kernels.bgrxToRgbaRow(input.bgrx.data(), actual.data(), width);
+		passed &= Report(out, level, "bgrx-to-rgba", expected == actual, std::string());
+	}
+
+	// shading may round a channel the other way
+	for (int mode = ShadeLambert; mode <= ShadeDepth; ++mode)
+	{
+		ShadingParameters parameters;
+		parameters.mode = (ShadingMode)mode;
+		ShadingTerms terms(parameters);
+		std::vector<unsigned int> expected(width), actual(width);
+		scalar.shadeRow(input.points.data(), width, input.worldToCamera, terms, expected.data());
+		kernels.shadeRow(input.points.data(), width, input.worldToCamera, terms, actual.data());
+		int difference = MaxChannelDifference(expected, actual);
+		passed &= Report(out, level, (std::string("shade-") + ShadingModeName((ShadingMode)mode)).c_str(), difference <= 1,
+			"max difference " + std::to_string(difference));
+	}
+
+	// the vector ICP rows sum in float before adding to the doubles
+	{
+		IcpSystem expected, actual;
+		expected.Clear();
+		actual.Clear();
+		int expectedValid = 0, actualValid = 0;
+		const float* rows[6];
+		for (int i = 0; i < 6; ++i)
+		{
+			rows[i] = input.planes.data() + i * width;
+		}
+		scalar.icpRow(rows, width, input.icp, expected, expectedValid);
+		kernels.icpRow(rows, width, input.icp, actual, actualValid);
+		double maxError = 0;
+		for (int i = 0; i < 28; ++i)
+		{
+			double a = (i < 21) ? expected.AtA[i] : ((i < 27) ? expected.Atb[i - 21] : expected.error);
+			double b = (i < 21) ? actual.AtA[i] : ((i < 27) ? actual.Atb[i - 21] : actual.error);
+			double error = fabs(a - b) / (fabs(a) + 1e-6);
+			maxError = (error > maxError) ? error : maxError;
+		}
+		bool same = expected.count == actual.count && expectedValid == actualValid && expected.count > 0 && maxError < 1e-4;
+		passed &= Report(out, level, "icp-row", same, std::to_string(actual.count) + " of " + std::to_string(expected.count)
+			+ " inliers, relative error " + std::to_string(maxError));
+	}
+
+	// a blended TSDF may truncate to the neighbouring value
+	{
+		std::vector<TsdfVoxel> expected(input.voxels), actual(input.voxels);
+		int expectedUpdated = scalar.integrateBrick(input.integrate, -0.2f, -0.15f, 0.95f, expected.data());
+		int actualUpdated = kernels.integrateBrick(input.integrate, -0.2f, -0.15f, 0.95f, actual.data());
+		int difference = 0;
+		bool sameWeights = true;
+		for (int i = 0; i < cBrickVoxels; ++i)
+		{
+			int d = abs(VoxelTsdf(expected[i]) - VoxelTsdf(actual[i]));
+			difference = (d > difference) ? d : difference;
+			sameWeights &= VoxelWeight(expected[i]) == VoxelWeight(actual[i]);
+		}
+		passed &= Report(out, level, "integrate-brick", sameWeights && difference <= 1
+			&& expectedUpdated == actualUpdated && expectedUpdated > 0,
+			std::to_string(actualUpdated) + " voxels updated, max difference " + std::to_string(difference));
+	}
+
+	// the depth filters add and compare in the same order at every level
+	{
+		const float* taps[cMaxBilateralTaps];
+		for (int k = 0; k < cMaxBilateralTaps; ++k)
+		{
+			taps[k] = input.filterRows.data() + k * width;
+		}
+		std::vector<float> expected(width), actual(width);
+		scalar.bilateralRow(input.bilateral, taps, width, expected.data());
+		kernels.bilateralRow(input.bilateral, taps, width, actual.data());
+		int dropped = 0;
+		for (int x = 0; x < width; ++x)
+		{
+			dropped += (taps[cMaxBilateralTaps / 2][x] > 0.0f && 0.0f == expected[x]) ? 1 : 0;
+		}
+		passed &= Report(out, level, "bilateral-row", expected == actual, std::to_string(dropped) + " flying pixels dropped");
+
+		for (int frames = 3; frames <= cMaxTemporalFrames; frames += 2)
+		{
+			scalar.temporalMedianRow(taps, frames, width, 0.05f, expected.data());
+			kernels.temporalMedianRow(taps, frames, width, 0.05f, actual.data());
+			passed &= Report(out, level, (std::string("temporal-median-") + std::to_string(frames)).c_str(), expected == actual,
+				std::string());
+		}
+	}
+
+	// vertices and normals take the same operations in the same order at every level
+	for (int last = 0; last < 2; ++last)
+	{
+		std::vector<float> expected(6 * width), actual(6 * width);
+		float* expectedRows[6];
+		float* actualRows[6];
+		for (int i = 0; i < 6; ++i)
+		{
+			expectedRows[i] = expected.data() + i * width;
+			actualRows[i] = actual.data() + i * width;
+		}
+		const float* pBelow = last ? nullptr : input.filterRows.data() + width;
+		scalar.vertexNormalRow(input.vertexNormal, input.filterRows.data(), pBelow, 7, width, expectedRows);
+		kernels.vertexNormalRow(input.vertexNormal, input.filterRows.data(), pBelow, 7, width, actualRows);
+		int normals = 0;
+		for (int x = 0; x < width; ++x)
+		{
+			normals += (0.0f != expectedRows[5][x]) ? 1 : 0;
+		}
+		passed &= Report(out, level, last ? "vertex-normal-end" : "vertex-normal-row", expected == actual,
+			std::to_string(normals) + " normals");
+	}
+	return passed;
+}
+
+
+bool RunSimdSelfTest(std::ostream& out)
+{
+	const SelfTestInput input(1);
+	const SimdKernels& scalar = *ScalarKernels();
+	out << "SIMD self test against the scalar kernels (CPU supports " << SimdLevelName(DetectSimdLevel()) << "):" << std::endl;
+
+	bool passed = true;
+	int tested = 0;
+	for (int level = SimdSSE41; level < cSimdLevelCount; ++level)
+	{
+		if (!IsAvailable((SimdLevel)level))
+		{
+			out << "  " << std::left << std::setw(8) << SimdLevelName((SimdLevel)level) << std::right
+				<< (nullptr == KernelsForLevel((SimdLevel)level) ? "not built" : "not supported by the CPU") << std::endl;
+			continue;
+		}
+		passed &= TestLevel(out, (SimdLevel)level, scalar, *KernelsForLevel((SimdLevel)level), input);
+		tested++;
+	}
+	out << (passed ? "All " : "NOT all ") << tested << " levels match" << std::endl;
+	return passed;
+}
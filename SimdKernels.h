@@ -0,0 +1,247 @@
+#pragma once
+
+#include "CpuFeatures.h"
+#include "FusionMath.h"
+#include "PointCloudShader.h"
+
+#include <iosfwd>
+
+/// <summary>
+/// Lighting terms of a shading mode, so that every mode runs through the same kernel:
+/// colour * (ambient + diffuse * n.l) + specular * (n.l)^shininess
+/// </summary>
+struct ShadingTerms
+{
+	ShadingMode                 mode;
+	float                       ambient;
+	float                       diffuse;
+	float                       specular;
+	int                         shininess;
+	float                       depthOffset;
+	float                       depthScale;
+
+	ShadingTerms(const ShadingParameters& parameters);
+};
+
+/// <summary>
+/// Normal equations of one ICP iteration: upper triangle of J^T J, J^T r, sum of r^2 and inlier count
+/// </summary>
+struct IcpSystem
+{
+	double                      AtA[21];
+	double                      Atb[6];
+	double                      error;
+	int                         count;
+
+	void Clear();
+	void Add(const IcpSystem& other);
+};
+
+/// <summary>
+/// What an ICP row needs besides the frame points: the current estimate and the model raycast
+/// </summary>
+struct IcpRowParameters
+{
+	float                       R[3][3];			// frame camera to world, current estimate
+	float                       t[3];
+	Mat4                        model;				// world to the camera the model was raycast from
+	float                       fx, fy, cx, cy;		// model intrinsics in pixels
+	int                         modelWidth;
+	int                         modelHeight;
+	const float*                pModelPoints;		// raycast point cloud, 6 floats per pixel
+	float                       distanceThreshold2;	// squared, in m^2
+	float                       normalThreshold;	// minimum cosine
+};
+
+/// <summary>
+/// Back-projection of one level of a VertexNormalMaps: pixel (x, y) of depth z is at
+/// ((x - cx) * invFx * z, (y - cy) * invFy * z, z)
+/// </summary>
+struct VertexNormalRowParameters
+{
+	float                       invFx, invFy;		// inverse focal lengths, per pixel
+	float                       cx, cy;				// principal point, in pixels
+};
+
+/// <summary>
+/// Side of the cubic bricks a TsdfVolume stores its voxels in, and voxels per brick
+/// </summary>
+static const int cBrickSize = 8;
+static const int cBrickVoxels = cBrickSize * cBrickSize * cBrickSize;
+
+/// <summary>
+/// Place of voxel (x, y, z) in its brick, coordinates taken modulo 8: the Morton (Z) order, the
+/// bits of x, y and z interleaved from the lowest, so that a 64 byte line of voxels is a 4x2x2
+/// block and the 8 corners of a trilinear sample share a line or two whichever way a ray runs
+/// </summary>
+inline unsigned int BrickVoxel(int x, int y, int z)
+{
+	return (unsigned int)((x & 1) | ((y & 1) << 1) | ((z & 1) << 2) | ((x & 2) << 2) | ((y & 2) << 3) | ((z & 2) << 4)
+		| ((x & 4) << 4) | ((y & 4) << 5) | ((z & 4) << 6));
+}
+
+/// <summary>
+/// A TsdfVolume voxel: the TSDF in [-32767, 32767] in the low 16 bits and the integration weight
+/// in the high 16 bits, so that a lookup touches one cache line
+/// </summary>
+typedef unsigned int TsdfVoxel;
+
+inline short VoxelTsdf(TsdfVoxel voxel) { return (short)(voxel & 0xFFFF); }
+inline unsigned short VoxelWeight(TsdfVoxel voxel) { return (unsigned short)(voxel >> 16); }
+inline TsdfVoxel MakeVoxel(short tsdf, unsigned short weight) { return (TsdfVoxel)(unsigned short)tsdf | ((TsdfVoxel)weight << 16); }
+
+/// <summary>
+/// What a TSDF brick needs besides the voxels: the camera space step per voxel along each volume
+/// axis and the depth image
+/// </summary>
+struct TsdfBrickParameters
+{
+	float                       axes[3][3];			// camera space offset of the next voxel along x, y and z
+	float                       fx, fy, cx, cy;		// depth intrinsics in pixels
+	int                         width;
+	int                         height;
+	const float*                pDepth;
+	float                       truncation;
+	float                       invTruncation;
+	float                       tsdfScale;			// TSDF of 1 as stored
+	unsigned short              maxWeight;
+};
+
+/// <summary>
+/// Taps of a bilateral filter pass at most (a radius of 4), entries of its range weight table,
+/// and frames of a temporal median at most
+/// </summary>
+static const int cMaxBilateralTaps = 9;
+static const int cBilateralLutSize = 64;
+static const int cMaxTemporalFrames = 5;
+
+/// <summary>
+/// One pass of the separable bilateral depth filter (see DepthFilter). The range weight of a tap
+/// is looked up at (difference / sigma)^2 * lutScale, sigma growing with the square of the centre
+/// depth like the sensor noise; the last entry, 0, stands for everything past the table.
+/// </summary>
+struct BilateralRowParameters
+{
+	int                         taps;				// odd, the centre tap being taps / 2
+	float                       spatial[cMaxBilateralTaps];
+	const float*                pRangeLut;			// cBilateralLutSize weights
+	float                       lutScale;			// entries per (difference / sigma at 1 m)^2
+	float                       minSupport;			// weight the other taps need, or the pixel is dropped
+};
+
+/// <summary>
+/// The inner loops of the vectorized stages, one table per SimdLevel. Every function handles one
+/// row (or brick) and gives the same result at every level, up to float rounding (see RunSimdSelfTest).
+/// </summary>
+struct SimdKernels
+{
+	/// <summary>
+	/// width depths in mm to m, 0 outside [minMm, maxMm]; mirror reads the row backwards
+	/// </summary>
+	void (*depthToFloatRow)(const unsigned short* pSrc, int width, float minMm, float maxMm, bool mirror, float* pDst);
+
+	/// <summary>
+	/// width BGRX pixels to RGBA with alpha 255
+	/// </summary>
+	void (*bgrxToRgbaRow)(const unsigned char* pSrc, unsigned char* pDst, int width);
+
+	/// <summary>
+	/// Shade width points (6 floats each) into BGRX pixels, black where the normal is zero
+	/// </summary>
+	void (*shadeRow)(const float* pRow, int width, const Mat4& worldToCamera, const ShadingTerms& terms, unsigned int* pOut);
+
+	/// <summary>
+	/// Associate width frame points with the model and add the inliers to the system; valid counts
+	/// the points with a normal. ppRow holds the row of each plane of a VertexNormalMaps level:
+	/// x, y, z, nx, ny, nz.
+	/// </summary>
+	void (*icpRow)(const float* const* ppRow, int width, const IcpRowParameters& parameters, IcpSystem& system, int& valid);
+
+	/// <summary>
+	/// Fuse the depth image into the cBrickVoxels voxels of a brick, in BrickVoxel order, whose
+	/// voxel (0, 0, 0) sits at (baseX, baseY, baseZ) in camera space
+	/// </summary>
+	/// <returns>how many voxels were updated</returns>
+	int (*integrateBrick)(const TsdfBrickParameters& parameters, float baseX, float baseY, float baseZ, TsdfVoxel* pVoxels);
+
+	/// <summary>
+	/// Filter width depths along one pass: pOut[x] averages ppTaps[k][x] over the taps, weighted
+	/// by their spatial and range weights. Depths of 0 (invalid) weigh nothing, an invalid centre
+	/// stays invalid, and a centre whose other taps weigh less than minSupport, a flying pixel
+	/// between two surfaces, becomes invalid.
+	/// </summary>
+	void (*bilateralRow)(const BilateralRowParameters& parameters, const float* const* ppTaps, int width, float* pOut);
+
+	/// <summary>
+	/// Per pixel, the median of ppFrames[0][x] (the current frame) and ppFrames[1 .. frames)[x]
+	/// (earlier ones), frames odd; an earlier depth that is invalid or further than gate * z^2 (in
+	/// m) from the current one z counts as the current one, so that moving surfaces do not smear.
+	/// Invalid current depths stay invalid.
+	/// </summary>
+	void (*temporalMedianRow)(const float* const* ppFrames, int frames, int width, float gate, float* pOut);
+
+	/// <summary>
+	/// Row y of the vertex and normal planes (ppOut: x, y, z, nx, ny, nz) from the depth rows y
+	/// (pRow) and y + 1 (pBelow, nullptr for the last row). The normal is the cross product of the
+	/// vectors to the right and lower neighbours, towards the camera, and zero where one of the
+	/// three lacks depth.
+	/// </summary>
+	void (*vertexNormalRow)(const VertexNormalRowParameters& parameters, const float* pRow, const float* pBelow, int y,
+		int width, float* const* ppOut);
+};
+
+/// <summary>
+/// The portable row kernels, from column xBegin on. The vector tables finish their rows with them.
+/// </summary>
+void DepthToFloatRowScalar(const unsigned short* pSrc, int xBegin, int width, float minMm, float maxMm, bool mirror,
+	float* pDst);
+void BgrxToRgbaRowScalar(const unsigned char* pSrc, unsigned char* pDst, int xBegin, int width);
+void ShadeRowScalar(const float* pRow, int xBegin, int width, const Mat4& worldToCamera, const ShadingTerms& terms,
+	unsigned int* pOut);
+void IcpRowScalar(const float* const* ppRow, int xBegin, int width, const IcpRowParameters& parameters,
+	IcpSystem& system, int& valid);
+void VertexNormalRowScalar(const VertexNormalRowParameters& parameters, const float* pRow, const float* pBelow, int y,
+	int xBegin, int width, float* const* ppOut);
+
+/// <summary>
+/// The portable brick kernel, from voxel begin on
+/// </summary>
+int IntegrateBrickScalar(const TsdfBrickParameters& parameters, int begin, float baseX, float baseY, float baseZ,
+	TsdfVoxel* pVoxels);
+
+/// <summary>
+/// The portable depth filter rows, from column xBegin on
+/// </summary>
+void BilateralRowScalar(const BilateralRowParameters& parameters, const float* const* ppTaps, int xBegin, int width,
+	float* pOut);
+void TemporalMedianRowScalar(const float* const* ppFrames, int frames, int xBegin, int width, float gate, float* pOut);
+
+/// <summary>
+/// The table of each level, nullptr where this build has none (the vector levels outside x86).
+/// Each comes from its own translation unit compiled for that instruction set only.
+/// </summary>
+const SimdKernels* ScalarKernels();
+const SimdKernels* SSE41Kernels();
+const SimdKernels* AVX2Kernels();
+const SimdKernels* AVX512Kernels();
+const SimdKernels* KernelsForLevel(SimdLevel level);
+
+/// <summary>
+/// The kernels in use: on the first call, those of the highest level the CPU supports and this
+/// build has, unless SetSimdLevel chose one before
+/// </summary>
+const SimdKernels& ActiveSimdKernels();
+SimdLevel ActiveSimdLevel();
+
+/// <summary>
+/// Use the kernels of a lower level, for tests and benchmarks. Call before the stages run.
+/// </summary>
+/// <returns>false, keeping the current level, if the CPU or this build does not support it</returns>
+bool SetSimdLevel(SimdLevel level);
+
+/// <summary>
+/// Run every kernel of every level the CPU supports on the same random rows as the scalar kernel
+/// and compare, one line per level and kernel
+/// </summary>
+/// <returns>false if any kernel disagrees with the scalar one</returns>
+bool RunSimdSelfTest(std::ostream& out);
@@ -0,0 +1,108 @@
+
+// Row kernels for AVX2, 8 lanes. Built with -mavx2 -mfma (/arch:AVX2); runs only once
+// DetectSimdLevel has found AVX2.
+
+#include "SimdKernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace
+{
+	typedef __m256 VecF;
+	typedef __m256i VecI;
+	typedef __m256 Mask;
+	const int cLanes = 8;
+
+	inline VecF Zero() { return _mm256_setzero_ps(); }
+	inline VecF Set1(float v) { return _mm256_set1_ps(v); }
+	inline VecF Load(const float* p) { return _mm256_loadu_ps(p); }
+	inline void Store(float* p, VecF v) { _mm256_storeu_ps(p, v); }
+	inline VecF Add(VecF a, VecF b) { return _mm256_add_ps(a, b); }
+	inline VecF Sub(VecF a, VecF b) { return _mm256_sub_ps(a, b); }
+	inline VecF Mul(VecF a, VecF b) { return _mm256_mul_ps(a, b); }
+	inline VecF Div(VecF a, VecF b) { return _mm256_div_ps(a, b); }
+	inline VecF Min(VecF a, VecF b) { return _mm256_min_ps(a, b); }
+	inline VecF Max(VecF a, VecF b) { return _mm256_max_ps(a, b); }
+	inline VecF Sqrt(VecF v) { return _mm256_sqrt_ps(v); }
+	inline VecF Floor(VecF v) { return _mm256_floor_ps(v); }
+	inline VecF Lanes() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+	inline VecF Reverse(VecF v) { return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+
+	inline float ReduceAdd(VecF v)
+	{
+		__m128 quad = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		__m128 pairs = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+		return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+	}
+
+	inline VecF LoadStride6(const float* p, int c)
+	{
+		return _mm256_i32gather_ps(p + c, _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42), 4);
+	}
+
+	inline Mask CmpGt(VecF a, VecF b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	inline Mask CmpGe(VecF a, VecF b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	inline Mask CmpLe(VecF a, VecF b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline Mask CmpNeq(VecF a, VecF b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+	inline Mask MaskAnd(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+	inline Mask MaskOr(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+	inline bool Any(Mask m) { return 0 != _mm256_movemask_ps(m); }
+	inline int Count(Mask m)
+	{
+		int count = 0;
+		for (unsigned int bits = (unsigned int)_mm256_movemask_ps(m); 0 != bits; bits &= bits - 1)
+		{
+			count++;
+		}
+		return count;
+	}
+
+	inline VecF Select(Mask m, VecF a, VecF b) { return _mm256_blendv_ps(b, a, m); }
+
+	inline VecI ZeroI() { return _mm256_setzero_si256(); }
+	inline VecI Set1I(int v) { return _mm256_set1_epi32(v); }
+	inline VecI LoadI(const void* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+	inline void StoreI(void* p, VecI v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	inline VecI AddI(VecI a, VecI b) { return _mm256_add_epi32(a, b); }
+	inline VecI MulI(VecI a, VecI b) { return _mm256_mullo_epi32(a, b); }
+	inline VecI MinI(VecI a, VecI b) { return _mm256_min_epi32(a, b); }
+	inline VecI AndI(VecI a, VecI b) { return _mm256_and_si256(a, b); }
+	inline VecI OrI(VecI a, VecI b) { return _mm256_or_si256(a, b); }
+	template <int N> inline VecI ShiftLeftI(VecI v) { return _mm256_slli_epi32(v, N); }
+	template <int N> inline VecI ShiftRightI(VecI v) { return _mm256_srli_epi32(v, N); }
+	template <int N> inline VecI ShiftRightArithI(VecI v) { return _mm256_srai_epi32(v, N); }
+	inline VecI SelectI(Mask m, VecI a, VecI b) { return _mm256_blendv_epi8(b, a, _mm256_castps_si256(m)); }
+	inline VecI ToInt(VecF v) { return _mm256_cvttps_epi32(v); }
+	inline VecF ToFloat(VecI v) { return _mm256_cvtepi32_ps(v); }
+	inline VecI LoadU16(const unsigned short* p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+
+	inline VecF Gather(const float* p, VecI index, Mask m)
+	{
+		return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), p, index, m, 4);
+	}
+
+	inline VecI SwizzleBGRX(VecI v)
+	{
+		const __m256i order = _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+			2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+		return _mm256_or_si256(_mm256_shuffle_epi8(v, order), _mm256_set1_epi32((int)0xFF000000u));
+	}
+}
+
+#include "SimdVectorKernels.h"
+
+
+const SimdKernels* AVX2Kernels()
+{
+	return &cVectorKernels;
+}
+
+#else
+
+const SimdKernels* AVX2Kernels()
+{
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,117 @@
+
+// Row kernels for AVX-512, 16 lanes. Built with -mavx512f -mavx512bw -mavx512dq -mavx512vl
+// (/arch:AVX512); runs only once DetectSimdLevel has found all four.
+
+#include "SimdKernels.h"
+
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512DQ__) && defined(__AVX512VL__)
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC 12's AVX-512 intrinsics start from a self-initialized "undefined" vector, which -Wall
+// reports as uninitialized wherever they are inlined (GCC bug 105593)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+
+namespace
+{
+	typedef __m512 VecF;
+	typedef __m512i VecI;
+	typedef __mmask16 Mask;
+	const int cLanes = 16;
+
+	inline VecF Zero() { return _mm512_setzero_ps(); }
+	inline VecF Set1(float v) { return _mm512_set1_ps(v); }
+	inline VecF Load(const float* p) { return _mm512_loadu_ps(p); }
+	inline void Store(float* p, VecF v) { _mm512_storeu_ps(p, v); }
+	inline VecF Add(VecF a, VecF b) { return _mm512_add_ps(a, b); }
+	inline VecF Sub(VecF a, VecF b) { return _mm512_sub_ps(a, b); }
+	inline VecF Mul(VecF a, VecF b) { return _mm512_mul_ps(a, b); }
+	inline VecF Div(VecF a, VecF b) { return _mm512_div_ps(a, b); }
+	inline VecF Min(VecF a, VecF b) { return _mm512_min_ps(a, b); }
+	inline VecF Max(VecF a, VecF b) { return _mm512_max_ps(a, b); }
+	inline VecF Sqrt(VecF v) { return _mm512_sqrt_ps(v); }
+	inline VecF Floor(VecF v) { return _mm512_roundscale_ps(v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+	inline float ReduceAdd(VecF v) { return _mm512_reduce_add_ps(v); }
+
+	inline VecF Lanes()
+	{
+		return _mm512_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f);
+	}
+
+	inline VecF Reverse(VecF v)
+	{
+		return _mm512_permutexvar_ps(_mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), v);
+	}
+
+	inline VecF LoadStride6(const float* p, int c)
+	{
+		const __m512i offsets = _mm512_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42, 48, 54, 60, 66, 72, 78, 84, 90);
+		return _mm512_i32gather_ps(offsets, p + c, 4);
+	}
+
+	inline Mask CmpGt(VecF a, VecF b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+	inline Mask CmpGe(VecF a, VecF b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+	inline Mask CmpLe(VecF a, VecF b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+	inline Mask CmpNeq(VecF a, VecF b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_UQ); }
+	inline Mask MaskAnd(Mask a, Mask b) { return (Mask)(a & b); }
+	inline Mask MaskOr(Mask a, Mask b) { return (Mask)(a | b); }
+	inline bool Any(Mask m) { return 0 != m; }
+
+	inline int Count(Mask m)
+	{
+		int count = 0;
+		for (unsigned int bits = m; 0 != bits; bits &= bits - 1)
+		{
+			count++;
+		}
+		return count;
+	}
+
+	inline VecF Select(Mask m, VecF a, VecF b) { return _mm512_mask_blend_ps(m, b, a); }
+
+	inline VecI ZeroI() { return _mm512_setzero_si512(); }
+	inline VecI Set1I(int v) { return _mm512_set1_epi32(v); }
+	inline VecI LoadI(const void* p) { return _mm512_loadu_si512(p); }
+	inline void StoreI(void* p, VecI v) { _mm512_storeu_si512(p, v); }
+	inline VecI AddI(VecI a, VecI b) { return _mm512_add_epi32(a, b); }
+	inline VecI MulI(VecI a, VecI b) { return _mm512_mullo_epi32(a, b); }
+	inline VecI MinI(VecI a, VecI b) { return _mm512_min_epi32(a, b); }
+	inline VecI AndI(VecI a, VecI b) { return _mm512_and_si512(a, b); }
+	inline VecI OrI(VecI a, VecI b) { return _mm512_or_si512(a, b); }
+	template <int N> inline VecI ShiftLeftI(VecI v) { return _mm512_slli_epi32(v, N); }
+	template <int N> inline VecI ShiftRightI(VecI v) { return _mm512_srli_epi32(v, N); }
+	template <int N> inline VecI ShiftRightArithI(VecI v) { return _mm512_srai_epi32(v, N); }
+	inline VecI SelectI(Mask m, VecI a, VecI b) { return _mm512_mask_blend_epi32(m, b, a); }
+	inline VecI ToInt(VecF v) { return _mm512_cvttps_epi32(v); }
+	inline VecF ToFloat(VecI v) { return _mm512_cvtepi32_ps(v); }
+	inline VecI LoadU16(const unsigned short* p) { return _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))); }
+
+	inline VecF Gather(const float* p, VecI index, Mask m)
+	{
+		return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, index, p, 4);
+	}
+
+	inline VecI SwizzleBGRX(VecI v)
+	{
+		const __m512i order = _mm512_broadcast_i32x4(_mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1));
+		return _mm512_or_si512(_mm512_shuffle_epi8(v, order), _mm512_set1_epi32((int)0xFF000000u));
+	}
+}
+
+#include "SimdVectorKernels.h"
+
+
+const SimdKernels* AVX512Kernels()
+{
+	return &cVectorKernels;
+}
+
+#else
+
+const SimdKernels* AVX512Kernels()
+{
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,100 @@
+
+// Row kernels for SSE4.1, 4 lanes. Built with -msse4.1 (MSVC needs no option for SSE4.1
+// intrinsics on x86 and x64); runs only once DetectSimdLevel has found SSE4.1.
+
+#include "SimdKernels.h"
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#include <smmintrin.h>
+#include <tmmintrin.h>
+
+namespace
+{
+	typedef __m128 VecF;
+	typedef __m128i VecI;
+	typedef __m128 Mask;
+	const int cLanes = 4;
+
+	inline VecF Zero() { return _mm_setzero_ps(); }
+	inline VecF Set1(float v) { return _mm_set1_ps(v); }
+	inline VecF Load(const float* p) { return _mm_loadu_ps(p); }
+	inline void Store(float* p, VecF v) { _mm_storeu_ps(p, v); }
+	inline VecF Add(VecF a, VecF b) { return _mm_add_ps(a, b); }
+	inline VecF Sub(VecF a, VecF b) { return _mm_sub_ps(a, b); }
+	inline VecF Mul(VecF a, VecF b) { return _mm_mul_ps(a, b); }
+	inline VecF Div(VecF a, VecF b) { return _mm_div_ps(a, b); }
+	inline VecF Min(VecF a, VecF b) { return _mm_min_ps(a, b); }
+	inline VecF Max(VecF a, VecF b) { return _mm_max_ps(a, b); }
+	inline VecF Sqrt(VecF v) { return _mm_sqrt_ps(v); }
+	inline VecF Floor(VecF v) { return _mm_floor_ps(v); }
+	inline VecF Lanes() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+	inline VecF Reverse(VecF v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3)); }
+
+	inline float ReduceAdd(VecF v)
+	{
+		VecF pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+	}
+
+	inline VecF LoadStride6(const float* p, int c)
+	{
+		return _mm_setr_ps(p[c], p[c + 6], p[c + 12], p[c + 18]);
+	}
+
+	inline Mask CmpGt(VecF a, VecF b) { return _mm_cmpgt_ps(a, b); }
+	inline Mask CmpGe(VecF a, VecF b) { return _mm_cmpge_ps(a, b); }
+	inline Mask CmpLe(VecF a, VecF b) { return _mm_cmple_ps(a, b); }
+	inline Mask CmpNeq(VecF a, VecF b) { return _mm_cmpneq_ps(a, b); }
+	inline Mask MaskAnd(Mask a, Mask b) { return _mm_and_ps(a, b); }
+	inline Mask MaskOr(Mask a, Mask b) { return _mm_or_ps(a, b); }
+	inline bool Any(Mask m) { return 0 != _mm_movemask_ps(m); }
+	inline int Count(Mask m) { static const int cBits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 }; return cBits[_mm_movemask_ps(m)]; }
+	inline VecF Select(Mask m, VecF a, VecF b) { return _mm_blendv_ps(b, a, m); }
+
+	inline VecI ZeroI() { return _mm_setzero_si128(); }
+	inline VecI Set1I(int v) { return _mm_set1_epi32(v); }
+	inline VecI LoadI(const void* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	inline void StoreI(void* p, VecI v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+	inline VecI AddI(VecI a, VecI b) { return _mm_add_epi32(a, b); }
+	inline VecI MulI(VecI a, VecI b) { return _mm_mullo_epi32(a, b); }
+	inline VecI MinI(VecI a, VecI b) { return _mm_min_epi32(a, b); }
+	inline VecI AndI(VecI a, VecI b) { return _mm_and_si128(a, b); }
+	inline VecI OrI(VecI a, VecI b) { return _mm_or_si128(a, b); }
+	template <int N> inline VecI ShiftLeftI(VecI v) { return _mm_slli_epi32(v, N); }
+	template <int N> inline VecI ShiftRightI(VecI v) { return _mm_srli_epi32(v, N); }
+	template <int N> inline VecI ShiftRightArithI(VecI v) { return _mm_srai_epi32(v, N); }
+	inline VecI SelectI(Mask m, VecI a, VecI b) { return _mm_blendv_epi8(b, a, _mm_castps_si128(m)); }
+	inline VecI ToInt(VecF v) { return _mm_cvttps_epi32(v); }
+	inline VecF ToFloat(VecI v) { return _mm_cvtepi32_ps(v); }
+	inline VecI LoadU16(const unsigned short* p) { return _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))); }
+
+	inline VecF Gather(const float* p, VecI index, Mask m)
+	{
+		int i[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(i), SelectI(m, index, ZeroI()));
+		return _mm_and_ps(_mm_setr_ps(p[i[0]], p[i[1]], p[i[2]], p[i[3]]), m);
+	}
+
+	inline VecI SwizzleBGRX(VecI v)
+	{
+		const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+		return _mm_or_si128(_mm_shuffle_epi8(v, order), _mm_set1_epi32((int)0xFF000000u));
+	}
+}
+
+#include "SimdVectorKernels.h"
+
+
+const SimdKernels* SSE41Kernels()
+{
+	return &cVectorKernels;
+}
+
+#else
+
+const SimdKernels* SSE41Kernels()
+{
+	return nullptr;
+}
+
+#endif
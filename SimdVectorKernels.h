@@ -0,0 +1,427 @@
+#pragma once
+
+// The row kernels of SimdKernels.h written once for any register width. Included only by the
+// SimdKernels<level>.cpp files, each compiled for its own instruction set, after they define in an
+// anonymous namespace:
+//
+//   VecF, VecI, Mask           cLanes floats, cLanes 32 bit integers, a per lane condition
+//   cLanes                     floats per register
+//   Zero, Set1, Load, Store, Add, Sub, Mul, Div, Min, Max, Sqrt, Floor, Lanes (0, 1, 2, ...), Reverse,
+//   ReduceAdd, LoadStride6 (component c of cLanes points of 6 floats), Gather (0 where the mask
+//   is off), CmpGt, CmpGe, CmpLe, CmpNeq, MaskAnd, MaskOr, Any, Count, Select (a where the mask is
+//   on, b elsewhere), ZeroI, Set1I, LoadI, StoreI, AddI, MulI, MinI, AndI, OrI, ShiftLeftI<n>,
+//   ShiftRightI<n> (logical), ShiftRightArithI<n>, SelectI, ToInt (truncating), ToFloat, LoadU16
+//   (widening), SwizzleBGRX (cLanes BGRX pixels to RGBA with alpha 255)
+//
+// Everything here has internal linkage and calls no inline function of another header: an inline
+// function instantiated in one of these files could be kept by the linker for the whole program,
+// and would then run instructions the CPU may not have.
+
+#include "SimdKernels.h"
+
+namespace
+{
+	void DepthToFloatRowVector(const unsigned short* pSrc, int width, float minMm, float maxMm, bool mirror, float* pDst)
+	{
+		const VecF vMin = Set1(minMm), vMax = Set1(maxMm), scale = Set1(0.001f), zero = Zero();
+		int x = 0;
+		for (; x + cLanes <= width; x += cLanes)
+		{
+			VecF mm = mirror ? Reverse(ToFloat(LoadU16(pSrc + width - x - cLanes))) : ToFloat(LoadU16(pSrc + x));
+			Store(pDst + x, Select(MaskAnd(CmpGe(mm, vMin), CmpLe(mm, vMax)), Mul(mm, scale), zero));
+		}
+		DepthToFloatRowScalar(pSrc, x, width, minMm, maxMm, mirror, pDst);
+	}
+
+
+	void BgrxToRgbaRowVector(const unsigned char* pSrc, unsigned char* pDst, int width)
+	{
+		int x = 0;
+		for (; x + cLanes <= width; x += cLanes)
+		{
+			StoreI(pDst + x * 4, SwizzleBGRX(LoadI(pSrc + x * 4)));
+		}
+		BgrxToRgbaRowScalar(pSrc, pDst, x, width);
+	}
+
+
+	VecF Clamp01(VecF v)
+	{
+		return Min(Max(v, Zero()), Set1(1.0f));
+	}
+
+	VecF PowInt(VecF base, int exponent)
+	{
+		VecF result = Set1(1.0f);
+		while (exponent > 0)
+		{
+			if (exponent & 1)
+			{
+				result = Mul(result, base);
+			}
+			base = Mul(base, base);
+			exponent >>= 1;
+		}
+		return result;
+	}
+
+	VecI ToByte(VecF v)
+	{
+		return ToInt(Add(Mul(Clamp01(v), Set1(255.0f)), Set1(0.5f)));
+	}
+
+	/// <summary>
+	/// x * a + y * b + z * c, rounded like the scalar kernels
+	/// </summary>
+	VecF Dot3(VecF x, VecF y, VecF z, float a, float b, float c)
+	{
+		return Add(Add(Mul(x, Set1(a)), Mul(y, Set1(b))), Mul(z, Set1(c)));
+	}
+
+	VecF Dot3(VecF x, VecF y, VecF z, VecF a, VecF b, VecF c)
+	{
+		return Add(Add(Mul(x, a), Mul(y, b)), Mul(z, c));
+	}
+
+
+	void ShadeRowVector(const float* pRow, int width, const Mat4& m, const ShadingTerms& t, unsigned int* pOut)
+	{
+		const VecF zero = Zero(), one = Set1(1.0f), half = Set1(0.5f);
+
+		int x = 0;
+		for (; x + cLanes <= width; x += cLanes)
+		{
+			const float* p = pRow + x * 6;
+			VecF px = LoadStride6(p, 0), py = LoadStride6(p, 1), pz = LoadStride6(p, 2);
+			VecF wx = LoadStride6(p, 3), wy = LoadStride6(p, 4), wz = LoadStride6(p, 5);
+
+			VecF cx = Add(Dot3(px, py, pz, m.M11, m.M21, m.M31), Set1(m.M41));
+			VecF cy = Add(Dot3(px, py, pz, m.M12, m.M22, m.M32), Set1(m.M42));
+			VecF cz = Add(Dot3(px, py, pz, m.M13, m.M23, m.M33), Set1(m.M43));
+			VecF nx = Dot3(wx, wy, wz, m.M11, m.M21, m.M31);
+			VecF ny = Dot3(wx, wy, wz, m.M12, m.M22, m.M32);
+			VecF nz = Dot3(wx, wy, wz, m.M13, m.M23, m.M33);
+
+			Mask valid = MaskAnd(CmpGt(Dot3(wx, wy, wz, wx, wy, wz), half), CmpGt(cz, zero));
+			if (!Any(valid))
+			{
+				StoreI(pOut + x, ZeroI());
+				continue;
+			}
+
+			VecF distance = Sqrt(Dot3(cx, cy, cz, cx, cy, cz));
+			VecF ndl = Max(Div(Sub(zero, Dot3(nx, ny, nz, cx, cy, cz)), distance), zero);
+
+			VecF r = one, g = one, b = one;
+			if (ShadeNormals == t.mode)
+			{
+				r = Add(Mul(nx, half), half);
+				g = Add(Mul(ny, half), half);
+				b = Add(Mul(nz, half), half);
+			}
+			else if (ShadeDepth == t.mode)
+			{
+				VecF d = Clamp01(Mul(Sub(cz, Set1(t.depthOffset)), Set1(t.depthScale)));
+				VecF ramp = Sub(Add(d, d), one);
+				r = Sub(one, d);
+				g = Sub(one, Max(ramp, Sub(zero, ramp)));
+				b = d;
+			}
+
+			VecF light = Add(Set1(t.ambient), Mul(Set1(t.diffuse), ndl));
+			VecF highlight = Mul(Set1(t.specular), PowInt(ndl, t.shininess));
+			VecI bgrx = OrI(ToByte(Add(Mul(b, light), highlight)),
+				OrI(ShiftLeftI<8>(ToByte(Add(Mul(g, light), highlight))), ShiftLeftI<16>(ToByte(Add(Mul(r, light), highlight)))));
+			StoreI(pOut + x, SelectI(valid, bgrx, ZeroI()));
+		}
+		ShadeRowScalar(pRow, x, width, m, t, pOut);
+	}
+
+
+	void IcpRowVector(const float* const* ppRow, int width, const IcpRowParameters& p, IcpSystem& system, int& valid)
+	{
+		const VecF zero = Zero(), half = Set1(0.5f);
+		const VecF modelWidth = Set1((float)p.modelWidth), modelHeight = Set1((float)p.modelHeight);
+		const Mat4& model = p.model;
+
+		// per lane sums over the row, added to the system at the end
+		VecF sumAtA[21], sumAtb[6], sumError = zero;
+		for (int i = 0; i < 21; ++i)
+		{
+			sumAtA[i] = zero;
+		}
+		for (int i = 0; i < 6; ++i)
+		{
+			sumAtb[i] = zero;
+		}
+		int count = 0;
+
+		int x = 0;
+		for (; x + cLanes <= width; x += cLanes)
+		{
+			VecF vx = Load(ppRow[0] + x), vy = Load(ppRow[1] + x), vz = Load(ppRow[2] + x);
+			VecF mx = Load(ppRow[3] + x), my = Load(ppRow[4] + x), mz = Load(ppRow[5] + x);
+			Mask inlier = MaskOr(MaskOr(CmpNeq(mx, zero), CmpNeq(my, zero)), CmpNeq(mz, zero));
+			valid += Count(inlier);
+			if (!Any(inlier))
+			{
+				continue;
+			}
+
+			// frame point and normal in world space under the current estimate
+			VecF w[3], n[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				w[i] = Add(Dot3(vx, vy, vz, p.R[i][0], p.R[i][1], p.R[i][2]), Set1(p.t[i]));
+				n[i] = Dot3(mx, my, mz, p.R[i][0], p.R[i][1], p.R[i][2]);
+			}
+
+			// projective association with the model raycast
+			VecF cx = Add(Dot3(w[0], w[1], w[2], model.M11, model.M21, model.M31), Set1(model.M41));
+			VecF cy = Add(Dot3(w[0], w[1], w[2], model.M12, model.M22, model.M32), Set1(model.M42));
+			VecF cz = Add(Dot3(w[0], w[1], w[2], model.M13, model.M23, model.M33), Set1(model.M43));
+			inlier = MaskAnd(inlier, CmpGt(cz, zero));
+			VecF u = Floor(Add(Add(Div(Mul(Set1(p.fx), cx), cz), Set1(p.cx)), half));
+			VecF h = Floor(Add(Add(Div(Mul(Set1(p.fy), cy), cz), Set1(p.cy)), half));
+			inlier = MaskAnd(inlier, MaskAnd(MaskAnd(CmpGe(u, zero), CmpGe(h, zero)),
+				MaskAnd(CmpGt(modelWidth, u), CmpGt(modelHeight, h))));
+			if (!Any(inlier))
+			{
+				continue;
+			}
+
+			VecI index = MulI(AddI(MulI(SelectI(inlier, ToInt(h), ZeroI()), Set1I(p.modelWidth)),
+				SelectI(inlier, ToInt(u), ZeroI())), Set1I(6));
+			VecF q[3], nq[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				q[i] = Gather(p.pModelPoints + i, index, inlier);
+				nq[i] = Gather(p.pModelPoints + 3 + i, index, inlier);
+			}
+			inlier = MaskAnd(inlier, MaskOr(MaskOr(CmpNeq(nq[0], zero), CmpNeq(nq[1], zero)), CmpNeq(nq[2], zero)));
+
+			VecF d[3] = { Sub(w[0], q[0]), Sub(w[1], q[1]), Sub(w[2], q[2]) };
+			inlier = MaskAnd(inlier, MaskAnd(CmpLe(Dot3(d[0], d[1], d[2], d[0], d[1], d[2]), Set1(p.distanceThreshold2)),
+				CmpGe(Dot3(n[0], n[1], n[2], nq[0], nq[1], nq[2]), Set1(p.normalThreshold))));
+			if (!Any(inlier))
+			{
+				continue;
+			}
+
+			// r = nq . (p - q); J = [p x nq, nq], zero for the outliers
+			VecF r = Select(inlier, Dot3(d[0], d[1], d[2], nq[0], nq[1], nq[2]), zero);
+			VecF J[6] = { Sub(Mul(w[1], nq[2]), Mul(w[2], nq[1])), Sub(Mul(w[2], nq[0]), Mul(w[0], nq[2])),
+				Sub(Mul(w[0], nq[1]), Mul(w[1], nq[0])), nq[0], nq[1], nq[2] };
+			for (int i = 0; i < 6; ++i)
+			{
+				J[i] = Select(inlier, J[i], zero);
+			}
+			int k = 0;
+			for (int i = 0; i < 6; ++i)
+			{
+				for (int j = i; j < 6; ++j)
+				{
+					sumAtA[k] = Add(sumAtA[k], Mul(J[i], J[j]));
+					k++;
+				}
+				sumAtb[i] = Sub(sumAtb[i], Mul(J[i], r));
+			}
+			sumError = Add(sumError, Mul(r, r));
+			count += Count(inlier);
+		}
+
+		for (int i = 0; i < 21; ++i)
+		{
+			system.AtA[i] += ReduceAdd(sumAtA[i]);
+		}
+		for (int i = 0; i < 6; ++i)
+		{
+			system.Atb[i] += ReduceAdd(sumAtb[i]);
+		}
+		system.error += ReduceAdd(sumError);
+		system.count += count;
+		IcpRowScalar(ppRow, x, width, p, system, valid);
+	}
+
+
+	int IntegrateBrickVector(const TsdfBrickParameters& p, float baseX, float baseY, float baseZ, TsdfVoxel* pVoxels)
+	{
+		const VecF zero = Zero(), one = Set1(1.0f), half = Set1(0.5f);
+		const VecF width = Set1((float)p.width), height = Set1((float)p.height);
+		const VecF truncation = Set1(p.truncation);
+		const VecI lanes = ToInt(Lanes()), lowHalf = Set1I(0xFFFF);
+		const VecI bit0 = Set1I(1), bit1 = Set1I(2), bit2 = Set1I(4);
+
+		int updated = 0;
+		int i = 0;
+		for (; i + cLanes <= cBrickVoxels; i += cLanes)
+		{
+			// the inverse of BrickVoxel
+			VecI voxel = AddI(Set1I(i), lanes);
+			VecF x = ToFloat(OrI(OrI(AndI(voxel, bit0), AndI(ShiftRightI<2>(voxel), bit1)), AndI(ShiftRightI<4>(voxel), bit2)));
+			VecF y = ToFloat(OrI(OrI(AndI(ShiftRightI<1>(voxel), bit0), AndI(ShiftRightI<3>(voxel), bit1)), AndI(ShiftRightI<5>(voxel), bit2)));
+			VecF z = ToFloat(OrI(OrI(AndI(ShiftRightI<2>(voxel), bit0), AndI(ShiftRightI<4>(voxel), bit1)), AndI(ShiftRightI<6>(voxel), bit2)));
+			VecF camZ = Add(Add(Add(Set1(baseZ), Mul(x, Set1(p.axes[0][2]))), Mul(y, Set1(p.axes[1][2]))), Mul(z, Set1(p.axes[2][2])));
+			Mask valid = CmpGt(camZ, zero);
+			if (!Any(valid))
+			{
+				continue;
+			}
+			VecF camX = Add(Add(Add(Set1(baseX), Mul(x, Set1(p.axes[0][0]))), Mul(y, Set1(p.axes[1][0]))), Mul(z, Set1(p.axes[2][0])));
+			VecF camY = Add(Add(Add(Set1(baseY), Mul(x, Set1(p.axes[0][1]))), Mul(y, Set1(p.axes[1][1]))), Mul(z, Set1(p.axes[2][1])));
+			VecF invZ = Div(one, camZ);
+			VecF u = Floor(Add(Add(Mul(Mul(Set1(p.fx), camX), invZ), Set1(p.cx)), half));
+			VecF v = Floor(Add(Add(Mul(Mul(Set1(p.fy), camY), invZ), Set1(p.cy)), half));
+			valid = MaskAnd(valid, MaskAnd(MaskAnd(CmpGe(u, zero), CmpGe(v, zero)), MaskAnd(CmpGt(width, u), CmpGt(height, v))));
+			if (!Any(valid))
+			{
+				continue;
+			}
+
+			VecI index = AddI(MulI(SelectI(valid, ToInt(v), ZeroI()), Set1I(p.width)), SelectI(valid, ToInt(u), ZeroI()));
+			VecF depth = Gather(p.pDepth, index, valid);
+			VecF sdf = Sub(depth, camZ);
+			valid = MaskAnd(valid, MaskAnd(CmpGt(depth, zero), CmpGe(sdf, Sub(zero, truncation))));
+			if (!Any(valid))
+			{
+				continue;
+			}
+
+			VecF tsdf = Select(CmpGe(sdf, truncation), one, Mul(sdf, Set1(p.invTruncation)));
+			// see TsdfVoxel; a blend of TSDFs stays in their range, so the low half needs no saturation
+			VecI voxels = LoadI(pVoxels + i);
+			VecI oldWeight = ShiftRightI<16>(voxels);
+			VecF weight = ToFloat(oldWeight);
+			VecF oldTsdf = ToFloat(ShiftRightArithI<16>(ShiftLeftI<16>(voxels)));
+			VecF blended = Div(Add(Mul(oldTsdf, weight), Mul(tsdf, Set1(p.tsdfScale))), Add(weight, one));
+			VecI newWeight = MinI(AddI(oldWeight, Set1I(1)), Set1I(p.maxWeight));
+			VecI updatedVoxels = OrI(AndI(ToInt(blended), lowHalf), ShiftLeftI<16>(newWeight));
+			StoreI(pVoxels + i, SelectI(valid, updatedVoxels, voxels));
+			updated += Count(valid);
+		}
+		return updated + IntegrateBrickScalar(p, i, baseX, baseY, baseZ, pVoxels);
+	}
+
+
+	void BilateralRowVector(const BilateralRowParameters& p, const float* const* ppTaps, int width, float* pOut)
+	{
+		const int centre = p.taps / 2;
+		const VecF zero = Zero(), one = Set1(1.0f), lastEntry = Set1((float)(cBilateralLutSize - 1));
+		const VecF lutScale = Set1(p.lutScale), minSupport = Set1(p.minSupport);
+
+		int x = 0;
+		for (; x + cLanes <= width; x += cLanes)
+		{
+			VecF z = Load(ppTaps[centre] + x);
+			Mask valid = CmpGt(z, zero);
+			if (!Any(valid))
+			{
+				Store(pOut + x, zero);
+				continue;
+			}
+
+			VecF invZ2 = Div(one, Mul(Select(valid, z, one), Select(valid, z, one)));
+			VecF sum = zero, weights = zero, support = zero;
+			for (int k = 0; k < p.taps; ++k)
+			{
+				VecF depth = Load(ppTaps[k] + x);
+				VecF difference = Sub(depth, z);
+				VecF entry = Mul(Mul(Mul(Mul(difference, difference), lutScale), invZ2), invZ2);
+				VecF weight = Mul(Set1(p.spatial[k]), Gather(p.pRangeLut, ToInt(Min(entry, lastEntry)), CmpGt(depth, zero)));
+				sum = Add(sum, Mul(weight, depth));
+				weights = Add(weights, weight);
+				support = (k == centre) ? support : Add(support, weight);
+			}
+			Mask keep = MaskAnd(valid, CmpGe(support, minSupport));
+			Store(pOut + x, Select(keep, Div(sum, Select(keep, weights, one)), zero));
+		}
+		BilateralRowScalar(p, ppTaps, x, width, pOut);
+	}
+
+
+	void TemporalMedianRowVector(const float* const* ppFrames, int frames, int width, float gate, float* pOut)
+	{
+		const VecF zero = Zero(), vGate = Set1(gate);
+
+		int x = 0;
+		for (; x + cLanes <= width; x += cLanes)
+		{
+			VecF z = Load(ppFrames[0] + x);
+			VecF tolerance = Mul(Mul(vGate, z), z);
+			VecF values[cMaxTemporalFrames];
+			for (int f = 0; f < frames; ++f)
+			{
+				VecF depth = Load(ppFrames[f] + x);
+				VecF difference = Max(Sub(depth, z), Sub(z, depth));
+				values[f] = Select(MaskAnd(CmpGt(depth, zero), CmpLe(difference, tolerance)), depth, z);
+			}
+
+			// odd-even transposition sort, as in the scalar kernel
+			for (int round = 0; round < frames; ++round)
+			{
+				for (int i = round & 1; i + 1 < frames; i += 2)
+				{
+					VecF low = Min(values[i], values[i + 1]);
+					values[i + 1] = Max(values[i], values[i + 1]);
+					values[i] = low;
+				}
+			}
+			Store(pOut + x, Select(CmpGt(z, zero), values[frames / 2], zero));
+		}
+		TemporalMedianRowScalar(ppFrames, frames, x, width, gate, pOut);
+	}
+
+
+	/// <summary>
+	/// The table of the including file's level
+	/// </summary>
+	void VertexNormalRowVector(const VertexNormalRowParameters& p, const float* pRow, const float* pBelow, int y, int width,
+		float* const* ppOut)
+	{
+		const VecF zero = Zero(), one = Set1(1.0f), invFx = Set1(p.invFx), cx = Set1(p.cx);
+		const VecF ry = Set1((y - p.cy) * p.invFy), rd = Set1((y + 1 - p.cy) * p.invFy);
+
+		// the right neighbour of the last lane must be in the row, so the scalar kernel ends it
+		int x = 0;
+		for (; x + cLanes < width; x += cLanes)
+		{
+			const VecF lanes = Add(Set1((float)x), Lanes());
+			const VecF z = Load(pRow + x);
+			const VecF rx = Mul(Sub(lanes, cx), invFx);
+			const VecF vx = Mul(rx, z), vy = Mul(ry, z);
+			Store(ppOut[0] + x, vx);
+			Store(ppOut[1] + x, vy);
+			Store(ppOut[2] + x, z);
+
+			const VecF zRight = Load(pRow + x + 1);
+			const VecF zDown = (nullptr != pBelow) ? Load(pBelow + x) : zero;
+			Mask valid = MaskAnd(CmpGt(z, zero), MaskAnd(CmpGt(zRight, zero), CmpGt(zDown, zero)));
+			if (!Any(valid))
+			{
+				Store(ppOut[3] + x, zero);
+				Store(ppOut[4] + x, zero);
+				Store(ppOut[5] + x, zero);
+				continue;
+			}
+
+			const VecF rxRight = Mul(Sub(Add(lanes, one), cx), invFx);
+			const VecF ax = Sub(Mul(rxRight, zRight), vx), ay = Sub(Mul(ry, zRight), vy), az = Sub(zRight, z);
+			const VecF bx = Sub(Mul(rx, zDown), vx), by = Sub(Mul(rd, zDown), vy), bz = Sub(zDown, z);
+			const VecF nx = Sub(Mul(az, by), Mul(ay, bz));
+			const VecF ny = Sub(Mul(ax, bz), Mul(az, bx));
+			const VecF nz = Sub(Mul(ay, bx), Mul(ax, by));
+			const VecF length2 = Add(Add(Mul(nx, nx), Mul(ny, ny)), Mul(nz, nz));
+			valid = MaskAnd(valid, CmpGt(length2, zero));
+			const VecF inv = Div(one, Sqrt(Select(valid, length2, one)));
+			Store(ppOut[3] + x, Select(valid, Mul(nx, inv), zero));
+			Store(ppOut[4] + x, Select(valid, Mul(ny, inv), zero));
+			Store(ppOut[5] + x, Select(valid, Mul(nz, inv), zero));
+		}
+		VertexNormalRowScalar(p, pRow, pBelow, y, x, width, ppOut);
+	}
+
+
+	const SimdKernels cVectorKernels = { &DepthToFloatRowVector, &BgrxToRgbaRowVector, &ShadeRowVector, &IcpRowVector,
+		&IntegrateBrickVector, &BilateralRowVector, &TemporalMedianRowVector,
+		&VertexNormalRowVector };
+}
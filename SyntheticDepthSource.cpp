@@ -0,0 +1,67 @@
+#include "SyntheticDepthSource.h"
+
+#include <algorithm>
+
+
+SyntheticDepthSource::SyntheticDepthSource(const DepthSourceSettings& settings)
+	: m_settings(settings)
+	, m_scene(settings.seed)
+	, m_intrinsics(KinectDepthIntrinsics())
+	, m_next(0)
+{
+	SetIdentity(m_pose);
+}
+
+
+bool SyntheticDepthSource::Open()
+{
+	if (m_settings.width < 40 || m_settings.height < 30)
+	{
+		m_error = "the synthetic frames must be at least 40x30";
+		return false;
+	}
+	m_depthMm.resize((size_t)m_settings.width * m_settings.height);
+	m_next = 0;
+	m_pacer.Start(m_settings.frameRateHz);
+	return true;
+}
+
+
+Mat4 SyntheticDepthSource::Pose(int frame) const
+{
+	return m_scene.CameraPose(std::max(0, frame - m_settings.holdFrames));
+}
+
+
+DepthFrameStatus SyntheticDepthSource::NextFrame(DepthFrame& frame, int timeoutMs)
+{
+	if (m_settings.frames > 0 && m_next >= m_settings.frames)
+	{
+		if (!m_settings.loop)
+		{
+			return DepthFrameEnd;
+		}
+		m_next = 0;
+	}
+	if (!m_pacer.Wait(timeoutMs))
+	{
+		return DepthFrameTimeout;
+	}
+
+	m_pose = Pose(m_next);
+	m_scene.RenderDepth(m_pose, m_intrinsics, m_settings.width, m_settings.height, m_settings.noise, m_next, m_depthMm.data());
+
+	frame.pDepthMm = m_depthMm.data();
+	frame.width = m_settings.width;
+	frame.height = m_settings.height;
+	frame.timestamp = m_next / 30.0;
+	frame.index = m_next++;
+	return DepthFrameReady;
+}
+
+
+bool SyntheticDepthSource::GroundTruth(Mat4& worldToCamera) const
+{
+	worldToCamera = m_pose;
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "DepthSource.h"
+#include "SyntheticScene.h"
+#include "MemoryAccounting.h"
+
+#include <vector>
+
+/// <summary>
+/// The synthetic scene rendered from its ground truth trajectory, with Kinect-like noise
+/// </summary>
+class SyntheticDepthSource : public DepthSource
+{
+public:
+	explicit SyntheticDepthSource(const DepthSourceSettings& settings);
+
+	const char* Name() const { return "synthetic"; }
+	bool Open();
+	int Width() const { return m_settings.width; }
+	int Height() const { return m_settings.height; }
+	DepthFrameStatus NextFrame(DepthFrame& frame, int timeoutMs);
+	bool GroundTruth(Mat4& worldToCamera) const;
+
+	const SyntheticScene& Scene() const { return m_scene; }
+
+	/// <summary>
+	/// Ground truth pose of a frame: still during the hold, then moving along CameraPose
+	/// </summary>
+	Mat4 Pose(int frame) const;
+
+private:
+	DepthSourceSettings         m_settings;
+	SyntheticScene              m_scene;
+	CameraIntrinsics            m_intrinsics;
+	std::vector<unsigned short, TaggedAllocator<unsigned short, MemoryFrames> > m_depthMm;
+	int                         m_next;				// frame index in the sequence
+	Mat4                        m_pose;
+	FramePacer                  m_pacer;
+};
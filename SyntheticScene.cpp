@@ -0,0 +1,139 @@
+
+#include "SyntheticScene.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <math.h>
+
+
+/// <summary>
+/// splitmix64: a counter-based generator, so every pixel of every frame draws its own numbers
+/// </summary>
+static inline unsigned long long Mix(unsigned long long x)
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+static inline float Uniform(unsigned long long bits)
+{
+	// 24 random bits in (0, 1]
+	return ((float)(bits >> 40) + 1.0f) * (1.0f / 16777216.0f);
+}
+
+static inline float SphereDistance(const float p[3], float x, float y, float z, float radius)
+{
+	float dx = p[0] - x, dy = p[1] - y, dz = p[2] - z;
+	return sqrtf(dx * dx + dy * dy + dz * dz) - radius;
+}
+
+static inline float BoxDistance(const float p[3], float x, float y, float z, float hx, float hy, float hz)
+{
+	float qx = fabsf(p[0] - x) - hx, qy = fabsf(p[1] - y) - hy, qz = fabsf(p[2] - z) - hz;
+	float ox = std::max(qx, 0.0f), oy = std::max(qy, 0.0f), oz = std::max(qz, 0.0f);
+	return sqrtf(ox * ox + oy * oy + oz * oz) + std::min(std::max(qx, std::max(qy, qz)), 0.0f);
+}
+
+
+SyntheticScene::SyntheticScene(unsigned int seed)
+	: m_seed(seed)
+{
+}
+
+
+float SyntheticScene::SignedDistance(const float p[3]) const
+{
+	// the room: floor below the camera (+y is down), a back wall and a left wall
+	float d = 0.55f - p[1];
+	d = std::min(d, 1.9f - p[2]);
+	d = std::min(d, p[0] + 0.9f);
+
+	d = std::min(d, SphereDistance(p, 0.15f, 0.1f, 1.2f, 0.25f));
+	d = std::min(d, SphereDistance(p, 0.5f, 0.43f, 0.9f, 0.12f));
+	d = std::min(d, BoxDistance(p, -0.4f, 0.35f, 1.0f, 0.15f, 0.2f, 0.15f));
+	return d;
+}
+
+
+Mat4 SyntheticScene::CameraPose(int frame) const
+{
+	const float s = frame / 30.0f;
+	const float yaw = 0.15f * sinf(0.4f * s);
+	const float pitch = 0.05f * sinf(0.6f * s);
+
+	// camera to world: rotate about y (yaw), then x (pitch), then move
+	float cy = cosf(yaw), sy = sinf(yaw), cp = cosf(pitch), sp = sinf(pitch);
+	Mat4 cameraToWorld;
+	SetIdentity(cameraToWorld);
+	cameraToWorld.M11 = cy;       cameraToWorld.M12 = 0.0f; cameraToWorld.M13 = -sy;
+	cameraToWorld.M21 = sy * sp;  cameraToWorld.M22 = cp;   cameraToWorld.M23 = cy * sp;
+	cameraToWorld.M31 = sy * cp;  cameraToWorld.M32 = -sp;  cameraToWorld.M33 = cy * cp;
+	cameraToWorld.M41 = 0.15f * sinf(0.5f * s);
+	cameraToWorld.M42 = 0.05f * sinf(0.7f * s);
+	cameraToWorld.M43 = 0.1f * (1.0f - cosf(0.3f * s));
+	return InverseAffine(cameraToWorld);
+}
+
+
+void SyntheticScene::RenderDepth(const Mat4& worldToCamera, const CameraIntrinsics& intrinsics, int width, int height,
+	float noise, int frame, unsigned short* pDepthMm) const
+{
+	const Mat4 cameraToWorld = InverseAffine(worldToCamera);
+	const float fx = intrinsics.focalLengthX * width;
+	const float fy = intrinsics.focalLengthY * height;
+	const float cx = intrinsics.principalPointX * width - 0.5f;
+	const float cy = intrinsics.principalPointY * height - 0.5f;
+	const unsigned long long frameKey = Mix(((unsigned long long)m_seed << 32) ^ (unsigned int)frame);
+
+	float origin[3];
+	const float zero[3] = { 0.0f, 0.0f, 0.0f };
+	TransformPoint(cameraToWorld, zero, origin);
+
+	ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				// sphere trace along the ray; z is the camera depth per unit of the ray parameter
+				const float ray[3] = { (x - cx) / fx, (y - cy) / fy, 1.0f };
+				float direction[3];
+				TransformVector(cameraToWorld, ray, direction);
+				float rayLength = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+
+				float t = 0.0f;
+				bool hit = false;
+				for (int step = 0; step < 128 && t < 8.0f; ++step)
+				{
+					float p[3] = { origin[0] + t * direction[0], origin[1] + t * direction[1], origin[2] + t * direction[2] };
+					float d = SignedDistance(p);
+					if (d < 1e-4f)
+					{
+						hit = true;
+						break;
+					}
+					t += d / rayLength;
+				}
+
+				unsigned short mm = 0;
+				if (hit)
+				{
+					float z = t;
+					if (noise > 0.0f)
+					{
+						// Box-Muller over two counter-based uniforms
+						unsigned long long key = Mix(frameKey ^ ((unsigned long long)y * width + x));
+						float g = sqrtf(-2.0f * logf(Uniform(key))) * cosf(6.2831853f * Uniform(Mix(key)));
+						float sigma = 0.0012f + 0.0019f * (z - 0.4f) * (z - 0.4f);
+						z += noise * sigma * g;
+					}
+					float value = z * 1000.0f + 0.5f;
+					mm = (value > 0.0f && value < 65535.0f) ? (unsigned short)value : (unsigned short)0;
+				}
+				pDepthMm[(size_t)y * width + x] = mm;
+			}
+		}
+	}, 4);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FusionMath.h"
+
+/// <summary>
+/// Analytic test scene for running the native pipeline without a sensor: a room corner (floor,
+/// back and left wall) with two spheres and a box, seen by a camera that starts at the world
+/// origin looking down +z (y pointing down, as in the Kinect camera space) and sways slowly.
+/// Everything is a pure function of the seed and the frame index, so runs are reproducible
+/// whatever the thread count.
+/// </summary>
+class SyntheticScene
+{
+public:
+	explicit SyntheticScene(unsigned int seed = 1);
+
+	/// <summary>
+	/// Distance (in m) from a world space point to the nearest surface, negative inside objects
+	/// </summary>
+	float SignedDistance(const float p[3]) const;
+
+	/// <summary>
+	/// Ground truth world-to-camera transform of a frame, at 30 frames per second
+	/// </summary>
+	Mat4 CameraPose(int frame) const;
+
+	/// <summary>
+	/// Render the depth (in mm, 0 = no reading) seen from a pose by sphere tracing.
+	/// </summary>
+	/// <param name="noise">scale of the Kinect-like axial noise, which grows with the square of the
+	/// distance; 0 renders exact depth</param>
+	/// <param name="frame">selects the noise pattern</param>
+	void RenderDepth(const Mat4& worldToCamera, const CameraIntrinsics& intrinsics, int width, int height,
+		float noise, int frame, unsigned short* pDepthMm) const;
+
+private:
+	unsigned int                m_seed;
+};
@@ -0,0 +1,473 @@
+
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+static inline int HighestBit(unsigned long long value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+#ifdef _M_X64
+	_BitScanReverse64(&index, value);
+#else
+	if (value >> 32)
+	{
+		_BitScanReverse(&index, (unsigned long)(value >> 32));
+		index += 32;
+	}
+	else
+	{
+		_BitScanReverse(&index, (unsigned long)value);
+	}
+#endif
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+
+LatencyHistogram::LatencyHistogram()
+	: m_total(0)
+	, m_sumNs(0)
+	, m_maxNs(0)
+{
+	for (int i = 0; i < cBucketCount; ++i)
+	{
+		m_counts[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+
+void LatencyHistogram::Clear()
+{
+	for (int i = 0; i < cBucketCount; ++i)
+	{
+		m_counts[i].store(0, std::memory_order_relaxed);
+	}
+	m_total.store(0, std::memory_order_relaxed);
+	m_sumNs.store(0, std::memory_order_relaxed);
+	m_maxNs.store(0, std::memory_order_relaxed);
+}
+
+
+int LatencyHistogram::BucketOf(unsigned long long ns)
+{
+	if (ns < 2 * cSubBuckets)
+	{
+		return (int)ns;
+	}
+	int exponent = HighestBit(ns);
+	if (exponent >= cMaxExponent)
+	{
+		return cBucketCount - 1;
+	}
+	int sub = (int)(ns >> (exponent - 4)) - cSubBuckets;
+	return 2 * cSubBuckets + (exponent - 5) * cSubBuckets + sub;
+}
+
+
+unsigned long long LatencyHistogram::BucketLowerBound(int bucket)
+{
+	if (bucket < 2 * cSubBuckets)
+	{
+		return (unsigned long long)bucket;
+	}
+	int exponent = (bucket - 2 * cSubBuckets) / cSubBuckets + 5;
+	int sub = (bucket - 2 * cSubBuckets) % cSubBuckets;
+	return (unsigned long long)(cSubBuckets + sub) << (exponent - 4);
+}
+
+
+unsigned long long LatencyHistogram::BucketWidth(int bucket)
+{
+	if (bucket < 2 * cSubBuckets)
+	{
+		return 1;
+	}
+	int exponent = (bucket - 2 * cSubBuckets) / cSubBuckets + 5;
+	return 1ull << (exponent - 4);
+}
+
+
+long long TelemetrySnapshot::Counter(const std::string& name) const
+{
+	for (size_t i = 0; i < counters.size(); ++i)
+	{
+		if (counters[i].first == name)
+		{
+			return counters[i].second;
+		}
+	}
+	return 0;
+}
+
+
+const StageSummary* TelemetrySnapshot::Stage(const std::string& name) const
+{
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		if (stages[i].name == name)
+		{
+			return &stages[i];
+		}
+	}
+	return nullptr;
+}
+
+
+// quotes and backslashes escaped, control characters as \u00XX: event text is free-form
+static std::string JsonEscape(const char* text)
+{
+	std::string escaped;
+	for (; nullptr != text && *text; ++text)
+	{
+		if (*text == '"' || *text == '\\')
+		{
+			escaped += '\\';
+			escaped += *text;
+		}
+		else if ((unsigned char)*text < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", (unsigned int)(unsigned char)*text);
+			escaped += code;
+		}
+		else
+		{
+			escaped += *text;
+		}
+	}
+	return escaped;
+}
+
+
+std::string TelemetrySnapshot::ToJson() const
+{
+	std::ostringstream json;
+	json << std::fixed << std::setprecision(4);
+	json << "{\n  \"elapsedSeconds\": " << elapsedSeconds << ",\n";
+	json << "  \"scopeOverheadNs\": " << scopeOverheadNs << ",\n";
+	json << "  \"stages\": [\n";
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		const StageSummary& s = stages[i];
+		json << "    { \"name\": \"" << JsonEscape(s.name.c_str()) << "\", \"count\": " << s.count
+			<< ", \"meanMs\": " << s.meanMs << ", \"p50Ms\": " << s.p50Ms << ", \"p95Ms\": " << s.p95Ms
+			<< ", \"p99Ms\": " << s.p99Ms << ", \"maxMs\": " << s.maxMs << " }"
+			<< (i + 1 < stages.size() ? "," : "") << "\n";
+	}
+	json << "  ],\n  \"counters\": {\n";
+	for (size_t i = 0; i < counters.size(); ++i)
+	{
+		json << "    \"" << JsonEscape(counters[i].first.c_str()) << "\": " << counters[i].second << (i + 1 < counters.size() ? "," : "") << "\n";
+	}
+	json << "  },\n  \"eventCount\": " << eventCount << ",\n  \"events\": [\n";
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		json << "    { \"seconds\": " << events[i].seconds << ", \"text\": \"" << JsonEscape(events[i].text) << "\" }"
+			<< (i + 1 < events.size() ? "," : "") << "\n";
+	}
+	json << "  ],\n  \"memory\": " << memory.ToJson() << "\n}\n";
+	return json.str();
+}
+
+
+std::string TelemetrySnapshot::ToCsv() const
+{
+	std::ostringstream csv;
+	csv << std::fixed << std::setprecision(4);
+	csv << "kind,name,count,meanMs,p50Ms,p95Ms,p99Ms,maxMs\n";
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		const StageSummary& s = stages[i];
+		csv << "stage," << s.name << "," << s.count << "," << s.meanMs << "," << s.p50Ms << ","
+			<< s.p95Ms << "," << s.p99Ms << "," << s.maxMs << "\n";
+	}
+	for (size_t i = 0; i < counters.size(); ++i)
+	{
+		csv << "counter," << counters[i].first << "," << counters[i].second << ",,,,,\n";
+	}
+	for (size_t i = 0; i < memory.tags.size(); ++i)
+	{
+		const MemoryTagUsage& t = memory.tags[i];
+		csv << "memory," << t.name << ".liveBytes," << t.liveBytes << ",,,,,\n";
+		csv << "memory," << t.name << ".peakBytes," << t.peakBytes << ",,,,,\n";
+		csv << "memory," << t.name << ".refused," << t.refused << ",,,,,\n";
+	}
+	csv << "memory,budgetBytes," << memory.budgetBytes << ",,,,,\n";
+	csv << "memory,peakBytes," << memory.peakBytes << ",,,,,\n";
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		// quoted field: quotes inside are doubled
+		std::string text(events[i].text);
+		for (size_t quote = text.find('"'); std::string::npos != quote; quote = text.find('"', quote + 2))
+		{
+			text.insert(quote, 1, '"');
+		}
+		csv << "event,\"" << text << "\"," << events[i].seconds << ",,,,,\n";
+	}
+	csv << "meta,elapsedSeconds," << elapsedSeconds << ",,,,,\n";
+	csv << "meta,scopeOverheadNs," << scopeOverheadNs << ",,,,,\n";
+	return csv.str();
+}
+
+
+std::string TelemetrySnapshot::ToText() const
+{
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(2);
+	text << "stage            p50     p95     p99     max (ms)\n";
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		const StageSummary& s = stages[i];
+		if (0 == s.count)
+		{
+			continue;
+		}
+		text << std::left << std::setw(14) << s.name << std::right
+			<< std::setw(7) << s.p50Ms << " " << std::setw(7) << s.p95Ms << " "
+			<< std::setw(7) << s.p99Ms << " " << std::setw(7) << s.maxMs << "\n";
+	}
+	for (size_t i = 0; i < counters.size(); ++i)
+	{
+		text << counters[i].first << ": " << counters[i].second << (i + 1 < counters.size() ? ", " : "\n");
+	}
+	text << memory.ToText() << "\n";
+	if (!events.empty())
+	{
+		text << "last event: " << events.back().text << "\n";
+	}
+	return text.str();
+}
+
+
+Telemetry& Telemetry::Instance()
+{
+	static Telemetry telemetry;
+	return telemetry;
+}
+
+
+Telemetry::Telemetry()
+	: m_eventCount(0)
+	, m_start(Clock::now())
+	, m_scopeOverheadNs(0)
+{
+	// never reallocated, so StageName can hand out c_str()
+	m_stageNames.reserve(cMaxStages);
+	m_counterNames.reserve(cMaxCounters);
+	for (int i = 0; i < cMaxCounters; ++i)
+	{
+		m_counters[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+
+static int FindOrAdd(std::vector<std::string>& names, const char* name, int maxCount, const char* kind)
+{
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (names[i] == name)
+		{
+			return (int)i;
+		}
+	}
+	if ((int)names.size() >= maxCount)
+	{
+		// out of slots: sharing one would mix two histograms, so the name is dropped, loudly but
+		// without failing at static initialization
+		fprintf(stderr, "Telemetry: more than %d %s, \"%s\" is not recorded\n", maxCount, kind, name);
+		return Telemetry::cInvalidId;
+	}
+	names.push_back(name);
+	return (int)names.size() - 1;
+}
+
+
+StageId Telemetry::RegisterStage(const char* name)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return FindOrAdd(m_stageNames, name, cMaxStages, "stages");
+}
+
+
+CounterId Telemetry::RegisterCounter(const char* name)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return FindOrAdd(m_counterNames, name, cMaxCounters, "counters");
+}
+
+
+const char* Telemetry::StageName(StageId stage)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return (cInvalidId == stage) ? "unregistered" : m_stageNames[stage].c_str();
+}
+
+
+LatencyHistogram* Telemetry::AddThread()
+{
+	std::unique_ptr<LatencyHistogram[]> histograms(new LatencyHistogram[cMaxStages]);
+	LatencyHistogram* pHistograms = histograms.get();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_threads.push_back(std::move(histograms));
+	return pHistograms;
+}
+
+
+void Telemetry::LogEvent(const char* text)
+{
+	double seconds = std::chrono::duration<double>(Clock::now() - m_start).count();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	TelemetryEvent& event = m_events[m_eventCount % cMaxEvents];
+	event.seconds = seconds;
+	snprintf(event.text, sizeof(event.text), "%s", text);
+	m_eventCount++;
+}
+
+
+TelemetrySnapshot Telemetry::Snapshot()
+{
+	TelemetrySnapshot snapshot;
+	snapshot.elapsedSeconds = std::chrono::duration<double>(Clock::now() - m_start).count();
+	snapshot.memory = MemoryAccounting::Instance().Report();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	snapshot.scopeOverheadNs = m_scopeOverheadNs;
+
+	std::vector<unsigned long long> merged(LatencyHistogram::cBucketCount);
+	for (size_t stage = 0; stage < m_stageNames.size(); ++stage)
+	{
+		std::fill(merged.begin(), merged.end(), 0ull);
+		unsigned long long total = 0, sumNs = 0, maxNs = 0;
+		for (size_t t = 0; t < m_threads.size(); ++t)
+		{
+			const LatencyHistogram& h = m_threads[t][stage];
+			for (int b = 0; b < LatencyHistogram::cBucketCount; ++b)
+			{
+				merged[b] += h.Count(b);
+			}
+			sumNs += h.SumNs();
+			maxNs = (h.MaxNs() > maxNs) ? h.MaxNs() : maxNs;
+		}
+		for (int b = 0; b < LatencyHistogram::cBucketCount; ++b)
+		{
+			total += merged[b];
+		}
+
+		// percentiles at the middle of their bucket, never above the exact maximum
+		const double quantiles[3] = { 0.50, 0.95, 0.99 };
+		double values[3] = { 0, 0, 0 };
+		for (int q = 0; q < 3 && total > 0; ++q)
+		{
+			unsigned long long rank = (unsigned long long)(quantiles[q] * (double)total + 0.5);
+			rank = (rank < 1) ? 1 : rank;
+			unsigned long long seen = 0;
+			for (int b = 0; b < LatencyHistogram::cBucketCount; ++b)
+			{
+				seen += merged[b];
+				if (seen >= rank)
+				{
+					double middle = (double)LatencyHistogram::BucketLowerBound(b) + 0.5 * (double)(LatencyHistogram::BucketWidth(b) - 1);
+					values[q] = (middle < (double)maxNs) ? middle : (double)maxNs;
+					break;
+				}
+			}
+		}
+
+		StageSummary summary;
+		summary.name = m_stageNames[stage];
+		summary.count = total;
+		summary.meanMs = (total > 0) ? (double)sumNs / total * 1e-6 : 0;
+		summary.p50Ms = values[0] * 1e-6;
+		summary.p95Ms = values[1] * 1e-6;
+		summary.p99Ms = values[2] * 1e-6;
+		summary.maxMs = (double)maxNs * 1e-6;
+		snapshot.stages.push_back(summary);
+	}
+
+	for (size_t i = 0; i < m_counterNames.size(); ++i)
+	{
+		snapshot.counters.push_back(std::make_pair(m_counterNames[i], m_counters[i].load(std::memory_order_relaxed)));
+	}
+
+	snapshot.eventCount = m_eventCount;
+	long long first = (m_eventCount > cMaxEvents) ? m_eventCount - cMaxEvents : 0;
+	for (long long i = first; i < m_eventCount; ++i)
+	{
+		snapshot.events.push_back(m_events[i % cMaxEvents]);
+	}
+	return snapshot;
+}
+
+
+void Telemetry::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t t = 0; t < m_threads.size(); ++t)
+	{
+		for (int stage = 0; stage < cMaxStages; ++stage)
+		{
+			m_threads[t][stage].Clear();
+		}
+	}
+	for (int i = 0; i < cMaxCounters; ++i)
+	{
+		m_counters[i].store(0, std::memory_order_relaxed);
+	}
+	m_eventCount = 0;
+	m_start = Clock::now();
+}
+
+
+bool Telemetry::WriteSnapshot(const std::string& path)
+{
+	TelemetrySnapshot snapshot = Snapshot();
+	bool csv = path.size() >= 4 && 0 == path.compare(path.size() - 4, 4, ".csv");
+
+	// write aside and swap in, so a reader never sees half a file
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::out | std::ios::trunc);
+		if (!file)
+		{
+			return false;
+		}
+		file << (csv ? snapshot.ToCsv() : snapshot.ToJson());
+		if (!file)
+		{
+			return false;
+		}
+	}
+	remove(path.c_str());
+	return 0 == rename(temporary.c_str(), path.c_str());
+}
+
+
+double Telemetry::MeasureScopeOverhead(int iterations)
+{
+	// time real, empty scopes; they land in a stage of their own
+	StageId stage = RegisterStage("scope-overhead");
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		ScopedStageTimer scope(stage);
+	}
+	double overheadNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (iterations > 0 ? iterations : 1);
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_scopeOverheadNs = overheadNs;
+	return overheadNs;
+}
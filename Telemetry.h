@@ -0,0 +1,275 @@
+#pragma once
+
+#include "Timer.h"
+#include "TraceRecorder.h"
+#include "MemoryAccounting.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef int StageId;
+typedef int CounterId;
+
+/// <summary>
+/// Log-linear latency histogram in nanoseconds, in the spirit of HdrHistogram: values below 32 ns
+/// are exact, above that every power of two is split into 16 buckets (at most 6% error).
+/// Record may only be called by one thread; any thread may read.
+/// </summary>
+class LatencyHistogram
+{
+public:
+	static const int            cSubBuckets = 16;
+	static const int            cMaxExponent = 40;		// ~18 minutes
+	static const int            cBucketCount = 2 * cSubBuckets + (cMaxExponent - 5) * cSubBuckets;
+
+	LatencyHistogram();
+
+	/// <summary>
+	/// Single writer: plain loads and stores, no read-modify-write
+	/// </summary>
+	void Record(unsigned long long ns)
+	{
+		int bucket = BucketOf(ns);
+		m_counts[bucket].store(m_counts[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_total.store(m_total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_sumNs.store(m_sumNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+		if (ns > m_maxNs.load(std::memory_order_relaxed))
+		{
+			m_maxNs.store(ns, std::memory_order_relaxed);
+		}
+	}
+
+	/// <summary>
+	/// Forget all values; only safe while the owning thread is not recording
+	/// </summary>
+	void Clear();
+
+	static int BucketOf(unsigned long long ns);
+
+	/// <summary>
+	/// Smallest value that falls in the bucket, and the bucket width
+	/// </summary>
+	static unsigned long long BucketLowerBound(int bucket);
+	static unsigned long long BucketWidth(int bucket);
+
+	unsigned long long Count(int bucket) const { return m_counts[bucket].load(std::memory_order_relaxed); }
+	unsigned long long Total() const { return m_total.load(std::memory_order_relaxed); }
+	unsigned long long SumNs() const { return m_sumNs.load(std::memory_order_relaxed); }
+	unsigned long long MaxNs() const { return m_maxNs.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<unsigned long long> m_counts[cBucketCount];
+	std::atomic<unsigned long long> m_total;
+	std::atomic<unsigned long long> m_sumNs;
+	std::atomic<unsigned long long> m_maxNs;
+};
+
+
+/// <summary>
+/// Latency summary of one stage, all threads merged. Times in ms.
+/// </summary>
+struct StageSummary
+{
+	std::string                 name;
+	unsigned long long          count;
+	double                      meanMs;
+	double                      p50Ms;
+	double                      p95Ms;
+	double                      p99Ms;
+	double                      maxMs;
+};
+
+/// <summary>
+/// A logged decision, e.g. of the quality governor
+/// </summary>
+struct TelemetryEvent
+{
+	double                      seconds;			// since start
+	char                        text[128];
+};
+
+/// <summary>
+/// Point-in-time copy of all stages and counters, accumulated since start
+/// </summary>
+struct TelemetrySnapshot
+{
+	double                      elapsedSeconds;
+	double                      scopeOverheadNs;
+	std::vector<StageSummary>   stages;
+	std::vector<std::pair<std::string, long long> > counters;
+	MemoryReport                memory;
+
+	/// <summary>
+	/// The last Telemetry::cMaxEvents events, oldest first, out of eventCount since start
+	/// </summary>
+	std::vector<TelemetryEvent> events;
+	long long                   eventCount;
+
+	long long Counter(const std::string& name) const;
+
+	/// <summary>
+	/// Summary of a stage by name; nullptr if it was never registered
+	/// </summary>
+	const StageSummary* Stage(const std::string& name) const;
+
+	std::string ToJson() const;
+	std::string ToCsv() const;
+
+	/// <summary>
+	/// One line per stage, for the console or an overlay
+	/// </summary>
+	std::string ToText() const;
+};
+
+
+/// <summary>
+/// Low-overhead pipeline instrumentation.
+/// Stages are timed with ScopedStageTimer into histograms owned by the recording thread, so
+/// recording takes no lock and shares no cache line with other threads; Snapshot merges them.
+/// Counters are process-wide atomics for rare events (lost frames, resets, ...).
+/// </summary>
+class Telemetry
+{
+public:
+	static const int            cMaxStages = 32;
+	static const int            cMaxCounters = 32;
+	static const int            cMaxEvents = 64;
+	static const int            cInvalidId = -1;		// a stage or counter past the maximum, ignored
+
+	typedef Timing::Clock Clock;
+
+	static Telemetry& Instance();
+
+	/// <summary>
+	/// Get the id of a stage or counter, registering it on first use. Typically called once
+	/// per name to initialize a static. Past cMaxStages or cMaxCounters names, an error is
+	/// printed and cInvalidId returned, which Record, Add and Set ignore.
+	/// </summary>
+	StageId RegisterStage(const char* name);
+	CounterId RegisterCounter(const char* name);
+
+	/// <summary>
+	/// Name of a registered stage; valid for the lifetime of the process
+	/// </summary>
+	const char* StageName(StageId stage);
+
+	void Record(StageId stage, unsigned long long ns)
+	{
+		if (cInvalidId != stage)
+		{
+			LocalHistograms()[stage].Record(ns);
+		}
+	}
+
+	void Add(CounterId counter, long long value = 1)
+	{
+		if (cInvalidId != counter)
+		{
+			m_counters[counter].fetch_add(value, std::memory_order_relaxed);
+		}
+	}
+
+	void Set(CounterId counter, long long value)
+	{
+		if (cInvalidId != counter)
+		{
+			m_counters[counter].store(value, std::memory_order_relaxed);
+		}
+	}
+
+	/// <summary>
+	/// Log a rare event such as a decision, truncated to the size of TelemetryEvent::text. Events
+	/// go to a ring of the last cMaxEvents, so logging never allocates.
+	/// </summary>
+	void LogEvent(const char* text);
+
+	TelemetrySnapshot Snapshot();
+
+	/// <summary>
+	/// Clear all histograms, counters and events and restart the elapsed time, e.g. between two replayed
+	/// sequences. Registrations are kept. Only safe while no thread is recording.
+	/// </summary>
+	void Reset();
+
+	/// <summary>
+	/// Write a snapshot as CSV if the path ends in .csv, as JSON otherwise
+	/// </summary>
+	bool WriteSnapshot(const std::string& path);
+
+	/// <summary>
+	/// Average cost (in ns) of one ScopedStageTimer, measured over the given number of scopes.
+	/// The result is kept and reported in every snapshot.
+	/// </summary>
+	double MeasureScopeOverhead(int iterations = 1000000);
+
+private:
+	Telemetry();
+	Telemetry(const Telemetry&);
+	Telemetry& operator=(const Telemetry&);
+
+	LatencyHistogram* LocalHistograms()
+	{
+		static thread_local LatencyHistogram* t_pHistograms = nullptr;
+		if (nullptr == t_pHistograms)
+		{
+			t_pHistograms = AddThread();
+		}
+		return t_pHistograms;
+	}
+
+	LatencyHistogram* AddThread();
+
+	std::mutex                  m_lock;
+	std::vector<std::string>    m_stageNames;
+	std::vector<std::string>    m_counterNames;
+
+	// one array of cMaxStages histograms per thread that ever recorded, kept after the thread exits
+	std::vector<std::unique_ptr<LatencyHistogram[]> > m_threads;
+
+	std::atomic<long long>      m_counters[cMaxCounters];
+	TelemetryEvent              m_events[cMaxEvents];
+	long long                   m_eventCount;
+	Clock::time_point           m_start;
+	double                      m_scopeOverheadNs;
+};
+
+
+/// <summary>
+/// Time the enclosing scope into a stage histogram, and into the timeline while tracing
+/// </summary>
+class ScopedStageTimer
+{
+public:
+	explicit ScopedStageTimer(StageId stage)
+		: m_stage(stage)
+		, m_traceName(TraceRecorder::IsEnabled() ? Telemetry::Instance().StageName(stage) : nullptr)
+		, m_start(Telemetry::Clock::now())
+	{
+		if (nullptr != m_traceName)
+		{
+			TraceRecorder::Instance().Begin(m_traceName, m_start);
+		}
+	}
+
+	~ScopedStageTimer()
+	{
+		Telemetry::Clock::time_point end = Telemetry::Clock::now();
+		Telemetry::Instance().Record(m_stage, (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count());
+		if (nullptr != m_traceName)
+		{
+			TraceRecorder::Instance().End(m_traceName, end);
+		}
+	}
+
+private:
+	ScopedStageTimer(const ScopedStageTimer&);
+	ScopedStageTimer& operator=(const ScopedStageTimer&);
+
+	StageId                     m_stage;
+	const char*                 m_traceName;
+	Telemetry::Clock::time_point m_start;
+};
@@ -0,0 +1,325 @@
+
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+// true on pool worker threads, so nested loops run serially
+static thread_local bool s_bInsideWorker = false;
+
+// NUMA node index of a pinned thread, -1 for threads the pool has not pinned
+static thread_local int s_node = -1;
+
+
+ThreadPool::ThreadPool(int workerCount)
+	: m_pJob(nullptr)
+	, m_groupCount(1)
+	, m_pendingTasks(0)
+	, m_generation(0)
+	, m_bStop(false)
+	, m_callerNode(-1)
+{
+	for (int g = 0; g < cMaxNumaNodes; ++g)
+	{
+		m_groups[g].next.store(0, std::memory_order_relaxed);
+		m_groups[g].end = 0;
+	}
+
+	if (workerCount <= 0)
+	{
+		int cpus = NumaTopology::System().CpuCount();
+		workerCount = (cpus > 1) ? cpus - 1 : 0;
+	}
+
+	m_workerNodes.assign(workerCount, 0);
+	for (int i = 0; i < workerCount; ++i)
+	{
+		m_workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bStop = true;
+	}
+	m_wake.notify_all();
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		m_workers[i].join();
+	}
+}
+
+
+ThreadPool& ThreadPool::Instance()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+
+void ThreadPool::RunTasks(const Job* pJob, int groupCount, int homeGroup, unsigned int generation)
+{
+	int completed = 0;
+	for (int step = 0; step < groupCount; ++step)
+	{
+		TaskGroup& group = m_groups[(homeGroup + step) % groupCount];
+		unsigned long long next = group.next.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			unsigned int task = (unsigned int)(next & 0xFFFFFFFFu);
+			if ((unsigned int)(next >> 32) != generation || task >= group.end)
+			{
+				break;
+			}
+			if (!group.next.compare_exchange_weak(next, next + 1, std::memory_order_relaxed))
+			{
+				continue;
+			}
+			pJob->invoke(pJob->pFn, (int)task, 0);
+			completed++;
+			next = group.next.load(std::memory_order_relaxed);
+		}
+	}
+
+	if (completed > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pendingTasks -= completed;
+		if (0 == m_pendingTasks)
+		{
+			m_done.notify_all();
+		}
+	}
+}
+
+
+void ThreadPool::WorkerLoop(int worker)
+{
+	s_bInsideWorker = true;
+	unsigned int seenGeneration = 0;
+
+	for (;;)
+	{
+		const Job* pJob = nullptr;
+		int groupCount = 1;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&]() { return m_bStop || m_generation != seenGeneration; });
+			if (m_bStop)
+			{
+				return;
+			}
+			seenGeneration = m_generation;
+			pJob = m_pJob;
+			groupCount = m_groupCount;
+			s_node = m_workerNodes[worker];
+		}
+		if (nullptr != pJob)
+		{
+			RunTasks(pJob, groupCount, s_node % groupCount, seenGeneration);
+		}
+	}
+}
+
+
+void ThreadPool::RunJob(int taskCount, const Job& job, const int* pGroupBounds, int groupCount)
+{
+	if (taskCount <= 0)
+	{
+		return;
+	}
+
+	// One job at a time. A caller that finds the pool busy (e.g. a mesh load while the
+	// fusion thread is shading) runs its tasks itself rather than waiting for the other job.
+	std::unique_lock<std::mutex> jobLock(m_jobMutex, std::defer_lock);
+	if (taskCount == 1 || m_workers.empty() || s_bInsideWorker || !jobLock.try_lock())
+	{
+		for (int task = 0; task < taskCount; ++task)
+		{
+			job.invoke(job.pFn, task, 0);
+		}
+		return;
+	}
+
+	if (nullptr == pGroupBounds)
+	{
+		groupCount = 1;
+	}
+	unsigned int generation;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pJob = &job;
+		m_groupCount = groupCount;
+		m_pendingTasks = taskCount;
+		generation = ++m_generation;
+		for (int g = 0; g < groupCount; ++g)
+		{
+			const unsigned int begin = (nullptr != pGroupBounds) ? (unsigned int)pGroupBounds[g] : 0;
+			m_groups[g].end = (nullptr != pGroupBounds) ? (unsigned int)pGroupBounds[g + 1] : (unsigned int)taskCount;
+			m_groups[g].next.store(((unsigned long long)generation << 32) | begin, std::memory_order_relaxed);
+		}
+	}
+	m_wake.notify_all();
+
+	RunTasks(&job, groupCount, ((s_node >= 0) ? s_node : 0) % groupCount, generation);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [&]() { return 0 == m_pendingTasks; });
+	m_pJob = nullptr;
+}
+
+
+void ThreadPool::RunRanges(int begin, int end, const Job& job, int minRange)
+{
+	int count = end - begin;
+	if (count <= 0)
+	{
+		return;
+	}
+
+	minRange = (minRange > 0) ? minRange : 1;
+
+	// a few ranges per thread balances uneven work without much scheduling cost
+	int ranges = Concurrency() * 4;
+	if (ranges > (count + minRange - 1) / minRange)
+	{
+		ranges = (count + minRange - 1) / minRange;
+	}
+
+	if (ranges <= 1)
+	{
+		job.invoke(job.pFn, begin, end);
+		return;
+	}
+
+	ParallelTasks(ranges, [&](int task)
+	{
+		int rangeBegin = begin + (int)((long long)count * task / ranges);
+		int rangeEnd = begin + (int)((long long)count * (task + 1) / ranges);
+		job.invoke(job.pFn, rangeBegin, rangeEnd);
+	});
+}
+
+
+void ThreadPool::RunNodeRanges(const int* pBounds, int nodeCount, const Job& job, int minRange)
+{
+	nodeCount = (nodeCount < cMaxNumaNodes) ? nodeCount : cMaxNumaNodes;
+	if (nodeCount <= 1)
+	{
+		RunRanges(pBounds[0], pBounds[nodeCount], job, minRange);
+		return;
+	}
+
+	// a few ranges per thread of the node, as in RunRanges; a node without threads still gets
+	// ranges, for the other nodes' threads to take
+	minRange = (minRange > 0) ? minRange : 1;
+	int ranges[cMaxNumaNodes];
+	int taskBounds[cMaxNumaNodes + 1];
+	taskBounds[0] = 0;
+	for (int n = 0; n < nodeCount; ++n)
+	{
+		const int count = (pBounds[n + 1] > pBounds[n]) ? pBounds[n + 1] - pBounds[n] : 0;
+		const int threads = ThreadsOnNode(n);
+		const int maxRanges = (count + minRange - 1) / minRange;
+		ranges[n] = ((threads > 0) ? threads : 1) * 4;
+		ranges[n] = (ranges[n] < maxRanges) ? ranges[n] : maxRanges;
+		taskBounds[n + 1] = taskBounds[n] + ranges[n];
+	}
+
+	auto task = [&](int index)
+	{
+		int n = 0;
+		while (index >= taskBounds[n + 1])
+		{
+			n++;
+		}
+		const int count = pBounds[n + 1] - pBounds[n];
+		const int range = index - taskBounds[n];
+		const int rangeBegin = pBounds[n] + (int)((long long)count * range / ranges[n]);
+		const int rangeEnd = pBounds[n] + (int)((long long)count * (range + 1) / ranges[n]);
+		job.invoke(job.pFn, rangeBegin, rangeEnd);
+	};
+	Job rangeJob = { &InvokeTask<decltype(task)>, &task };
+	RunJob(taskBounds[nodeCount], rangeJob, taskBounds, nodeCount);
+}
+
+
+/// <summary>
+/// Restrict a thread to one CPU
+/// </summary>
+static bool PinThread(std::thread::native_handle_type handle, int cpu)
+{
+#ifdef _WIN32
+	return 0 != SetThreadAffinityMask((HANDLE)handle, (DWORD_PTR)1 << (cpu % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return 0 == pthread_setaffinity_np(handle, sizeof(set), &set);
+#else
+	(void)handle;
+	(void)cpu;
+	return false;
+#endif
+}
+
+
+bool ThreadPool::PinThreads()
+{
+	// the nodes' CPUs in turn: node 0's first, node 1's first, ..., node 0's second, ...
+	const NumaTopology& topology = NumaTopology::System();
+	std::vector<int> cpus, nodes;
+	for (size_t i = 0; cpus.size() < (size_t)topology.CpuCount(); ++i)
+	{
+		for (int n = 0; n < topology.NodeCount(); ++n)
+		{
+			if (i < topology.Node(n).cpus.size())
+			{
+				cpus.push_back(topology.Node(n).cpus[i]);
+				nodes.push_back(n);
+			}
+		}
+	}
+
+#ifdef _WIN32
+	bool ok = PinThread(GetCurrentThread(), cpus[0]);
+#elif defined(__linux__)
+	bool ok = PinThread(pthread_self(), cpus[0]);
+#else
+	bool ok = false;
+#endif
+	if (ok)
+	{
+		s_node = nodes[0];
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_callerNode = ok ? nodes[0] : -1;
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		const size_t slot = (i + 1) % cpus.size();
+		const bool pinned = PinThread(m_workers[i].native_handle(), cpus[slot]);
+		m_workerNodes[i] = pinned ? nodes[slot] : 0;
+		ok = pinned && ok;
+	}
+	return ok;
+}
+
+
+int ThreadPool::ThreadsOnNode(int node) const
+{
+	int count = (m_callerNode == node) ? 1 : 0;
+	for (size_t i = 0; i < m_workerNodes.size(); ++i)
+	{
+		count += (m_workerNodes[i] == node) ? 1 : 0;
+	}
+	return count;
+}
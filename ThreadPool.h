@@ -0,0 +1,143 @@
+#pragma once
+
+#include "NumaTopology.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+/// <summary>
+/// Persistent pool of worker threads for data-parallel loops.
+/// The calling thread takes part in the work, so a pool of N threads runs N + 1 ranges at once.
+/// ParallelFor called from inside a worker, or while another thread's loop owns the pool,
+/// runs serially on the calling thread instead of waiting.
+/// Loop bodies are taken by reference, never copied, so starting a loop does not allocate.
+/// Pinned threads know their NUMA node, so that ParallelForNodes can run each node's share of a
+/// loop on the threads next to its memory.
+/// </summary>
+class ThreadPool
+{
+public:
+	/// <summary>
+	/// Create a pool with the given number of worker threads
+	/// (0 = the CPUs of NumaTopology::System() - 1, the caller being the remaining thread)
+	/// </summary>
+	explicit ThreadPool(int workerCount = 0);
+	~ThreadPool();
+
+	/// <summary>
+	/// Process-wide pool shared by all stages
+	/// </summary>
+	static ThreadPool& Instance();
+
+	/// <summary>
+	/// Number of threads that execute ranges, including the caller
+	/// </summary>
+	int Concurrency() const { return (int)m_workers.size() + 1; }
+
+	/// <summary>
+	/// Split [begin, end) into contiguous ranges of at least minRange items and run fn(begin, end)
+	/// on each. Returns once every range has completed.
+	/// </summary>
+	template <class RangeFn>
+	void ParallelFor(int begin, int end, const RangeFn& fn, int minRange = 1)
+	{
+		Job job = { &InvokeRange<RangeFn>, &fn };
+		RunRanges(begin, end, job, minRange);
+	}
+
+	/// <summary>
+	/// ParallelFor over data split between NUMA nodes: [pBounds[n], pBounds[n + 1]) belongs to node
+	/// n of NumaTopology::System(). The threads pinned on a node run its ranges first, then help
+	/// with the other nodes' ranges, so a node without threads still gets its work done.
+	/// </summary>
+	template <class RangeFn>
+	void ParallelForNodes(const int* pBounds, int nodeCount, const RangeFn& fn, int minRange = 1)
+	{
+		Job job = { &InvokeRange<RangeFn>, &fn };
+		RunNodeRanges(pBounds, nodeCount, job, minRange);
+	}
+
+	/// <summary>
+	/// Run fn(task) for task in [0, taskCount), one task per call, and wait for all of them
+	/// </summary>
+	template <class TaskFn>
+	void ParallelTasks(int taskCount, const TaskFn& fn)
+	{
+		Job job = { &InvokeTask<TaskFn>, &fn };
+		RunJob(taskCount, job, nullptr, 1);
+	}
+
+	/// <summary>
+	/// Pin every thread to a CPU of NumaTopology::System(), for reproducible benchmarks and NUMA
+	/// locality: the calling thread to the first CPU of node 0 and the workers to the next CPUs,
+	/// taking the nodes in turn so that a pool smaller than the machine spreads over every node.
+	/// Returns false where affinity cannot be set.
+	/// </summary>
+	bool PinThreads();
+
+	/// <summary>
+	/// Threads pinned on a node of NumaTopology::System(), the caller of PinThreads included
+	/// </summary>
+	int ThreadsOnNode(int node) const;
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	/// <summary>
+	/// Non-owning reference to a loop body; unlike std::function it never allocates
+	/// </summary>
+	struct Job
+	{
+		void (*invoke)(const void* pFn, int a, int b);
+		const void* pFn;
+	};
+
+	template <class TaskFn>
+	static void InvokeTask(const void* pFn, int task, int) { (*static_cast<const TaskFn*>(pFn))(task); }
+
+	template <class RangeFn>
+	static void InvokeRange(const void* pFn, int begin, int end) { (*static_cast<const RangeFn*>(pFn))(begin, end); }
+
+	/// <summary>
+	/// Tasks [pGroupBounds[g], pGroupBounds[g + 1]) form group g; a thread claims the tasks of the
+	/// group of its node first. No bounds: one group of every task.
+	/// </summary>
+	void RunJob(int taskCount, const Job& job, const int* pGroupBounds, int groupCount);
+	void RunRanges(int begin, int end, const Job& job, int minRange);
+	void RunNodeRanges(const int* pBounds, int nodeCount, const Job& job, int minRange);
+
+	void WorkerLoop(int worker);
+	void RunTasks(const Job* pJob, int groupCount, int homeGroup, unsigned int generation);
+
+	std::vector<std::thread>        m_workers;
+	std::mutex                      m_mutex;
+	std::condition_variable         m_wake;
+	std::condition_variable         m_done;
+
+	// current job, guarded by m_mutex; only one job runs at a time
+	std::mutex                      m_jobMutex;
+	const Job*                      m_pJob;
+	int                             m_groupCount;
+	int                             m_pendingTasks;
+	unsigned int                    m_generation;
+	bool                            m_bStop;
+
+	// node of each worker once pinned (0 before), guarded by m_mutex
+	std::vector<int>                m_workerNodes;
+	int                             m_callerNode;
+
+	// per group of tasks, on its own cache line: the generation in the high 32 bits and the next
+	// task index in the low 32 bits, so a worker that wakes up late can never claim a task of a
+	// newer job; the end of the group's tasks
+	struct TaskGroup
+	{
+		std::atomic<unsigned long long> next;
+		unsigned int                    end;
+		char                            padding[64 - sizeof(std::atomic<unsigned long long>) - sizeof(unsigned int)];
+	};
+	TaskGroup                       m_groups[cMaxNumaNodes];
+};
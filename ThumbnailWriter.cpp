@@ -0,0 +1,251 @@
+
+#include "ThumbnailWriter.h"
+
+#include <chrono>
+#include <utility>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+static bool MakeDirectory(const std::string& directory)
+{
+#ifdef _WIN32
+	int result = _mkdir(directory.c_str());
+#else
+	int result = mkdir(directory.c_str(), 0755);
+#endif
+	return 0 == result || EEXIST == errno;
+}
+
+
+ThumbnailWriter::ThumbnailWriter()
+	: m_downscale(1)
+	, m_bStopping(false)
+	, m_bRunning(false)
+	, m_written(0)
+	, m_dropped(0)
+	, m_failed(0)
+	, m_encodeMsSum(0)
+{
+}
+
+
+ThumbnailWriter::~ThumbnailWriter()
+{
+	Stop();
+}
+
+
+bool ThumbnailWriter::Start(const std::string& directory, int downscale, int queueDepth, int width, int height)
+{
+	Stop();
+	if (!MakeDirectory(directory))
+	{
+		return false;
+	}
+
+	m_directory = directory;
+	m_downscale = (downscale > 0) ? downscale : 1;
+	m_free.clear();
+	m_free.resize(queueDepth > 0 ? queueDepth : 1);
+	m_queue.clear();
+	m_queue.reserve(m_free.size());
+	m_bStopping = false;
+	if (width > 0 && height > 0)
+	{
+		Reserve(width, height);
+	}
+
+	m_bRunning = true;
+	m_worker = std::thread(&ThumbnailWriter::WorkerLoop, this);
+	return true;
+}
+
+
+void ThumbnailWriter::Reserve(int width, int height)
+{
+	const size_t bytes = (size_t)width * height * 4;
+	for (size_t j = 0; j < m_free.size(); ++j)
+	{
+		if (m_free[j].pixels.capacity() < bytes
+			&& MemoryAccounting::Instance().Admit(MemoryThumbnails, (long long)(bytes - m_free[j].pixels.capacity())))
+		{
+			m_free[j].pixels.reserve(bytes);
+		}
+		m_free[j].name.reserve(32);
+	}
+
+	m_rgb.reserve((size_t)(width / m_downscale) * (height / m_downscale) * 3);
+	m_path.reserve(m_directory.size() + 40);
+}
+
+
+void ThumbnailWriter::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_bStopping = true;
+	}
+	m_wake.notify_all();
+	if (m_worker.joinable())
+	{
+		m_worker.join();
+	}
+	m_bRunning = false;
+}
+
+
+bool ThumbnailWriter::Submit(const std::string& name, const unsigned char* pPixels, int width, int height, int stride,
+	ThumbnailPixelFormat format, bool bottomUp)
+{
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (!m_bRunning || m_bStopping || m_free.empty())
+		{
+			m_dropped++;
+			return false;
+		}
+		job.pixels.swap(m_free.back().pixels);
+		job.name.swap(m_free.back().name);
+		m_free.pop_back();
+	}
+
+	// copy outside the lock; the buffer keeps its capacity across uses, and only grows when the
+	// memory budget allows
+	const int rowBytes = width * 4;
+	const size_t bytes = (size_t)rowBytes * height;
+	if (job.pixels.capacity() < bytes
+		&& !MemoryAccounting::Instance().Admit(MemoryThumbnails, (long long)(bytes - job.pixels.capacity())))
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_free.push_back(std::move(job));
+		m_dropped++;
+		return false;
+	}
+	job.pixels.resize(bytes);
+	for (int y = 0; y < height; ++y)
+	{
+		memcpy(&job.pixels[(size_t)y * rowBytes], pPixels + (size_t)y * stride, rowBytes);
+	}
+	job.name = name;
+	job.width = width;
+	job.height = height;
+	job.format = format;
+	job.bottomUp = bottomUp;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_queue.push_back(std::move(job));
+	}
+	m_wake.notify_one();
+	return true;
+}
+
+
+bool ThumbnailWriter::Encode(const Job& job)
+{
+	const int s = m_downscale;
+	const int outWidth = job.width / s;
+	const int outHeight = job.height / s;
+	if (outWidth <= 0 || outHeight <= 0)
+	{
+		return false;
+	}
+
+	const int r = (ThumbnailBGRX == job.format) ? 2 : 0;
+	const int b = 2 - r;
+	const int rowBytes = job.width * 4;
+	const int area = s * s;
+
+	// box filter down to the thumbnail size, top scanline first
+	std::vector<unsigned char>& rgb = m_rgb;
+	rgb.resize((size_t)outWidth * outHeight * 3);
+	for (int y = 0; y < outHeight; ++y)
+	{
+		int destinationRow = job.bottomUp ? (outHeight - 1 - y) : y;
+		unsigned char* pDst = &rgb[(size_t)destinationRow * outWidth * 3];
+		for (int x = 0; x < outWidth; ++x)
+		{
+			int sum[3] = { 0, 0, 0 };
+			for (int dy = 0; dy < s; ++dy)
+			{
+				const unsigned char* pSrc = &job.pixels[(size_t)(y * s + dy) * rowBytes + (size_t)x * s * 4];
+				for (int dx = 0; dx < s; ++dx, pSrc += 4)
+				{
+					sum[0] += pSrc[r];
+					sum[1] += pSrc[1];
+					sum[2] += pSrc[b];
+				}
+			}
+			pDst[x * 3 + 0] = (unsigned char)(sum[0] / area);
+			pDst[x * 3 + 1] = (unsigned char)(sum[1] / area);
+			pDst[x * 3 + 2] = (unsigned char)(sum[2] / area);
+		}
+	}
+
+	m_path.assign(m_directory).append("/").append(job.name).append(".ppm");
+	FILE* pFile = fopen(m_path.c_str(), "wb");
+	if (nullptr == pFile)
+	{
+		return false;
+	}
+	fprintf(pFile, "P6\n%d %d\n255\n", outWidth, outHeight);
+	bool bSuccess = fwrite(rgb.data(), 1, rgb.size(), pFile) == rgb.size();
+	bSuccess = (0 == fclose(pFile)) && bSuccess;
+	return bSuccess;
+}
+
+
+void ThumbnailWriter::WorkerLoop()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wake.wait(lock, [&]() { return m_bStopping || !m_queue.empty(); });
+			if (m_queue.empty())
+			{
+				break;
+			}
+			job = std::move(m_queue.front());
+			m_queue.erase(m_queue.begin());
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool bSuccess = Encode(job);
+		double encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (bSuccess)
+		{
+			m_written++;
+			m_encodeMsSum += encodeMs;
+		}
+		else
+		{
+			m_failed++;
+		}
+		m_free.push_back(std::move(job));
+	}
+}
+
+
+ThumbnailWriterStats ThumbnailWriter::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	ThumbnailWriterStats stats;
+	stats.written = m_written;
+	stats.dropped = m_dropped;
+	stats.failed = m_failed;
+	stats.meanEncodeMs = (m_written > 0) ? m_encodeMsSum / m_written : 0;
+	return stats;
+}
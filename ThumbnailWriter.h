@@ -0,0 +1,119 @@
+#pragma once
+
+#include "MemoryAccounting.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/// <summary>
+/// Pixel layouts accepted by ThumbnailWriter
+/// </summary>
+enum ThumbnailPixelFormat
+{
+	ThumbnailBGRX = 0,		// Kinect Fusion shaded surface
+	ThumbnailRGBA = 1		// VTK render window readback
+};
+
+/// <summary>
+/// Statistics of the thumbnail encoder
+/// </summary>
+struct ThumbnailWriterStats
+{
+	long long                   written;
+
+	/// <summary>
+	/// Images refused because the encoder was still busy with earlier ones, or because a
+	/// buffer for them did not fit in the memory budget
+	/// </summary>
+	long long                   dropped;
+
+	long long                   failed;
+	double                      meanEncodeMs;
+};
+
+/// <summary>
+/// Background encoder writing downscaled images as binary PPM files.
+/// Submit copies the pixels into a recycled buffer and returns immediately; when every
+/// buffer is queued the image is dropped instead of waiting, so the caller is never slowed
+/// down by disk I/O.
+/// </summary>
+class ThumbnailWriter
+{
+public:
+	ThumbnailWriter();
+	~ThumbnailWriter();
+
+	/// <summary>
+	/// Start the encoder thread
+	/// </summary>
+	/// <param name="directory">output directory, created if it does not exist</param>
+	/// <param name="downscale">images are shrunk by this factor with a box filter</param>
+	/// <param name="queueDepth">number of images that may wait for encoding</param>
+	/// <param name="width">width of the images to come, 0 if unknown</param>
+	/// <param name="height">height of the images to come, 0 if unknown</param>
+	/// <returns>false if the directory cannot be created</returns>
+	/// <remarks>With the image size known every buffer is allocated here, so Submit does not touch the heap</remarks>
+	bool Start(const std::string& directory, int downscale, int queueDepth = 4, int width = 0, int height = 0);
+
+	/// <summary>
+	/// Write the queued images and stop the encoder thread
+	/// </summary>
+	void Stop();
+
+	bool IsRunning() const { return m_bRunning; }
+
+	/// <summary>
+	/// Queue an image for writing as directory/name.ppm
+	/// </summary>
+	/// <param name="pPixels">4 bytes per pixel</param>
+	/// <param name="stride">length (in bytes) of a single scanline</param>
+	/// <param name="bottomUp">true if the first scanline is the bottom of the image</param>
+	/// <returns>false if the image was dropped</returns>
+	bool Submit(const std::string& name, const unsigned char* pPixels, int width, int height, int stride,
+		ThumbnailPixelFormat format, bool bottomUp);
+
+	ThumbnailWriterStats GetStats();
+
+private:
+	ThumbnailWriter(const ThumbnailWriter&);
+	ThumbnailWriter& operator=(const ThumbnailWriter&);
+
+	struct Job
+	{
+		std::string                 name;
+		std::vector<unsigned char, TaggedAllocator<unsigned char, MemoryThumbnails> > pixels;
+		int                         width;
+		int                         height;
+		ThumbnailPixelFormat        format;
+		bool                        bottomUp;
+	};
+
+	void Reserve(int width, int height);
+	void WorkerLoop();
+	bool Encode(const Job& job);
+
+	std::string                 m_directory;
+	int                         m_downscale;
+
+	// owned by the encoder thread once it runs
+	std::vector<unsigned char>  m_rgb;
+	std::string                 m_path;
+
+	std::mutex                  m_lock;
+	std::condition_variable     m_wake;
+	std::vector<Job>            m_free;
+	std::vector<Job>            m_queue;
+	bool                        m_bStopping;
+
+	std::thread                 m_worker;
+	std::atomic<bool>           m_bRunning;
+
+	long long                   m_written;
+	long long                   m_dropped;
+	long long                   m_failed;
+	double                      m_encodeMsSum;
+};
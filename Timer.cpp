@@ -11,14 +11,6 @@ namespace Timing
 
 	Timer::Timer()
 	{
-		if (QueryPerformanceFrequency(&frequency) == 0)
-		{
-			// Frequency not supported - cannot get time!
-			initialized = false;
-			return;
-		}
-
-		initialized = true;
 	}
 
 	/// <summary>
@@ -27,18 +19,8 @@ namespace Timing
 	/// <returns>Returns the absolute time in s.</returns>
 	double Timer::AbsoluteTime()
 	{
-		if (initialized == false)
-		{
-			return 0;
-		}
-
-		LARGE_INTEGER systemTime;
-		if (QueryPerformanceCounter(&systemTime) == 0)
-		{
-			return 0;
-		}
-		double realTime = (double)systemTime.QuadPart / (double)frequency.QuadPart;
-		return realTime;
+		// steady_clock is QueryPerformanceCounter on Windows and CLOCK_MONOTONIC elsewhere
+		return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
 	}
 
 };
@@ -6,26 +6,20 @@
 
 #pragma once
 
-#include <Windows.h>
+#include <chrono>
 
 namespace Timing
 {
+	/// <summary>
+	/// The monotonic clock shared by the timer, the telemetry and the trace recorder
+	/// </summary>
+	typedef std::chrono::steady_clock Clock;
+
 	/// <summary>
 	/// Timer is a minimal class to get the system time in seconds
 	/// </summary>
 	class Timer
 	{
-	private:
-		/// <summary>
-		///  Whether the timer is initialized and can be used.
-		/// </summary>
-		bool initialized;
-
-		/// <summary>
-		///  The clock frequency in ticks per second.
-		/// </summary>
-		LARGE_INTEGER frequency;
-
 	public:
 		/// <summary>
 		///  Initializes a new instance of the <see cref="Timer"/> class.
@@ -37,5 +31,14 @@ namespace Timing
 		/// </summary>
 		/// <returns>Returns the absolute time in s.</returns>
 		double AbsoluteTime();
+
+		/// <summary>
+		///  Gets the absolute time of a clock reading.
+		/// </summary>
+		/// <returns>Returns the absolute time in ns, on the same origin as AbsoluteTime.</returns>
+		static long long Nanoseconds(Clock::time_point time)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		}
 	};
 };
@@ -0,0 +1,181 @@
+
+#include "TraceRecorder.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdio.h>
+
+
+std::atomic<bool> TraceRecorder::s_bEnabled(false);
+thread_local TraceRecorder::ThreadBuffer* TraceRecorder::t_pBuffer = nullptr;
+thread_local long long TraceRecorder::t_frameId = -1;
+thread_local const char* TraceRecorder::t_threadName = nullptr;
+
+
+TraceRecorder& TraceRecorder::Instance()
+{
+	static TraceRecorder recorder;
+	return recorder;
+}
+
+
+TraceRecorder::TraceRecorder()
+	: m_eventsPerThread(1 << 16)
+	, m_sessionStartNs(0)
+{
+}
+
+
+void TraceRecorder::Start(int eventsPerThread)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	int capacity = 1;
+	while (capacity < eventsPerThread && capacity < (1 << 24))
+	{
+		capacity <<= 1;
+	}
+	m_eventsPerThread = capacity;
+	m_sessionStartNs = Timing::Timer::Nanoseconds(Timing::Clock::now());
+	s_bEnabled.store(true, std::memory_order_relaxed);
+}
+
+
+void TraceRecorder::Stop()
+{
+	s_bEnabled.store(false, std::memory_order_relaxed);
+}
+
+
+void TraceRecorder::SetThreadName(const char* name)
+{
+	// the ring is only allocated when the thread records
+	t_threadName = name;
+	if (nullptr != t_pBuffer)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		t_pBuffer->name = name;
+	}
+}
+
+
+TraceRecorder::ThreadBuffer* TraceRecorder::AddThread()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+	buffer->events.reset(new Event[m_eventsPerThread]);
+	buffer->mask = (unsigned long long)m_eventsPerThread - 1;
+	buffer->head.store(0, std::memory_order_relaxed);
+	buffer->tid = (int)m_threads.size() + 1;
+
+	if (nullptr != t_threadName)
+	{
+		buffer->name = t_threadName;
+	}
+	else
+	{
+		std::ostringstream name;
+		name << "thread " << buffer->tid;
+		buffer->name = name.str();
+	}
+
+	ThreadBuffer* pBuffer = buffer.get();
+	m_threads.push_back(std::move(buffer));
+	return pBuffer;
+}
+
+
+static std::string JsonEscape(const char* text)
+{
+	std::string escaped;
+	for (; nullptr != text && *text; ++text)
+	{
+		if (*text == '"' || *text == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += *text;
+	}
+	return escaped;
+}
+
+
+bool TraceRecorder::WriteJson(const std::string& path)
+{
+	struct Copy
+	{
+		const char* name;
+		long long   timeNs;
+		long long   frameId;
+		char        phase;
+	};
+
+	std::ostringstream json;
+	json << std::fixed << std::setprecision(3);
+	json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::vector<Copy> events;
+	for (size_t t = 0; t < m_threads.size(); ++t)
+	{
+		ThreadBuffer& buffer = *m_threads[t];
+		unsigned long long capacity = buffer.mask + 1;
+
+		// copy the ring, then drop what its thread overwrote meanwhile
+		unsigned long long head = buffer.head.load(std::memory_order_acquire);
+		unsigned long long begin = (head > capacity) ? head - capacity : 0;
+		events.clear();
+		for (unsigned long long i = begin; i < head; ++i)
+		{
+			const Event& e = buffer.events[i & buffer.mask];
+			Copy copy = { e.name.load(std::memory_order_relaxed), e.timeNs.load(std::memory_order_relaxed),
+				e.frameId.load(std::memory_order_relaxed), e.phase.load(std::memory_order_relaxed) };
+			events.push_back(copy);
+		}
+		unsigned long long after = buffer.head.load(std::memory_order_acquire);
+		size_t overwritten = (after > begin + capacity) ? (size_t)(after - begin - capacity) : 0;
+
+		json << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.tid
+			<< ",\"args\":{\"name\":\"" << JsonEscape(buffer.name.c_str()) << "\"}}";
+		first = false;
+
+		// an end whose begin was overwritten or came before the session would confuse the viewer
+		int depth = 0;
+		for (size_t i = overwritten; i < events.size(); ++i)
+		{
+			const Copy& e = events[i];
+			if (e.timeNs < m_sessionStartNs || (e.phase == 'E' && depth == 0))
+			{
+				continue;
+			}
+			depth += (e.phase == 'B') ? 1 : -1;
+
+			json << ",\n{\"name\":\"" << JsonEscape(e.name) << "\",\"ph\":\"" << e.phase << "\",\"pid\":1,\"tid\":" << buffer.tid
+				<< ",\"ts\":" << (e.timeNs - m_sessionStartNs) * 1e-3;
+			if (e.frameId >= 0)
+			{
+				json << ",\"args\":{\"frame\":" << e.frameId << "}";
+			}
+			json << "}";
+		}
+	}
+	json << "\n]}\n";
+
+	// write aside and swap in, as the telemetry snapshot does
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::out | std::ios::trunc);
+		if (!file)
+		{
+			return false;
+		}
+		file << json.str();
+		if (!file)
+		{
+			return false;
+		}
+	}
+	remove(path.c_str());
+	return 0 == rename(temporary.c_str(), path.c_str());
+}
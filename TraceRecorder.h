@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Timer.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Frame-level timeline recorder writing Chrome / Perfetto trace JSON (chrome://tracing,
+/// ui.perfetto.dev). Every thread that records gets a ring buffer of its own, allocated once on its
+/// first event, so recording takes no lock; when the ring is full the oldest events are overwritten.
+/// While the recorder is stopped an event costs one relaxed load.
+/// </summary>
+class TraceRecorder
+{
+public:
+	static TraceRecorder& Instance();
+
+	static bool IsEnabled() { return s_bEnabled.load(std::memory_order_relaxed); }
+
+	/// <summary>
+	/// Start a recording session; events from an earlier session are not written again.
+	/// </summary>
+	/// <param name="eventsPerThread">ring capacity of threads that record for the first time, rounded up to a power of two</param>
+	void Start(int eventsPerThread = 1 << 16);
+	void Stop();
+
+	/// <summary>
+	/// Write the events of the current (or last) session as trace JSON
+	/// </summary>
+	bool WriteJson(const std::string& path);
+
+	/// <summary>
+	/// Name shown for the calling thread
+	/// </summary>
+	void SetThreadName(const char* name);
+
+	/// <summary>
+	/// Frame id attached to the following events of the calling thread (-1 = none)
+	/// </summary>
+	static void SetFrame(long long frameId) { t_frameId = frameId; }
+
+	/// <summary>
+	/// Begin and end a span; name must outlive the recorder (a literal or a registered stage name)
+	/// </summary>
+	void Begin(const char* name, Timing::Clock::time_point time) { Record('B', name, time); }
+	void End(const char* name, Timing::Clock::time_point time) { Record('E', name, time); }
+
+private:
+	/// <summary>
+	/// Fields are relaxed atomics so that WriteJson may read a ring while its thread writes;
+	/// on x86 they compile to plain moves
+	/// </summary>
+	struct Event
+	{
+		std::atomic<const char*> name;
+		std::atomic<long long>   timeNs;
+		std::atomic<long long>   frameId;
+		std::atomic<char>        phase;
+	};
+
+	struct ThreadBuffer
+	{
+		std::unique_ptr<Event[]>        events;
+		unsigned long long              mask;
+		std::atomic<unsigned long long> head;
+		int                             tid;
+		std::string                     name;
+	};
+
+	TraceRecorder();
+	TraceRecorder(const TraceRecorder&);
+	TraceRecorder& operator=(const TraceRecorder&);
+
+	void Record(char phase, const char* name, Timing::Clock::time_point time)
+	{
+		ThreadBuffer* buffer = LocalBuffer();
+		unsigned long long index = buffer->head.load(std::memory_order_relaxed);
+		Event& e = buffer->events[index & buffer->mask];
+		e.name.store(name, std::memory_order_relaxed);
+		e.timeNs.store(Timing::Timer::Nanoseconds(time), std::memory_order_relaxed);
+		e.frameId.store(t_frameId, std::memory_order_relaxed);
+		e.phase.store(phase, std::memory_order_relaxed);
+		buffer->head.store(index + 1, std::memory_order_release);
+	}
+
+	ThreadBuffer* LocalBuffer()
+	{
+		if (nullptr == t_pBuffer)
+		{
+			t_pBuffer = AddThread();
+		}
+		return t_pBuffer;
+	}
+
+	ThreadBuffer* AddThread();
+
+	static std::atomic<bool>            s_bEnabled;
+	static thread_local ThreadBuffer*   t_pBuffer;
+	static thread_local long long       t_frameId;
+	static thread_local const char*     t_threadName;
+
+	std::mutex                          m_lock;
+	std::vector<std::unique_ptr<ThreadBuffer> > m_threads;
+	int                                 m_eventsPerThread;
+	long long                           m_sessionStartNs;
+};
+
+
+/// <summary>
+/// Trace the enclosing scope as one span
+/// </summary>
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name)
+		: m_name(TraceRecorder::IsEnabled() ? name : nullptr)
+	{
+		if (nullptr != m_name)
+		{
+			TraceRecorder::Instance().Begin(m_name, Timing::Clock::now());
+		}
+	}
+
+	~TraceScope()
+	{
+		if (nullptr != m_name)
+		{
+			TraceRecorder::Instance().End(m_name, Timing::Clock::now());
+		}
+	}
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+	const char*                 m_name;
+};
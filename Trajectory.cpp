@@ -0,0 +1,445 @@
+
+#include "Trajectory.h"
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/// <summary>
+/// Pose log layout: the header, then records of a double timestamp, a 64 bit frame index, the
+/// 12 floats of the world-to-camera transform that are not constant, the float residual and
+/// 16 bit status and lost frame count
+/// </summary>
+static const char cPoseLogMagic[8] = { 'F', 'U', 'S', 'P', 'O', 'S', 'E', '1' };
+static const size_t cPoseLogHeaderBytes = 16;
+static const size_t cPoseLogRecordBytes = 72;
+
+/// <summary>
+/// Entries of Mat4 stored in a record; the last column is always (0, 0, 0, 1)
+/// </summary>
+static const int cPoseLogMatrixEntries[12] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14 };
+
+/// <summary>
+/// Seconds the writer thread sleeps between blocks
+/// </summary>
+static const double cPoseLogFlushSeconds = 0.25;
+
+
+/// <summary>
+/// Camera-to-world transform from a translation and a unit quaternion (x, y, z, w)
+/// </summary>
+static Mat4 FromTranslationQuaternion(const double t[3], const double q[4])
+{
+	double norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	double x = q[0] / norm, y = q[1] / norm, z = q[2] / norm, w = q[3] / norm;
+
+	// the rotation R of p' = R p, stored transposed for the row vector convention of Mat4
+	double r[3][3] = {
+		{ 1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w) },
+		{ 2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w) },
+		{ 2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y) } };
+
+	Mat4 m;
+	SetIdentity(m);
+	m.M11 = (float)r[0][0]; m.M12 = (float)r[1][0]; m.M13 = (float)r[2][0];
+	m.M21 = (float)r[0][1]; m.M22 = (float)r[1][1]; m.M23 = (float)r[2][1];
+	m.M31 = (float)r[0][2]; m.M32 = (float)r[1][2]; m.M33 = (float)r[2][2];
+	m.M41 = (float)t[0]; m.M42 = (float)t[1]; m.M43 = (float)t[2];
+	return m;
+}
+
+/// <summary>
+/// Translation and unit quaternion (x, y, z, w) of a camera-to-world transform
+/// </summary>
+static void ToTranslationQuaternion(const Mat4& m, double t[3], double q[4])
+{
+	t[0] = m.M41; t[1] = m.M42; t[2] = m.M43;
+
+	// R = transpose of the upper 3x3
+	double r00 = m.M11, r01 = m.M21, r02 = m.M31;
+	double r10 = m.M12, r11 = m.M22, r12 = m.M32;
+	double r20 = m.M13, r21 = m.M23, r22 = m.M33;
+
+	// branch on the largest diagonal term for precision
+	double trace = r00 + r11 + r22;
+	if (trace > 0)
+	{
+		double s = 0.5 / sqrt(trace + 1.0);
+		q[3] = 0.25 / s;
+		q[0] = (r21 - r12) * s;
+		q[1] = (r02 - r20) * s;
+		q[2] = (r10 - r01) * s;
+	}
+	else if (r00 > r11 && r00 > r22)
+	{
+		double s = 2.0 * sqrt(1.0 + r00 - r11 - r22);
+		q[3] = (r21 - r12) / s;
+		q[0] = 0.25 * s;
+		q[1] = (r01 + r10) / s;
+		q[2] = (r02 + r20) / s;
+	}
+	else if (r11 > r22)
+	{
+		double s = 2.0 * sqrt(1.0 + r11 - r00 - r22);
+		q[3] = (r02 - r20) / s;
+		q[0] = (r01 + r10) / s;
+		q[1] = 0.25 * s;
+		q[2] = (r12 + r21) / s;
+	}
+	else
+	{
+		double s = 2.0 * sqrt(1.0 + r22 - r00 - r11);
+		q[3] = (r10 - r01) / s;
+		q[0] = (r02 + r20) / s;
+		q[1] = (r12 + r21) / s;
+		q[2] = 0.25 * s;
+	}
+}
+
+
+bool ReadTumTrajectory(const char* filename, std::vector<StampedPose>& poses)
+{
+	FILE* file = fopen(filename, "r");
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	poses.clear();
+	bool ok = true;
+	char line[512];
+	while (ok && nullptr != fgets(line, sizeof(line), file))
+	{
+		const char* p = line;
+		while (*p == ' ' || *p == '\t')
+		{
+			++p;
+		}
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+		{
+			continue;
+		}
+
+		double timestamp, t[3], q[4];
+		ok = 8 == sscanf(p, "%lf %lf %lf %lf %lf %lf %lf %lf", &timestamp, &t[0], &t[1], &t[2], &q[0], &q[1], &q[2], &q[3])
+			&& (q[0] != 0 || q[1] != 0 || q[2] != 0 || q[3] != 0);
+		if (ok)
+		{
+			StampedPose pose;
+			pose.timestamp = timestamp;
+			pose.worldToCamera = InverseAffine(FromTranslationQuaternion(t, q));
+			poses.push_back(pose);
+		}
+	}
+	fclose(file);
+	return ok;
+}
+
+
+bool WriteTumTrajectory(const char* filename, const std::vector<StampedPose>& poses)
+{
+	FILE* file = fopen(filename, "w");
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	fprintf(file, "# timestamp tx ty tz qx qy qz qw\n");
+	for (size_t i = 0; i < poses.size(); ++i)
+	{
+		double t[3], q[4];
+		ToTranslationQuaternion(InverseAffine(poses[i].worldToCamera), t, q);
+		fprintf(file, "%.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f\n", poses[i].timestamp, t[0], t[1], t[2], q[0], q[1], q[2], q[3]);
+	}
+
+	bool ok = !ferror(file);
+	ok = (0 == fclose(file)) && ok;
+	return ok;
+}
+
+
+const StampedPose* FindNearestPose(const std::vector<StampedPose>& poses, double timestamp, double maxDifference)
+{
+	const StampedPose* pNearest = nullptr;
+	double nearest = maxDifference;
+	for (size_t i = 0; i < poses.size(); ++i)
+	{
+		double difference = fabs(poses[i].timestamp - timestamp);
+		if (difference <= nearest)
+		{
+			nearest = difference;
+			pNearest = &poses[i];
+		}
+	}
+	return pNearest;
+}
+
+
+
+bool WriteKittiTrajectory(const char* filename, const std::vector<StampedPose>& poses)
+{
+	FILE* file = fopen(filename, "w");
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < poses.size(); ++i)
+	{
+		// the row vector convention of Mat4 holds R transposed
+		const Mat4 m = InverseAffine(poses[i].worldToCamera);
+		fprintf(file, "%.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+			m.M11, m.M21, m.M31, m.M41, m.M12, m.M22, m.M32, m.M42, m.M13, m.M23, m.M33, m.M43);
+	}
+
+	bool ok = !ferror(file);
+	ok = (0 == fclose(file)) && ok;
+	return ok;
+}
+
+
+static void PackPoseRecord(const PoseLogRecord& record, unsigned char* pOut)
+{
+	const int64_t frame = record.frame;
+	const float* pMatrix = &record.worldToCamera.M11;
+	const uint16_t status = (uint16_t)record.status;
+	const uint16_t lostFrames = (uint16_t)((record.lostFrames < 0xffff) ? record.lostFrames : 0xffff);
+
+	// little endian, as the platforms we build for are
+	memcpy(pOut, &record.timestamp, 8);
+	memcpy(pOut + 8, &frame, 8);
+	for (int i = 0; i < 12; ++i)
+	{
+		memcpy(pOut + 16 + i * 4, &pMatrix[cPoseLogMatrixEntries[i]], 4);
+	}
+	memcpy(pOut + 64, &record.residual, 4);
+	memcpy(pOut + 68, &status, 2);
+	memcpy(pOut + 70, &lostFrames, 2);
+}
+
+
+static void UnpackPoseRecord(const unsigned char* pIn, PoseLogRecord& record)
+{
+	int64_t frame;
+	uint16_t status, lostFrames;
+	SetIdentity(record.worldToCamera);
+	float* pMatrix = &record.worldToCamera.M11;
+
+	memcpy(&record.timestamp, pIn, 8);
+	memcpy(&frame, pIn + 8, 8);
+	for (int i = 0; i < 12; ++i)
+	{
+		memcpy(&pMatrix[cPoseLogMatrixEntries[i]], pIn + 16 + i * 4, 4);
+	}
+	memcpy(&record.residual, pIn + 64, 4);
+	memcpy(&status, pIn + 68, 2);
+	memcpy(&lostFrames, pIn + 70, 2);
+	record.frame = frame;
+	record.status = (status <= PoseLost) ? (PoseStatus)status : PoseLost;
+	record.lostFrames = lostFrames;
+}
+
+
+PoseLogWriter::PoseLogWriter()
+	: m_pFile(nullptr)
+	, m_head(0)
+	, m_tail(0)
+	, m_bStopping(false)
+	, m_written(0)
+	, m_dropped(0)
+	, m_bFailed(false)
+{
+}
+
+
+PoseLogWriter::~PoseLogWriter()
+{
+	Close();
+}
+
+
+bool PoseLogWriter::Open(const std::string& path, int capacity)
+{
+	Close();
+	m_pFile = fopen(path.c_str(), "wb");
+	if (nullptr == m_pFile)
+	{
+		return false;
+	}
+
+	unsigned char header[cPoseLogHeaderBytes] = { 0 };
+	const uint32_t recordBytes = (uint32_t)cPoseLogRecordBytes;
+	memcpy(header, cPoseLogMagic, sizeof(cPoseLogMagic));
+	memcpy(header + 8, &recordBytes, 4);
+	m_bFailed = fwrite(header, 1, sizeof(header), m_pFile) != sizeof(header);
+
+	m_ring.assign(capacity > 0 ? capacity : 1, PoseLogRecord());
+	m_block.assign(m_ring.size() * cPoseLogRecordBytes, 0);
+	m_head = 0;
+	m_tail = 0;
+	m_written = 0;
+	m_dropped = 0;
+	m_bStopping = false;
+	m_writer = std::thread(&PoseLogWriter::WriterLoop, this);
+	return true;
+}
+
+
+void PoseLogWriter::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_bStopping = true;
+	}
+	m_wake.notify_all();
+	if (m_writer.joinable())
+	{
+		m_writer.join();
+	}
+	if (nullptr != m_pFile)
+	{
+		m_bFailed = (0 != fclose(m_pFile)) || m_bFailed;
+		m_pFile = nullptr;
+	}
+}
+
+
+bool PoseLogWriter::Append(const PoseLogRecord& record)
+{
+	if (nullptr == m_pFile)
+	{
+		return false;
+	}
+
+	const long long head = m_head.load(std::memory_order_relaxed);
+	const long long waiting = head - m_tail.load(std::memory_order_acquire);
+	const long long capacity = (long long)m_ring.size();
+	if (waiting >= capacity)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	m_ring[head % capacity] = record;
+	m_head.store(head + 1, std::memory_order_release);
+
+	// a missed wake-up only delays the block to the writer's next round
+	if (waiting + 1 == capacity / 4)
+	{
+		m_wake.notify_one();
+	}
+	return true;
+}
+
+
+void PoseLogWriter::Drain()
+{
+	const long long capacity = (long long)m_ring.size();
+	const long long head = m_head.load(std::memory_order_acquire);
+	long long tail = m_tail.load(std::memory_order_relaxed);
+	if (head == tail)
+	{
+		return;
+	}
+
+	// pack first and release the slots, then write without holding them
+	const size_t count = (size_t)(head - tail);
+	for (size_t i = 0; i < count; ++i)
+	{
+		PackPoseRecord(m_ring[(tail + i) % capacity], &m_block[i * cPoseLogRecordBytes]);
+	}
+	m_tail.store(head, std::memory_order_release);
+
+	bool ok = fwrite(m_block.data(), cPoseLogRecordBytes, count, m_pFile) == count;
+	ok = (0 == fflush(m_pFile)) && ok;
+	if (ok)
+	{
+		m_written.fetch_add((long long)count, std::memory_order_release);
+	}
+	else
+	{
+		m_bFailed = true;
+	}
+}
+
+
+void PoseLogWriter::WriterLoop()
+{
+	const std::chrono::duration<double> period(cPoseLogFlushSeconds);
+	for (;;)
+	{
+		bool stopping;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wake.wait_for(lock, period, [&]() { return m_bStopping; });
+			stopping = m_bStopping;
+		}
+		Drain();
+		if (stopping)
+		{
+			break;
+		}
+	}
+}
+
+
+PoseLogStats PoseLogWriter::GetStats() const
+{
+	PoseLogStats stats;
+	stats.written = m_written.load(std::memory_order_acquire);
+	stats.appended = m_head.load(std::memory_order_acquire);
+	stats.dropped = m_dropped.load(std::memory_order_relaxed);
+	stats.failed = m_bFailed;
+	return stats;
+}
+
+
+bool ReadPoseLog(const char* filename, std::vector<PoseLogRecord>& records)
+{
+	FILE* file = fopen(filename, "rb");
+	if (nullptr == file)
+	{
+		return false;
+	}
+
+	records.clear();
+	unsigned char header[cPoseLogHeaderBytes];
+	uint32_t recordBytes = 0;
+	bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) && 0 == memcmp(header, cPoseLogMagic, sizeof(cPoseLogMagic));
+	if (ok)
+	{
+		memcpy(&recordBytes, header + 8, 4);
+		ok = recordBytes >= cPoseLogRecordBytes;
+	}
+
+	// later versions may append fields to a record
+	std::vector<unsigned char> record(ok ? recordBytes : 0);
+	while (ok && fread(record.data(), 1, record.size(), file) == record.size())
+	{
+		PoseLogRecord pose;
+		UnpackPoseRecord(record.data(), pose);
+		records.push_back(pose);
+	}
+	ok = ok && !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+
+void ToStampedPoses(const std::vector<PoseLogRecord>& records, bool keepLost, std::vector<StampedPose>& poses)
+{
+	poses.clear();
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		if (keepLost || PoseLost != records[i].status)
+		{
+			StampedPose pose;
+			pose.timestamp = records[i].timestamp;
+			pose.worldToCamera = records[i].worldToCamera;
+			poses.push_back(pose);
+		}
+	}
+}
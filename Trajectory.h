@@ -0,0 +1,165 @@
+#pragma once
+
+#include "FusionMath.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdio.h>
+
+/// <summary>
+/// Camera pose at a point in time
+/// </summary>
+struct StampedPose
+{
+	double                      timestamp;			// s
+	Mat4                        worldToCamera;
+};
+
+/// <summary>
+/// Read a trajectory in the TUM RGB-D format: one "timestamp tx ty tz qx qy qz qw" line per pose,
+/// the camera-to-world translation and unit quaternion, # starts a comment
+/// </summary>
+/// <returns>false if the file cannot be read or a line is malformed</returns>
+bool ReadTumTrajectory(const char* filename, std::vector<StampedPose>& poses);
+
+/// <summary>
+/// Write a trajectory in the TUM RGB-D format
+/// </summary>
+bool WriteTumTrajectory(const char* filename, const std::vector<StampedPose>& poses);
+
+/// <summary>
+/// Pose with the timestamp closest to the given one, as the TUM associate tool pairs frames
+/// </summary>
+/// <returns>nullptr if none lies within maxDifference (in s)</returns>
+const StampedPose* FindNearestPose(const std::vector<StampedPose>& poses, double timestamp, double maxDifference);
+
+/// <summary>
+/// Write a trajectory in the KITTI odometry format: one line per pose with the 12 values of the
+/// camera-to-world [R | t], row by row. KITTI keeps the timestamps apart, so they are not written.
+/// </summary>
+bool WriteKittiTrajectory(const char* filename, const std::vector<StampedPose>& poses);
+
+/// <summary>
+/// Tracking status of a logged pose
+/// </summary>
+enum PoseStatus
+{
+	PoseTracked = 0,			// tracked against the model
+	PoseReset = 1,				// first frame after a reset: the pose the new model starts from
+	PoseLost = 2				// tracking failed, the pose is the last tracked one
+};
+
+/// <summary>
+/// The pose of one frame in a pose log
+/// </summary>
+struct PoseLogRecord
+{
+	double                      timestamp;			// s, of the depth frame
+	long long                   frame;				// index of the depth frame in its stream
+	Mat4                        worldToCamera;
+	PoseStatus                  status;
+	int                         lostFrames;			// consecutive lost frames, this one included
+
+	/// <summary>
+	/// Residual of the frame's tracking: the RMS point-to-plane distance in m for the native
+	/// tracker, the alignment energy for the SDK; negative when it was not measured
+	/// </summary>
+	float                       residual;
+};
+
+/// <summary>
+/// Statistics of a pose log
+/// </summary>
+struct PoseLogStats
+{
+	long long                   appended;
+
+	/// <summary>
+	/// Records written to the file and flushed; the others are waiting in the ring or were lost
+	/// to a failed write
+	/// </summary>
+	long long                   written;
+
+	/// <summary>
+	/// Records refused because the ring was full: the writer is behind the disk
+	/// </summary>
+	long long                   dropped;
+
+	bool                        failed;				// a write failed, the file is incomplete
+};
+
+/// <summary>
+/// Binary log of the pose of every frame, for drift evaluation and offline re-integration.
+/// Append copies the record into a ring allocated by Open and returns without locking; a
+/// background thread writes the ring out in blocks every fraction of a second, or sooner once
+/// a quarter of it is waiting. When the ring is full the record is dropped and counted, so the
+/// tracking thread never waits for the disk. A single thread appends.
+/// The file is a 16 byte header, "FUSPOSE1" then the record size and a reserved word, followed
+/// by one 72 byte little endian record per frame (see ReadPoseLog).
+/// </summary>
+class PoseLogWriter
+{
+public:
+	PoseLogWriter();
+	~PoseLogWriter();
+
+	/// <summary>
+	/// Create the file and start the writer thread
+	/// </summary>
+	/// <param name="capacity">records the ring holds: 4096 is over two minutes at 30 fps</param>
+	/// <returns>false if the file cannot be created</returns>
+	bool Open(const std::string& path, int capacity = 4096);
+
+	/// <summary>
+	/// Write the records in the ring and close the file
+	/// </summary>
+	void Close();
+
+	bool IsOpen() const { return nullptr != m_pFile; }
+
+	/// <returns>false if the record was dropped</returns>
+	bool Append(const PoseLogRecord& record);
+
+	PoseLogStats GetStats() const;
+
+private:
+	PoseLogWriter(const PoseLogWriter&);
+	PoseLogWriter& operator=(const PoseLogWriter&);
+
+	void WriterLoop();
+
+	/// <summary>
+	/// Write the records appended so far
+	/// </summary>
+	void Drain();
+
+	FILE*                       m_pFile;
+	std::vector<PoseLogRecord>  m_ring;
+	std::vector<unsigned char>  m_block;			// records of the ring in the file layout
+	std::atomic<long long>      m_head;				// next record to append
+	std::atomic<long long>      m_tail;				// next record to write
+
+	std::mutex                  m_lock;
+	std::condition_variable     m_wake;
+	bool                        m_bStopping;
+	std::thread                 m_writer;
+
+	std::atomic<long long>      m_written;			// records flushed to the file
+	std::atomic<long long>      m_dropped;
+	std::atomic<bool>           m_bFailed;
+};
+
+/// <summary>
+/// Read a pose log written by PoseLogWriter
+/// </summary>
+/// <returns>false if the file cannot be read or is not a pose log; a truncated last record is ignored</returns>
+bool ReadPoseLog(const char* filename, std::vector<PoseLogRecord>& records);
+
+/// <summary>
+/// The poses of a log, leaving out those of lost frames unless keepLost
+/// </summary>
+void ToStampedPoses(const std::vector<PoseLogRecord>& records, bool keepLost, std::vector<StampedPose>& poses);
@@ -0,0 +1,649 @@
+
+#include "TsdfVolume.h"
+#include "MarchingCubes.h"
+#include "NumaTopology.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <new>
+#include <math.h>
+#include <string.h>
+
+
+static const float cTsdfScale = 32767.0f;
+
+/// <summary>
+/// BrickVoxel one axis at a time: BrickVoxel(x, y, z) = s_brickVoxelX[x & 7] | s_brickVoxelY[y & 7]
+/// | s_brickVoxelZ[z & 7], so that a lookup in a known brick is three loads and two ors
+/// </summary>
+static const unsigned int s_brickVoxelX[cBrickSize] = { 0, 1, 8, 9, 64, 65, 72, 73 };
+static const unsigned int s_brickVoxelY[cBrickSize] = { 0, 2, 16, 18, 128, 130, 144, 146 };
+static const unsigned int s_brickVoxelZ[cBrickSize] = { 0, 4, 32, 36, 256, 260, 288, 292 };
+
+VolumeParameters::VolumeParameters()
+	: voxelsPerMeter(256.0f)
+	, voxelCountX(512)
+	, voxelCountY(384)
+	, voxelCountZ(512)
+{
+}
+
+
+VolumeParameters::VolumeParameters(float voxelsPerMeter, int voxelCountX, int voxelCountY, int voxelCountZ)
+	: voxelsPerMeter(voxelsPerMeter)
+	, voxelCountX(voxelCountX)
+	, voxelCountY(voxelCountY)
+	, voxelCountZ(voxelCountZ)
+{
+}
+
+
+TsdfVolume::TsdfVolume()
+	: m_truncation(0.03f)
+	, m_bricksX(0)
+	, m_bricksY(0)
+	, m_bricksZ(0)
+	, m_pVoxels(nullptr)
+	, m_nodeLayers(2, 0)
+	, m_nodeBricks(2, 0)
+{
+	SetIdentity(m_worldToVolume);
+}
+
+
+void TsdfVolume::Initialize(const VolumeParameters& parameters, float truncationDistance)
+{
+	m_parameters = parameters;
+	m_truncation = truncationDistance;
+	m_bricksX = (parameters.voxelCountX + cBrickSize - 1) / cBrickSize;
+	m_bricksY = (parameters.voxelCountY + cBrickSize - 1) / cBrickSize;
+	m_bricksZ = (parameters.voxelCountZ + cBrickSize - 1) / cBrickSize;
+	const size_t brickCount = (size_t)m_bricksX * m_bricksY * m_bricksZ;
+
+	if (!m_pages.Allocate(MemoryVolume, brickCount * cBrickVoxels * sizeof(TsdfVoxel)))
+	{
+		m_pVoxels = nullptr;
+		throw std::bad_alloc();
+	}
+	m_pVoxels = static_cast<TsdfVoxel*>(m_pages.Data());
+	m_brickObserved.assign(brickCount, 0);
+	PlaceOnNodes();
+	Reset();
+}
+
+
+void TsdfVolume::PlaceOnNodes()
+{
+	// slabs of brick layers in proportion to each node's CPUs, so that every node's threads
+	// integrate about as many bricks
+	const NumaTopology& topology = NumaTopology::System();
+	const int nodeCount = std::min(std::min(topology.NodeCount(), (int)cMaxNumaNodes), m_bricksZ);
+	const int cpus = topology.CpuCount();
+	const int bricksXY = m_bricksX * m_bricksY;
+	m_nodeLayers.assign(nodeCount + 1, 0);
+	m_nodeBricks.assign(nodeCount + 1, 0);
+	int cpusBefore = 0;
+	for (int n = 0; n < nodeCount; ++n)
+	{
+		cpusBefore += (int)topology.Node(n).cpus.size();
+		m_nodeLayers[n + 1] = (n + 1 == nodeCount) ? m_bricksZ : (int)((long long)m_bricksZ * cpusBefore / cpus);
+		m_nodeBricks[n + 1] = m_nodeLayers[n + 1] * bricksXY;
+	}
+
+	// before the first touch; whole huge pages, as hugetlbfs mappings can only be bound in those
+	if (nodeCount > 1)
+	{
+		const size_t cHugePage = 2 * 1024 * 1024;
+		char* pBytes = static_cast<char*>(m_pages.Data());
+		for (int n = 0; n < nodeCount; ++n)
+		{
+			const size_t begin = (size_t)m_nodeBricks[n] * cBrickVoxels * sizeof(TsdfVoxel) / cHugePage * cHugePage;
+			const size_t end = (n + 1 == nodeCount) ? m_pages.Bytes()
+				: (size_t)m_nodeBricks[n + 1] * cBrickVoxels * sizeof(TsdfVoxel) / cHugePage * cHugePage;
+			if (end > begin)
+			{
+				topology.BindMemory(pBytes + begin, end - begin, n);
+			}
+		}
+	}
+}
+
+
+size_t TsdfVolume::MemoryBytes() const
+{
+	return m_pages.Bytes() + m_brickObserved.capacity();
+}
+
+
+inline size_t TsdfVolume::BrickIndex(int x, int y, int z) const
+{
+	return ((size_t)(z >> 3) * m_bricksY + (y >> 3)) * m_bricksX + (x >> 3);
+}
+
+
+inline size_t TsdfVolume::VoxelIndex(int x, int y, int z) const
+{
+	return BrickIndex(x, y, z) * cBrickVoxels + BrickVoxel(x, y, z);
+}
+
+
+void TsdfVolume::Reset()
+{
+	// each node's threads clear its slab: where memory cannot be bound (Windows), this first
+	// touch is what places it
+	if (nullptr != m_pVoxels)
+	{
+		ThreadPool::Instance().ParallelForNodes(m_nodeBricks.data(), (int)m_nodeBricks.size() - 1, [&](int brickBegin, int brickEnd)
+		{
+			memset(m_pVoxels + (size_t)brickBegin * cBrickVoxels, 0, (size_t)(brickEnd - brickBegin) * cBrickVoxels * sizeof(TsdfVoxel));
+		}, 64);
+	}
+	std::fill(m_brickObserved.begin(), m_brickObserved.end(), (unsigned char)0);
+
+	const float scale = m_parameters.voxelsPerMeter;
+	SetIdentity(m_worldToVolume);
+	m_worldToVolume.M11 = scale;
+	m_worldToVolume.M22 = scale;
+	m_worldToVolume.M33 = scale;
+	m_worldToVolume.M41 = m_parameters.voxelCountX * 0.5f;
+	m_worldToVolume.M42 = m_parameters.voxelCountY * 0.5f;
+	m_worldToVolume.M43 = 0.0f;
+}
+
+
+/// <summary>
+/// Whether no voxel of a brick can take part in an integration: all 8 corners of the brick lie on
+/// the outer side of one face of the view frustum, behind the camera, or farther than any depth
+/// plus the truncation. The voxels are convex combinations of the corners, so they lie there too.
+/// The image faces have a pixel of margin against rounding.
+/// </summary>
+static bool BrickOutsideView(const TsdfBrickParameters& p, const float base[3], float farZ)
+{
+	bool outside[6] = { true, true, true, true, true, true };
+	const float last = (float)(cBrickSize - 1);
+	for (int c = 0; c < 8; ++c)
+	{
+		const float x = (c & 1) ? last : 0.0f, y = (c & 2) ? last : 0.0f, z = (c & 4) ? last : 0.0f;
+		float camera[3];
+		for (int a = 0; a < 3; ++a)
+		{
+			camera[a] = base[a] + x * p.axes[0][a] + y * p.axes[1][a] + z * p.axes[2][a];
+		}
+
+		// u = fx * X / Z + cx + 0.5 is in the image when in [0, width)
+		outside[0] &= camera[2] < -1e-3f;
+		outside[1] &= camera[2] > farZ;
+		outside[2] &= p.fx * camera[0] + (p.cx + 1.5f) * camera[2] < 0.0f;
+		outside[3] &= p.fx * camera[0] + (p.cx - 0.5f - p.width) * camera[2] > 0.0f;
+		outside[4] &= p.fy * camera[1] + (p.cy + 1.5f) * camera[2] < 0.0f;
+		outside[5] &= p.fy * camera[1] + (p.cy - 0.5f - p.height) * camera[2] > 0.0f;
+	}
+	return outside[0] || outside[1] || outside[2] || outside[3] || outside[4] || outside[5];
+}
+
+
+void TsdfVolume::Integrate(const float* pDepth, int width, int height, const CameraIntrinsics& intrinsics,
+	const Mat4& worldToCamera, unsigned short maxWeight)
+{
+	TsdfIntegrationFrame frame;
+	frame.pDepth = pDepth;
+	frame.worldToCamera = worldToCamera;
+	IntegrateBatch(&frame, 1, width, height, intrinsics, maxWeight);
+}
+
+
+void TsdfVolume::IntegrateBatch(const TsdfIntegrationFrame* pFrames, int frameCount, int width, int height,
+	const CameraIntrinsics& intrinsics, unsigned short maxWeight)
+{
+	for (; frameCount > cMaxBatchFrames; pFrames += cMaxBatchFrames, frameCount -= cMaxBatchFrames)
+	{
+		IntegrateBatch(pFrames, cMaxBatchFrames, width, height, intrinsics, maxWeight);
+	}
+	if (frameCount <= 0)
+	{
+		return;
+	}
+
+	// per frame, volume coordinates straight to camera space: c = i * row1 + j * row2 + k * row3 + row4
+	Mat4 volumeToCamera[cMaxBatchFrames];
+	TsdfBrickParameters voxels[cMaxBatchFrames];
+	float farZ[cMaxBatchFrames];
+	for (int f = 0; f < frameCount; ++f)
+	{
+		volumeToCamera[f] = Multiply(VolumeToWorld(), pFrames[f].worldToCamera);
+		const Mat4& m = volumeToCamera[f];
+
+		TsdfBrickParameters& p = voxels[f];
+		const float axes[3][3] = { { m.M11, m.M12, m.M13 }, { m.M21, m.M22, m.M23 }, { m.M31, m.M32, m.M33 } };
+		memcpy(p.axes, axes, sizeof(axes));
+		p.fx = intrinsics.focalLengthX * width;
+		p.fy = intrinsics.focalLengthY * height;
+		p.cx = intrinsics.principalPointX * width - 0.5f;
+		p.cy = intrinsics.principalPointY * height - 0.5f;
+		p.width = width;
+		p.height = height;
+		p.pDepth = pFrames[f].pDepth;
+		p.truncation = m_truncation;
+		p.invTruncation = 1.0f / m_truncation;
+		p.tsdfScale = cTsdfScale;
+		p.maxWeight = maxWeight;
+
+		float maxDepth = 0.0f;
+		for (size_t i = 0, count = (size_t)width * height; i < count; ++i)
+		{
+			maxDepth = std::max(maxDepth, p.pDepth[i]);
+		}
+		farZ[f] = maxDepth + m_truncation + 1e-3f;
+	}
+	const SimdKernels& simd = ActiveSimdKernels();
+
+	// each thread on a run of bricks, consecutive in memory, of its own node's slab
+	const int bricksXY = m_bricksX * m_bricksY;
+	ThreadPool::Instance().ParallelForNodes(m_nodeBricks.data(), (int)m_nodeBricks.size() - 1, [&](int brickBegin, int brickEnd)
+	{
+		for (int brick = brickBegin; brick < brickEnd; ++brick)
+		{
+			const float i = (float)(brick % m_bricksX * cBrickSize);
+			const float j = (float)(brick / m_bricksX % m_bricksY * cBrickSize);
+			const float k = (float)(brick / bricksXY * cBrickSize);
+			for (int f = 0; f < frameCount; ++f)
+			{
+				const Mat4& m = volumeToCamera[f];
+				const float base[3] = { i * m.M11 + j * m.M21 + k * m.M31 + m.M41, i * m.M12 + j * m.M22 + k * m.M32 + m.M42,
+					i * m.M13 + j * m.M23 + k * m.M33 + m.M43 };
+				if (BrickOutsideView(voxels[f], base, farZ[f]))
+				{
+					continue;
+				}
+
+				if (simd.integrateBrick(voxels[f], base[0], base[1], base[2], m_pVoxels + (size_t)brick * cBrickVoxels) > 0)
+				{
+					m_brickObserved[brick] = 1;
+				}
+			}
+		}
+	}, 64);
+}
+
+
+bool TsdfVolume::Sample(float x, float y, float z, float& value) const
+{
+	int x0 = (int)x, y0 = (int)y, z0 = (int)z;
+	float fx = x - x0, fy = y - y0, fz = z - z0;
+
+	// per axis, both corners as a brick offset and a place in the brick: each of the 8 corners is
+	// then two adds and two ors, whichever bricks they fall in
+	const size_t bricksXY = (size_t)m_bricksX * m_bricksY;
+	const size_t brickX[2] = { (size_t)(x0 >> 3), (size_t)((x0 + 1) >> 3) };
+	const size_t brickY[2] = { (size_t)(y0 >> 3) * m_bricksX, (size_t)((y0 + 1) >> 3) * m_bricksX };
+	const size_t brickZ[2] = { (size_t)(z0 >> 3) * bricksXY, (size_t)((z0 + 1) >> 3) * bricksXY };
+	const unsigned int placeX[2] = { s_brickVoxelX[x0 & 7], s_brickVoxelX[(x0 + 1) & 7] };
+	const unsigned int placeY[2] = { s_brickVoxelY[y0 & 7], s_brickVoxelY[(y0 + 1) & 7] };
+	const unsigned int placeZ[2] = { s_brickVoxelZ[z0 & 7], s_brickVoxelZ[(z0 + 1) & 7] };
+
+	float c[8];
+	for (int i = 0; i < 8; ++i)
+	{
+		const int dx = i & 1, dy = (i >> 1) & 1, dz = i >> 2;
+		const TsdfVoxel voxel = m_pVoxels[(brickX[dx] + brickY[dy] + brickZ[dz]) * cBrickVoxels
+			+ (placeX[dx] | placeY[dy] | placeZ[dz])];
+		if (0 == VoxelWeight(voxel))
+		{
+			return false;
+		}
+		c[i] = VoxelTsdf(voxel);
+	}
+
+	float c00 = c[0] + (c[1] - c[0]) * fx;
+	float c10 = c[2] + (c[3] - c[2]) * fx;
+	float c01 = c[4] + (c[5] - c[4]) * fx;
+	float c11 = c[6] + (c[7] - c[6]) * fx;
+	float c0 = c00 + (c10 - c00) * fy;
+	float c1 = c01 + (c11 - c01) * fy;
+	value = (c0 + (c1 - c0) * fz) * (1.0f / cTsdfScale);
+	return true;
+}
+
+
+/// <summary>
+/// One ray of a Raycast, in volume coordinates and parameterized in voxels of travel, with the
+/// brick it is in
+/// </summary>
+struct TsdfVolume::RayMarch
+{
+	float                       direction[3];
+	float                       t;
+	float                       tFar;
+	float                       previousT;
+	float                       previous;
+	bool                        hasPrevious;
+	bool                        hit;
+	int                         brick[3];
+	const TsdfVoxel*            pBrick;
+	bool                        brickObserved;
+};
+
+
+bool TsdfVolume::MarchStep(RayMarch& ray, const float origin[3], float truncationVoxels) const
+{
+	const float* direction = ray.direction;
+	const float t = ray.t;
+	const int voxel[3] = { (int)(origin[0] + t * direction[0] + 0.5f), (int)(origin[1] + t * direction[1] + 0.5f),
+		(int)(origin[2] + t * direction[2] + 0.5f) };
+
+	// the brick is resolved once per brick crossed; within it, a step only looks up the voxel's place
+	if ((voxel[0] >> 3) != ray.brick[0] || (voxel[1] >> 3) != ray.brick[1] || (voxel[2] >> 3) != ray.brick[2])
+	{
+		ray.brick[0] = voxel[0] >> 3;
+		ray.brick[1] = voxel[1] >> 3;
+		ray.brick[2] = voxel[2] >> 3;
+		const size_t brick = ((size_t)ray.brick[2] * m_bricksY + ray.brick[1]) * m_bricksX + ray.brick[0];
+		ray.pBrick = m_pVoxels + brick * cBrickVoxels;
+		ray.brickObserved = 0 != m_brickObserved[brick];
+	}
+
+	if (!ray.brickObserved)
+	{
+		// nothing in the whole brick: on to just past the face the ray leaves it by; voxel v spans
+		// [v - 0.5, v + 0.5)
+		ray.hasPrevious = false;
+		float tExit = ray.tFar;
+		for (int a = 0; a < 3; ++a)
+		{
+			const int brickStart = ray.brick[a] * cBrickSize;
+			if (direction[a] > 1e-8f)
+			{
+				tExit = std::min(tExit, (brickStart + cBrickSize - 0.5f - origin[a]) / direction[a]);
+			}
+			else if (direction[a] < -1e-8f)
+			{
+				tExit = std::min(tExit, (brickStart - 0.5f - origin[a]) / direction[a]);
+			}
+		}
+		ray.t = std::max(t, tExit) + 0.01f;
+		return ray.t < ray.tFar;
+	}
+
+	const TsdfVoxel stored = ray.pBrick[s_brickVoxelX[voxel[0] & 7] | s_brickVoxelY[voxel[1] & 7] | s_brickVoxelZ[voxel[2] & 7]];
+	if (0 == VoxelWeight(stored))
+	{
+		// nothing observed here, but never step over a whole truncation band
+		ray.hasPrevious = false;
+		ray.t = t + 0.8f * truncationVoxels;
+		return ray.t < ray.tFar;
+	}
+
+	float value = VoxelTsdf(stored) * (1.0f / cTsdfScale);
+	if (ray.hasPrevious && ray.previous > 0.0f && value <= 0.0f)
+	{
+		float previous = ray.previous, a, b;
+		const float previousT = ray.previousT;
+		if (Sample(origin[0] + previousT * direction[0], origin[1] + previousT * direction[1], origin[2] + previousT * direction[2], a)
+			&& Sample(origin[0] + t * direction[0], origin[1] + t * direction[1], origin[2] + t * direction[2], b)
+			&& a > 0.0f && b <= 0.0f)
+		{
+			previous = a;
+			value = b;
+		}
+		ray.t = previousT + (t - previousT) * previous / (previous - value);
+		ray.hit = true;
+		return false;
+	}
+	if (value < 0.0f && !ray.hasPrevious)
+	{
+		// started behind a surface
+		return false;
+	}
+	ray.previous = value;
+	ray.previousT = t;
+	ray.hasPrevious = true;
+	ray.t = t + std::max(0.8f * value * truncationVoxels, 0.5f);
+	return ray.t < ray.tFar;
+}
+
+
+void TsdfVolume::Raycast(const Mat4& worldToCamera, const CameraIntrinsics& intrinsics, int width, int height,
+	float* pPoints) const
+{
+	const Mat4 cameraToVolume = Multiply(InverseAffine(worldToCamera), m_worldToVolume);
+	const Mat4 volumeToWorld = VolumeToWorld();
+
+	const float fx = intrinsics.focalLengthX * width;
+	const float fy = intrinsics.focalLengthY * height;
+	const float cx = intrinsics.principalPointX * width - 0.5f;
+	const float cy = intrinsics.principalPointY * height - 0.5f;
+
+	// stay one voxel inside so that trilinear samples and central differences never leave the volume
+	const float upper[3] = { m_parameters.voxelCountX - 2.0f, m_parameters.voxelCountY - 2.0f, m_parameters.voxelCountZ - 2.0f };
+	const float lower = 1.0f;
+	const float truncationVoxels = m_truncation * m_parameters.voxelsPerMeter;
+
+	const float zero[3] = { 0.0f, 0.0f, 0.0f };
+	float origin[3];
+	TransformPoint(cameraToVolume, zero, origin);
+
+	ThreadPool::Instance().ParallelFor(0, height, [&](int rowBegin, int rowEnd)
+	{
+		for (int y = rowBegin; y < rowEnd; ++y)
+		{
+			float* pOut = pPoints + (size_t)y * width * 6;
+			for (int groupBegin = 0; groupBegin < width; groupBegin += cRayGroup)
+			{
+				const int groupSize = std::min((int)cRayGroup, width - groupBegin);
+				RayMarch rays[cRayGroup];
+				bool marching[cRayGroup];
+				int marchingCount = 0;
+				for (int r = 0; r < groupSize; ++r)
+				{
+					const int x = groupBegin + r;
+					float* p = pOut + x * 6;
+					p[0] = p[1] = p[2] = p[3] = p[4] = p[5] = 0.0f;
+
+					RayMarch& ray = rays[r];
+					const float cameraRay[3] = { (x - cx) / fx, (y - cy) / fy, 1.0f };
+					float* direction = ray.direction;
+					TransformVector(cameraToVolume, cameraRay, direction);
+					float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+					for (int a = 0; a < 3; ++a)
+					{
+						direction[a] /= length;
+					}
+
+					// clip against the volume box
+					float tNear = 0.0f, tFar = 1e30f;
+					for (int a = 0; a < 3; ++a)
+					{
+						if (fabsf(direction[a]) < 1e-8f)
+						{
+							if (origin[a] < lower || origin[a] > upper[a])
+							{
+								tNear = tFar + 1.0f;
+							}
+							continue;
+						}
+						float t0 = (lower - origin[a]) / direction[a];
+						float t1 = (upper[a] - origin[a]) / direction[a];
+						tNear = std::max(tNear, std::min(t0, t1));
+						tFar = std::min(tFar, std::max(t0, t1));
+					}
+					ray.t = tNear;
+					ray.tFar = tFar;
+					ray.previousT = tNear;
+					ray.previous = 0.0f;
+					ray.hasPrevious = false;
+					ray.hit = false;
+					ray.brick[0] = ray.brick[1] = ray.brick[2] = -1;
+					ray.pBrick = nullptr;
+					ray.brickObserved = false;
+					marching[r] = tNear < tFar;
+					marchingCount += marching[r] ? 1 : 0;
+				}
+
+				// march on the nearest voxel, one lookup per step, stepping by most of the distance the
+				// TSDF promises to be free and over bricks never observed. Every step waits on the
+				// lookup before it, so the rays of the group take turns: the steps of different rays
+				// overlap in the core instead of each ray's running one after the other.
+				while (marchingCount > 0)
+				{
+					for (int r = 0; r < groupSize; ++r)
+					{
+						if (marching[r] && !MarchStep(rays[r], origin, truncationVoxels))
+						{
+							marching[r] = false;
+							--marchingCount;
+						}
+					}
+				}
+
+				for (int r = 0; r < groupSize; ++r)
+				{
+					const RayMarch& ray = rays[r];
+					if (!ray.hit)
+					{
+						continue;
+					}
+
+					float hitPoint[3] = { origin[0] + ray.t * ray.direction[0], origin[1] + ray.t * ray.direction[1],
+						origin[2] + ray.t * ray.direction[2] };
+					float gradient[3];
+					bool valid = true;
+					for (int a = 0; a < 3 && valid; ++a)
+					{
+						float plus[3] = { hitPoint[0], hitPoint[1], hitPoint[2] };
+						float minus[3] = { hitPoint[0], hitPoint[1], hitPoint[2] };
+						plus[a] += 1.0f;
+						minus[a] -= 1.0f;
+						float vPlus, vMinus;
+						valid = plus[a] <= upper[a] + 1.0f && minus[a] >= 0.0f
+							&& Sample(plus[0], plus[1], plus[2], vPlus) && Sample(minus[0], minus[1], minus[2], vMinus);
+						gradient[a] = valid ? vPlus - vMinus : 0.0f;
+					}
+					if (!valid)
+					{
+						continue;
+					}
+
+					// the gradient points to free space, towards the camera; volume axes are world axes
+					float world[3], normal[3];
+					TransformPoint(volumeToWorld, hitPoint, world);
+					TransformVector(volumeToWorld, gradient, normal);
+					float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+					if (!(normalLength > 0.0f))
+					{
+						continue;
+					}
+					float* p = pOut + (groupBegin + r) * 6;
+					for (int a = 0; a < 3; ++a)
+					{
+						p[a] = world[a];
+						p[3 + a] = normal[a] / normalLength;
+					}
+				}
+			}
+		}
+	}, 4);
+}
+
+
+bool TsdfVolume::ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+	std::vector<short>& samples) const
+{
+	const int countX = m_parameters.voxelCountX;
+	const int countY = m_parameters.voxelCountY;
+	const int countZ = m_parameters.voxelCountZ;
+	if (x < 0 || y < 0 || z < 0 || step <= 0
+		|| x + (samplesX - 1) * step >= countX || y + (samplesY - 1) * step >= countY || z + (samplesZ - 1) * step >= countZ)
+	{
+		return false;
+	}
+
+	samples.resize((size_t)samplesX * samplesY * samplesZ);
+	short* pOut = samples.data();
+	for (int k = 0; k < samplesZ; ++k)
+	{
+		for (int j = 0; j < samplesY; ++j)
+		{
+			for (int i = 0; i < samplesX; ++i)
+			{
+				const TsdfVoxel voxel = m_pVoxels[VoxelIndex(x + i * step, y + j * step, z + k * step)];
+				*pOut++ = (0 != VoxelWeight(voxel)) ? VoxelTsdf(voxel) : (short)0;
+			}
+		}
+	}
+	return true;
+}
+
+
+size_t TsdfVolume::CalculateMesh(std::vector<float>& triangles) const
+{
+	const int countX = m_parameters.voxelCountX;
+	const int countY = m_parameters.voxelCountY;
+	const int countZ = m_parameters.voxelCountZ;
+	const Mat4 volumeToWorld = VolumeToWorld();
+
+	// a cube whose first corner lies in a brick never observed has a corner of weight 0, so such
+	// bricks have no surface
+	std::vector<std::vector<float> > layers(m_bricksZ);
+	ThreadPool::Instance().ParallelForNodes(m_nodeLayers.data(), (int)m_nodeLayers.size() - 1, [&](int layerBegin, int layerEnd)
+	{
+		// each brick with the first samples of the next bricks along x, y and z, so that the
+		// surfaces of neighbouring bricks join without cracks
+		const int cSamples = cBrickSize + 1;
+		short tsdf[cSamples * cSamples * cSamples];
+		unsigned short weights[cSamples * cSamples * cSamples];
+
+		TsdfBlock block;
+		block.tsdf = tsdf;
+		block.weights = weights;
+		block.zeroIsUnobserved = false;
+		block.spacing = 1.0f / m_parameters.voxelsPerMeter;
+		for (int bz = layerBegin; bz < layerEnd; ++bz)
+		{
+			for (int by = 0; by < m_bricksY; ++by)
+			{
+				for (int bx = 0; bx < m_bricksX; ++bx)
+				{
+					if (0 == m_brickObserved[((size_t)bz * m_bricksY + by) * m_bricksX + bx])
+					{
+						continue;
+					}
+
+					const int x0 = bx * cBrickSize, y0 = by * cBrickSize, z0 = bz * cBrickSize;
+					block.sizeX = std::min(cSamples, countX - x0);
+					block.sizeY = std::min(cSamples, countY - y0);
+					block.sizeZ = std::min(cSamples, countZ - z0);
+					size_t sample = 0;
+					for (int k = 0; k < block.sizeZ; ++k)
+					{
+						for (int j = 0; j < block.sizeY; ++j)
+						{
+							for (int i = 0; i < block.sizeX; ++i, ++sample)
+							{
+								const TsdfVoxel voxel = m_pVoxels[VoxelIndex(x0 + i, y0 + j, z0 + k)];
+								tsdf[sample] = VoxelTsdf(voxel);
+								weights[sample] = VoxelWeight(voxel);
+							}
+						}
+					}
+					const float corner[3] = { (float)x0, (float)y0, (float)z0 };
+					TransformPoint(volumeToWorld, corner, block.origin);
+					ExtractIsoSurface(block, layers[bz]);
+				}
+			}
+		}
+	});
+
+	size_t total = 0;
+	for (int layer = 0; layer < m_bricksZ; ++layer)
+	{
+		total += layers[layer].size();
+	}
+	triangles.clear();
+	triangles.reserve(total);
+	for (int layer = 0; layer < m_bricksZ; ++layer)
+	{
+		triangles.insert(triangles.end(), layers[layer].begin(), layers[layer].end());
+	}
+	return triangles.size() / 9;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "FusionMath.h"
+#include "MemoryAccounting.h"
+
+#include <vector>
+#include <stddef.h>
+
+/// <summary>
+/// Size of a reconstruction volume, as in NUI_FUSION_RECONSTRUCTION_PARAMETERS
+/// </summary>
+struct VolumeParameters
+{
+	float                       voxelsPerMeter;
+	int                         voxelCountX;
+	int                         voxelCountY;
+	int                         voxelCountZ;
+
+	VolumeParameters();
+	VolumeParameters(float voxelsPerMeter, int voxelCountX, int voxelCountY, int voxelCountZ);
+
+	size_t VoxelCount() const { return (size_t)voxelCountX * voxelCountY * voxelCountZ; }
+};
+
+/// <summary>
+/// A depth image in m and the pose it was seen from, for TsdfVolume::IntegrateBatch
+/// </summary>
+struct TsdfIntegrationFrame
+{
+	const float*                pDepth;
+	Mat4                        worldToCamera;
+};
+
+/// <summary>
+/// Native dense truncated signed distance volume, the CPU counterpart of INuiFusionReconstruction.
+/// Every voxel holds a TSDF in [-32767, 32767] (positive in front of the surface) and an
+/// integration weight, side by side; a weight of 0 means never observed. Voxels are sampled at
+/// integer volume coordinates and stored in bricks of 8x8x8, each brick 2 KB in Morton (Z) order
+/// (see BrickVoxel) and the bricks x fastest, then y, then z: voxels close in any direction
+/// share cache lines and pages, whichever way a camera ray runs through the volume. Voxel counts
+/// that are not multiples of 8 are padded to whole bricks in memory only. On a NUMA machine the
+/// layers of bricks are split into one slab per node, placed in that node's memory and integrated,
+/// cleared and meshed by the threads pinned there (see ThreadPool::ParallelForNodes).
+/// </summary>
+class TsdfVolume
+{
+public:
+	TsdfVolume();
+
+	/// <summary>
+	/// Allocate and clear the volume
+	/// </summary>
+	/// <param name="truncationDistance">distance (in m) over which the TSDF ramps from -1 to 1</param>
+	void Initialize(const VolumeParameters& parameters, float truncationDistance = 0.03f);
+
+	/// <summary>
+	/// Clear all voxels and restore the default placement: the world origin sits at the center of
+	/// the z = 0 face, looking into the volume, like the Kinect Fusion default.
+	/// </summary>
+	void Reset();
+
+	const VolumeParameters& Parameters() const { return m_parameters; }
+	float TruncationDistance() const { return m_truncation; }
+
+	/// <summary>
+	/// World space to volume (voxel) coordinates: a uniform scale and a translation
+	/// </summary>
+	const Mat4& WorldToVolume() const { return m_worldToVolume; }
+	Mat4 VolumeToWorld() const { return InverseAffine(m_worldToVolume); }
+
+	/// <summary>
+	/// Fuse a depth image seen from the given pose into the volume
+	/// </summary>
+	/// <param name="pDepth">width * height depths in m, 0 = invalid</param>
+	/// <param name="maxWeight">weights saturate here, so that the model keeps adapting</param>
+	void Integrate(const float* pDepth, int width, int height, const CameraIntrinsics& intrinsics,
+		const Mat4& worldToCamera, unsigned short maxWeight);
+
+	/// <summary>
+	/// Fuse several depth images of the same size into the volume in one pass over the bricks:
+	/// each brick takes the frames in order while it is in cache, so the volume is read and
+	/// written once per cMaxBatchFrames frames instead of once per frame, and the result is that
+	/// of integrating the frames one by one.
+	/// </summary>
+	void IntegrateBatch(const TsdfIntegrationFrame* pFrames, int frameCount, int width, int height,
+		const CameraIntrinsics& intrinsics, unsigned short maxWeight);
+
+	static const int            cMaxBatchFrames = 16;
+
+	/// <summary>
+	/// Native replacement of CalculatePointCloud: march a ray per pixel to the first zero crossing.
+	/// </summary>
+	/// <param name="pPoints">receives 6 floats per pixel, world space position and normal;
+	/// pixels that hit nothing are all zero</param>
+	void Raycast(const Mat4& worldToCamera, const CameraIntrinsics& intrinsics, int width, int height,
+		float* pPoints) const;
+
+	/// <summary>
+	/// Read a box of TSDF samples, one every step voxels, x fastest (see TsdfBlockExporter).
+	/// Unobserved samples read 0, like ExportVolumeBlock.
+	/// </summary>
+	bool ExportBlock(int x, int y, int z, int samplesX, int samplesY, int samplesZ, int step,
+		std::vector<short>& samples) const;
+
+	/// <summary>
+	/// Native replacement of CalculateMesh: marching cubes over every observed brick, in parallel
+	/// layers of bricks
+	/// </summary>
+	/// <param name="triangles">receives 9 floats (3 world space corners) per triangle</param>
+	/// <returns>number of triangles</returns>
+	size_t CalculateMesh(std::vector<float>& triangles) const;
+
+	size_t MemoryBytes() const;
+
+	/// <summary>
+	/// How the voxels are backed: huge pages where the system grants them
+	/// </summary>
+	PageKind Pages() const { return m_pages.Kind(); }
+
+	/// <summary>
+	/// NUMA nodes the bricks are split between
+	/// </summary>
+	int NodeCount() const { return (int)m_nodeBricks.size() - 1; }
+
+private:
+	TsdfVolume(const TsdfVolume&);
+	TsdfVolume& operator=(const TsdfVolume&);
+
+	/// <summary>
+	/// Where voxel (x, y, z) lives in m_pVoxels
+	/// </summary>
+	size_t VoxelIndex(int x, int y, int z) const;
+
+	/// <summary>
+	/// Index of the brick holding voxel (x, y, z), x fastest, then y, then z
+	/// </summary>
+	size_t BrickIndex(int x, int y, int z) const;
+
+	/// <summary>
+	/// Split the layers of bricks between the NUMA nodes and bind each slab to its node's memory
+	/// </summary>
+	void PlaceOnNodes();
+
+	/// <summary>
+	/// Trilinear TSDF in [-1, 1] at a volume position; false if a corner was never observed
+	/// </summary>
+	bool Sample(float x, float y, float z, float& value) const;
+
+	/// <summary>
+	/// Rays of a row marched in turns by Raycast
+	/// </summary>
+	static const int            cRayGroup = 8;
+	struct RayMarch;
+
+	/// <summary>
+	/// Take one step of a ray through the volume
+	/// </summary>
+	/// <returns>false once the ray has hit a zero crossing (ray.hit), or left the volume or started
+	/// behind a surface</returns>
+	bool MarchStep(RayMarch& ray, const float origin[3], float truncationVoxels) const;
+
+	VolumeParameters            m_parameters;
+	float                       m_truncation;
+	Mat4                        m_worldToVolume;
+	int                         m_bricksX;
+	int                         m_bricksY;
+	int                         m_bricksZ;
+
+	/// <summary>
+	/// The bricks, one TsdfVoxel (TSDF and weight in 32 bits) per voxel
+	/// </summary>
+	PageBuffer                  m_pages;
+	unsigned int*               m_pVoxels;
+
+	/// <summary>
+	/// Per brick, whether any of its voxels has a weight; raycasts skip the other bricks whole
+	/// and marching cubes leaves them out
+	/// </summary>
+	std::vector<unsigned char, TaggedAllocator<unsigned char, MemoryVolume> > m_brickObserved;
+
+	/// <summary>
+	/// Node n owns the brick layers [m_nodeLayers[n], m_nodeLayers[n + 1]), that is the bricks
+	/// [m_nodeBricks[n], m_nodeBricks[n + 1])
+	/// </summary>
+	std::vector<int>            m_nodeLayers;
+	std::vector<int>            m_nodeBricks;
+};
@@ -0,0 +1,120 @@
+
+#include "VolumeSizing.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <math.h>
+
+
+VolumeBackend KinectFusionBackend()
+{
+	VolumeBackend backend = { "Kinect Fusion", 4, 32 };
+	return backend;
+}
+
+
+VolumeBackend NativeVolumeBackend()
+{
+	VolumeBackend backend = { "native", (int)(sizeof(short) + sizeof(unsigned short)), 8 };
+	return backend;
+}
+
+
+VolumeSizingRequest::VolumeSizingRequest()
+	: budgetBytes(512.0 * 1024 * 1024)
+	, minVoxelsPerMeter(128.0f)
+	, maxVoxelsPerMeter(512.0f)
+{
+	// the extent of the default 512x384x512 volume at 256 voxels/m
+	extent[0] = 2.0f;
+	extent[1] = 1.5f;
+	extent[2] = 2.0f;
+}
+
+
+static int AlignUp(int value, int alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+
+size_t VolumeBytes(const VolumeParameters& volume, const VolumeBackend& backend)
+{
+	return volume.VoxelCount() * backend.bytesPerVoxel;
+}
+
+
+VolumeSizing ChooseVolume(const VolumeSizingRequest& request, const VolumeBackend& backend)
+{
+	const int a = backend.alignment;
+	const double extentVolume = (double)request.extent[0] * request.extent[1] * request.extent[2];
+	const double budgetVoxels = request.budgetBytes / backend.bytesPerVoxel;
+
+	// the resolution at which the extent exactly fills the budget, then down until the aligned
+	// voxel counts fit too
+	float voxelsPerMeter = (float)floor(cbrt(budgetVoxels / extentVolume));
+	voxelsPerMeter = std::min(std::max(voxelsPerMeter, request.minVoxelsPerMeter), request.maxVoxelsPerMeter);
+
+	VolumeSizing sizing;
+	sizing.coversExtent = true;
+	for (;;)
+	{
+		sizing.volume = VolumeParameters(voxelsPerMeter,
+			AlignUp((int)ceil(request.extent[0] * voxelsPerMeter), a),
+			AlignUp((int)ceil(request.extent[1] * voxelsPerMeter), a),
+			AlignUp((int)ceil(request.extent[2] * voxelsPerMeter), a));
+		if ((double)sizing.volume.VoxelCount() <= budgetVoxels || voxelsPerMeter <= request.minVoxelsPerMeter)
+		{
+			break;
+		}
+		voxelsPerMeter = std::max(request.minVoxelsPerMeter, (float)floor(voxelsPerMeter * 0.98f));
+	}
+
+	// not even the minimum resolution fits: keep it and give up extent, the largest axis first
+	int* counts[3] = { &sizing.volume.voxelCountX, &sizing.volume.voxelCountY, &sizing.volume.voxelCountZ };
+	while ((double)sizing.volume.VoxelCount() > budgetVoxels)
+	{
+		int** largest = std::max_element(counts, counts + 3, [](const int* x, const int* y) { return *x < *y; });
+		if (**largest <= a)
+		{
+			break;
+		}
+		**largest -= a;
+		sizing.coversExtent = false;
+	}
+
+	sizing.bytes = VolumeBytes(sizing.volume, backend);
+	sizing.withinBudget = (double)sizing.bytes <= request.budgetBytes;
+	return sizing;
+}
+
+
+bool ShrinkVolume(VolumeParameters& volume, const VolumeBackend& backend)
+{
+	const int smallest = 4 * backend.alignment;
+	int* counts[3] = { &volume.voxelCountX, &volume.voxelCountY, &volume.voxelCountZ };
+	bool shrunk = false;
+	for (int i = 0; i < 3; ++i)
+	{
+		int count = std::max(smallest, *counts[i] * 4 / 5 / backend.alignment * backend.alignment);
+		if (count < *counts[i])
+		{
+			*counts[i] = count;
+			shrunk = true;
+		}
+	}
+	return shrunk;
+}
+
+
+std::string DescribeVolume(const VolumeParameters& volume, const VolumeBackend& backend)
+{
+	std::ostringstream text;
+	text << volume.voxelCountX << "x" << volume.voxelCountY << "x" << volume.voxelCountZ << " voxels at "
+		<< volume.voxelsPerMeter << " voxels/m (" << std::fixed << std::setprecision(2)
+		<< volume.voxelCountX / volume.voxelsPerMeter << " x " << volume.voxelCountY / volume.voxelsPerMeter << " x "
+		<< volume.voxelCountZ / volume.voxelsPerMeter << " m, " << std::setprecision(1) << 1000.0f / volume.voxelsPerMeter
+		<< " mm voxels), " << VolumeBytes(volume, backend) / (1024.0 * 1024.0) << " MB";
+	return text.str();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "TsdfVolume.h"
+
+#include <string>
+#include <stddef.h>
+
+/// <summary>
+/// How a volume is stored, for the memory it takes and the dimensions it accepts
+/// </summary>
+struct VolumeBackend
+{
+	const char*                 name;
+	int                         bytesPerVoxel;
+
+	/// <summary>
+	/// Every voxel count must be a multiple of this
+	/// </summary>
+	int                         alignment;
+};
+
+/// <summary>
+/// INuiFusionReconstruction: 4 bytes per voxel, voxel counts in multiples of 32
+/// </summary>
+VolumeBackend KinectFusionBackend();
+
+/// <summary>
+/// TsdfVolume: a short TSDF and a ushort weight per voxel, voxel counts in multiples of 8 so that
+/// the volume is a whole number of 8x8x8 bricks
+/// </summary>
+VolumeBackend NativeVolumeBackend();
+
+/// <summary>
+/// What auto-sizing aims for
+/// </summary>
+struct VolumeSizingRequest
+{
+	double                      budgetBytes;		// for the volume alone
+	float                       extent[3];			// m
+	float                       minVoxelsPerMeter;
+	float                       maxVoxelsPerMeter;
+
+	VolumeSizingRequest();
+};
+
+/// <summary>
+/// Outcome of auto-sizing
+/// </summary>
+struct VolumeSizing
+{
+	VolumeParameters            volume;
+	size_t                      bytes;
+
+	/// <summary>
+	/// false when even the minimum resolution did not fit the extent in the budget, so the
+	/// volume is smaller than asked
+	/// </summary>
+	bool                        coversExtent;
+
+	/// <summary>
+	/// false when the smallest volume at the minimum resolution still exceeds the budget
+	/// </summary>
+	bool                        withinBudget;
+};
+
+/// <summary>
+/// Pick the finest resolution, between the minimum and the maximum, at which the extent fits in
+/// the budget. When not even the minimum resolution fits, keep it and shrink the extent instead,
+/// the longest axis first.
+/// </summary>
+VolumeSizing ChooseVolume(const VolumeSizingRequest& request, const VolumeBackend& backend);
+
+size_t VolumeBytes(const VolumeParameters& volume, const VolumeBackend& backend);
+
+/// <summary>
+/// Next smaller configuration to try when the backend cannot create this one: the same
+/// resolution with every axis at 80%, about half the memory
+/// </summary>
+/// <returns>false when the volume is already at the smallest size, 4 alignments per axis</returns>
+bool ShrinkVolume(VolumeParameters& volume, const VolumeBackend& backend);
+
+/// <summary>
+/// e.g. "512x384x512 voxels at 256 voxels/m (2.00 x 1.50 x 2.00 m, 3.9 mm voxels), 384.0 MB"
+/// </summary>
+std::string DescribeVolume(const VolumeParameters& volume, const VolumeBackend& backend);
@@ -1,64 +1,303 @@
 #include "vtkImageRender.h"
+#include "PixelConvert.h"
+#include "ThreadPool.h"
+#include <string.h>
 
 
 vtkImageRender::vtkImageRender():
 m_sourceWidth(0),
 m_sourceHeight(0),
-m_sourceStride(0)
+m_sourceStride(0),
+m_pPixels(NULL),
+m_bPreviewVisible(false),
+m_bOffScreen(false)
 {
-} 
+}
 
 
 vtkImageRender::~vtkImageRender()
 {
+	// the scalars were created with save=1, so the buffer is ours to free
+	image->GetPointData()->SetScalars(NULL);
+	m_scalars = NULL;
+	delete[] m_pPixels;
+	m_pPixels = NULL;
 }
 
-bool vtkImageRender::Initialize(int sourceWidth, int sourceHeight, int sourceStride)
+bool vtkImageRender::Initialize(int sourceWidth, int sourceHeight, int sourceStride, bool offScreen)
 {
 	// Get the frame size
 	m_sourceWidth = sourceWidth;
 	m_sourceHeight = sourceHeight;
 	m_sourceStride = sourceStride;
+	m_bOffScreen = offScreen;
+
+	AllocateImage(sourceWidth, sourceHeight);
+
+	//the image is persistent, so the actor can be bound once
+	Actor->GetMapper()->SetInputData(image);
+	renderer->AddActor(Actor);
+
+	if (m_bOffScreen)
+	{
+		// Headless: only the model view is ever rendered, into a buffer of the frame size.
+		// The live image is written out without going through VTK.
+		renWin->SetOffScreenRendering(1);
+		renWin->SetSize(sourceWidth, sourceHeight);
+		m_capture = vtkSmartPointer<vtkUnsignedCharArray>::New();
+		return true;
+	}
 
-	//set windows and renderer 
+	//set windows and renderer
 	renWin->AddRenderer(renderer);
 	renWin->SetSize(800, 600);
 	renWin->SetPosition(500, 200);
 
 	//set interactor
+	interactor = vtkSmartPointer<vtkRenderWindowInteractor>::New();
     interactor->SetRenderWindow(renWin);
 
 	return true;
 }
 
 
+void vtkImageRender::AllocateImage(int width, int height)
+{
+	image->GetPointData()->SetScalars(NULL);
+	delete[] m_pPixels;
+
+	vtkIdType size = (vtkIdType)width * height * 4;
+	m_pPixels = new unsigned char[size];
+	memset(m_pPixels, 0, (size_t)size);
+	m_pixelMemory.Reserve(MemoryDisplay, (long long)size);
+
+	m_scalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
+	m_scalars->SetNumberOfComponents(4);
+	// save = 1: vtk must not free or reallocate our buffer
+	m_scalars->SetArray(m_pPixels, size, 1);
 
+	image->SetDimensions(width, height, 1);
+	image->GetPointData()->SetScalars(m_scalars);
+
+	m_sourceWidth = width;
+	m_sourceHeight = height;
+}
 
 
-void vtkImageRender::Draw(BYTE* pImage, int sourceWidth, int sourceHeight, int cBytesPerPixel)
+void vtkImageRender::Draw(const unsigned char* pImage, int sourceWidth, int sourceHeight, int cBytesPerPixel)
 {
-	
-	
-	image->SetDimensions(sourceWidth, sourceHeight, cBytesPerPixel);
-	
-	image->AllocateScalars(VTK_UNSIGNED_CHAR, 4);	
+	if (nullptr == pImage || cBytesPerPixel != 4)
+	{
+		return;
+	}
+
+	if (sourceWidth != m_sourceWidth || sourceHeight != m_sourceHeight || nullptr == m_pPixels)
+	{
+		// the stride given to Initialize was for the old size: take the new frames as unpadded
+		m_sourceStride = (sourceWidth != m_sourceWidth) ? 0 : m_sourceStride;
+		AllocateImage(sourceWidth, sourceHeight);
+	}
 
-	int* dims = image->GetDimensions();
+	// vtkImageData has its origin at the bottom-left, so flip while swizzling; the source rows
+	// may be padded (a LockRect pitch), so they are walked at the stride given to Initialize
+	const int sourceStride = (0 != m_sourceStride) ? m_sourceStride : sourceWidth * cBytesPerPixel;
+	ConvertBGRXToRGBA(pImage, sourceStride, m_pPixels, sourceWidth, sourceHeight, true);
+
+	m_scalars->Modified();
+	image->Modified();
+}
 
-	//std::cout << "Dims: " << " x: " << dims[0] << " y: " << dims[1] << " z: " << dims[2] << std::endl;
 
-	// Fill every entry of the image 
-	for (int y = dims[1]-1; y >=0; y--)
+void vtkImageRender::ShowModelViewport()
+{
+	if (!renWin->HasRenderer(reviewRenderer))
 	{
-		for (int x = 0; x < dims[0]; x++)
-		{			
-				unsigned char* pixel = static_cast<unsigned char*>(image->GetScalarPointer(x, y, 0));
-				pixel[0] = *pImage++;
-				pixel[1] = *pImage++;
-				pixel[2] = *pImage++;
-				*pImage++;					
+		if (!m_bOffScreen)
+		{
+			// live image on the left half, mesh on the right half
+			renderer->SetViewport(0.0, 0.0, 0.5, 1.0);
+			reviewRenderer->SetViewport(0.5, 0.0, 1.0, 1.0);
 		}
+		reviewRenderer->SetBackground(.3, .6, .3); // Background color green
+		renWin->AddRenderer(reviewRenderer);
+	}
+}
+
+
+void vtkImageRender::ShowReviewMesh(vtkPolyData* mesh)
+{
+	ShowModelViewport();
+	if (!reviewRenderer->HasViewProp(reviewActor))
+	{
+		reviewRenderer->AddActor(reviewActor);
+	}
+
+	vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+	mapper->SetInputData(mesh);
+	reviewActor->SetMapper(mapper);
+	reviewRenderer->ResetCamera();
+}
+
+
+void vtkImageRender::ShowPreviewMesh(float* pPoints, int capacityTriangles)
+{
+	vtkIdType pointCount = (vtkIdType)capacityTriangles * 3;
+
+	// save = 1: the points belong to the caller
+	m_previewPoints = vtkSmartPointer<vtkFloatArray>::New();
+	m_previewPoints->SetNumberOfComponents(3);
+	m_previewPoints->SetArray(pPoints, pointCount * 3, 1);
+	vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+	points->SetData(m_previewPoints);
+
+	// the connectivity never changes: triangle i uses points 3i, 3i+1, 3i+2
+	vtkSmartPointer<vtkIdTypeArray> connectivity = vtkSmartPointer<vtkIdTypeArray>::New();
+	connectivity->SetNumberOfValues((vtkIdType)capacityTriangles * 4);
+	vtkIdType* pCell = connectivity->GetPointer(0);
+	for (vtkIdType i = 0; i < capacityTriangles; ++i)
+	{
+		pCell[i * 4 + 0] = 3;
+		pCell[i * 4 + 1] = i * 3 + 0;
+		pCell[i * 4 + 2] = i * 3 + 1;
+		pCell[i * 4 + 3] = i * 3 + 2;
+	}
+	vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
+	cells->SetCells(capacityTriangles, connectivity);
+
+	preview->SetPoints(points);
+	preview->SetPolys(cells);
+
+	vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+	mapper->SetInputData(preview);
+	previewActor->SetMapper(mapper);
+	// Kinect camera space has y down and z into the scene; show it upright, facing the viewer
+	previewActor->SetScale(1, -1, -1);
+
+	SetPreviewVisible(true);
+}
+
+
+void vtkImageRender::PreviewMeshModified()
+{
+	if (m_previewPoints)
+	{
+		m_previewPoints->Modified();
+		preview->GetPoints()->Modified();
+		preview->Modified();
 	}
-	image->Modified();
 }
 
+
+void vtkImageRender::SetPreviewVisible(bool visible)
+{
+	if (!m_previewPoints)
+	{
+		return;
+	}
+
+	bool showCamera = visible && !m_bPreviewVisible;
+	m_bPreviewVisible = visible;
+	if (visible)
+	{
+		ShowModelViewport();
+		if (!reviewRenderer->HasViewProp(previewActor))
+		{
+			reviewRenderer->AddActor(previewActor);
+		}
+	}
+	previewActor->SetVisibility(visible ? 1 : 0);
+
+	if (showCamera)
+	{
+		// the buffer is still empty, so frame the volume in front of the camera
+		reviewRenderer->GetActiveCamera()->SetPosition(0, 0, 2);
+		reviewRenderer->GetActiveCamera()->SetFocalPoint(0, 0, -1.5);
+		reviewRenderer->GetActiveCamera()->SetViewUp(0, 1, 0);
+		reviewRenderer->ResetCameraClippingRange();
+	}
+}
+
+
+void vtkImageRender::SetOverlayText(const std::string& text)
+{
+	if (!renderer->HasViewProp(overlay))
+	{
+		overlay->GetTextProperty()->SetFontFamilyToCourier();
+		overlay->GetTextProperty()->SetFontSize(12);
+		overlay->GetTextProperty()->SetColor(1.0, 1.0, 0.0);
+		overlay->GetTextProperty()->SetVerticalJustificationToTop();
+		overlay->GetPositionCoordinate()->SetCoordinateSystemToNormalizedViewport();
+		overlay->SetPosition(0.01, 0.99);
+		renderer->AddActor2D(overlay);
+	}
+	overlay->SetInput(text.c_str());
+	overlay->SetVisibility(text.empty() ? 0 : 1);
+}
+
+
+const unsigned char* vtkImageRender::RenderModelView(int& width, int& height)
+{
+	width = 0;
+	height = 0;
+	if (!m_bOffScreen || !renWin->HasRenderer(reviewRenderer))
+	{
+		return nullptr;
+	}
+
+	reviewRenderer->ResetCameraClippingRange();
+	renWin->Render();
+
+	int* size = renWin->GetSize();
+	width = size[0];
+	height = size[1];
+	// read the back buffer: offscreen rendering never swaps
+	renWin->GetRGBACharPixelData(0, 0, width - 1, height - 1, 0, m_capture);
+	return m_capture->GetPointer(0);
+}
+
+
+/// <summary>
+/// Build a vtkPolyData from a loaded mesh, filling the point and cell arrays in bulk
+/// </summary>
+/// <param name="mesh">the welded mesh</param>
+/// <returns>the poly data, sharing no memory with the mesh</returns>
+vtkSmartPointer<vtkPolyData> CreatePolyData(const LoadedMesh& mesh)
+{
+	const vtkIdType numPoints = (vtkIdType)mesh.VertexCount();
+	const vtkIdType numTriangles = (vtkIdType)mesh.TriangleCount();
+
+	// Points: one memcpy into the array storage
+	vtkSmartPointer<vtkFloatArray> coordinates = vtkSmartPointer<vtkFloatArray>::New();
+	coordinates->SetNumberOfComponents(3);
+	coordinates->SetNumberOfTuples(numPoints);
+	if (numPoints > 0)
+	{
+		memcpy(coordinates->GetPointer(0), mesh.points.data(), mesh.points.size() * sizeof(float));
+	}
+	vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+	points->SetData(coordinates);
+
+	// Triangles: legacy cell layout (3, a, b, c), written in parallel
+	vtkSmartPointer<vtkIdTypeArray> connectivity = vtkSmartPointer<vtkIdTypeArray>::New();
+	connectivity->SetNumberOfValues(numTriangles * 4);
+	vtkIdType* pCells = connectivity->GetPointer(0);
+	const int* pTriangles = mesh.triangles.data();
+	ThreadPool::Instance().ParallelFor(0, (int)numTriangles, [&](int begin, int end)
+	{
+		for (int t = begin; t < end; ++t)
+		{
+			vtkIdType* cell = pCells + (size_t)t * 4;
+			cell[0] = 3;
+			cell[1] = pTriangles[t * 3 + 0];
+			cell[2] = pTriangles[t * 3 + 1];
+			cell[3] = pTriangles[t * 3 + 2];
+		}
+	}, 4096);
+	vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+	polys->SetCells(numTriangles, connectivity);
+
+	vtkSmartPointer<vtkPolyData> polyData = vtkSmartPointer<vtkPolyData>::New();
+	polyData->SetPoints(points);
+	polyData->SetPolys(polys);
+	return polyData;
+}
@@ -1,12 +1,10 @@
 #pragma once
-//VTK
-#include <windows.h>
-#include <NuiApi.h>
 
 //VTK headers
 #include <vtkSmartPointer.h>
 #include <vtkLookupTable.h>
 #include <vtkImageData.h>
+#include <vtkUnsignedCharArray.h>
 #include <vtkImageMapper3D.h>
 #include <vtkImageMapToColors.h>
 #include <vtkPointData.h>
@@ -18,10 +16,22 @@
 #include <vtkCommand.h>
 #include <vtkCallbackCommand.h>
 
-#include <vtkOBJReader.h>
-#include <vtkSTLReader.h>
 #include <vtkActor.h>
+#include <vtkPolyData.h>
 #include <vtkPolyDataMapper.h>
+#include <vtkPoints.h>
+#include <vtkFloatArray.h>
+#include <vtkCellArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkCamera.h>
+#include <vtkTextActor.h>
+#include <vtkTextProperty.h>
+
+#include <string>
+
+#include "MemoryAccounting.h"
+#include "PixelConvert.h"
+#include "MeshLoader.h"
 
 
 class vtkImageRender
@@ -36,11 +46,51 @@ public:
 	/// <param name="sourceWidth">width (in pixels) of image data to be drawn</param>
 	/// <param name="sourceHeight">height (in pixels) of image data to be drawn</param>
 	/// <param name="sourceStride">length (in bytes) of a single scanline</param>
+	/// <param name="offScreen">render into an offscreen buffer of the source size; no window and no interactor are created</param>
 	/// <returns>indicates success or failure</returns>
-	bool Initialize( int sourceWidth, int sourceHeight, int sourceStride);
+	bool Initialize( int sourceWidth, int sourceHeight, int sourceStride, bool offScreen = false);
+
+	/// <summary>
+	/// Upload a BGRX frame into the persistent display image.
+	/// The frame is swizzled to RGBA and flipped in one pass straight into the buffer
+	/// wrapped by the image scalars; no allocation happens unless the frame size changes.
+	/// </summary>
+	/// <param name="pImage">BGRX pixels, top scanline first, rows the sourceStride of Initialize apart
+	/// (width * 4 when it was 0 or the width has changed since)</param>
+	/// <param name="sourceWidth">width (in pixels) of the frame</param>
+	/// <param name="sourceHeight">height (in pixels) of the frame</param>
+	/// <param name="cBytesPerPixel">bytes per source pixel, must be 4</param>
+	void Draw(const unsigned char* pImage, int sourceWidth, int sourceHeight, int cBytesPerPixel);
+
+	/// <summary>
+	/// Show a mesh in a viewport next to the live image, in the same window.
+	/// Must be called from the thread that renders.
+	/// </summary>
+	void ShowReviewMesh(vtkPolyData* mesh);
 
+	/// <summary>
+	/// Show a live triangle soup in the model viewport. The points are wrapped, not copied:
+	/// the caller keeps them alive and calls PreviewMeshModified after changing them.
+	/// </summary>
+	/// <param name="pPoints">capacityTriangles * 9 floats, 3 corners per triangle</param>
+	/// <param name="capacityTriangles">number of triangles in pPoints</param>
+	void ShowPreviewMesh(float* pPoints, int capacityTriangles);
+	void PreviewMeshModified();
+	void SetPreviewVisible(bool visible);
+	bool IsPreviewVisible() const { return m_bPreviewVisible; }
 
-	void Draw(BYTE* pImage, int sourceWidth, int sourceHeight, int cBytesPerPixel);
+	/// <summary>
+	/// Show text over the top left of the live image; an empty string hides it
+	/// </summary>
+	void SetOverlayText(const std::string& text);
+
+	/// <summary>
+	/// Offscreen mode: render the model viewport and read it back
+	/// </summary>
+	/// <param name="width">receives the width of the image</param>
+	/// <param name="height">receives the height of the image</param>
+	/// <returns>RGBA pixels, bottom scanline first, valid until the next call</returns>
+	const unsigned char* RenderModelView(int& width, int& height);
 
 	//image data
 	vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
@@ -54,14 +104,55 @@ public:
 	//Render windows
 	vtkSmartPointer<vtkRenderWindow> renWin = vtkSmartPointer<vtkRenderWindow>::New();
 
-	//Interactor
-	vtkSmartPointer<vtkRenderWindowInteractor> interactor = vtkSmartPointer<vtkRenderWindowInteractor>::New();
+	//Interactor, nullptr when rendering offscreen
+	vtkSmartPointer<vtkRenderWindowInteractor> interactor;
+
+	//Renderer and actor of the mesh review viewport
+	vtkSmartPointer<vtkRenderer> reviewRenderer = vtkSmartPointer<vtkRenderer>::New();
+	vtkSmartPointer<vtkActor> reviewActor = vtkSmartPointer<vtkActor>::New();
+
+	//Live mesh preview, drawn in the review viewport
+	vtkSmartPointer<vtkPolyData> preview = vtkSmartPointer<vtkPolyData>::New();
+	vtkSmartPointer<vtkActor> previewActor = vtkSmartPointer<vtkActor>::New();
+
+	//Text overlay of the live image
+	vtkSmartPointer<vtkTextActor> overlay = vtkSmartPointer<vtkTextActor>::New();
 
 private:
 
+	/// <summary>
+	/// (Re)create the RGBA buffer and point the image scalars at it
+	/// </summary>
+	void AllocateImage(int width, int height);
+
+	/// <summary>
+	/// Split the window into the live image and the model viewport
+	/// </summary>
+	void ShowModelViewport();
+
 	// Format information
-	UINT                     m_sourceHeight;
-	UINT                     m_sourceWidth;
-	LONG                     m_sourceStride;
+	int                      m_sourceHeight;
+	int                      m_sourceWidth;
+	int                      m_sourceStride;
+
+	// RGBA pixels owned by us and wrapped (not copied) by the image scalars
+	unsigned char*           m_pPixels;
+	vtkSmartPointer<vtkUnsignedCharArray> m_scalars;
+	MemoryReservation        m_pixelMemory;
+
+	// preview points, owned by the caller of ShowPreviewMesh
+	vtkSmartPointer<vtkFloatArray> m_previewPoints;
+	bool                     m_bPreviewVisible;
+
+	// offscreen rendering and its readback buffer
+	bool                     m_bOffScreen;
+	vtkSmartPointer<vtkUnsignedCharArray> m_capture;
 };
 
+
+/// <summary>
+/// Build a vtkPolyData from a loaded mesh, filling the point and cell arrays in bulk
+/// </summary>
+/// <param name="mesh">the welded mesh</param>
+/// <returns>the poly data, sharing no memory with the mesh</returns>
+vtkSmartPointer<vtkPolyData> CreatePolyData(const LoadedMesh& mesh);